@@ -0,0 +1,153 @@
+#include "RangeAllocator.h"
+
+#include <assert.h>
+
+namespace PixelsForGlory
+{
+    RangeAllocator::RangeAllocator()
+        : size_(0)
+        , used_(0)
+    {}
+
+    void RangeAllocator::Initialize(uint64_t size) {
+        size_ = size;
+        used_ = 0;
+
+        freeRanges_.clear();
+        freeRangesBySize_.clear();
+
+        if (size > 0) {
+            InsertFreeRange(0, size);
+        }
+    }
+
+    uint64_t RangeAllocator::Allocate(uint64_t size, uint64_t alignment) {
+        if (size == 0) {
+            return kInvalidOffset;
+        }
+
+        if (alignment == 0) {
+            alignment = 1;
+        }
+
+        // Smallest ranges first, the first one that still fits after alignment is the best fit
+        for (auto itr = freeRangesBySize_.lower_bound(size); itr != freeRangesBySize_.end(); ++itr) {
+            const uint64_t rangeOffset = itr->second;
+            const uint64_t rangeSize = itr->first;
+
+            const uint64_t alignedOffset = (rangeOffset + alignment - 1) / alignment * alignment;
+            const uint64_t padding = alignedOffset - rangeOffset;
+            if (padding + size > rangeSize) {
+                continue;
+            }
+
+            EraseFreeRange(freeRanges_.find(rangeOffset));
+
+            // Give back what the alignment and the allocation didn't use
+            if (padding > 0) {
+                InsertFreeRange(rangeOffset, padding);
+            }
+
+            const uint64_t remaining = rangeSize - padding - size;
+            if (remaining > 0) {
+                InsertFreeRange(alignedOffset + size, remaining);
+            }
+
+            used_ += size;
+            return alignedOffset;
+        }
+
+        return kInvalidOffset;
+    }
+
+    void RangeAllocator::Free(uint64_t offset, uint64_t size) {
+        if (size == 0) {
+            return;
+        }
+
+        assert(offset + size <= size_);
+        assert(used_ >= size);
+        used_ -= size;
+
+        uint64_t freeOffset = offset;
+        uint64_t freeSize = size;
+
+        // Merge with the range after
+        auto next = freeRanges_.lower_bound(offset);
+        if (next != freeRanges_.end() && next->first == offset + size) {
+            freeSize += next->second;
+            EraseFreeRange(next);
+        }
+
+        // Merge with the range before
+        auto prev = freeRanges_.lower_bound(offset);
+        if (prev != freeRanges_.begin()) {
+            --prev;
+            if (prev->first + prev->second == offset) {
+                freeOffset = prev->first;
+                freeSize += prev->second;
+                EraseFreeRange(prev);
+            }
+        }
+
+        InsertFreeRange(freeOffset, freeSize);
+    }
+
+    void RangeAllocator::Grow(uint64_t size) {
+        if (size <= size_) {
+            return;
+        }
+
+        uint64_t freeOffset = size_;
+        uint64_t freeSize = size - size_;
+        size_ = size;
+
+        // Merge with a free range at the old end
+        auto last = freeRanges_.end();
+        if (last != freeRanges_.begin()) {
+            --last;
+            if (last->first + last->second == freeOffset) {
+                freeOffset = last->first;
+                freeSize += last->second;
+                EraseFreeRange(last);
+            }
+        }
+
+        InsertFreeRange(freeOffset, freeSize);
+    }
+
+    uint64_t RangeAllocator::GetSize() const {
+        return size_;
+    }
+
+    uint64_t RangeAllocator::GetUsed() const {
+        return used_;
+    }
+
+    uint64_t RangeAllocator::GetLargestFreeRange() const {
+        if (freeRangesBySize_.empty()) {
+            return 0;
+        }
+        return freeRangesBySize_.rbegin()->first;
+    }
+
+    bool RangeAllocator::IsEmpty() const {
+        return used_ == 0;
+    }
+
+    void RangeAllocator::InsertFreeRange(uint64_t offset, uint64_t size) {
+        freeRanges_.insert(std::make_pair(offset, size));
+        freeRangesBySize_.insert(std::make_pair(size, offset));
+    }
+
+    void RangeAllocator::EraseFreeRange(std::map<uint64_t, uint64_t>::iterator itr) {
+        auto bySize = freeRangesBySize_.equal_range(itr->second);
+        for (auto i = bySize.first; i != bySize.second; ++i) {
+            if (i->second == itr->first) {
+                freeRangesBySize_.erase(i);
+                break;
+            }
+        }
+        freeRanges_.erase(itr);
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+
+namespace PixelsForGlory
+{
+    /// <summary>
+    /// Manages free ranges inside a linear address space (e.g. a block of device memory).  Allocations are best fit
+    /// and neighbouring free ranges are coalesced when released.
+    /// </summary>
+    class RangeAllocator
+    {
+    public:
+        static const uint64_t kInvalidOffset = UINT64_MAX;
+
+        RangeAllocator();
+
+        /// <summary>
+        /// Reset allocator to manage a single free range of the passed size
+        /// </summary>
+        /// <param name="size"></param>
+        void Initialize(uint64_t size);
+
+        /// <summary>
+        /// Find a free range that fits size at the passed alignment
+        /// </summary>
+        /// <param name="size"></param>
+        /// <param name="alignment"></param>
+        /// <returns>Offset of the range, kInvalidOffset if nothing fits</returns>
+        uint64_t Allocate(uint64_t size, uint64_t alignment);
+
+        /// <summary>
+        /// Return a range previously returned by Allocate
+        /// </summary>
+        /// <param name="offset"></param>
+        /// <param name="size"></param>
+        void Free(uint64_t offset, uint64_t size);
+
+        /// <summary>
+        /// Extend the managed space to size.  The added space is free, existing ranges are untouched
+        /// </summary>
+        /// <param name="size"></param>
+        void Grow(uint64_t size);
+
+        // getters
+        uint64_t GetSize() const;
+        uint64_t GetUsed() const;
+        uint64_t GetLargestFreeRange() const;
+        bool     IsEmpty() const;
+
+    private:
+        void InsertFreeRange(uint64_t offset, uint64_t size);
+        void EraseFreeRange(std::map<uint64_t, uint64_t>::iterator itr);
+
+        uint64_t size_;
+        uint64_t used_;
+
+        // offset -> size
+        std::map<uint64_t, uint64_t> freeRanges_;
+
+        // size -> offset, used to find the best fit quickly
+        std::multimap<uint64_t, uint64_t> freeRangesBySize_;
+    };
+}
@@ -4,12 +4,72 @@
 #include "../Unity/IUnityGraphics.h"
 
 #include <stddef.h>
+#include <stdint.h>
 #include <string>
 
 struct IUnityInterfaces;
 
 namespace PixelsForGlory
 {
+    /// <summary>
+    /// GPU and host memory held by the ray tracer, laid out to be marshalled to C#
+    /// </summary>
+    struct RayTracerMemoryStatistics
+    {
+        // Bytes allocated per category
+        uint64_t meshGeometryBytes;
+        uint64_t bottomLevelAccelerationStructureBytes;
+        uint64_t topLevelAccelerationStructureBytes;
+        uint64_t renderTargetBytes;
+        uint64_t shaderBindingTableBytes;
+        uint64_t scratchBytes;
+        uint64_t uploadBytes;
+        uint64_t stagingBytes;
+        uint64_t otherBytes;
+
+        // Bytes requested from the driver and the part of them handed out to resources
+        uint64_t blockBytes;
+        uint64_t allocatedBytes;
+
+        // Device local heaps.  Budget and usage cover the whole process when VK_EXT_memory_budget is available,
+        // otherwise they fall back to heap size and the ray tracer's own blocks
+        uint64_t deviceLocalBlockBytes;
+        uint64_t deviceLocalBudgetBytes;
+        uint64_t deviceLocalUsageBytes;
+
+        // Host memory the driver took through the plugin's allocation callbacks, per VkSystemAllocationScope.  Only
+        // counted while host memory accounting is enabled
+        uint64_t hostCommandBytes;
+        uint64_t hostObjectBytes;
+        uint64_t hostCacheBytes;
+        uint64_t hostDeviceBytes;
+        uint64_t hostInstanceBytes;
+        uint64_t hostPeakBytes;
+
+        // Driver allocations it only reported to us, and memory reserved for the small allocation pools
+        uint64_t hostInternalBytes;
+        uint64_t hostSlabBytes;
+
+        uint32_t blockCount;
+        uint32_t allocationCount;
+        uint32_t hostAllocationCount;
+        int32_t  memoryBudgetSupported;
+    };
+
+    /// <summary>
+    /// How an acceleration structure is expected to be used, picks its build flags and update strategy.  Crosses the
+    /// plugin boundary as an int
+    /// </summary>
+    enum class RayTracerBuildPolicy : int32_t
+    {
+        Static = 0,     // Built once and traced a lot: fast trace, compacted
+        Dynamic,        // Changes every frame: fast trace, refit instead of rebuilt
+        Streamed,       // Short lived: fast build, not compacted
+        LodProxy,       // Distant stand-in: fast build, compacted, low memory
+
+        Count
+    };
+
     class RayTracerAPI
     {
     public:
@@ -20,6 +80,11 @@ namespace PixelsForGlory
         /// </summary>
         virtual void SetShaderFolder(std::string shaderFolder) = 0;
 
+        /// <summary>
+        /// Set the folder built blases are cached in between runs.  An empty folder disables the cache
+        /// </summary>
+        virtual void SetAccelerationStructureCacheFolder(std::string cacheFolder) = 0;
+
         /// <summary>
         /// Creates or updates a camera render target
         /// </summary>
@@ -57,7 +122,42 @@ namespace PixelsForGlory
         /// <param name="uvCount"></param>
         /// <param name="indices"></param>
         /// <param name="indexCount"></param>
-        virtual int AddSharedMesh(int instanceId, float* verticesArray, float* normalsArray, float* uvsArray, int vertexCount, int* indicesArray, int indexCount) = 0;
+        /// <param name="buildPolicy">RayTracerBuildPolicy of the mesh's blas</param>
+        virtual int AddSharedMesh(int instanceId, float* verticesArray, float* normalsArray, float* uvsArray, int vertexCount, int* indicesArray, int indexCount, int buildPolicy) = 0;
+
+        /// <summary>
+        /// Add a shared mesh with several submeshes.  Its blas gets one geometry per submesh so it can be traced with
+        /// a single instance, hit shaders find the submesh through gl_GeometryIndexEXT
+        /// </summary>
+        /// <param name="instanceId"></param>
+        /// <param name="verticesArray"></param>
+        /// <param name="normalsArray"></param>
+        /// <param name="uvsArray"></param>
+        /// <param name="vertexCount"></param>
+        /// <param name="indicesArray">Indices of every submesh, submeshes are ranges of it</param>
+        /// <param name="indexCount"></param>
+        /// <param name="submeshIndexStarts">First index of each submesh</param>
+        /// <param name="submeshIndexCounts">Index count of each submesh</param>
+        /// <param name="submeshCount">At most MAX_BLAS_GEOMETRIES</param>
+        /// <param name="buildPolicy">RayTracerBuildPolicy of the mesh's blas</param>
+        /// <returns>Shared mesh index, -1 on failure</returns>
+        virtual int AddSharedMeshWithSubmeshes(int instanceId, float* verticesArray, float* normalsArray, float* uvsArray, int vertexCount, int* indicesArray, int indexCount, int* submeshIndexStarts, int* submeshIndexCounts, int submeshCount, int buildPolicy) = 0;
+
+        /// <summary>
+        /// Remove a shared mesh no instance references.  Meshes are also removed when their last instance is, either way
+        /// their memory is released once frames in flight are done with it
+        /// </summary>
+        /// <param name="sharedMeshIndex"></param>
+        virtual void RemoveSharedMesh(int sharedMeshIndex) = 0;
+
+        /// <summary>
+        /// Replace the vertex positions and normals of a shared mesh in place, e.g. for cloth or vertex animation.  The
+        /// mesh's blas is refit before the next tlas build
+        /// </summary>
+        /// <param name="sharedMeshIndex"></param>
+        /// <param name="verticesArray">vertexCount * 3 floats, same vertex count the mesh was added with</param>
+        /// <param name="normalsArray">vertexCount * 3 floats, nullptr to keep the current normals</param>
+        virtual void UpdateSharedMeshVertices(int sharedMeshIndex, float* verticesArray, float* normalsArray) = 0;
 
         /// <summary>
         /// Method to check if a instancehas already been added, saves gathering handles if exists
@@ -81,6 +181,27 @@ namespace PixelsForGlory
         /// <param name="meshInstanceIndex"></param>
         virtual void RemoveTlasInstance(int meshInstanceIndex) = 0;
 
+        /// <summary>
+        /// Move an instance.  Transform only changes refit the tlas on the next build instead of rebuilding it
+        /// </summary>
+        /// <param name="meshInstanceIndex"></param>
+        /// <param name="l2wMatrix"></param>
+        virtual void UpdateTlasInstanceTransform(int meshInstanceIndex, float* l2wMatrix) = 0;
+
+        /// <summary>
+        /// Mark an instance as static scenery.  While static batching is on, static instances are merged with the others
+        /// in their cell instead of being traced on their own.  Moving a batched instance takes it back out of its batch
+        /// </summary>
+        /// <param name="meshInstanceIndex"></param>
+        /// <param name="isStatic"></param>
+        virtual void SetTlasInstanceStatic(int meshInstanceIndex, int isStatic) = 0;
+
+        /// <summary>
+        /// Set the RayTracerBuildPolicy of the tlas.  Takes effect with a rebuild on the next tlas build
+        /// </summary>
+        /// <param name="buildPolicy"></param>
+        virtual void SetTlasBuildPolicy(int buildPolicy) = 0;
+
         /// <summary>
         /// Build top level acceleration structure
         /// </summary>
@@ -116,6 +237,39 @@ namespace PixelsForGlory
         /// Ray those rays!
         /// </summary>
         virtual void TraceRays(int cameraInstanceId) = 0;
+
+        /// <summary>
+        /// Get a snapshot of GPU memory used by the ray tracer and the device local budget
+        /// </summary>
+        /// <param name="outStatistics"></param>
+        virtual void GetMemoryStatistics(RayTracerMemoryStatistics* outStatistics) = 0;
+
+        /// <summary>
+        /// Set how long each frame may spend moving geometry and blases to release fragmented memory, 0 disables it
+        /// </summary>
+        /// <param name="milliseconds"></param>
+        virtual void SetDefragmentationBudget(float milliseconds) = 0;
+
+        /// <summary>
+        /// Turn per scope accounting of host memory on or off
+        /// </summary>
+        /// <param name="enabled"></param>
+        virtual void SetHostMemoryAccounting(int enabled) = 0;
+
+        /// <summary>
+        /// Set how many CPU threads build blases of newly added meshes on the host, 0 builds them on the GPU.  Only has an
+        /// effect if the device supports acceleration structure host commands
+        /// </summary>
+        /// <param name="threadCount"></param>
+        virtual void SetHostBlasBuildThreads(int threadCount) = 0;
+
+        /// <summary>
+        /// Turn static batching on or off.  Static instances centered in the same cell of a world grid are pre-transformed
+        /// into one merged mesh, traced with a single instance.  Only meshes added while it is on can be batched
+        /// </summary>
+        /// <param name="enabled"></param>
+        /// <param name="cellSize">Edge length of the grid cells in world units</param>
+        virtual void SetStaticBatching(int enabled, float cellSize) = 0;
     };
 
     // Create a graphics API implementation instance for the given API type.
@@ -0,0 +1,56 @@
+#version 460
+#extension GL_EXT_buffer_reference : require
+#extension GL_GOOGLE_include_directive : require
+
+#include "../Vulkan/ShaderConstants.h"
+
+// Matches ComputePass::kGroupSize
+layout(local_size_x = 64) in;
+
+// Layout of VkAccelerationStructureInstanceKHR, the blas reference is split to avoid 64 bit integers
+struct InstanceRecord {
+    float transform[12];
+    uint  customIndexAndMask;
+    uint  sbtOffsetAndFlags;
+    uint  blasAddressLow;
+    uint  blasAddressHigh;
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer TransformStream {
+    ShaderInstanceTransform Transforms[];
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer DescriptionBuffer {
+    ShaderInstanceDescription Descriptions[];
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 16) writeonly buffer RecordBuffer {
+    InstanceRecord Records[];
+};
+
+// Matches InstanceGenerator::PushConstants
+layout(push_constant) uniform Params {
+    TransformStream   transforms;
+    DescriptionBuffer descriptions;
+    RecordBuffer      records;
+    uint              count;
+};
+
+void main() {
+    const uint index = gl_GlobalInvocationID.x;
+    if (index >= count) {
+        return;
+    }
+
+    const ShaderInstanceTransform instance = transforms.Transforms[index];
+    const ShaderInstanceDescription description = descriptions.Descriptions[instance.slot];
+
+    InstanceRecord record;
+    record.transform = instance.rows;
+    record.customIndexAndMask = description.customIndexAndMask;
+    record.sbtOffsetAndFlags = description.sbtOffsetAndFlags;
+    record.blasAddressLow = description.blasAddressLow;
+    record.blasAddressHigh = description.blasAddressHigh;
+
+    records.Records[instance.slot] = record;
+}
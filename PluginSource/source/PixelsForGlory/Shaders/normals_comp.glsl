@@ -0,0 +1,34 @@
+#version 460
+#extension GL_EXT_buffer_reference : require
+#extension GL_GOOGLE_include_directive : require
+
+#include "../Vulkan/ShaderConstants.h"
+
+// Matches ComputePass::kGroupSize
+layout(local_size_x = 64) in;
+
+// Normals are uploaded packed, three floats per vertex
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer NormalStream {
+    float Normals[];
+};
+
+layout(buffer_reference, std430, buffer_reference_align = 16) buffer AttributeBuffer {
+    ShaderVertexAttribute Attributes[];
+};
+
+// Matches NormalWriter::PushConstants
+layout(push_constant) uniform Params {
+    NormalStream    normals;
+    AttributeBuffer attributes;
+    uint            count;
+};
+
+void main() {
+    const uint index = gl_GlobalInvocationID.x;
+    if (index >= count) {
+        return;
+    }
+
+    // Uvs don't change, only the normal of the attribute is written
+    attributes.Attributes[index].normal = vec3(normals.Normals[3 * index + 0], normals.Normals[3 * index + 1], normals.Normals[3 * index + 2]);
+}
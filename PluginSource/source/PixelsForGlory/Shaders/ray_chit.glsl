@@ -6,6 +6,10 @@
 #include "../Vulkan/ShaderConstants.h"
 
 
+layout(set = DESCRIPTOR_SET_MESH_DATA, binding = DESCRIPTOR_BINDING_MESH_DATA, std430) readonly buffer MeshDataBuffer {
+    ShaderMeshData MeshData[];
+};
+
 layout(set = DESCRIPTOR_SET_VERTEX_ATTRIBUTES, binding = DESCRIPTOR_BINDING_VERTEX_ATTRIBUTES, std430) readonly buffer AttribsBuffer {
     ShaderVertexAttribute VertexAttribs[];
 } AttribsArray[];
@@ -14,13 +18,32 @@ layout(set = DESCRIPTOR_SET_FACE_DATA, binding = DESCRIPTOR_BINDING_FACE_DATA, s
     ShaderFace Faces[];
 } FacesArray[];
 
+layout(set = DESCRIPTOR_SET_SOURCE_INSTANCES, binding = DESCRIPTOR_BINDING_SOURCE_INSTANCES, std430) readonly buffer SourceInstancesBuffer {
+    uint SourceInstances[];
+} SourceInstancesArray[];
+
 layout(location = LOCATION_PRIMARY_RAY) rayPayloadInEXT ShaderRayPayload PrimaryRay;
                                         hitAttributeEXT vec2 HitAttribs;
 
 void main() {
-    
+    const ShaderMeshData mesh = MeshData[gl_InstanceCustomIndexEXT + gl_GeometryIndexEXT];
+    const ShaderFace face = FacesArray[nonuniformEXT(mesh.geometryPage)].Faces[mesh.faceOffset + gl_PrimitiveID];
+
+    const ShaderVertexAttribute v0 = AttribsArray[nonuniformEXT(mesh.geometryPage)].VertexAttribs[mesh.attributeOffset + face.index0];
+    const ShaderVertexAttribute v1 = AttribsArray[nonuniformEXT(mesh.geometryPage)].VertexAttribs[mesh.attributeOffset + face.index1];
+    const ShaderVertexAttribute v2 = AttribsArray[nonuniformEXT(mesh.geometryPage)].VertexAttribs[mesh.attributeOffset + face.index2];
+
+    const vec3 barycentrics = vec3(1.0f - HitAttribs.x - HitAttribs.y, HitAttribs.x, HitAttribs.y);
+    const vec3 normal = BaryLerp(v0.normal, v1.normal, v2.normal, barycentrics);
+
     // Return payload to gen shader
     PrimaryRay.albedo = vec4(1.0f, 1.0f, 1.0f, 1.0f);
+    PrimaryRay.normal = normalize(vec3(normal * gl_WorldToObjectEXT));
+    PrimaryRay.uv = BaryLerp(v0.uv, v1.uv, v2.uv, barycentrics);
     PrimaryRay.distance = gl_HitTEXT;
+    PrimaryRay.materialIndex = mesh.materialIndex;
+    PrimaryRay.sourceInstance = mesh.sourceInstanceOffset != NO_SOURCE_INSTANCES
+        ? SourceInstancesArray[nonuniformEXT(mesh.geometryPage)].SourceInstances[mesh.sourceInstanceOffset + gl_PrimitiveID]
+        : NO_SOURCE_INSTANCES;
 }
 
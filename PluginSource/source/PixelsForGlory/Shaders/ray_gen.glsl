@@ -4,7 +4,7 @@
 
 #include "../Vulkan/ShaderConstants.h"
 
-layout(set = DESCRIPTOR_SET_ACCELERATION_STRUCTURE, binding = DESCRIPTOR_BINDING_ACCELERATION_STRUCTURE)        uniform accelerationStructureEXT Scene;
+layout(set = DESCRIPTOR_SET_ACCELERATION_STRUCTURE, binding = DESCRIPTOR_BINDING_ACCELERATION_STRUCTURE)        uniform accelerationStructureEXT Scene[TLAS_LAYER_COUNT];
 
 layout(set = DESCRIPTOR_SET_RENDER_TARGET,         binding = DESCRIPTOR_BINDING_RENDER_TARGET, rgba8)    uniform image2D RenderTarget;
 
@@ -22,7 +22,7 @@ layout(location = LOCATION_SHADOW_RAY)  rayPayloadEXT ShaderShadowRayPayload Sha
 const uint rayFlags = gl_RayFlagsOpaqueEXT;
 const uint shadowRayFlags = gl_RayFlagsOpaqueEXT | gl_RayFlagsTerminateOnFirstHitEXT;
 const uint cullMask = 0xFF;
-const uint sbtRecordStride = 1;
+const uint sbtRecordStride = HIT_SHADERS_PER_GEOMETRY;
 const float tmin = 0.0f;
 const float AIR_REFRACTICE_INDEX = 1.0003f;
 const float PI = 3.1415926535897932384626433832795f;
@@ -64,6 +64,40 @@ vec3 CalcRayDir(vec2 screenUV, float aspect) {
     return rayDir;
 }
 
+// Trace both tlas layers and keep the closer hit.  The dynamic layer only has to be searched up to the static hit
+void TraceScene(vec3 origin, vec3 direction, float tmax) {
+    traceRayEXT(Scene[TLAS_LAYER_STATIC],
+                rayFlags,
+                cullMask,
+                PRIMARY_HIT_SHADERS_INDEX,
+                sbtRecordStride,
+                PRIMARY_MISS_SHADERS_INDEX,
+                origin,
+                tmin,
+                direction,
+                tmax,
+                LOCATION_PRIMARY_RAY);
+
+    const ShaderRayPayload staticHit = PrimaryRay;
+
+    traceRayEXT(Scene[TLAS_LAYER_DYNAMIC],
+                rayFlags,
+                cullMask,
+                PRIMARY_HIT_SHADERS_INDEX,
+                sbtRecordStride,
+                PRIMARY_MISS_SHADERS_INDEX,
+                origin,
+                tmin,
+                direction,
+                staticHit.distance >= 0.0f ? staticHit.distance : tmax,
+                LOCATION_PRIMARY_RAY);
+
+    // Nothing dynamic in front of the static hit
+    if (PrimaryRay.distance < 0.0f) {
+        PrimaryRay = staticHit;
+    }
+}
+
 // Trace a ray
 vec3 TraceRay() {
     int currentRayIndex = 0;
@@ -75,17 +109,7 @@ vec3 TraceRay() {
         const vec3 direction = rays[currentRayIndex].direction;
 
         // Real time ray tracing!
-        traceRayEXT(Scene,
-                    rayFlags,
-                    cullMask,
-                    PRIMARY_HIT_SHADERS_INDEX,
-                    sbtRecordStride,
-                    PRIMARY_MISS_SHADERS_INDEX,
-                    origin,
-                    tmin,
-                    direction,
-                    CameraParams.camNearFarFov.y, // camera.Far = tmax
-                    LOCATION_PRIMARY_RAY);
+        TraceScene(origin, direction, CameraParams.camNearFarFov.y); // camera.Far = tmax
 
         const float hitDistance = PrimaryRay.distance;
         rays[currentRayIndex].color = PrimaryRay.albedo.rgb;
@@ -0,0 +1,172 @@
+#include "AccelerationStructureCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "../Debug.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    // Serialized acceleration structures start with the driver UUID and compatibility UUID, followed by the
+    // serialized size, the deserialized size and the handle count
+    static const size_t kSerializedVersionSize = 2 * VK_UUID_SIZE;
+    static const size_t kSerializedDeserializedSizeOffset = kSerializedVersionSize + sizeof(uint64_t);
+
+    AccelerationStructureCache::AccelerationStructureCache()
+        : device_(VK_NULL_HANDLE)
+        , physicalDeviceProperties_(VkPhysicalDeviceProperties())
+    {}
+
+    void AccelerationStructureCache::Initialize(VkDevice device, const VkPhysicalDeviceProperties& physicalDeviceProperties) {
+        device_ = device;
+        physicalDeviceProperties_ = physicalDeviceProperties;
+    }
+
+    void AccelerationStructureCache::SetFolder(const std::string& folder) {
+        folder_ = folder;
+
+        if (folder_.empty()) {
+            PFG_EDITORLOG("Acceleration structure cache disabled");
+            return;
+        }
+
+        if (folder_.back() != '/' && folder_.back() != '\\') {
+            folder_ = folder_ + "/";
+        }
+
+        std::error_code error;
+        std::filesystem::create_directories(folder_, error);
+        if (error) {
+            PFG_EDITORLOGERROR("Cannot create acceleration structure cache folder: " + folder_);
+            folder_.clear();
+            return;
+        }
+
+        PFG_EDITORLOG("Acceleration structure cache folder set to: " + folder_);
+    }
+
+    bool AccelerationStructureCache::Load(uint64_t key, std::vector<uint8_t>& outData) const {
+        if (!IsEnabled()) {
+            return false;
+        }
+
+        std::ifstream file(GetPath(key), std::ios::in | std::ios::binary);
+        if (!file) {
+            return false;
+        }
+
+        FileHeader header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(FileHeader))) {
+            return false;
+        }
+
+        // Entries written by another GPU or driver are stale, they are replaced once the blas has been rebuilt
+        FileHeader expectedHeader;
+        FillHeader(expectedHeader, header.dataSize);
+        if (std::memcmp(&header, &expectedHeader, sizeof(FileHeader)) != 0 || header.dataSize < kSerializedDeserializedSizeOffset + sizeof(uint64_t)) {
+            return false;
+        }
+
+        outData.resize(static_cast<size_t>(header.dataSize));
+        if (!file.read(reinterpret_cast<char*>(outData.data()), outData.size())) {
+            outData.clear();
+            return false;
+        }
+
+        // The driver has the final say, a driver update may keep the version but change the layout
+        VkAccelerationStructureVersionInfoKHR versionInfo = {};
+        versionInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR;
+        versionInfo.pVersionData = outData.data();
+
+        VkAccelerationStructureCompatibilityKHR compatibility = VK_ACCELERATION_STRUCTURE_COMPATIBILITY_INCOMPATIBLE_KHR;
+        vkGetDeviceAccelerationStructureCompatibilityKHR(device_, &versionInfo, &compatibility);
+        if (compatibility != VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR) {
+            outData.clear();
+            return false;
+        }
+
+        return true;
+    }
+
+    bool AccelerationStructureCache::Store(uint64_t key, const void* data, size_t size) const {
+        if (!IsEnabled()) {
+            return false;
+        }
+
+        const std::string path = GetPath(key);
+        const std::string temporaryPath = path + ".tmp";
+
+        FileHeader header;
+        FillHeader(header, size);
+
+        {
+            std::ofstream file(temporaryPath, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!file) {
+                PFG_EDITORLOGERROR("Cannot write acceleration structure cache file: " + temporaryPath);
+                return false;
+            }
+
+            file.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+            file.write(reinterpret_cast<const char*>(data), size);
+            if (!file) {
+                PFG_EDITORLOGERROR("Cannot write acceleration structure cache file: " + temporaryPath);
+                file.close();
+                std::remove(temporaryPath.c_str());
+                return false;
+            }
+        }
+
+        // Written whole before it replaces the entry, so an interrupted write never leaves a truncated entry behind
+        std::error_code error;
+        std::filesystem::rename(temporaryPath, path, error);
+        if (error) {
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    uint64_t AccelerationStructureCache::Hash(const void* data, size_t size, uint64_t hash) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    VkDeviceSize AccelerationStructureCache::GetDeserializedSize(const std::vector<uint8_t>& data) {
+        if (data.size() < kSerializedDeserializedSizeOffset + sizeof(uint64_t)) {
+            return 0;
+        }
+
+        uint64_t deserializedSize;
+        std::memcpy(&deserializedSize, data.data() + kSerializedDeserializedSizeOffset, sizeof(uint64_t));
+        return deserializedSize;
+    }
+
+    bool AccelerationStructureCache::IsEnabled() const {
+        return !folder_.empty() && device_ != VK_NULL_HANDLE;
+    }
+
+    std::string AccelerationStructureCache::GetPath(uint64_t key) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.blas", static_cast<unsigned long long>(key));
+        return folder_ + name;
+    }
+
+    void AccelerationStructureCache::FillHeader(FileHeader& outHeader, uint64_t dataSize) const {
+        // Zeroed so padding compares equal
+        std::memset(&outHeader, 0, sizeof(FileHeader));
+        outHeader.magic = kMagic;
+        outHeader.version = kVersion;
+        outHeader.vendorID = physicalDeviceProperties_.vendorID;
+        outHeader.deviceID = physicalDeviceProperties_.deviceID;
+        outHeader.driverVersion = physicalDeviceProperties_.driverVersion;
+        std::memcpy(outHeader.pipelineCacheUUID, physicalDeviceProperties_.pipelineCacheUUID, VK_UUID_SIZE);
+        outHeader.dataSize = dataSize;
+    }
+}
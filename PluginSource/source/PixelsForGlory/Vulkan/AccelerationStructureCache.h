@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "../../vulkan.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    /// <summary>
+    /// Serialized bottom level acceleration structures on disk, one file per mesh content hash.  Files record the
+    /// device and driver they were written with, and are only handed back when both match and the driver reports the
+    /// serialized data compatible.
+    /// </summary>
+    class AccelerationStructureCache
+    {
+    public:
+        // Seed of Hash, also the key of nothing hashed
+        static const uint64_t kHashSeed = 14695981039346656037ull;
+
+        AccelerationStructureCache();
+
+        /// <summary>
+        /// Remember which device entries are written for
+        /// </summary>
+        /// <param name="device"></param>
+        /// <param name="physicalDeviceProperties"></param>
+        void Initialize(VkDevice device, const VkPhysicalDeviceProperties& physicalDeviceProperties);
+
+        /// <summary>
+        /// Set the folder entries are read from and written to.  An empty folder disables the cache
+        /// </summary>
+        /// <param name="folder"></param>
+        void SetFolder(const std::string& folder);
+
+        /// <summary>
+        /// Read the serialized acceleration structure stored for a key
+        /// </summary>
+        /// <param name="key"></param>
+        /// <param name="outData">Data to pass to vkCmdCopyMemoryToAccelerationStructureKHR</param>
+        /// <returns>false if there is no entry, or it was written for another device or driver</returns>
+        bool Load(uint64_t key, std::vector<uint8_t>& outData) const;
+
+        /// <summary>
+        /// Write a serialized acceleration structure for a key, replacing any existing entry
+        /// </summary>
+        /// <param name="key"></param>
+        /// <param name="data">Data written by vkCmdCopyAccelerationStructureToMemoryKHR</param>
+        /// <param name="size"></param>
+        /// <returns></returns>
+        bool Store(uint64_t key, const void* data, size_t size) const;
+
+        /// <summary>
+        /// FNV-1a hash of some bytes.  Chain calls by passing the previous result as hash
+        /// </summary>
+        /// <param name="data"></param>
+        /// <param name="size"></param>
+        /// <param name="hash"></param>
+        /// <returns></returns>
+        static uint64_t Hash(const void* data, size_t size, uint64_t hash = kHashSeed);
+
+        /// <summary>
+        /// Size of the acceleration structure serialized data deserializes to
+        /// </summary>
+        /// <param name="data"></param>
+        /// <returns>0 if the data is too short to hold the serialization header</returns>
+        static VkDeviceSize GetDeserializedSize(const std::vector<uint8_t>& data);
+
+        // getters
+        bool IsEnabled() const;
+
+    private:
+        struct FileHeader
+        {
+            uint32_t    magic;
+            uint32_t    version;
+            uint32_t    vendorID;
+            uint32_t    deviceID;
+            uint32_t    driverVersion;
+            uint8_t     pipelineCacheUUID[VK_UUID_SIZE];
+            uint64_t    dataSize;
+        };
+
+        static const uint32_t kMagic = 0x41474650; // "PFGA"
+        static const uint32_t kVersion = 1;
+
+        std::string GetPath(uint64_t key) const;
+        void FillHeader(FileHeader& outHeader, uint64_t dataSize) const;
+
+        VkDevice                    device_;
+        VkPhysicalDeviceProperties  physicalDeviceProperties_;
+        std::string                 folder_;
+    };
+}
@@ -0,0 +1,121 @@
+#include "AccelerationStructureQuality.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace PixelsForGlory::Vulkan
+{
+    Bounds::Bounds()
+        : min(vec3(FLT_MAX))
+        , max(vec3(-FLT_MAX))
+    {}
+
+    void Bounds::Add(const vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void Bounds::Add(const Bounds& other) {
+        if (other.IsEmpty()) {
+            return;
+        }
+
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    Bounds Bounds::Transformed(const mat4& localToWorld) const {
+        if (IsEmpty()) {
+            return Bounds();
+        }
+
+        // Transform the center and add up how much each axis of the extent contributes to each world axis
+        const vec3 center = (min + max) * 0.5f;
+        const vec3 extent = (max - min) * 0.5f;
+
+        Bounds result;
+        for (int row = 0; row < 3; ++row) {
+            const vec4& r = localToWorld[row];
+            const float worldCenter = r.x * center.x + r.y * center.y + r.z * center.z + r.w;
+            const float worldExtent = std::abs(r.x) * extent.x + std::abs(r.y) * extent.y + std::abs(r.z) * extent.z;
+
+            result.min[row] = worldCenter - worldExtent;
+            result.max[row] = worldCenter + worldExtent;
+        }
+
+        return result;
+    }
+
+    bool Bounds::IsEmpty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    float Bounds::SurfaceArea() const {
+        if (IsEmpty()) {
+            return 0.0f;
+        }
+
+        const vec3 size = max - min;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    AccelerationStructureQuality::AccelerationStructureQuality()
+        : updateCount_(0)
+        , buildSurfaceArea_(0.0f)
+        , driftSurfaceArea_(0.0f)
+        , baselineMillisecondsPerMegapixel_(-1.0f)
+        , lostMilliseconds_(0.0f)
+    {}
+
+    void AccelerationStructureQuality::Built(float surfaceArea) {
+        updateCount_ = 0;
+        buildSurfaceArea_ = surfaceArea;
+        driftSurfaceArea_ = surfaceArea;
+        baselineMillisecondsPerMegapixel_ = -1.0f;
+        lostMilliseconds_ = 0.0f;
+    }
+
+    void AccelerationStructureQuality::Updated(float driftSurfaceArea) {
+        ++updateCount_;
+        driftSurfaceArea_ = driftSurfaceArea;
+    }
+
+    void AccelerationStructureQuality::Traced(float millisecondsPerMegapixel, float megapixels) {
+        if (baselineMillisecondsPerMegapixel_ < 0.0f) {
+            baselineMillisecondsPerMegapixel_ = millisecondsPerMegapixel;
+            return;
+        }
+
+        // Views change what is traced, so only time over the baseline counts, and only while the structure has
+        // actually been refit
+        if (updateCount_ > 0) {
+            lostMilliseconds_ += std::max(0.0f, millisecondsPerMegapixel - baselineMillisecondsPerMegapixel_) * megapixels;
+        }
+    }
+
+    bool AccelerationStructureQuality::NeedsRebuild(float rebuildMilliseconds, uint32_t maxUpdates, float maxBoundsGrowth) const {
+        if (updateCount_ == 0) {
+            return false;
+        }
+
+        if (updateCount_ >= maxUpdates || GetBoundsGrowth() >= maxBoundsGrowth) {
+            return true;
+        }
+
+        // Lost time only adds up once a baseline was measured, and a rebuild only pays off once its cost is known
+        return rebuildMilliseconds > 0.0f && lostMilliseconds_ > rebuildMilliseconds;
+    }
+
+    uint32_t AccelerationStructureQuality::GetUpdateCount() const {
+        return updateCount_;
+    }
+
+    float AccelerationStructureQuality::GetBoundsGrowth() const {
+        return buildSurfaceArea_ > 0.0f ? driftSurfaceArea_ / buildSurfaceArea_ : 1.0f;
+    }
+
+    float AccelerationStructureQuality::GetLostMilliseconds() const {
+        return lostMilliseconds_;
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "../../vulkan.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    /// <summary>
+    /// Axis aligned box, empty until something is added
+    /// </summary>
+    struct Bounds
+    {
+        Bounds();
+
+        /// <summary>
+        /// Grow to contain a point
+        /// </summary>
+        /// <param name="point"></param>
+        void Add(const vec3& point);
+
+        /// <summary>
+        /// Grow to contain another box
+        /// </summary>
+        /// <param name="other"></param>
+        void Add(const Bounds& other);
+
+        /// <summary>
+        /// Box containing this one after an affine transform
+        /// </summary>
+        /// <param name="localToWorld">Rows of the transform, as written to tlas instance records</param>
+        /// <returns></returns>
+        Bounds Transformed(const mat4& localToWorld) const;
+
+        bool IsEmpty() const;
+        float SurfaceArea() const;
+
+        vec3 min;
+        vec3 max;
+    };
+
+    /// <summary>
+    /// How much an acceleration structure has degraded since its last full build.  Refits keep the tree built for
+    /// the old geometry, so its boxes grow as the geometry moves away from where it was and traces get slower.  Growth
+    /// is estimated coarsely from whole bounds, a mesh's for a blas and each instance's for a tlas, not per primitive.
+    /// The structure is worth rebuilding once the trace time lost since the build adds up to more than a rebuild costs.
+    /// </summary>
+    class AccelerationStructureQuality
+    {
+    public:
+        AccelerationStructureQuality();
+
+        /// <summary>
+        /// The structure was built from scratch
+        /// </summary>
+        /// <param name="surfaceArea">Surface area of the mesh's bounds, or the sum over instances' bounds, at build
+        /// time</param>
+        void Built(float surfaceArea);
+
+        /// <summary>
+        /// The structure was refit
+        /// </summary>
+        /// <param name="driftSurfaceArea">Surface area of the union of the mesh's build time and current bounds, or the
+        /// sum of those unions over instances.  Its ratio to the build time surface area is the bounds growth</param>
+        void Updated(float driftSurfaceArea);
+
+        /// <summary>
+        /// A trace of the structure was measured.  The first trace after a build is the baseline, slower ones after
+        /// it add the difference to the lost time
+        /// </summary>
+        /// <param name="millisecondsPerMegapixel"></param>
+        /// <param name="megapixels"></param>
+        void Traced(float millisecondsPerMegapixel, float megapixels);
+
+        /// <summary>
+        /// Whether rebuilding pays off
+        /// </summary>
+        /// <param name="rebuildMilliseconds">What a rebuild costs over a refit, 0 if it hasn't been measured</param>
+        /// <param name="maxUpdates">Refits after which the structure is rebuilt regardless</param>
+        /// <param name="maxBoundsGrowth">Bounds growth after which the structure is rebuilt regardless</param>
+        /// <returns></returns>
+        bool NeedsRebuild(float rebuildMilliseconds, uint32_t maxUpdates, float maxBoundsGrowth) const;
+
+        // getters
+        uint32_t GetUpdateCount() const;
+        float GetBoundsGrowth() const;
+        float GetLostMilliseconds() const;
+
+    private:
+        uint32_t    updateCount_;
+        float       buildSurfaceArea_;
+        float       driftSurfaceArea_;
+
+        // Trace time of the first measurement after the build, negative until then
+        float       baselineMillisecondsPerMegapixel_;
+        float       lostMilliseconds_;
+    };
+}
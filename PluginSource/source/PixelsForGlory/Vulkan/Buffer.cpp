@@ -1,8 +1,11 @@
 #include "Buffer.h"
 
+#include <algorithm>
+#include <assert.h>
 #include <memory>
 
 #include "../Debug.h"
+#include "HostAllocator.h"
 
 namespace PixelsForGlory::Vulkan
 {
@@ -10,14 +13,15 @@ namespace PixelsForGlory::Vulkan
     Buffer::Buffer()
         : device_(VK_NULL_HANDLE)
         , buffer_(VK_NULL_HANDLE)
-        , memory_(VK_NULL_HANDLE)
+        , allocation_(MemoryAllocation())
         , size_(0)
+        , mapped_(nullptr)
     {}
 
     Buffer::~Buffer() {
     }
 
-    VkResult Buffer::Create(VkDevice device, VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties) {
+    VkResult Buffer::Create(VkDevice device, VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties, MemoryCategory category, VkDeviceSize minAlignment) {
         device_ = device;
 
         VkResult result = VK_SUCCESS;
@@ -34,42 +38,35 @@ namespace PixelsForGlory::Vulkan
 
         size_ = size;
 
-        result = vkCreateBuffer(device_, &bufferCreateInfo, nullptr, &buffer_);
+        result = vkCreateBuffer(device_, &bufferCreateInfo, HostAllocator::Instance().GetCallbacks(), &buffer_);
         VK_CHECK("vkCreateBuffer", result);
         if (VK_SUCCESS == result) {
             VkMemoryRequirements memoryRequirements;
             vkGetBufferMemoryRequirements(device_, buffer_, &memoryRequirements);
 
-            VkMemoryAllocateInfo memoryAllocateInfo;
-            memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            memoryAllocateInfo.pNext = nullptr;
-            memoryAllocateInfo.allocationSize = memoryRequirements.size;
-            memoryAllocateInfo.memoryTypeIndex = GetMemoryType(physicalDeviceMemoryProperties, memoryRequirements, memoryProperties);
-
-            VkMemoryAllocateFlagsInfo allocationFlags = {};
-            allocationFlags.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
-            allocationFlags.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
-            if ((usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) == VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
-                memoryAllocateInfo.pNext = &allocationFlags;
-            }
+            // Some commands need addresses aligned beyond what the buffer requires, e.g. serialized acceleration structures
+            memoryRequirements.alignment = std::max(memoryRequirements.alignment, minAlignment);
+
+            const uint32_t memoryTypeIndex = GetMemoryType(physicalDeviceMemoryProperties, memoryRequirements, memoryProperties);
 
-            result = vkAllocateMemory(device_, &memoryAllocateInfo, nullptr, &memory_);
-            VK_CHECK("vkAllocateMemory", result);
+            // Sub-allocated from a shared block, the buffer is bound at the allocation's offset
+            result = MemoryAllocator::Instance().Allocate(memoryRequirements, memoryTypeIndex, true, category, allocation_);
+            if (VK_SUCCESS != result) {
+                vkDestroyBuffer(device_, buffer_, HostAllocator::Instance().GetCallbacks());
+                buffer_ = VK_NULL_HANDLE;
+            }
+            else {
+                result = vkBindBufferMemory(device_, buffer_, allocation_.memory, allocation_.offset);
+                VK_CHECK("vkBindBufferMemory", result);
                 if (VK_SUCCESS != result) {
-                    vkDestroyBuffer(device_, buffer_, nullptr);
+                    vkDestroyBuffer(device_, buffer_, HostAllocator::Instance().GetCallbacks());
+                    MemoryAllocator::Instance().Free(allocation_);
                     buffer_ = VK_NULL_HANDLE;
-                    memory_ = VK_NULL_HANDLE;
                 }
                 else {
-                    result = vkBindBufferMemory(device_, buffer_, memory_, 0);
-                    VK_CHECK("vkBindBufferMemory", result);
-                        if (VK_SUCCESS != result) {
-                            vkDestroyBuffer(device_, buffer_, nullptr);
-                            vkFreeMemory(device_, memory_, nullptr);
-                            buffer_ = VK_NULL_HANDLE;
-                            memory_ = VK_NULL_HANDLE;
-                        }
+                    mapped_ = MemoryAllocator::Instance().GetMappedData(allocation_);
                 }
+            }
         }
 
         return result;
@@ -83,41 +80,42 @@ namespace PixelsForGlory::Vulkan
         }
 
         if (buffer_) {
-            vkDestroyBuffer(device_, buffer_, nullptr);
+            vkDestroyBuffer(device_, buffer_, HostAllocator::Instance().GetCallbacks());
             buffer_ = VK_NULL_HANDLE;
         }
-        if (memory_) {
-            vkFreeMemory(device_, memory_, nullptr);
-            memory_ = VK_NULL_HANDLE;
+        if (allocation_.memory) {
+            MemoryAllocator::Instance().Free(allocation_);
         }
+        mapped_ = nullptr;
     }
 
     void* Buffer::Map(VkDeviceSize size, VkDeviceSize offset) const {
-        void* mem = nullptr;
+        assert(offset < size_);
 
-        if (size > size_) {
-            size = size_;
+        if (mapped_ == nullptr) {
+            return nullptr;
         }
 
-        VkResult result = vkMapMemory(device_, memory_, offset, size, 0, &mem);
-        if (VK_SUCCESS != result) {
-            mem = nullptr;
-        }
+        return static_cast<uint8_t*>(mapped_) + offset;
+    }
 
-        return mem;
+    void Buffer::Flush(VkDeviceSize size, VkDeviceSize offset) const {
+        MemoryAllocator::Instance().Flush(allocation_, offset, size);
     }
-    void Buffer::Unmap() const {
-        vkUnmapMemory(device_, memory_);
+
+    void Buffer::Invalidate(VkDeviceSize size, VkDeviceSize offset) const {
+        MemoryAllocator::Instance().Invalidate(allocation_, offset, size);
     }
 
     bool Buffer::UploadData(const void* data, VkDeviceSize size, VkDeviceSize offset) const {
-        bool result = false;
-
         void* mem = this->Map(size, offset);
-        if (mem) {
-            std::memcpy(mem, data, size);
-            this->Unmap();
+        if (mem == nullptr) {
+            return false;
         }
+
+        std::memcpy(mem, data, size);
+        this->Flush(size, offset);
+
         return true;
     }
 
@@ -1,5 +1,6 @@
 #pragma once
 #include "../../vulkan.h"
+#include "MemoryAllocator.h"
 
 namespace PixelsForGlory::Vulkan
 {
@@ -17,8 +18,11 @@ namespace PixelsForGlory::Vulkan
         /// <param name="size"></param>
         /// <param name="usage"></param>
         /// <param name="memoryProperties"></param>
+        /// <param name="category">Bucket the buffer's memory is reported under</param>
+        /// <param name="minAlignment">Alignment of the buffer's memory, and so of its device address, on top of what the
+        /// buffer itself requires</param>
         /// <returns></returns>
-        VkResult Create(VkDevice device, VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties);
+        VkResult Create(VkDevice device, VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties, MemoryCategory category = MemoryCategory::Other, VkDeviceSize minAlignment = 1);
 
         /// <summary>
         /// Destroy buffer
@@ -26,17 +30,27 @@ namespace PixelsForGlory::Vulkan
         void Destroy();
 
         /// <summary>
-        /// Get a handle to GPU memory 
+        /// Get a pointer to GPU memory.  Host visible buffers are mapped for their whole lifetime, so this is only
+        /// pointer math and the result can be cached
         /// </summary>
         /// <param name="size"></param>
         /// <param name="offset"></param>
-        /// <returns></returns>
+        /// <returns>nullptr if the buffer isn't host visible</returns>
         void* Map(VkDeviceSize size = UINT64_MAX, VkDeviceSize offset = 0) const;
 
         /// <summary>
-        /// Free handle to GPU memory
+        /// Make host writes visible to the GPU.  Only does work for non-coherent memory
+        /// </summary>
+        /// <param name="size"></param>
+        /// <param name="offset"></param>
+        void Flush(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0) const;
+
+        /// <summary>
+        /// Make GPU writes visible to the host.  Only does work for non-coherent memory
         /// </summary>
-        void Unmap() const;
+        /// <param name="size"></param>
+        /// <param name="offset"></param>
+        void Invalidate(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0) const;
 
         /// <summary>
         /// Upload data to GPU
@@ -56,9 +70,10 @@ namespace PixelsForGlory::Vulkan
         VkDeviceOrHostAddressConstKHR GetBufferDeviceAddressConst() const;
 
     private:
-        VkDevice        device_;
-        VkBuffer        buffer_;
-        VkDeviceMemory  memory_;
-        VkDeviceSize    size_;
+        VkDevice            device_;
+        VkBuffer            buffer_;
+        MemoryAllocation    allocation_;
+        VkDeviceSize        size_;
+        void*               mapped_;
     };
 }
\ No newline at end of file
@@ -0,0 +1,82 @@
+#include "ComputePass.h"
+
+#include "../Debug.h"
+#include "HostAllocator.h"
+#include "Shader.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    ComputePass::ComputePass()
+        : device_(VK_NULL_HANDLE)
+        , pipelineLayout_(VK_NULL_HANDLE)
+        , pipeline_(VK_NULL_HANDLE)
+    {}
+
+    void ComputePass::Initialize(VkDevice device) {
+        device_ = device;
+    }
+
+    void ComputePass::Destroy() {
+        if (pipeline_ != VK_NULL_HANDLE) {
+            vkDestroyPipeline(device_, pipeline_, HostAllocator::Instance().GetCallbacks());
+            pipeline_ = VK_NULL_HANDLE;
+        }
+
+        if (pipelineLayout_ != VK_NULL_HANDLE) {
+            vkDestroyPipelineLayout(device_, pipelineLayout_, HostAllocator::Instance().GetCallbacks());
+            pipelineLayout_ = VK_NULL_HANDLE;
+        }
+    }
+
+    bool ComputePass::Load(const std::string& shaderFolder, const std::string& shaderFile, uint32_t pushConstantsSize) {
+        Destroy();
+
+        Shader shader(device_);
+        if (!shader.LoadFromFile((shaderFolder + shaderFile).c_str())) {
+            return false;
+        }
+
+        // Everything the shader reads is passed by address, so there are no descriptor sets
+        VkPushConstantRange pushConstantRange = {};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = pushConstantsSize;
+
+        VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {};
+        pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+        VkResult result = vkCreatePipelineLayout(device_, &pipelineLayoutCreateInfo, HostAllocator::Instance().GetCallbacks(), &pipelineLayout_);
+        if (result != VK_SUCCESS) {
+            PFG_EDITORLOGERROR("Failed to create " + shaderFile + " pipeline layout: " + std::to_string(result));
+            pipelineLayout_ = VK_NULL_HANDLE;
+            return false;
+        }
+
+        VkComputePipelineCreateInfo computePipelineCreateInfo = {};
+        computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        computePipelineCreateInfo.stage = shader.GetShaderStage(VK_SHADER_STAGE_COMPUTE_BIT);
+        computePipelineCreateInfo.layout = pipelineLayout_;
+
+        result = vkCreateComputePipelines(device_, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, HostAllocator::Instance().GetCallbacks(), &pipeline_);
+        if (result != VK_SUCCESS) {
+            PFG_EDITORLOGERROR("Failed to create " + shaderFile + " pipeline: " + std::to_string(result));
+            pipeline_ = VK_NULL_HANDLE;
+            Destroy();
+            return false;
+        }
+
+        return true;
+    }
+
+    void ComputePass::Dispatch(VkCommandBuffer commandBuffer, const void* pushConstants, uint32_t pushConstantsSize, uint32_t count) const {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_);
+        vkCmdPushConstants(commandBuffer, pipelineLayout_, VK_SHADER_STAGE_COMPUTE_BIT, 0, pushConstantsSize, pushConstants);
+        vkCmdDispatch(commandBuffer, (count + kGroupSize - 1) / kGroupSize, 1, 1);
+    }
+
+    bool ComputePass::IsLoaded() const {
+        return pipeline_ != VK_NULL_HANDLE;
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+
+#include "../../vulkan.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    /// <summary>
+    /// Pipeline shared by the single dispatch compute passes.  Everything a pass reads is passed by device address in
+    /// its push constants, so the pipeline layout is one compute push constant range and no descriptor sets.  Passes
+    /// load their shader and record their own dispatches and barriers.
+    /// </summary>
+    class ComputePass
+    {
+    public:
+        // Matches local_size_x in the compute shaders
+        static const uint32_t kGroupSize = 64;
+
+        ComputePass();
+
+        /// <summary>
+        /// Setup pass, the pipeline is created by the first Load
+        /// </summary>
+        /// <param name="device"></param>
+        void Initialize(VkDevice device);
+
+        /// <summary>
+        /// Destroy pipeline
+        /// </summary>
+        void Destroy();
+
+        // getters
+        bool IsLoaded() const;
+
+    protected:
+        /// <summary>
+        /// Create the pipeline from a shader in the shader folder
+        /// </summary>
+        /// <param name="shaderFolder"></param>
+        /// <param name="shaderFile">Compiled shader, e.g. instances_comp.bin</param>
+        /// <param name="pushConstantsSize">Size of the pass' push constants</param>
+        /// <returns>false if the shader couldn't be loaded</returns>
+        bool Load(const std::string& shaderFolder, const std::string& shaderFile, uint32_t pushConstantsSize);
+
+        /// <summary>
+        /// Bind the pipeline, push the constants and dispatch enough groups for count invocations
+        /// </summary>
+        /// <param name="commandBuffer"></param>
+        /// <param name="pushConstants"></param>
+        /// <param name="pushConstantsSize"></param>
+        /// <param name="count"></param>
+        void Dispatch(VkCommandBuffer commandBuffer, const void* pushConstants, uint32_t pushConstantsSize, uint32_t count) const;
+
+    private:
+        VkDevice            device_;
+        VkPipelineLayout    pipelineLayout_;
+        VkPipeline          pipeline_;
+    };
+}
@@ -0,0 +1,107 @@
+#include "DeferredOperationPool.h"
+
+#include <algorithm>
+
+#include "../Debug.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    DeferredOperationPool::DeferredOperationPool()
+        : device_(VK_NULL_HANDLE)
+        , stopping_(false)
+    {}
+
+    void DeferredOperationPool::Initialize(VkDevice device, uint32_t threadCount) {
+        device_ = device;
+        stopping_ = false;
+
+        for (uint32_t i = 0; i < threadCount; ++i) {
+            threads_.emplace_back(&DeferredOperationPool::WorkerLoop, this);
+        }
+    }
+
+    void DeferredOperationPool::Destroy() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        condition_.notify_all();
+
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+        threads_.clear();
+        entries_.clear();
+    }
+
+    void DeferredOperationPool::Run(VkDeferredOperationKHR operation) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            Entry entry = {};
+            entry.operation = operation;
+            entries_.push_back(entry);
+        }
+        condition_.notify_all();
+    }
+
+    bool DeferredOperationPool::IsReleased(VkDeferredOperationKHR operation) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto itr = std::find_if(entries_.begin(), entries_.end(), [operation](const Entry& entry) { return entry.operation == operation; });
+        if (itr == entries_.end()) {
+            return true;
+        }
+
+        if (!itr->done || itr->joinedThreads > 0) {
+            return false;
+        }
+
+        entries_.erase(itr);
+        return true;
+    }
+
+    uint32_t DeferredOperationPool::GetThreadCount() const {
+        return static_cast<uint32_t>(threads_.size());
+    }
+
+    void DeferredOperationPool::WorkerLoop() {
+        auto hasWork = [this] {
+            return std::any_of(entries_.begin(), entries_.end(), [](const Entry& entry) { return !entry.done; });
+        };
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            condition_.wait(lock, [this, &hasWork] { return stopping_ || hasWork(); });
+
+            // Queued operations are finished before stopping, their owners are waiting on the result
+            auto itr = std::find_if(entries_.begin(), entries_.end(), [](const Entry& entry) { return !entry.done; });
+            if (itr == entries_.end()) {
+                return;
+            }
+
+            // Entries are never removed while a thread has joined them, so the operation stays alive
+            const VkDeferredOperationKHR operation = itr->operation;
+            ++itr->joinedThreads;
+
+            lock.unlock();
+
+            // Every worker joins the same operation, the driver splits the work between them
+            VkResult result = vkDeferredOperationJoinKHR(device_, operation);
+            if (result == VK_THREAD_IDLE_KHR) {
+                // Work remains but none is available right now
+                std::this_thread::yield();
+            }
+
+            lock.lock();
+
+            itr = std::find_if(entries_.begin(), entries_.end(), [operation](const Entry& entry) { return entry.operation == operation; });
+            --itr->joinedThreads;
+
+            // VK_SUCCESS or VK_THREAD_DONE_KHR, nothing is left for another thread to join
+            if (result != VK_THREAD_IDLE_KHR) {
+                itr->done = true;
+            }
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../../vulkan.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    /// <summary>
+    /// CPU threads that join deferred host operations (e.g. host acceleration structure builds) until they are done.
+    /// The thread that started an operation never waits on it, it polls vkGetDeferredOperationResultKHR instead.
+    /// </summary>
+    class DeferredOperationPool
+    {
+    public:
+        DeferredOperationPool();
+
+        /// <summary>
+        /// Start the worker threads
+        /// </summary>
+        /// <param name="device"></param>
+        /// <param name="threadCount"></param>
+        void Initialize(VkDevice device, uint32_t threadCount);
+
+        /// <summary>
+        /// Let the workers finish every queued operation, then stop them
+        /// </summary>
+        void Destroy();
+
+        /// <summary>
+        /// Hand an operation that vkBuildAccelerationStructuresKHR or similar deferred to the workers.  The operation
+        /// must stay alive until IsReleased returns true.
+        /// </summary>
+        /// <param name="operation"></param>
+        void Run(VkDeferredOperationKHR operation);
+
+        /// <summary>
+        /// Check if the workers are done with an operation.  Once they are the operation can be destroyed, after
+        /// vkGetDeferredOperationResultKHR reports it complete
+        /// </summary>
+        /// <param name="operation"></param>
+        /// <returns></returns>
+        bool IsReleased(VkDeferredOperationKHR operation);
+
+        // getters
+        uint32_t GetThreadCount() const;
+
+    private:
+        struct Entry
+        {
+            VkDeferredOperationKHR  operation;
+            uint32_t                joinedThreads;
+            bool                    done;           // No more work for another thread to join
+        };
+
+        void WorkerLoop();
+
+        VkDevice                            device_;
+
+        std::vector<std::thread>            threads_;
+
+        // Operations handed to the workers and not yet released.  Guarded by mutex_
+        std::mutex                          mutex_;
+        std::condition_variable             condition_;
+        std::deque<Entry>                   entries_;
+        bool                                stopping_;
+    };
+}
@@ -0,0 +1,163 @@
+#include "GeometryBuffer.h"
+
+#include <algorithm>
+
+#include "../Debug.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    GeometryBuffer::GeometryBuffer()
+        : device_(VK_NULL_HANDLE)
+        , physicalDeviceMemoryProperties_(VkPhysicalDeviceMemoryProperties())
+        , usage_(0)
+        , memoryProperties_(0)
+        , category_(MemoryCategory::Other)
+        , pageSize_(kDefaultPageSize)
+    {}
+
+    void GeometryBuffer::Initialize(VkDevice device, VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties, MemoryCategory category, VkDeviceSize pageSize) {
+        device_ = device;
+        physicalDeviceMemoryProperties_ = physicalDeviceMemoryProperties;
+        usage_ = usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+        memoryProperties_ = memoryProperties;
+        category_ = category;
+        pageSize_ = pageSize;
+    }
+
+    void GeometryBuffer::Destroy() {
+        for (auto& page : pages_) {
+            page->buffer.Destroy();
+        }
+        pages_.clear();
+    }
+
+    bool GeometryBuffer::Allocate(VkDeviceSize size, VkDeviceSize alignment, GeometryAllocation& outAllocation) {
+        if (AllocateInPages(size, alignment, static_cast<uint32_t>(pages_.size()), outAllocation)) {
+            return true;
+        }
+
+        if (pages_.size() >= kMaxPages) {
+            PFG_EDITORLOGERROR("Out of geometry pages, can't allocate " + std::to_string(size) + " bytes");
+            return false;
+        }
+
+        if (CreatePage(std::max(size, pageSize_)) != VK_SUCCESS) {
+            return false;
+        }
+
+        const uint64_t offset = pages_.back()->ranges.Allocate(size, alignment);
+        if (offset == RangeAllocator::kInvalidOffset) {
+            return false;
+        }
+
+        outAllocation.page = static_cast<uint32_t>(pages_.size() - 1);
+        outAllocation.offset = offset;
+        outAllocation.size = size;
+
+        return true;
+    }
+
+    bool GeometryBuffer::AllocateInPages(VkDeviceSize size, VkDeviceSize alignment, uint32_t pageCount, GeometryAllocation& outAllocation) {
+        // Pages are tried in order so geometry packs towards the first pages
+        pageCount = std::min(pageCount, static_cast<uint32_t>(pages_.size()));
+        for (uint32_t pageIndex = 0; pageIndex < pageCount; ++pageIndex) {
+            auto& page = pages_[pageIndex];
+            if (page->ranges.GetLargestFreeRange() < size) {
+                continue;
+            }
+
+            const uint64_t offset = page->ranges.Allocate(size, alignment);
+            if (offset != RangeAllocator::kInvalidOffset) {
+                outAllocation.page = pageIndex;
+                outAllocation.offset = offset;
+                outAllocation.size = size;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void GeometryBuffer::Free(GeometryAllocation& allocation) {
+        if (!allocation.IsValid() || allocation.page >= pages_.size()) {
+            return;
+        }
+
+        pages_[allocation.page]->ranges.Free(allocation.offset, allocation.size);
+        allocation = GeometryAllocation();
+    }
+
+    uint32_t GeometryBuffer::GetEvacuationPage() const {
+        if (pages_.size() < 2) {
+            return GeometryAllocation::kInvalidPage;
+        }
+
+        const uint32_t lastPage = static_cast<uint32_t>(pages_.size() - 1);
+        const VkDeviceSize used = pages_[lastPage]->ranges.GetUsed();
+        if (used == 0) {
+            return GeometryAllocation::kInvalidPage;
+        }
+
+        VkDeviceSize available = 0;
+        for (uint32_t pageIndex = 0; pageIndex < lastPage; ++pageIndex) {
+            available += pages_[pageIndex]->ranges.GetSize() - pages_[pageIndex]->ranges.GetUsed();
+        }
+
+        return used <= available ? lastPage : GeometryAllocation::kInvalidPage;
+    }
+
+    bool GeometryBuffer::ReleaseLastPage(Buffer& outBuffer) {
+        if (pages_.empty() || !pages_.back()->ranges.IsEmpty()) {
+            return false;
+        }
+
+        PFG_EDITORLOG("Releasing geometry page of " + std::to_string(pages_.back()->buffer.GetSize()) + " bytes");
+
+        outBuffer = pages_.back()->buffer;
+        pages_.pop_back();
+
+        return true;
+    }
+
+    void* GeometryBuffer::GetMappedData(const GeometryAllocation& allocation) const {
+        return pages_[allocation.page]->buffer.Map(allocation.size, allocation.offset);
+    }
+
+    void GeometryBuffer::Flush(const GeometryAllocation& allocation) const {
+        pages_[allocation.page]->buffer.Flush(allocation.size, allocation.offset);
+    }
+
+    VkDeviceAddress GeometryBuffer::GetDeviceAddress(const GeometryAllocation& allocation) const {
+        return pages_[allocation.page]->deviceAddress + allocation.offset;
+    }
+
+    uint32_t GeometryBuffer::GetPageCount() const {
+        return static_cast<uint32_t>(pages_.size());
+    }
+
+    const Buffer& GeometryBuffer::GetPage(uint32_t page) const {
+        return pages_[page]->buffer;
+    }
+
+    VkDeviceSize GeometryBuffer::GetPageUsed(uint32_t page) const {
+        return pages_[page]->ranges.GetUsed();
+    }
+
+    VkResult GeometryBuffer::CreatePage(VkDeviceSize size) {
+        PFG_EDITORLOG("Creating geometry page of " + std::to_string(size) + " bytes");
+
+        auto page = std::make_unique<Page>();
+
+        VkResult result = page->buffer.Create(device_, physicalDeviceMemoryProperties_, size, usage_, memoryProperties_, category_);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+
+        page->ranges.Initialize(size);
+        page->deviceAddress = page->buffer.GetBufferDeviceAddress().deviceAddress;
+
+        pages_.push_back(std::move(page));
+
+        return VK_SUCCESS;
+    }
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "../../vulkan.h"
+#include "../RangeAllocator.h"
+#include "Buffer.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    /// <summary>
+    /// Range of a geometry page handed out by the GeometryBuffer
+    /// </summary>
+    struct GeometryAllocation
+    {
+        static const uint32_t kInvalidPage = UINT32_MAX;
+
+        GeometryAllocation()
+            : page(kInvalidPage)
+            , offset(0)
+            , size(0)
+        {}
+
+        bool IsValid() const { return page != kInvalidPage; }
+
+        uint32_t        page;
+        VkDeviceSize    offset;     // Bytes from the start of the page
+        VkDeviceSize    size;
+    };
+
+    /// <summary>
+    /// Packs the geometry of every shared mesh into a few large buffers ("pages").  Only the last page is ever
+    /// released, so a page index stays valid for descriptor arrays and the per mesh offset table.
+    /// </summary>
+    class GeometryBuffer
+    {
+    public:
+        static const VkDeviceSize   kDefaultPageSize = 32ull * 1024ull * 1024ull;
+
+        // Upper bound of the page descriptor arrays
+        static const uint32_t       kMaxPages = 64;
+
+        GeometryBuffer();
+
+        /// <summary>
+        /// Setup buffer, pages are created on demand
+        /// </summary>
+        /// <param name="device"></param>
+        /// <param name="physicalDeviceMemoryProperties"></param>
+        /// <param name="usage">Usage of every page, shader device address is always added</param>
+        /// <param name="memoryProperties"></param>
+        /// <param name="category">Bucket the pages are reported under</param>
+        /// <param name="pageSize"></param>
+        void Initialize(VkDevice device, VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties, VkBufferUsageFlags usage, VkMemoryPropertyFlags memoryProperties, MemoryCategory category, VkDeviceSize pageSize = kDefaultPageSize);
+
+        /// <summary>
+        /// Destroy every page.  GPU must be done with all of them
+        /// </summary>
+        void Destroy();
+
+        /// <summary>
+        /// Allocate a range from an existing page, or from a new page if none has room.  Ranges larger than a page
+        /// get a page of their own.
+        /// </summary>
+        /// <param name="size"></param>
+        /// <param name="alignment">Any value, not only powers of two, so ranges can line up with element strides</param>
+        /// <param name="outAllocation"></param>
+        /// <returns>false if no page could be created or kMaxPages was reached</returns>
+        bool Allocate(VkDeviceSize size, VkDeviceSize alignment, GeometryAllocation& outAllocation);
+
+        /// <summary>
+        /// Allocate a range from one of the first pageCount pages without creating a new page.  Used to move ranges
+        /// towards the front when defragmenting.
+        /// </summary>
+        /// <param name="size"></param>
+        /// <param name="alignment"></param>
+        /// <param name="pageCount"></param>
+        /// <param name="outAllocation"></param>
+        /// <returns>false if none of the pages has room</returns>
+        bool AllocateInPages(VkDeviceSize size, VkDeviceSize alignment, uint32_t pageCount, GeometryAllocation& outAllocation);
+
+        /// <summary>
+        /// Return a range to its page.  The page itself stays alive
+        /// </summary>
+        /// <param name="allocation"></param>
+        void Free(GeometryAllocation& allocation);
+
+        /// <summary>
+        /// Page worth emptying: the last page, when everything in it would fit in the free space of the pages before it
+        /// </summary>
+        /// <returns>GeometryAllocation::kInvalidPage if there is nothing to gain</returns>
+        uint32_t GetEvacuationPage() const;
+
+        /// <summary>
+        /// Remove the last page if nothing is allocated from it.  The page's buffer is handed back rather than
+        /// destroyed so it can be kept alive until frames in flight are done with it.
+        /// </summary>
+        /// <param name="outBuffer"></param>
+        /// <returns>true if a page was removed</returns>
+        bool ReleaseLastPage(Buffer& outBuffer);
+
+        /// <summary>
+        /// Get a pointer to the range
+        /// </summary>
+        /// <param name="allocation"></param>
+        /// <returns>nullptr if pages aren't host visible</returns>
+        void* GetMappedData(const GeometryAllocation& allocation) const;
+
+        /// <summary>
+        /// Make host writes to the range visible to the GPU.  Only does work for non-coherent memory
+        /// </summary>
+        /// <param name="allocation"></param>
+        void Flush(const GeometryAllocation& allocation) const;
+
+        /// <summary>
+        /// Device address of the start of the range
+        /// </summary>
+        /// <param name="allocation"></param>
+        /// <returns></returns>
+        VkDeviceAddress GetDeviceAddress(const GeometryAllocation& allocation) const;
+
+        // getters
+        uint32_t GetPageCount() const;
+        const Buffer& GetPage(uint32_t page) const;
+        VkDeviceSize GetPageUsed(uint32_t page) const;
+
+    private:
+        struct Page
+        {
+            Page()
+                : deviceAddress(0)
+            {}
+
+            Buffer          buffer;
+            RangeAllocator  ranges;
+            VkDeviceAddress deviceAddress;
+        };
+
+        VkResult CreatePage(VkDeviceSize size);
+
+        VkDevice                            device_;
+        VkPhysicalDeviceMemoryProperties    physicalDeviceMemoryProperties_;
+        VkBufferUsageFlags                  usage_;
+        VkMemoryPropertyFlags               memoryProperties_;
+        MemoryCategory                      category_;
+        VkDeviceSize                        pageSize_;
+
+        std::vector<std::unique_ptr<Page>>  pages_;
+    };
+}
@@ -0,0 +1,371 @@
+#include "HostAllocator.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace PixelsForGlory::Vulkan
+{
+    namespace
+    {
+        // Stored in front of every allocation so Free knows where it came from
+        struct AllocationHeader
+        {
+            uint32_t    offset;         // Bytes from the start of the raw allocation to the pointer handed out
+            uint16_t    sizeClass;
+            uint8_t     scope;
+            uint8_t     accounted;
+            uint64_t    size;           // Size asked for by the driver
+        };
+
+        static_assert(sizeof(AllocationHeader) == 16, "Allocation header must keep handed out pointers 16 byte aligned");
+
+        const uint16_t kLargeAllocation = UINT16_MAX;
+
+        // Most entries a thread keeps per size class before handing half of them back
+        const uint32_t kMaxCachedEntries = 64;
+
+        // Entries taken from the shared lists at once when a thread's cache is empty
+        const uint32_t kRefillCount = 32;
+
+        struct ThreadCache
+        {
+            ThreadCache()
+                : entries()
+                , counts()
+            {}
+
+            ~ThreadCache()
+            {
+                for (uint32_t sizeClass = 0; sizeClass < HostAllocator::kSizeClassCount; ++sizeClass) {
+                    if (entries[sizeClass] == nullptr) {
+                        continue;
+                    }
+
+                    HostAllocator::FreeEntry* last = entries[sizeClass];
+                    while (last->next != nullptr) {
+                        last = last->next;
+                    }
+
+                    HostAllocator::Instance().PushEntries(sizeClass, entries[sizeClass], last);
+                }
+            }
+
+            HostAllocator::FreeEntry*   entries[HostAllocator::kSizeClassCount];
+            uint32_t                    counts[HostAllocator::kSizeClassCount];
+        };
+
+        thread_local ThreadCache threadCache;
+
+        uint16_t GetSizeClass(size_t size) {
+            uint16_t sizeClass = 0;
+            size_t classSize = HostAllocator::kMinSizeClass;
+            while (classSize < size) {
+                classSize <<= 1;
+                ++sizeClass;
+            }
+            return sizeClass;
+        }
+
+        size_t GetClassSize(uint32_t sizeClass) {
+            return HostAllocator::kMinSizeClass << sizeClass;
+        }
+
+        VKAPI_ATTR void* VKAPI_CALL AllocationCallback(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+            return reinterpret_cast<HostAllocator*>(userData)->Allocate(size, alignment, scope);
+        }
+
+        VKAPI_ATTR void* VKAPI_CALL ReallocationCallback(void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+            return reinterpret_cast<HostAllocator*>(userData)->Reallocate(original, size, alignment, scope);
+        }
+
+        VKAPI_ATTR void VKAPI_CALL FreeCallback(void* userData, void* memory) {
+            reinterpret_cast<HostAllocator*>(userData)->Free(memory);
+        }
+
+        VKAPI_ATTR void VKAPI_CALL InternalAllocationCallback(void* userData, size_t size, VkInternalAllocationType, VkSystemAllocationScope) {
+            reinterpret_cast<HostAllocator*>(userData)->NotifyInternalAllocation(size);
+        }
+
+        VKAPI_ATTR void VKAPI_CALL InternalFreeCallback(void* userData, size_t size, VkInternalAllocationType, VkSystemAllocationScope) {
+            reinterpret_cast<HostAllocator*>(userData)->NotifyInternalFree(size);
+        }
+    }
+
+    HostAllocator::HostAllocator()
+        : callbacks_(VkAllocationCallbacks())
+        , parent_(VkAllocationCallbacks())
+        , hasParent_(false)
+        , accountingEnabled_(true)
+        , bytes_(0)
+        , peakBytes_(0)
+        , internalBytes_(0)
+        , slabBytes_(0)
+        , freeLists_()
+    {
+        for (uint32_t scope = 0; scope < kHostAllocationScopeCount; ++scope) {
+            scopeBytes_[scope] = 0;
+            scopeAllocationCounts_[scope] = 0;
+        }
+
+        callbacks_.pUserData = this;
+        callbacks_.pfnAllocation = AllocationCallback;
+        callbacks_.pfnReallocation = ReallocationCallback;
+        callbacks_.pfnFree = FreeCallback;
+        callbacks_.pfnInternalAllocation = InternalAllocationCallback;
+        callbacks_.pfnInternalFree = InternalFreeCallback;
+    }
+
+    void HostAllocator::SetParent(const VkAllocationCallbacks* parent) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // Memory already taken from one parent can't be given back to another
+        assert(slabs_.empty());
+
+        hasParent_ = parent != nullptr;
+        if (hasParent_) {
+            parent_ = *parent;
+        }
+    }
+
+    void HostAllocator::SetAccountingEnabled(bool enabled) {
+        accountingEnabled_ = enabled;
+    }
+
+    const VkAllocationCallbacks* HostAllocator::GetCallbacks() const {
+        return &callbacks_;
+    }
+
+    void HostAllocator::GetStatistics(HostAllocatorStatistics& outStatistics) const {
+        outStatistics = HostAllocatorStatistics();
+
+        for (uint32_t scope = 0; scope < kHostAllocationScopeCount; ++scope) {
+            outStatistics.scopeBytes[scope] = scopeBytes_[scope];
+            outStatistics.scopeAllocationCounts[scope] = scopeAllocationCounts_[scope];
+            outStatistics.allocationCount += scopeAllocationCounts_[scope];
+        }
+
+        outStatistics.bytes = bytes_;
+        outStatistics.peakBytes = peakBytes_;
+        outStatistics.internalBytes = internalBytes_;
+        outStatistics.slabBytes = slabBytes_;
+    }
+
+    void* HostAllocator::Allocate(size_t size, size_t alignment, VkSystemAllocationScope scope) {
+        if (size == 0) {
+            return nullptr;
+        }
+
+        // Raw allocations are 16 byte aligned, so size + alignment leaves room for the header and for aligning
+        alignment = std::max<size_t>(alignment, sizeof(AllocationHeader));
+        const size_t required = size + alignment;
+
+        uint8_t* raw = nullptr;
+        uint16_t sizeClass = kLargeAllocation;
+
+        if (required <= GetClassSize(kSizeClassCount - 1)) {
+            sizeClass = GetSizeClass(required);
+
+            if (threadCache.entries[sizeClass] == nullptr) {
+                uint32_t count = 0;
+                threadCache.entries[sizeClass] = PopEntries(sizeClass, kRefillCount, count);
+                threadCache.counts[sizeClass] = count;
+            }
+
+            FreeEntry* entry = threadCache.entries[sizeClass];
+            if (entry == nullptr) {
+                return nullptr;
+            }
+
+            threadCache.entries[sizeClass] = entry->next;
+            --threadCache.counts[sizeClass];
+
+            raw = reinterpret_cast<uint8_t*>(entry);
+        }
+        else {
+            raw = reinterpret_cast<uint8_t*>(AllocateFromParent(required, sizeof(AllocationHeader)));
+            if (raw == nullptr) {
+                return nullptr;
+            }
+        }
+
+        const uintptr_t address = (reinterpret_cast<uintptr_t>(raw) + sizeof(AllocationHeader) + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+        uint8_t* memory = reinterpret_cast<uint8_t*>(address);
+
+        auto header = reinterpret_cast<AllocationHeader*>(memory - sizeof(AllocationHeader));
+        header->offset = static_cast<uint32_t>(memory - raw);
+        header->sizeClass = sizeClass;
+        header->scope = static_cast<uint8_t>(std::min<uint32_t>(scope, kHostAllocationScopeCount - 1));
+        header->accounted = accountingEnabled_ ? 1 : 0;
+        header->size = size;
+
+        if (header->accounted) {
+            scopeBytes_[header->scope] += size;
+            ++scopeAllocationCounts_[header->scope];
+
+            const uint64_t bytes = (bytes_ += size);
+            uint64_t peakBytes = peakBytes_;
+            while (bytes > peakBytes && !peakBytes_.compare_exchange_weak(peakBytes, bytes)) {}
+        }
+
+        return memory;
+    }
+
+    void* HostAllocator::Reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+        if (original == nullptr) {
+            return Allocate(size, alignment, scope);
+        }
+
+        if (size == 0) {
+            Free(original);
+            return nullptr;
+        }
+
+        // On failure the original must be left untouched
+        void* memory = Allocate(size, alignment, scope);
+        if (memory == nullptr) {
+            return nullptr;
+        }
+
+        auto header = reinterpret_cast<const AllocationHeader*>(reinterpret_cast<uint8_t*>(original) - sizeof(AllocationHeader));
+        memcpy(memory, original, std::min<size_t>(header->size, size));
+
+        Free(original);
+
+        return memory;
+    }
+
+    void HostAllocator::Free(void* memory) {
+        if (memory == nullptr) {
+            return;
+        }
+
+        auto header = reinterpret_cast<AllocationHeader*>(reinterpret_cast<uint8_t*>(memory) - sizeof(AllocationHeader));
+        uint8_t* raw = reinterpret_cast<uint8_t*>(memory) - header->offset;
+
+        if (header->accounted) {
+            scopeBytes_[header->scope] -= header->size;
+            --scopeAllocationCounts_[header->scope];
+            bytes_ -= header->size;
+        }
+
+        const uint16_t sizeClass = header->sizeClass;
+        if (sizeClass == kLargeAllocation) {
+            FreeToParent(raw);
+            return;
+        }
+
+        auto entry = reinterpret_cast<FreeEntry*>(raw);
+        entry->next = threadCache.entries[sizeClass];
+        threadCache.entries[sizeClass] = entry;
+        ++threadCache.counts[sizeClass];
+
+        // Threads that only free (e.g. a driver's worker thread) would otherwise pile up entries
+        if (threadCache.counts[sizeClass] > kMaxCachedEntries) {
+            const uint32_t count = kMaxCachedEntries / 2;
+
+            FreeEntry* first = threadCache.entries[sizeClass];
+            FreeEntry* last = first;
+            for (uint32_t i = 1; i < count; ++i) {
+                last = last->next;
+            }
+
+            threadCache.entries[sizeClass] = last->next;
+            threadCache.counts[sizeClass] -= count;
+
+            last->next = nullptr;
+            PushEntries(sizeClass, first, last);
+        }
+    }
+
+    void HostAllocator::NotifyInternalAllocation(size_t size) {
+        internalBytes_ += size;
+    }
+
+    void HostAllocator::NotifyInternalFree(size_t size) {
+        internalBytes_ -= size;
+    }
+
+    void HostAllocator::PushEntries(uint32_t sizeClass, FreeEntry* first, FreeEntry* last) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        last->next = freeLists_[sizeClass];
+        freeLists_[sizeClass] = first;
+    }
+
+    HostAllocator::FreeEntry* HostAllocator::PopEntries(uint32_t sizeClass, uint32_t maxCount, uint32_t& outCount) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        outCount = 0;
+
+        if (freeLists_[sizeClass] == nullptr && !AllocateSlab(sizeClass)) {
+            return nullptr;
+        }
+
+        FreeEntry* first = freeLists_[sizeClass];
+        FreeEntry* last = first;
+        outCount = 1;
+        while (outCount < maxCount && last->next != nullptr) {
+            last = last->next;
+            ++outCount;
+        }
+
+        freeLists_[sizeClass] = last->next;
+        last->next = nullptr;
+
+        return first;
+    }
+
+    void* HostAllocator::AllocateFromParent(size_t size, size_t alignment) {
+        if (hasParent_) {
+            return parent_.pfnAllocation(parent_.pUserData, size, alignment, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+        }
+
+#ifdef _WIN32
+        return _aligned_malloc(size, alignment);
+#else
+        void* memory = nullptr;
+        return posix_memalign(&memory, alignment, size) == 0 ? memory : nullptr;
+#endif
+    }
+
+    void HostAllocator::FreeToParent(void* memory) {
+        if (hasParent_) {
+            parent_.pfnFree(parent_.pUserData, memory);
+            return;
+        }
+
+#ifdef _WIN32
+        _aligned_free(memory);
+#else
+        free(memory);
+#endif
+    }
+
+    bool HostAllocator::AllocateSlab(uint32_t sizeClass) {
+        const size_t classSize = GetClassSize(sizeClass);
+
+        // Class sized alignment keeps entries aligned to their size, up to the largest class
+        auto slab = reinterpret_cast<uint8_t*>(AllocateFromParent(kSlabSize, GetClassSize(kSizeClassCount - 1)));
+        if (slab == nullptr) {
+            return false;
+        }
+
+        const size_t entryCount = kSlabSize / classSize;
+        for (size_t i = 0; i < entryCount; ++i) {
+            auto entry = reinterpret_cast<FreeEntry*>(slab + i * classSize);
+            entry->next = freeLists_[sizeClass];
+            freeLists_[sizeClass] = entry;
+        }
+
+        slabs_.push_back(slab);
+        slabBytes_ += kSlabSize;
+
+        return true;
+    }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "../../vulkan.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    // One bucket per VkSystemAllocationScope
+    static const uint32_t kHostAllocationScopeCount = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+
+    /// <summary>
+    /// Snapshot of host memory handed to the driver through the plugin's allocation callbacks
+    /// </summary>
+    struct HostAllocatorStatistics
+    {
+        HostAllocatorStatistics()
+            : scopeBytes()
+            , scopeAllocationCounts()
+            , bytes(0)
+            , peakBytes(0)
+            , allocationCount(0)
+            , internalBytes(0)
+            , slabBytes(0)
+        {}
+
+        // Only counted while accounting is enabled
+        uint64_t    scopeBytes[kHostAllocationScopeCount];
+        uint32_t    scopeAllocationCounts[kHostAllocationScopeCount];
+        uint64_t    bytes;
+        uint64_t    peakBytes;
+        uint32_t    allocationCount;
+
+        // Memory the driver allocated itself and reported through the internal notifications
+        uint64_t    internalBytes;
+
+        // Memory reserved for the size classes, used or not
+        uint64_t    slabBytes;
+    };
+
+    /// <summary>
+    /// Host memory for every Vulkan object the plugin creates.  Small allocations come from size classed free lists
+    /// with a per thread cache in front of them, so creating and destroying lots of objects doesn't go through malloc.
+    /// Larger allocations go straight to the parent allocator (Unity's if it gave us one).
+    /// </summary>
+    class HostAllocator
+    {
+    public:
+        // Smallest size class, every following class doubles
+        static const size_t     kMinSizeClass = 64;
+        static const uint32_t   kSizeClassCount = 7;    // 64 bytes to 4KB
+
+        // Size classes are carved out of slabs of this size
+        static const size_t     kSlabSize = 64 * 1024;
+
+        static HostAllocator& Instance()
+        {
+            static HostAllocator instance;
+            return instance;
+        }
+
+        HostAllocator(HostAllocator const&) = delete;       // Deleted for singleton
+        void operator=(HostAllocator const&) = delete;      // Deleted for singleton
+
+        /// <summary>
+        /// Allocator large allocations and slabs are taken from.  Must be set before the first allocation
+        /// </summary>
+        /// <param name="parent">nullptr to use the C runtime</param>
+        void SetParent(const VkAllocationCallbacks* parent);
+
+        /// <summary>
+        /// Turn per scope accounting on or off.  Allocations are only counted if accounting was on when they were made
+        /// </summary>
+        /// <param name="enabled"></param>
+        void SetAccountingEnabled(bool enabled);
+
+        /// <summary>
+        /// Callbacks to pass to every vkCreate*, vkDestroy*, vkAllocate* and vkFree* call
+        /// </summary>
+        /// <returns></returns>
+        const VkAllocationCallbacks* GetCallbacks() const;
+
+        /// <summary>
+        /// Fill out current usage
+        /// </summary>
+        /// <param name="outStatistics"></param>
+        void GetStatistics(HostAllocatorStatistics& outStatistics) const;
+
+        void* Allocate(size_t size, size_t alignment, VkSystemAllocationScope scope);
+        void* Reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+        void Free(void* memory);
+        void NotifyInternalAllocation(size_t size);
+        void NotifyInternalFree(size_t size);
+
+        // Per thread free lists return their entries here when they overflow or the thread exits
+        struct FreeEntry
+        {
+            FreeEntry* next;
+        };
+
+        void PushEntries(uint32_t sizeClass, FreeEntry* first, FreeEntry* last);
+        FreeEntry* PopEntries(uint32_t sizeClass, uint32_t maxCount, uint32_t& outCount);
+
+    private:
+        HostAllocator();    // Private for singleton
+
+        void* AllocateFromParent(size_t size, size_t alignment);
+        void FreeToParent(void* memory);
+        bool AllocateSlab(uint32_t sizeClass);
+
+        VkAllocationCallbacks   callbacks_;
+        VkAllocationCallbacks   parent_;
+        bool                    hasParent_;
+
+        std::atomic<bool>       accountingEnabled_;
+
+        std::atomic<uint64_t>   scopeBytes_[kHostAllocationScopeCount];
+        std::atomic<uint32_t>   scopeAllocationCounts_[kHostAllocationScopeCount];
+        std::atomic<uint64_t>   bytes_;
+        std::atomic<uint64_t>   peakBytes_;
+        std::atomic<uint64_t>   internalBytes_;
+        std::atomic<uint64_t>   slabBytes_;
+
+        // Guards the shared free lists and slabs, threads only get here when their own cache runs dry or overflows
+        std::mutex              mutex_;
+        FreeEntry*              freeLists_[kSizeClassCount];
+
+        // Slabs are kept for the life of the process since any thread's cache may still point into them
+        std::vector<void*>      slabs_;
+    };
+}
@@ -1,6 +1,7 @@
 #include "Image.h"
 
 #include "Buffer.h"
+#include "HostAllocator.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 // excluding old and unuseful formats
@@ -18,7 +19,7 @@ namespace PixelsForGlory::Vulkan
         , physicalDeviceMemoryProperties_(VkPhysicalDeviceMemoryProperties())
         , format_(VK_FORMAT_B8G8R8A8_UNORM)
         , image_(VK_NULL_HANDLE)
-        , memory_(VK_NULL_HANDLE)
+        , allocation_(MemoryAllocation())
         , imageView_(VK_NULL_HANDLE)
         , sampler_(VK_NULL_HANDLE)
     {}
@@ -28,7 +29,7 @@ namespace PixelsForGlory::Vulkan
         , physicalDeviceMemoryProperties_(physicalDeviceMemoryProperties)
         , format_(VK_FORMAT_B8G8R8A8_UNORM)
         , image_(VK_NULL_HANDLE)
-        , memory_(VK_NULL_HANDLE)
+        , allocation_(MemoryAllocation())
         , imageView_(VK_NULL_HANDLE)
         , sampler_(VK_NULL_HANDLE)
     {}
@@ -43,7 +44,8 @@ namespace PixelsForGlory::Vulkan
         VkExtent3D extent,
         VkImageTiling tiling,
         VkImageUsageFlags usage,
-        VkMemoryPropertyFlags memoryProperties) {
+        VkMemoryPropertyFlags memoryProperties,
+        MemoryCategory category) {
         VkResult result = VK_SUCCESS;
 
         assert(image_ == VK_NULL_HANDLE);
@@ -63,30 +65,26 @@ namespace PixelsForGlory::Vulkan
         imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
         imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
-        result = vkCreateImage(device_, &imageCreateInfo, nullptr, &image_);
+        result = vkCreateImage(device_, &imageCreateInfo, HostAllocator::Instance().GetCallbacks(), &image_);
 
         if (VK_SUCCESS == result) {
             VkMemoryRequirements memoryRequirements = {};
             vkGetImageMemoryRequirements(device_, image_, &memoryRequirements);
 
-            VkMemoryAllocateInfo memoryAllocateInfo = {};
-            memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-            memoryAllocateInfo.allocationSize = memoryRequirements.size;
-            memoryAllocateInfo.memoryTypeIndex = GetMemoryType(physicalDeviceMemoryProperties_, memoryRequirements, memoryProperties);
+            const uint32_t memoryTypeIndex = GetMemoryType(physicalDeviceMemoryProperties_, memoryRequirements, memoryProperties);
 
-            result = vkAllocateMemory(device_, &memoryAllocateInfo, nullptr, &memory_);
+            // Optimal images get their own blocks so they never share a page with buffers
+            result = MemoryAllocator::Instance().Allocate(memoryRequirements, memoryTypeIndex, tiling == VK_IMAGE_TILING_LINEAR, category, allocation_);
             if (VK_SUCCESS != result) {
-                vkDestroyImage(device_, image_, nullptr);
+                vkDestroyImage(device_, image_, HostAllocator::Instance().GetCallbacks());
                 image_ = VK_NULL_HANDLE;
-                memory_ = VK_NULL_HANDLE;
             }
             else {
-                result = vkBindImageMemory(device_, image_, memory_, 0);
+                result = vkBindImageMemory(device_, image_, allocation_.memory, allocation_.offset);
                 if (VK_SUCCESS != result) {
-                    vkDestroyImage(device_, image_, nullptr);
-                    vkFreeMemory(device_, memory_, nullptr);
+                    vkDestroyImage(device_, image_, HostAllocator::Instance().GetCallbacks());
+                    MemoryAllocator::Instance().Free(allocation_);
                     image_ = VK_NULL_HANDLE;
-                    memory_ = VK_NULL_HANDLE;
                 }
             }
         }
@@ -96,19 +94,18 @@ namespace PixelsForGlory::Vulkan
 
     void Image::Destroy() {
         if (sampler_) {
-            vkDestroySampler(device_, sampler_, nullptr);
+            vkDestroySampler(device_, sampler_, HostAllocator::Instance().GetCallbacks());
             sampler_ = VK_NULL_HANDLE;
         }
         if (imageView_) {
-            vkDestroyImageView(device_, imageView_, nullptr);
+            vkDestroyImageView(device_, imageView_, HostAllocator::Instance().GetCallbacks());
             imageView_ = VK_NULL_HANDLE;
         }
-        if (memory_) {
-            vkFreeMemory(device_, memory_, nullptr);
-            memory_ = VK_NULL_HANDLE;
+        if (allocation_.memory) {
+            MemoryAllocator::Instance().Free(allocation_);
         }
         if (image_) {
-            vkDestroyImage(device_, image_, nullptr);
+            vkDestroyImage(device_, image_, HostAllocator::Instance().GetCallbacks());
             image_ = VK_NULL_HANDLE;
         }
     }
@@ -134,7 +131,7 @@ namespace PixelsForGlory::Vulkan
             VkDeviceSize imageSize = static_cast<VkDeviceSize>(static_cast<uint64_t>(width) * static_cast<uint64_t>(height) * static_cast<uint64_t>(bpp));
 
             Vulkan::Buffer stagingBuffer;
-            VkResult error = stagingBuffer.Create(device_, physicalDeviceMemoryProperties_, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, Vulkan::Buffer::kDefaultMemoryPropertyFlags);
+            VkResult error = stagingBuffer.Create(device_, physicalDeviceMemoryProperties_, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, Vulkan::Buffer::kDefaultMemoryPropertyFlags, MemoryCategory::Staging);
             if (VK_SUCCESS == error && stagingBuffer.UploadData(imageData, imageSize)) {
                 stbi_image_free(imageData);
 
@@ -228,7 +225,7 @@ namespace PixelsForGlory::Vulkan
         imageViewCreateInfo.flags = 0;
         imageViewCreateInfo.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A };
 
-        return vkCreateImageView(device_, &imageViewCreateInfo, nullptr, &imageView_);
+        return vkCreateImageView(device_, &imageViewCreateInfo, HostAllocator::Instance().GetCallbacks(), &imageView_);
     }
 
     VkResult Image::CreateSampler(VkFilter magFilter, VkFilter minFilter, VkSamplerMipmapMode mipmapMode, VkSamplerAddressMode addressMode) {
@@ -252,7 +249,7 @@ namespace PixelsForGlory::Vulkan
         samplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
         samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
 
-        return vkCreateSampler(device_, &samplerCreateInfo, nullptr, &sampler_);
+        return vkCreateSampler(device_, &samplerCreateInfo, HostAllocator::Instance().GetCallbacks(), &sampler_);
     }
 
     // getters
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../../vulkan.h"
+#include "MemoryAllocator.h"
 
 namespace PixelsForGlory::Vulkan
 {
@@ -43,13 +44,15 @@ namespace PixelsForGlory::Vulkan
         /// <param name="tiling"></param>
         /// <param name="usage"></param>
         /// <param name="memoryProperties"></param>
+        /// <param name="category">Bucket the image's memory is reported under</param>
         /// <returns></returns>
         VkResult Create(VkImageType imageType,
             VkFormat format,
             VkExtent3D extent,
             VkImageTiling tiling,
             VkImageUsageFlags usage,
-            VkMemoryPropertyFlags memoryProperties);
+            VkMemoryPropertyFlags memoryProperties,
+            MemoryCategory category = MemoryCategory::Other);
 
         /// <summary>
         /// Destroy image
@@ -96,7 +99,7 @@ namespace PixelsForGlory::Vulkan
         VkPhysicalDeviceMemoryProperties    physicalDeviceMemoryProperties_;
         VkFormat                            format_;
         VkImage                             image_;
-        VkDeviceMemory                      memory_;
+        MemoryAllocation                    allocation_;
         VkImageView                         imageView_;
         VkSampler                           sampler_;
     };
@@ -0,0 +1,42 @@
+#include "InstanceGenerator.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    bool InstanceGenerator::Load(const std::string& shaderFolder) {
+        return ComputePass::Load(shaderFolder, "instances_comp.bin", sizeof(PushConstants));
+    }
+
+    void InstanceGenerator::Record(VkCommandBuffer commandBuffer, VkDeviceAddress transforms, VkDeviceAddress descriptions, VkDeviceAddress records, uint32_t count) const {
+        if (count == 0) {
+            return;
+        }
+
+        // Descriptions and grown records are copied in before, and earlier builds may still read the records
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+        PushConstants pushConstants = {};
+        pushConstants.transforms = transforms;
+        pushConstants.descriptions = descriptions;
+        pushConstants.records = records;
+        pushConstants.count = count;
+
+        Dispatch(commandBuffer, &pushConstants, sizeof(PushConstants), count);
+
+        // Make the records visible to the tlas build
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+
+#include "../../vulkan.h"
+#include "ComputePass.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    /// <summary>
+    /// Compute pass that writes VkAccelerationStructureInstanceKHR records on the GPU.  The host uploads a stream of
+    /// ShaderInstanceTransform, and each entry's record is assembled from its transform and the ShaderInstanceDescription
+    /// of its slot, so the host never touches the records themselves.  Buffers are passed by device address.
+    /// </summary>
+    class InstanceGenerator : public ComputePass
+    {
+    public:
+        /// <summary>
+        /// Create the pipeline from instances_comp.bin in the shader folder
+        /// </summary>
+        /// <param name="shaderFolder"></param>
+        /// <returns>false if the shader couldn't be loaded</returns>
+        bool Load(const std::string& shaderFolder);
+
+        /// <summary>
+        /// Record the dispatch writing one record per transform.  Writes of the transforms and descriptions must be
+        /// visible to compute shaders, and the records written are made visible to acceleration structure builds.
+        /// </summary>
+        /// <param name="commandBuffer"></param>
+        /// <param name="transforms">ShaderInstanceTransform per record to write</param>
+        /// <param name="descriptions">ShaderInstanceDescription per slot</param>
+        /// <param name="records">VkAccelerationStructureInstanceKHR per slot</param>
+        /// <param name="count">Number of transforms</param>
+        void Record(VkCommandBuffer commandBuffer, VkDeviceAddress transforms, VkDeviceAddress descriptions, VkDeviceAddress records, uint32_t count) const;
+
+    private:
+        // Matches Params in instances_comp.glsl
+        struct PushConstants
+        {
+            VkDeviceAddress transforms;
+            VkDeviceAddress descriptions;
+            VkDeviceAddress records;
+            uint32_t        count;
+        };
+    };
+}
@@ -0,0 +1,290 @@
+#include "MemoryAllocator.h"
+
+#include <algorithm>
+#include <assert.h>
+
+#include "../Debug.h"
+#include "HostAllocator.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    MemoryAllocator::MemoryAllocator()
+        : device_(VK_NULL_HANDLE)
+        , physicalDeviceMemoryProperties_(VkPhysicalDeviceMemoryProperties())
+        , nonCoherentAtomSize_(1)
+        , categoryBytes_()
+        , categoryAllocationCounts_()
+    {}
+
+    void MemoryAllocator::Initialize(VkDevice device, VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties, VkDeviceSize nonCoherentAtomSize) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        device_ = device;
+        physicalDeviceMemoryProperties_ = physicalDeviceMemoryProperties;
+        nonCoherentAtomSize_ = std::max<VkDeviceSize>(nonCoherentAtomSize, 1);
+    }
+
+    void MemoryAllocator::Destroy() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        for (uint32_t memoryTypeIndex = 0; memoryTypeIndex < VK_MAX_MEMORY_TYPES; ++memoryTypeIndex) {
+            auto& blocks = blocks_[memoryTypeIndex];
+            for (auto& block : blocks) {
+                if (!block->ranges.IsEmpty()) {
+                    PFG_EDITORLOGERROR("Releasing memory block that still has " + std::to_string(block->ranges.GetUsed()) + " bytes allocated");
+                }
+
+                if (block->mapped != nullptr) {
+                    vkUnmapMemory(device_, block->memory);
+                }
+                vkFreeMemory(device_, block->memory, HostAllocator::Instance().GetCallbacks());
+            }
+            blocks.clear();
+        }
+
+        device_ = VK_NULL_HANDLE;
+    }
+
+    VkResult MemoryAllocator::Allocate(const VkMemoryRequirements& memoryRequirements, uint32_t memoryTypeIndex, bool linear, MemoryCategory category, MemoryAllocation& outAllocation) {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        assert(device_ != VK_NULL_HANDLE);
+
+        const VkDeviceSize blockSize = GetBlockSize(memoryTypeIndex);
+
+        // Non-coherent allocations cover whole atoms so flushing one never touches a neighbour
+        VkMemoryRequirements requirements = memoryRequirements;
+        const VkMemoryPropertyFlags propertyFlags = physicalDeviceMemoryProperties_.memoryTypes[memoryTypeIndex].propertyFlags;
+        if ((propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+            requirements.alignment = std::max(requirements.alignment, nonCoherentAtomSize_);
+            requirements.size = (requirements.size + nonCoherentAtomSize_ - 1) / nonCoherentAtomSize_ * nonCoherentAtomSize_;
+        }
+
+        MemoryBlock* block = nullptr;
+        VkDeviceSize offset = RangeAllocator::kInvalidOffset;
+
+        // Anything larger than half a block gets its own allocation so large resources don't waste a block
+        const bool dedicated = requirements.size > blockSize / 2;
+        if (!dedicated) {
+            for (auto& candidate : blocks_[memoryTypeIndex]) {
+                if (candidate->dedicated || candidate->linear != linear) {
+                    continue;
+                }
+
+                if (candidate->ranges.GetLargestFreeRange() < requirements.size) {
+                    continue;
+                }
+
+                offset = candidate->ranges.Allocate(requirements.size, requirements.alignment);
+                if (offset != RangeAllocator::kInvalidOffset) {
+                    block = candidate.get();
+                    break;
+                }
+            }
+        }
+
+        if (block == nullptr) {
+            VkResult result = AllocateBlock(dedicated ? requirements.size : blockSize, memoryTypeIndex, linear, dedicated, block);
+            if (result != VK_SUCCESS) {
+                return result;
+            }
+
+            offset = block->ranges.Allocate(requirements.size, requirements.alignment);
+            assert(offset != RangeAllocator::kInvalidOffset);
+        }
+
+        outAllocation.memory = block->memory;
+        outAllocation.offset = offset;
+        outAllocation.size = requirements.size;
+        outAllocation.block = block;
+        outAllocation.category = category;
+
+        categoryBytes_[static_cast<uint32_t>(category)] += requirements.size;
+        ++categoryAllocationCounts_[static_cast<uint32_t>(category)];
+
+        return VK_SUCCESS;
+    }
+
+    void MemoryAllocator::Free(MemoryAllocation& allocation) {
+        if (allocation.block == nullptr) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        MemoryBlock* block = allocation.block;
+        block->ranges.Free(allocation.offset, allocation.size);
+
+        categoryBytes_[static_cast<uint32_t>(allocation.category)] -= allocation.size;
+        --categoryAllocationCounts_[static_cast<uint32_t>(allocation.category)];
+
+        if (block->ranges.IsEmpty()) {
+            // Keep one empty shared block around per memory type so a free/allocate pair doesn't hit the driver
+            bool keep = false;
+            if (!block->dedicated) {
+                keep = true;
+                for (auto& other : blocks_[block->memoryTypeIndex]) {
+                    if (other.get() != block && !other->dedicated && other->linear == block->linear && other->ranges.IsEmpty()) {
+                        keep = false;
+                        break;
+                    }
+                }
+            }
+
+            if (!keep) {
+                FreeBlock(block);
+            }
+        }
+
+        allocation = MemoryAllocation();
+    }
+
+    void* MemoryAllocator::GetMappedData(const MemoryAllocation& allocation) const {
+        if (allocation.block == nullptr || allocation.block->mapped == nullptr) {
+            return nullptr;
+        }
+
+        return static_cast<uint8_t*>(allocation.block->mapped) + allocation.offset;
+    }
+
+    void MemoryAllocator::Flush(const MemoryAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const {
+        if (allocation.block == nullptr || allocation.block->coherent) {
+            return;
+        }
+
+        VkMappedMemoryRange range = GetMappedMemoryRange(allocation, offset, size);
+        VK_CHECK("vkFlushMappedMemoryRanges", vkFlushMappedMemoryRanges(device_, 1, &range));
+    }
+
+    void MemoryAllocator::Invalidate(const MemoryAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const {
+        if (allocation.block == nullptr || allocation.block->coherent) {
+            return;
+        }
+
+        VkMappedMemoryRange range = GetMappedMemoryRange(allocation, offset, size);
+        VK_CHECK("vkInvalidateMappedMemoryRanges", vkInvalidateMappedMemoryRanges(device_, 1, &range));
+    }
+
+    void MemoryAllocator::GetStatistics(MemoryAllocatorStatistics& outStatistics) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        outStatistics = MemoryAllocatorStatistics();
+
+        for (uint32_t category = 0; category < static_cast<uint32_t>(MemoryCategory::Count); ++category) {
+            outStatistics.categoryBytes[category] = categoryBytes_[category];
+            outStatistics.categoryAllocationCounts[category] = categoryAllocationCounts_[category];
+            outStatistics.allocationCount += categoryAllocationCounts_[category];
+        }
+
+        for (uint32_t memoryTypeIndex = 0; memoryTypeIndex < VK_MAX_MEMORY_TYPES; ++memoryTypeIndex) {
+            const uint32_t heapIndex = physicalDeviceMemoryProperties_.memoryTypes[memoryTypeIndex].heapIndex;
+            for (auto& block : blocks_[memoryTypeIndex]) {
+                outStatistics.heapBlockBytes[heapIndex] += block->size;
+                outStatistics.heapAllocatedBytes[heapIndex] += block->ranges.GetUsed();
+                outStatistics.blockBytes += block->size;
+                outStatistics.allocatedBytes += block->ranges.GetUsed();
+                ++outStatistics.blockCount;
+            }
+        }
+    }
+
+    uint32_t MemoryAllocator::GetBlockCount() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        uint32_t count = 0;
+        for (uint32_t memoryTypeIndex = 0; memoryTypeIndex < VK_MAX_MEMORY_TYPES; ++memoryTypeIndex) {
+            count += static_cast<uint32_t>(blocks_[memoryTypeIndex].size());
+        }
+        return count;
+    }
+
+    VkResult MemoryAllocator::AllocateBlock(VkDeviceSize size, uint32_t memoryTypeIndex, bool linear, bool dedicated, MemoryBlock*& outBlock) {
+        VkMemoryAllocateInfo memoryAllocateInfo;
+        memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        memoryAllocateInfo.pNext = nullptr;
+        memoryAllocateInfo.allocationSize = size;
+        memoryAllocateInfo.memoryTypeIndex = memoryTypeIndex;
+
+        // Any buffer in a linear block may ask for its device address
+        VkMemoryAllocateFlagsInfo allocationFlags = {};
+        allocationFlags.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+        allocationFlags.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+        if (linear) {
+            memoryAllocateInfo.pNext = &allocationFlags;
+        }
+
+        const VkMemoryPropertyFlags propertyFlags = physicalDeviceMemoryProperties_.memoryTypes[memoryTypeIndex].propertyFlags;
+
+        auto block = std::make_unique<MemoryBlock>();
+        block->size = size;
+        block->memoryTypeIndex = memoryTypeIndex;
+        block->linear = linear;
+        block->dedicated = dedicated;
+        block->coherent = (propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        block->ranges.Initialize(size);
+
+        VkResult result = vkAllocateMemory(device_, &memoryAllocateInfo, HostAllocator::Instance().GetCallbacks(), &block->memory);
+        VK_CHECK("vkAllocateMemory", result);
+        if (result != VK_SUCCESS) {
+            outBlock = nullptr;
+            return result;
+        }
+
+        // Map once up front, every allocation in the block reuses the same pointer
+        if (propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+            result = vkMapMemory(device_, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped);
+            VK_CHECK("vkMapMemory", result);
+            if (result != VK_SUCCESS) {
+                vkFreeMemory(device_, block->memory, HostAllocator::Instance().GetCallbacks());
+                outBlock = nullptr;
+                return result;
+            }
+        }
+
+        outBlock = block.get();
+        blocks_[memoryTypeIndex].push_back(std::move(block));
+
+        return VK_SUCCESS;
+    }
+
+    void MemoryAllocator::FreeBlock(MemoryBlock* block) {
+        auto& blocks = blocks_[block->memoryTypeIndex];
+        auto itr = std::find_if(blocks.begin(), blocks.end(), [block](const std::unique_ptr<MemoryBlock>& b) { return b.get() == block; });
+        if (itr == blocks.end()) {
+            return;
+        }
+
+        if (block->mapped != nullptr) {
+            vkUnmapMemory(device_, block->memory);
+        }
+        vkFreeMemory(device_, block->memory, HostAllocator::Instance().GetCallbacks());
+
+        blocks.erase(itr);
+    }
+
+    VkDeviceSize MemoryAllocator::GetBlockSize(uint32_t memoryTypeIndex) const {
+        // Don't let a single block take a large part of small heaps (e.g. the 256MB BAR heap)
+        const uint32_t heapIndex = physicalDeviceMemoryProperties_.memoryTypes[memoryTypeIndex].heapIndex;
+        const VkDeviceSize heapSize = physicalDeviceMemoryProperties_.memoryHeaps[heapIndex].size;
+        const VkDeviceSize defaultBlockSize = kDefaultBlockSize;
+        return std::min(defaultBlockSize, std::max<VkDeviceSize>(heapSize / 8, 1024 * 1024));
+    }
+
+    VkMappedMemoryRange MemoryAllocator::GetMappedMemoryRange(const MemoryAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const {
+        if (size == VK_WHOLE_SIZE || offset + size > allocation.size) {
+            size = allocation.size - offset;
+        }
+
+        // Non-coherent allocations start and end on an atom, so rounding out stays inside the allocation
+        const VkDeviceSize begin = (allocation.offset + offset) / nonCoherentAtomSize_ * nonCoherentAtomSize_;
+        const VkDeviceSize end = (allocation.offset + offset + size + nonCoherentAtomSize_ - 1) / nonCoherentAtomSize_ * nonCoherentAtomSize_;
+
+        VkMappedMemoryRange range = {};
+        range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.memory = allocation.memory;
+        range.offset = begin;
+        range.size = std::min(end, allocation.block->size) - begin;
+
+        return range;
+    }
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../../vulkan.h"
+#include "../RangeAllocator.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    /// <summary>
+    /// What an allocation is used for, only used for accounting
+    /// </summary>
+    enum class MemoryCategory : uint32_t
+    {
+        Other = 0,
+        MeshGeometry,
+        BottomLevelAccelerationStructure,
+        TopLevelAccelerationStructure,
+        RenderTarget,
+        ShaderBindingTable,
+        Scratch,
+        Upload,
+        Staging,
+
+        Count
+    };
+
+    /// <summary>
+    /// Single vkAllocateMemory that is carved up into ranges
+    /// </summary>
+    struct MemoryBlock
+    {
+        MemoryBlock()
+            : memory(VK_NULL_HANDLE)
+            , size(0)
+            , memoryTypeIndex(0)
+            , linear(true)
+            , dedicated(false)
+            , coherent(true)
+            , mapped(nullptr)
+        {}
+
+        VkDeviceMemory  memory;
+        VkDeviceSize    size;
+        uint32_t        memoryTypeIndex;
+
+        // Buffers and linear images live in different blocks than optimal images so bufferImageGranularity never matters
+        bool            linear;
+
+        // Block was allocated for a single resource that was too large to share a block
+        bool            dedicated;
+
+        // Host writes are visible to the device without a flush
+        bool            coherent;
+
+        RangeAllocator  ranges;
+
+        // Host visible blocks stay mapped for their whole lifetime
+        void*           mapped;
+    };
+
+    /// <summary>
+    /// Range of device memory handed out by the MemoryAllocator
+    /// </summary>
+    struct MemoryAllocation
+    {
+        MemoryAllocation()
+            : memory(VK_NULL_HANDLE)
+            , offset(0)
+            , size(0)
+            , block(nullptr)
+            , category(MemoryCategory::Other)
+        {}
+
+        VkDeviceMemory  memory;
+        VkDeviceSize    offset;
+        VkDeviceSize    size;
+        MemoryBlock*    block;
+        MemoryCategory  category;
+    };
+
+    /// <summary>
+    /// Snapshot of what the allocator holds
+    /// </summary>
+    struct MemoryAllocatorStatistics
+    {
+        MemoryAllocatorStatistics()
+            : categoryBytes()
+            , categoryAllocationCounts()
+            , heapBlockBytes()
+            , heapAllocatedBytes()
+            , blockBytes(0)
+            , allocatedBytes(0)
+            , blockCount(0)
+            , allocationCount(0)
+        {}
+
+        VkDeviceSize    categoryBytes[static_cast<uint32_t>(MemoryCategory::Count)];
+        uint32_t        categoryAllocationCounts[static_cast<uint32_t>(MemoryCategory::Count)];
+
+        // Bytes requested from the driver and bytes handed out of them, per heap
+        VkDeviceSize    heapBlockBytes[VK_MAX_MEMORY_HEAPS];
+        VkDeviceSize    heapAllocatedBytes[VK_MAX_MEMORY_HEAPS];
+
+        VkDeviceSize    blockBytes;
+        VkDeviceSize    allocatedBytes;
+        uint32_t        blockCount;
+        uint32_t        allocationCount;
+    };
+
+    /// <summary>
+    /// Sub-allocates device memory for Buffer and Image from large per memory type blocks
+    /// </summary>
+    class MemoryAllocator
+    {
+    public:
+        static const VkDeviceSize kDefaultBlockSize = 64ull * 1024ull * 1024ull;
+
+        static MemoryAllocator& Instance()
+        {
+            static MemoryAllocator instance;
+            return instance;
+        }
+
+        MemoryAllocator(MemoryAllocator const&) = delete;       // Deleted for singleton
+        void operator=(MemoryAllocator const&) = delete;        // Deleted for singleton
+
+        /// <summary>
+        /// Setup allocator for a device
+        /// </summary>
+        /// <param name="device"></param>
+        /// <param name="physicalDeviceMemoryProperties"></param>
+        /// <param name="nonCoherentAtomSize"></param>
+        void Initialize(VkDevice device, VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties, VkDeviceSize nonCoherentAtomSize);
+
+        /// <summary>
+        /// Release all blocks.  Every allocation must have been freed before calling
+        /// </summary>
+        void Destroy();
+
+        /// <summary>
+        /// Allocate a range of memory
+        /// </summary>
+        /// <param name="memoryRequirements"></param>
+        /// <param name="memoryTypeIndex"></param>
+        /// <param name="linear">true for buffers and linear images, false for optimal images</param>
+        /// <param name="category">Bucket the allocation is counted in</param>
+        /// <param name="outAllocation"></param>
+        /// <returns></returns>
+        VkResult Allocate(const VkMemoryRequirements& memoryRequirements, uint32_t memoryTypeIndex, bool linear, MemoryCategory category, MemoryAllocation& outAllocation);
+
+        /// <summary>
+        /// Free a range of memory and release its block if it was the last allocation in it
+        /// </summary>
+        /// <param name="allocation"></param>
+        void Free(MemoryAllocation& allocation);
+
+        /// <summary>
+        /// Get a pointer to the allocation's memory.  Host visible blocks are mapped once when they are created
+        /// </summary>
+        /// <param name="allocation"></param>
+        /// <returns>nullptr if the allocation isn't host visible</returns>
+        void* GetMappedData(const MemoryAllocation& allocation) const;
+
+        /// <summary>
+        /// Make host writes to a range of the allocation visible to the device.  Does nothing for coherent memory
+        /// </summary>
+        /// <param name="allocation"></param>
+        /// <param name="offset"></param>
+        /// <param name="size"></param>
+        void Flush(const MemoryAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const;
+
+        /// <summary>
+        /// Make device writes to a range of the allocation visible to the host.  Does nothing for coherent memory
+        /// </summary>
+        /// <param name="allocation"></param>
+        /// <param name="offset"></param>
+        /// <param name="size"></param>
+        void Invalidate(const MemoryAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const;
+
+        /// <summary>
+        /// Fill out current usage per category and per heap
+        /// </summary>
+        /// <param name="outStatistics"></param>
+        void GetStatistics(MemoryAllocatorStatistics& outStatistics) const;
+
+        // getters
+        uint32_t GetBlockCount() const;
+
+    private:
+        MemoryAllocator();    // Private for singleton
+
+        VkResult AllocateBlock(VkDeviceSize size, uint32_t memoryTypeIndex, bool linear, bool dedicated, MemoryBlock*& outBlock);
+        void FreeBlock(MemoryBlock* block);
+        VkDeviceSize GetBlockSize(uint32_t memoryTypeIndex) const;
+        VkMappedMemoryRange GetMappedMemoryRange(const MemoryAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) const;
+
+        VkDevice                            device_;
+        VkPhysicalDeviceMemoryProperties    physicalDeviceMemoryProperties_;
+        VkDeviceSize                        nonCoherentAtomSize_;
+
+        std::vector<std::unique_ptr<MemoryBlock>> blocks_[VK_MAX_MEMORY_TYPES];
+
+        VkDeviceSize    categoryBytes_[static_cast<uint32_t>(MemoryCategory::Count)];
+        uint32_t        categoryAllocationCounts_[static_cast<uint32_t>(MemoryCategory::Count)];
+
+        mutable std::mutex mutex_;
+    };
+}
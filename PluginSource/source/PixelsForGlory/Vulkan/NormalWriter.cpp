@@ -0,0 +1,41 @@
+#include "NormalWriter.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    bool NormalWriter::Load(const std::string& shaderFolder) {
+        return ComputePass::Load(shaderFolder, "normals_comp.bin", sizeof(PushConstants));
+    }
+
+    void NormalWriter::Record(VkCommandBuffer commandBuffer, VkDeviceAddress normals, VkDeviceAddress attributes, uint32_t count) const {
+        if (count == 0) {
+            return;
+        }
+
+        // Normals come from the upload ring, and traces already submitted may still read the old attributes
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+        PushConstants pushConstants = {};
+        pushConstants.normals = normals;
+        pushConstants.attributes = attributes;
+        pushConstants.count = count;
+
+        Dispatch(commandBuffer, &pushConstants, sizeof(PushConstants), count);
+
+        // Make the normals visible to closest hit shaders
+        memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+            0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+}
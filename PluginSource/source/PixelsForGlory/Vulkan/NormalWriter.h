@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+
+#include "../../vulkan.h"
+#include "ComputePass.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    /// <summary>
+    /// Compute pass that writes per-frame normals of deformed meshes into their interleaved ShaderVertexAttribute
+    /// array.  The host uploads the normals as one packed stream, so an update is a single dispatch instead of a copy
+    /// region per vertex.  Buffers are passed by device address.
+    /// </summary>
+    class NormalWriter : public ComputePass
+    {
+    public:
+        /// <summary>
+        /// Create the pipeline from normals_comp.bin in the shader folder
+        /// </summary>
+        /// <param name="shaderFolder"></param>
+        /// <returns>false if the shader couldn't be loaded</returns>
+        bool Load(const std::string& shaderFolder);
+
+        /// <summary>
+        /// Record the dispatch writing one normal per vertex.  Writes of the normals must be visible to compute
+        /// shaders, and the attributes written are made visible to closest hit shaders.
+        /// </summary>
+        /// <param name="commandBuffer"></param>
+        /// <param name="normals">Three floats per vertex</param>
+        /// <param name="attributes">ShaderVertexAttribute per vertex</param>
+        /// <param name="count">Number of vertices</param>
+        void Record(VkCommandBuffer commandBuffer, VkDeviceAddress normals, VkDeviceAddress attributes, uint32_t count) const;
+
+    private:
+        // Matches Params in normals_comp.glsl
+        struct PushConstants
+        {
+            VkDeviceAddress normals;
+            VkDeviceAddress attributes;
+            uint32_t        count;
+        };
+    };
+}
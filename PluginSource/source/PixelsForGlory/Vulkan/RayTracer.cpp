@@ -1,5 +1,12 @@
 #include "RayTracer.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <numeric>
+
 namespace PixelsForGlory
 {
     RayTracerAPI* CreateRayTracerAPI_Vulkan()
@@ -66,6 +73,11 @@ namespace PixelsForGlory::Vulkan
 
         // Get the ray tracing pipeline properties, which we'll need later on in the sample
         PixelsForGlory::Vulkan::RayTracer::Instance().rayTracingProperties_.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR;
+        PixelsForGlory::Vulkan::RayTracer::Instance().rayTracingProperties_.pNext = &PixelsForGlory::Vulkan::RayTracer::Instance().accelerationStructureProperties_;
+
+        // Acceleration structure properties are needed for scratch buffer alignment
+        PixelsForGlory::Vulkan::RayTracer::Instance().accelerationStructureProperties_.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
+        PixelsForGlory::Vulkan::RayTracer::Instance().accelerationStructureProperties_.pNext = nullptr;
 
         VkPhysicalDeviceProperties2 physicalDeviceProperties = { };
         physicalDeviceProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
@@ -73,6 +85,18 @@ namespace PixelsForGlory::Vulkan
 
         PFG_EDITORLOG("Getting physical device properties");
         vkGetPhysicalDeviceProperties2(physicalDevice, &physicalDeviceProperties);
+        PixelsForGlory::Vulkan::RayTracer::Instance().physicalDeviceProperties_ = physicalDeviceProperties.properties;
+
+        // Integrated GPUs share memory with the host, so geometry can be written in place without staging it
+        const VkPhysicalDeviceType deviceType = physicalDeviceProperties.properties.deviceType;
+        if (deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU || deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU)
+        {
+            PixelsForGlory::Vulkan::RayTracer::Instance().geometryMemoryProperties_ = Vulkan::Buffer::kDefaultMemoryPropertyFlags;
+        }
+        else
+        {
+            PixelsForGlory::Vulkan::RayTracer::Instance().geometryMemoryProperties_ = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        }
 
         // Get memory properties
         vkGetPhysicalDeviceMemoryProperties(physicalDevice, &PixelsForGlory::Vulkan::RayTracer::Instance().physicalDeviceMemoryProperties_);
@@ -164,6 +188,9 @@ namespace PixelsForGlory::Vulkan
     {
         ResolvePropertiesAndQueues_RayTracer(physicalDevice);
 
+        // Everything the plugin creates takes its host memory from the pooled allocator, which falls back to Unity's
+        HostAllocator::Instance().SetParent(unityAllocator);
+
         std::vector<VkDeviceQueueCreateInfo> deviceQueueCreateInfos;
         const float priority = 0.0f;
 
@@ -188,10 +215,16 @@ namespace PixelsForGlory::Vulkan
         physicalDeviceDescriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
         physicalDeviceDescriptorIndexingFeatures.pNext = nullptr;
 
+        // Worker submits are tracked with a timeline semaphore instead of blocking on fences
+        VkPhysicalDeviceTimelineSemaphoreFeatures physicalDeviceTimelineSemaphoreFeatures = { };
+        physicalDeviceTimelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+        physicalDeviceTimelineSemaphoreFeatures.timelineSemaphore = VK_TRUE;
+        physicalDeviceTimelineSemaphoreFeatures.pNext = &physicalDeviceDescriptorIndexingFeatures;
+
         VkPhysicalDeviceRayTracingPipelineFeaturesKHR physicalDeviceRayTracingPipelineFeatures = { };
         physicalDeviceRayTracingPipelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR;
         physicalDeviceRayTracingPipelineFeatures.rayTracingPipeline = VK_TRUE;
-        physicalDeviceRayTracingPipelineFeatures.pNext = &physicalDeviceDescriptorIndexingFeatures;
+        physicalDeviceRayTracingPipelineFeatures.pNext = &physicalDeviceTimelineSemaphoreFeatures;
 
         VkPhysicalDeviceBufferDeviceAddressFeatures physicalDeviceBufferDeviceAddressFeatures = { };
         physicalDeviceBufferDeviceAddressFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES;
@@ -209,6 +242,9 @@ namespace PixelsForGlory::Vulkan
 
         vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures); // enable all the features our GPU has
 
+        // Optional, lets blases of new meshes be built on CPU threads
+        PixelsForGlory::Vulkan::RayTracer::Instance().hostBuildsSupported_ = physicalDeviceAccelerationStructureFeatures.accelerationStructureHostCommands == VK_TRUE;
+
         // Setup extensions required for ray tracing.  Rebuild from Unity
         std::vector<const char*> requiredExtensions = {
             // Required by Unity3D
@@ -241,6 +277,21 @@ namespace PixelsForGlory::Vulkan
             VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME
         };
 
+        // Optional, only used to report memory statistics
+        uint32_t extensionCount = 0;
+        vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+
+        PixelsForGlory::Vulkan::RayTracer::Instance().memoryBudgetSupported_ = false;
+        for (const auto& extension : availableExtensions) {
+            if (strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+                requiredExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+                PixelsForGlory::Vulkan::RayTracer::Instance().memoryBudgetSupported_ = true;
+                break;
+            }
+        }
+
         for (auto const& ext : requiredExtensions) {
             PFG_EDITORLOG("Enabling extension: " + std::string(ext));
         }
@@ -278,8 +329,65 @@ namespace PixelsForGlory::Vulkan
         return result;
     }
 
+    /// <summary>
+    /// Acceleration structure build flags for a RayTracerBuildPolicy
+    /// </summary>
+    /// <param name="buildPolicy"></param>
+    /// <returns></returns>
+    static VkBuildAccelerationStructureFlagsKHR GetBuildPolicyFlags(RayTracerBuildPolicy buildPolicy)
+    {
+        switch (buildPolicy)
+        {
+        case RayTracerBuildPolicy::Dynamic:
+            // Refit every frame, never compacted
+            return VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+        case RayTracerBuildPolicy::Streamed:
+            // Built once and traced for a short time, build time matters more than trace time
+            return VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR;
+        case RayTracerBuildPolicy::LodProxy:
+            // Coarse stand ins, kept as small as possible
+            return VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_LOW_MEMORY_BIT_KHR;
+        case RayTracerBuildPolicy::Static:
+        default:
+            return VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+        }
+    }
+
+    /// <summary>
+    /// Build flags of a mesh's blas.  Deformable meshes are refit in place, which rules out compaction
+    /// </summary>
+    /// <param name="mesh"></param>
+    /// <returns></returns>
+    static VkBuildAccelerationStructureFlagsKHR GetBlasBuildFlags(const RayTracerMeshSharedData& mesh)
+    {
+        VkBuildAccelerationStructureFlagsKHR flags = GetBuildPolicyFlags(mesh.buildPolicy);
+        if (mesh.deformable)
+        {
+            flags &= ~VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+            flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+        }
+        return flags;
+    }
+
+    /// <summary>
+    /// Key of the static batch cell a point is in, 21 bits per axis
+    /// </summary>
+    /// <param name="point"></param>
+    /// <param name="cellSize"></param>
+    /// <returns></returns>
+    static uint64_t StaticBatchCellKey(const vec3& point, float cellSize)
+    {
+        const auto axisKey = [cellSize](float coordinate)
+        {
+            return static_cast<uint64_t>(static_cast<int64_t>(std::floor(coordinate / cellSize))) & 0x1FFFFFull;
+        };
+
+        return axisKey(point.x) | (axisKey(point.y) << 21) | (axisKey(point.z) << 42);
+    }
+
     VkDevice RayTracer::NullDevice = VK_NULL_HANDLE;
     bool RayTracer::CreateDeviceSuccess = false;
+    const VkDeviceSize RayTracer::kGeometryAlignment = std::lcm(sizeof(ShaderVertexAttribute), sizeof(ShaderFace));
 
     RayTracer::RayTracer()
         : graphicsInterface_(nullptr)
@@ -289,15 +397,46 @@ namespace PixelsForGlory::Vulkan
         , transferQueue_(VK_NULL_HANDLE)
         , graphicsCommandPool_(VK_NULL_HANDLE)
         , transferCommandPool_(VK_NULL_HANDLE)
+        , timelineSemaphore_(VK_NULL_HANDLE)
+        , submittedTimelineValue_(0)
+        , completedTimelineValue_(0)
+        , physicalDeviceProperties_(VkPhysicalDeviceProperties())
         , physicalDeviceMemoryProperties_(VkPhysicalDeviceMemoryProperties())
         , rayTracingProperties_(VkPhysicalDeviceRayTracingPipelinePropertiesKHR())
+        , accelerationStructureProperties_(VkPhysicalDeviceAccelerationStructurePropertiesKHR())
+        , geometryMemoryProperties_(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+        , memoryBudgetSupported_(false)
         , device_(NullDevice)
         , alreadyPrepared_(false)
+        , instancesCapacity_(0)
+        , staticBatchingEnabled_(false)
+        , staticBatchCellSize_(32.0f)
+        , tlasBuildPolicy_(RayTracerBuildPolicy::Dynamic)
         , rebuildTlas_(true)
         , updateTlas_(false)
-        , tlas_(RayTracerAccelerationStructure())
+        , hostBuildsSupported_(false)
+        , hostBuildThreadCount_(0)
+        , compactionQueryPool_(VK_NULL_HANDLE)
+        , serializationQueryPool_(VK_NULL_HANDLE)
+        , defragmentationBudgetMilliseconds_(0.5f)
+        , meshDataCapacity_(0)
+        , meshDataBufferInfo_(VkDescriptorBufferInfo())
+        , staticTlas_(RayTracerTlasLayer())
+        , dynamicTlas_(RayTracerTlasLayer())
+        , tlasBuildCount_(0)
+        , timestampQueryPool_(VK_NULL_HANDLE)
+        , tlasTimingTimelineValue_(0)
+        , tlasTimingUpdate_(false)
+        , tlasBuildMilliseconds_(0.0f)
+        , tlasRefitMilliseconds_(0.0f)
         , descriptorPool_(VK_NULL_HANDLE)
+        , currentFrameNumber_(0)
+        , safeFrameNumber_(0)
+        , sceneDataOffset_(0)
+        , hasSceneData_(false)
         , sceneBufferInfo_(VkDescriptorBufferInfo())
+        , sceneAmbient_(vec4(0.0f))
+        , sceneDataBuffer_(VK_NULL_HANDLE)
         , pipelineLayout_(VK_NULL_HANDLE)
         , pipeline_(VK_NULL_HANDLE)
         , debugMessenger_(VK_NULL_HANDLE)
@@ -311,6 +450,101 @@ namespace PixelsForGlory::Vulkan
         // Setup one off command pools
         CreateCommandPool(graphicsQueueFamilyIndex_, graphicsCommandPool_);
         CreateCommandPool(transferQueueFamilyIndex_, transferCommandPool_);  
+
+        // Signalled by worker submits so nothing has to wait on them
+        VkSemaphoreTypeCreateInfo semaphoreTypeCreateInfo = {};
+        semaphoreTypeCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        semaphoreTypeCreateInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        semaphoreTypeCreateInfo.initialValue = 0;
+
+        VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+        semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreCreateInfo.pNext = &semaphoreTypeCreateInfo;
+        VK_CHECK("vkCreateSemaphore", vkCreateSemaphore(device_, &semaphoreCreateInfo, HostAllocator::Instance().GetCallbacks(), &timelineSemaphore_));
+
+        submittedTimelineValue_ = 0;
+        completedTimelineValue_ = 0;
+
+        // Buffers and images sub-allocate their memory from here
+        MemoryAllocator::Instance().Initialize(device_, physicalDeviceMemoryProperties_, physicalDeviceProperties_.limits.nonCoherentAtomSize);
+
+        // Per frame constants and tlas instance uploads are sub-allocated from here
+        uploadRing_.Create(
+            device_,
+            physicalDeviceMemoryProperties_,
+            Vulkan::RingBuffer::kDefaultFrameSize * Vulkan::RingBuffer::kDefaultFramesInFlight,
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+
+        // Scratch memory shared by all acceleration structure builds
+        scratchBuffer_.Initialize(device_, physicalDeviceMemoryProperties_, accelerationStructureProperties_.minAccelerationStructureScratchOffsetAlignment);
+
+        renderTargetPool_.Initialize(device_, physicalDeviceMemoryProperties_);
+
+        // Writes tlas instance records from the transforms streamed in by WriteDirtyInstances
+        instanceGenerator_.Initialize(device_);
+        normalWriter_.Initialize(device_);
+
+        // Shared mesh geometry is packed into a few large pages
+        geometryBuffer_.Initialize(
+            device_,
+            physicalDeviceMemoryProperties_,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            geometryMemoryProperties_,
+            Vulkan::MemoryCategory::MeshGeometry);
+
+        // Blases are packed the same way so they can be moved to free up pages
+        blasBuffer_.Initialize(
+            device_,
+            physicalDeviceMemoryProperties_,
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            Vulkan::MemoryCategory::BottomLevelAccelerationStructure);
+
+        // Host builds need host visible storage, blases are copied into blasBuffer_ once built
+        hostBlasBuffer_.Initialize(
+            device_,
+            physicalDeviceMemoryProperties_,
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+            Vulkan::Buffer::kDefaultMemoryPropertyFlags,
+            Vulkan::MemoryCategory::BottomLevelAccelerationStructure);
+
+        // Leave a core for Unity's main and render threads
+        hostBuildThreadCount_ = hostBuildsSupported_ ? std::max(1u, std::thread::hardware_concurrency() / 2) : 0;
+        deferredOperationPool_.Initialize(device_, hostBuildThreadCount_);
+
+        // Blas builds write their compacted size here so CompactBlases can shrink them
+        VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+        queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolCreateInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
+        queryPoolCreateInfo.queryCount = kCompactionQueryCount;
+        VK_CHECK("vkCreateQueryPool", vkCreateQueryPool(device_, &queryPoolCreateInfo, HostAllocator::Instance().GetCallbacks(), &compactionQueryPool_));
+
+        freeCompactionQueries_.clear();
+        for (uint32_t query = kCompactionQueryCount; query > 0; --query)
+        {
+            freeCompactionQueries_.push_back(query - 1);
+        }
+
+        // Serialized sizes of blases on their way to the acceleration structure cache
+        accelerationStructureCache_.Initialize(device_, physicalDeviceProperties_);
+
+        queryPoolCreateInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR;
+        queryPoolCreateInfo.queryCount = kSerializationQueryCount;
+        VK_CHECK("vkCreateQueryPool", vkCreateQueryPool(device_, &queryPoolCreateInfo, HostAllocator::Instance().GetCallbacks(), &serializationQueryPool_));
+
+        freeSerializationQueries_.clear();
+        for (uint32_t query = kSerializationQueryCount; query > 0; --query)
+        {
+            freeSerializationQueries_.push_back(query - 1);
+        }
+
+        // Tlas build and trace times decide when refitting the tlas stops paying off
+        if (physicalDeviceProperties_.limits.timestampComputeAndGraphics == VK_TRUE)
+        {
+            queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryPoolCreateInfo.queryCount = 2 + 2 * kTraceTimingSlots;
+            VK_CHECK("vkCreateQueryPool", vkCreateQueryPool(device_, &queryPoolCreateInfo, HostAllocator::Instance().GetCallbacks(), &timestampQueryPool_));
+        }
     }
 
     void RayTracer::Shutdown()
@@ -321,15 +555,25 @@ namespace PixelsForGlory::Vulkan
             debugMessenger_ = VK_NULL_HANDLE;
         }
 
+        // Let every worker submit finish so their command buffers and resources can be released
+        WaitForSubmission(submittedTimelineValue_);
+        UpdateCompletedSubmissions();
+
+        if (timelineSemaphore_ != VK_NULL_HANDLE)
+        {
+            vkDestroySemaphore(device_, timelineSemaphore_, HostAllocator::Instance().GetCallbacks());
+            timelineSemaphore_ = VK_NULL_HANDLE;
+        }
+
         if (graphicsCommandPool_ != VK_NULL_HANDLE)
         {
-            vkDestroyCommandPool(device_, graphicsCommandPool_, nullptr);
+            vkDestroyCommandPool(device_, graphicsCommandPool_, HostAllocator::Instance().GetCallbacks());
             graphicsCommandPool_ = VK_NULL_HANDLE;
         }
 
         if (transferCommandPool_ != VK_NULL_HANDLE)
         {
-            vkDestroyCommandPool(device_, transferCommandPool_, nullptr);
+            vkDestroyCommandPool(device_, transferCommandPool_, HostAllocator::Instance().GetCallbacks());
             transferCommandPool_ = VK_NULL_HANDLE;
         }
 
@@ -337,56 +581,118 @@ namespace PixelsForGlory::Vulkan
         {
             auto& renderTarget = (*itr).second;
 
-            renderTarget->stagingImage.Destroy();
-            renderTarget->cameraData.Destroy();
-
             if (renderTarget->descriptorSets.size() > 0)
             {
                 vkFreeDescriptorSets(device_, descriptorPool_, DESCRIPTOR_SET_SIZE, renderTarget->descriptorSets.data());
             }
             renderTarget->descriptorSets.clear();
-
-            renderTarget.release();
         }
         renderTargets_.clear();
+        renderTargetPool_.Destroy();
         
 
+        // Host builds still running read the meshes' host geometry
+        deferredOperationPool_.Destroy();
+
+        for (auto& batch : hostBlasBatches_)
+        {
+            if (batch->operation != VK_NULL_HANDLE)
+            {
+                vkDestroyDeferredOperationKHR(device_, batch->operation, HostAllocator::Instance().GetCallbacks());
+            }
+
+            for (auto& hostBlas : batch->hostBlases)
+            {
+                vkDestroyAccelerationStructureKHR(device_, hostBlas.accelerationStructure, HostAllocator::Instance().GetCallbacks());
+            }
+        }
+        hostBlasBatches_.clear();
+
         for (auto itr = sharedMeshesPool_.pool_begin(); itr != sharedMeshesPool_.pool_end(); ++itr)
         {
             auto const& mesh = (*itr);
 
-            mesh->vertexBuffer.Destroy();
-            mesh->indexBuffer.Destroy();
-            
+            // Slots of removed meshes are empty
+            if (!mesh)
+            {
+                continue;
+            }
+
             if (mesh->blas.accelerationStructure != VK_NULL_HANDLE)
             {
-                vkDestroyAccelerationStructureKHR(device_, mesh->blas.accelerationStructure, nullptr);
+                vkDestroyAccelerationStructureKHR(device_, mesh->blas.accelerationStructure, HostAllocator::Instance().GetCallbacks());
                 mesh->blas.accelerationStructure = VkAccelerationStructureKHR();
-                mesh->blas.buffer.Destroy();
+                mesh->blas.storage = Vulkan::GeometryAllocation();
                 mesh->blas.deviceAddress = 0;
             }
         }
 
-        for (auto i = sharedMeshAttributesPool_.pool_begin(); i != sharedMeshAttributesPool_.pool_end(); ++i)
+        ReleaseRetiredResources(UINT64_MAX);
+
+        // Batches refer to pool slots of the device being shut down, their members are traced on their own again
+        for (auto itr = meshInstancePool_.in_use_begin(); itr != meshInstancePool_.in_use_end(); ++itr)
         {
-            (*i).Destroy();
+            meshInstancePool_[*itr]->inStaticBatch = false;
+            meshInstancePool_[*itr]->mergedIntoStaticBatch = false;
         }
+        staticBatches_.clear();
 
-        for (auto i = sharedMeshFacesPool_.pool_begin(); i != sharedMeshFacesPool_.pool_end(); ++i)
+        pendingBlasBuilds_.clear();
+        pendingCompactions_.clear();
+        releasedSharedMeshes_.clear();
+        freeCompactionQueries_.clear();
+        if (compactionQueryPool_ != VK_NULL_HANDLE)
         {
-            (*i).Destroy();
+            vkDestroyQueryPool(device_, compactionQueryPool_, HostAllocator::Instance().GetCallbacks());
+            compactionQueryPool_ = VK_NULL_HANDLE;
         }
 
-        instancesAccelerationStructuresBuffer_.Destroy();
+        for (auto& serialization : pendingSerializations_)
+        {
+            serialization.buffer.Destroy();
+        }
+        pendingSerializations_.clear();
+        freeSerializationQueries_.clear();
+        if (serializationQueryPool_ != VK_NULL_HANDLE)
+        {
+            vkDestroyQueryPool(device_, serializationQueryPool_, HostAllocator::Instance().GetCallbacks());
+            serializationQueryPool_ = VK_NULL_HANDLE;
+        }
 
-        if (tlas_.accelerationStructure != VK_NULL_HANDLE)
+        if (timestampQueryPool_ != VK_NULL_HANDLE)
+        {
+            vkDestroyQueryPool(device_, timestampQueryPool_, HostAllocator::Instance().GetCallbacks());
+            timestampQueryPool_ = VK_NULL_HANDLE;
+        }
+        tlasTimingTimelineValue_ = 0;
+        for (auto& timing : traceTimings_)
         {
-            vkDestroyAccelerationStructureKHR(device_, tlas_.accelerationStructure, nullptr);
+            timing = RayTracerTraceTiming();
         }
-        tlas_.buffer.Destroy();
+
+        geometryBuffer_.Destroy();
+        blasBuffer_.Destroy();
+        hostBlasBuffer_.Destroy();
+        meshDataBuffer_.Destroy();
+        meshDataCapacity_ = 0;
+        meshDataRanges_.Initialize(0);
+
+        uploadRing_.Destroy();
+        scratchBuffer_.Destroy();
+
+        DestroyTlasLayer(staticTlas_);
+        DestroyTlasLayer(dynamicTlas_);
+
+        // Every record is written again once the buffer is recreated
+        instancesBuffer_.Destroy();
+        instanceDescriptionsBuffer_.Destroy();
+        instancesCapacity_ = 0;
+        dirtyInstanceSlots_.clear();
+        instanceGenerator_.Destroy();
+        normalWriter_.Destroy();
 
         if (descriptorPool_ != VK_NULL_HANDLE) {
-            vkDestroyDescriptorPool(device_, descriptorPool_, nullptr);
+            vkDestroyDescriptorPool(device_, descriptorPool_, HostAllocator::Instance().GetCallbacks());
             descriptorPool_ = VK_NULL_HANDLE;
         }
 
@@ -394,22 +700,22 @@ namespace PixelsForGlory::Vulkan
 
         if (pipeline_ != VK_NULL_HANDLE) 
         {
-            vkDestroyPipeline(device_, pipeline_, nullptr);
+            vkDestroyPipeline(device_, pipeline_, HostAllocator::Instance().GetCallbacks());
             pipeline_ = VK_NULL_HANDLE;
         }
 
         if (pipelineLayout_ != VK_NULL_HANDLE) {
-            vkDestroyPipelineLayout(device_, pipelineLayout_, nullptr);
+            vkDestroyPipelineLayout(device_, pipelineLayout_, HostAllocator::Instance().GetCallbacks());
             pipelineLayout_ = VK_NULL_HANDLE;
         }
 
         for (auto descriptorSetLayout : descriptorSetLayouts_)
         {
-            vkDestroyDescriptorSetLayout(device_, descriptorSetLayout, nullptr);
+            vkDestroyDescriptorSetLayout(device_, descriptorSetLayout, HostAllocator::Instance().GetCallbacks());
         }
         descriptorSetLayouts_.clear();
 
-
+        MemoryAllocator::Instance().Destroy();
     }
 
 #pragma region RayTracerAPI
@@ -486,6 +792,11 @@ namespace PixelsForGlory::Vulkan
         PFG_EDITORLOG("Shader folder set to: " + shaderFolder_);
     }
 
+    void RayTracer::SetAccelerationStructureCacheFolder(std::string cacheFolder)
+    {
+        accelerationStructureCache_.SetFolder(cacheFolder);
+    }
+
     int RayTracer::SetRenderTarget(int cameraInstanceId, int unityTextureFormat, int width, int height, void* textureHandle)
     {
         VkFormat vkFormat;
@@ -511,15 +822,16 @@ namespace PixelsForGlory::Vulkan
         {
             auto& renderTarget = renderTargets_[cameraInstanceId];
                 
-            renderTarget->cameraData.Destroy();
-            renderTarget->stagingImage.Destroy();
+            // The image may still be in use by a frame in flight, the pool holds on to it until it's safe to reuse
+            // or destroy.  Unity may still be recording the previous frame, so tag it one past the next frame.
+            renderTargetPool_.Release(renderTarget->stagingImage, currentFrameNumber_ + 2);
+            renderTarget->stagingImage = nullptr;
             
             if (renderTarget->descriptorSets.size() > 0)
             {
                 vkFreeDescriptorSets(device_, descriptorPool_, static_cast<uint32_t>(renderTarget->descriptorSets.size()), renderTarget->descriptorSets.data());
             }
 
-            renderTarget.release();
             renderTargets_.erase(cameraInstanceId);
         }
 
@@ -531,26 +843,14 @@ namespace PixelsForGlory::Vulkan
         renderTarget->extent.depth = 1;
         renderTarget->destination = textureHandle;
         
-        renderTarget->stagingImage = Vulkan::Image(device_, physicalDeviceMemoryProperties_);
+        Vulkan::RenderTargetKey key;
+        key.format = renderTarget->format;
+        key.extent = renderTarget->extent;
+        key.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
 
-        if (renderTarget->stagingImage.Create(
-            VK_IMAGE_TYPE_2D,
-            renderTarget->format,
-            renderTarget->extent,
-            VK_IMAGE_TILING_OPTIMAL,
-            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != VK_SUCCESS) 
+        renderTarget->stagingImage = renderTargetPool_.Acquire(key);
+        if (renderTarget->stagingImage == nullptr)
         {
-
-            PFG_EDITORLOGERROR("Failed to create render image!");
-            renderTarget->stagingImage.Destroy();
-            return 0;
-        }
-
-        VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        if(renderTarget->stagingImage.CreateImageView(VK_IMAGE_VIEW_TYPE_2D, renderTarget->format, range) != VK_SUCCESS) {
-            PFG_EDITORLOGERROR("Failed to create render image view!");
-            renderTarget->stagingImage.Destroy();
             return 0;
         }
 
@@ -567,7 +867,7 @@ namespace PixelsForGlory::Vulkan
         for (auto itr = sharedMeshesPool_.in_use_begin(); itr != sharedMeshesPool_.in_use_end(); ++itr)
         {
             auto i = (*itr);
-            if (sharedMeshesPool_[i]->sharedMeshInstanceId == sharedMeshInstanceId)
+            if (sharedMeshesPool_[i]->sharedMeshInstanceId == sharedMeshInstanceId && !sharedMeshesPool_[i]->isStaticBatch)
             {
                 return i;
             }
@@ -576,20 +876,59 @@ namespace PixelsForGlory::Vulkan
         return -1;    
     }
 
-    int RayTracer::AddSharedMesh(int instanceId, float* verticesArray, float* normalsArray, float* uvsArray, int vertexCount, int* indicesArray, int indexCount) 
+    int RayTracer::AddSharedMesh(int instanceId, float* verticesArray, float* normalsArray, float* uvsArray, int vertexCount, int* indicesArray, int indexCount, int buildPolicy) 
     { 
-        // Check that this shared mesh hasn't been added yet
-        for (auto itr = sharedMeshesPool_.in_use_begin(); itr != sharedMeshesPool_.in_use_end(); ++itr)
+        // The whole mesh is one submesh
+        int submeshIndexStart = 0;
+        return AddSharedMeshWithSubmeshes(instanceId, verticesArray, normalsArray, uvsArray, vertexCount, indicesArray, indexCount, &submeshIndexStart, &indexCount, 1, buildPolicy);
+    }
+
+    int RayTracer::AddSharedMeshWithSubmeshes(int instanceId, float* verticesArray, float* normalsArray, float* uvsArray, int vertexCount, int* indicesArray, int indexCount, int* submeshIndexStarts, int* submeshIndexCounts, int submeshCount, int buildPolicy)
+    {
+        return AddSharedMeshGeometry(instanceId, verticesArray, normalsArray, uvsArray, vertexCount, indicesArray, indexCount, submeshIndexStarts, submeshIndexCounts, submeshCount, buildPolicy, nullptr);
+    }
+
+    int RayTracer::AddSharedMeshGeometry(int instanceId, float* verticesArray, float* normalsArray, float* uvsArray, int vertexCount, int* indicesArray, int indexCount, int* submeshIndexStarts, int* submeshIndexCounts, int submeshCount, int buildPolicy, const std::vector<uint32_t>* sourceInstanceIds)
+    {
+        // Level loads add meshes in bulk, release the staging buffers of uploads that are done as we go
+        UpdateCompletedSubmissions();
+
+        // Check that this shared mesh hasn't been added yet.  Merged meshes of static batches are never shared
+        if (sourceInstanceIds == nullptr)
         {
-            auto i = (*itr);
-            if (sharedMeshesPool_[i]->sharedMeshInstanceId == instanceId)
+            for (auto itr = sharedMeshesPool_.in_use_begin(); itr != sharedMeshesPool_.in_use_end(); ++itr)
             {
-                return i;
+                auto i = (*itr);
+                if (sharedMeshesPool_[i]->sharedMeshInstanceId == instanceId && !sharedMeshesPool_[i]->isStaticBatch)
+                {
+                    return i;
+                }
             }
         }
         
+        // Empty meshes have nothing to trace, and a zero sized geometry range can't be allocated.  Empty submeshes are
+        // fine, they become blas geometries without triangles
+        if (vertexCount <= 0 || indexCount <= 0)
+        {
+            PFG_EDITORLOGERROR("Shared mesh instance id " + std::to_string(instanceId) + " is empty (vertices: " + std::to_string(vertexCount) + ", indices: " + std::to_string(indexCount) + ")");
+            return -1;
+        }
+
         // We can only add tris, make sure the index count reflects this
         assert(indexCount % 3 == 0);
+        assert(sourceInstanceIds == nullptr || sourceInstanceIds->size() == static_cast<size_t>(indexCount / 3));
+
+        if (submeshCount < 1 || submeshCount > MAX_BLAS_GEOMETRIES)
+        {
+            PFG_EDITORLOGERROR("Shared mesh instance id " + std::to_string(instanceId) + " has " + std::to_string(submeshCount) + " submeshes, at most " + std::to_string(MAX_BLAS_GEOMETRIES) + " are supported");
+            return -1;
+        }
+
+        if (buildPolicy < 0 || buildPolicy >= static_cast<int>(RayTracerBuildPolicy::Count))
+        {
+            PFG_EDITORLOGERROR("Shared mesh instance id " + std::to_string(instanceId) + " has unknown build policy " + std::to_string(buildPolicy));
+            return -1;
+        }
     
         auto sentMesh = std::make_unique<RayTracerMeshSharedData>();
         
@@ -598,73 +937,101 @@ namespace PixelsForGlory::Vulkan
         sentMesh->vertexCount = vertexCount;
         sentMesh->indexCount = indexCount;
 
-        sentMesh->vertexAttributeIndex = sharedMeshAttributesPool_.get_next_index();
-        sentMesh->faceDataIndex = sharedMeshFacesPool_.get_next_index();
-    
-        Vulkan::Buffer& sentMeshAttributes = sharedMeshAttributesPool_[sentMesh->vertexAttributeIndex];
-        Vulkan::Buffer& sentMeshFaces = sharedMeshFacesPool_[sentMesh->faceDataIndex];
-    
-        // Setup buffers
-        bool success = true;
-        if (sentMesh->vertexBuffer.Create(
-                device_,
-                physicalDeviceMemoryProperties_,
-                sizeof(vec3) * sentMesh->vertexCount,
-                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-                Vulkan::Buffer::kDefaultMemoryPropertyFlags) 
-            != VK_SUCCESS)
+        // Dynamic meshes are expected to deform, build them to be refit from the start
+        sentMesh->buildPolicy = static_cast<RayTracerBuildPolicy>(buildPolicy);
+        sentMesh->deformable = sentMesh->buildPolicy == RayTracerBuildPolicy::Dynamic;
+        sentMesh->isStaticBatch = sourceInstanceIds != nullptr;
+
+        // Submeshes are whole triangles of the index array
+        sentMesh->submeshes.resize(submeshCount);
+        for (int i = 0; i < submeshCount; ++i)
         {
-            PFG_EDITORLOGERROR("Failed to create vertex buffer for shared mesh instance id " + std::to_string(instanceId));
-            success = false;
+            if (submeshIndexStarts[i] < 0 || submeshIndexCounts[i] < 0 ||
+                submeshIndexStarts[i] % 3 != 0 || submeshIndexCounts[i] % 3 != 0 ||
+                submeshIndexStarts[i] + submeshIndexCounts[i] > indexCount)
+            {
+                PFG_EDITORLOGERROR("Submesh " + std::to_string(i) + " of shared mesh instance id " + std::to_string(instanceId) + " isn't a range of whole triangles");
+                return -1;
+            }
+
+            sentMesh->submeshes[i].indexStart = static_cast<uint32_t>(submeshIndexStarts[i]);
+            sentMesh->submeshes[i].indexCount = static_cast<uint32_t>(submeshIndexCounts[i]);
         }
-    
-        if (sentMesh->indexBuffer.Create(
-            device_,
-            physicalDeviceMemoryProperties_,
-            sizeof(uint32_t) * sentMesh->indexCount,
-            VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-            Vulkan::Buffer::kDefaultMemoryPropertyFlags))
+
+        // The blas only depends on positions, indices, submesh ranges and build flags.  Deformable blases change all
+        // the time, and static batches are re-merged whenever a cell's instances change, so neither is cached
+        if (accelerationStructureCache_.IsEnabled() && !sentMesh->deformable && !sentMesh->isStaticBatch)
         {
-            PFG_EDITORLOGERROR("Failed to create index buffer for shared mesh instance id " + std::to_string(instanceId));
-            success = false;
+            const VkBuildAccelerationStructureFlagsKHR buildFlags = GetBlasBuildFlags(*sentMesh);
+
+            uint64_t cacheKey = Vulkan::AccelerationStructureCache::Hash(&buildFlags, sizeof(buildFlags));
+            cacheKey = Vulkan::AccelerationStructureCache::Hash(verticesArray, sizeof(float) * 3 * vertexCount, cacheKey);
+            cacheKey = Vulkan::AccelerationStructureCache::Hash(indicesArray, sizeof(int) * indexCount, cacheKey);
+            cacheKey = Vulkan::AccelerationStructureCache::Hash(sentMesh->submeshes.data(), sizeof(RayTracerSubmesh) * sentMesh->submeshes.size(), cacheKey);
+
+            sentMesh->cacheKey = cacheKey != RayTracerMeshSharedData::kNoCacheKey ? cacheKey : cacheKey + 1;
         }
-    
-        if (sentMeshAttributes.Create(
-            device_,
-                physicalDeviceMemoryProperties_,
-                sizeof(ShaderVertexAttribute) * sentMesh->vertexCount,
-                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-                Vulkan::Buffer::kDefaultMemoryPropertyFlags)
-            != VK_SUCCESS)
+
+        // Everything goes in one range laid out as attributes, faces, vertices, indices and, for static batches, source
+        // instances.  The range is aligned to both shader element strides so attribute and face offsets can be stored
+        // as element indices.
+        sentMesh->attributesOffset = 0;
+        const VkDeviceSize vertexAttributesSize = sizeof(ShaderVertexAttribute) * sentMesh->vertexCount;
+
+        sentMesh->facesOffset = (sentMesh->attributesOffset + vertexAttributesSize + sizeof(ShaderFace) - 1) / sizeof(ShaderFace) * sizeof(ShaderFace);
+        const VkDeviceSize facesSize = sizeof(ShaderFace) * sentMesh->indexCount / 3;
+
+        sentMesh->verticesOffset = sentMesh->facesOffset + facesSize;
+        const VkDeviceSize verticesSize = sizeof(vec3) * sentMesh->vertexCount;
+
+        sentMesh->indicesOffset = sentMesh->verticesOffset + verticesSize;
+        const VkDeviceSize indicesSize = sizeof(uint32_t) * sentMesh->indexCount;
+
+        sentMesh->sourceInstancesOffset = sentMesh->indicesOffset + indicesSize;
+        const VkDeviceSize sourceInstancesSize = sourceInstanceIds != nullptr ? sizeof(uint32_t) * sentMesh->indexCount / 3 : 0;
+
+        const VkDeviceSize geometrySize = sentMesh->sourceInstancesOffset + sourceInstancesSize;
+
+        const uint32_t pageCount = geometryBuffer_.GetPageCount();
+        if (!geometryBuffer_.Allocate(geometrySize, kGeometryAlignment, sentMesh->geometry))
         {
-            PFG_EDITORLOGERROR("Failed to create vertex attribute buffer for shared mesh instance id " + std::to_string(instanceId));
-            success = false;
+            PFG_EDITORLOGERROR("Failed to allocate geometry for shared mesh instance id " + std::to_string(instanceId));
+            return -1;
         }
-    
-    
-        if (sentMeshFaces.Create(
-            device_,
-            physicalDeviceMemoryProperties_,
-            sizeof(ShaderFace) * sentMesh->indexCount / 3,
-            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-            Vulkan::Buffer::kDefaultMemoryPropertyFlags)
-            != VK_SUCCESS)
+
+        // Device local geometry can't be written directly, fill a staging buffer and copy from it instead
+        const bool stageUpload = (geometryMemoryProperties_ & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 0;
+
+        Vulkan::Buffer stagingBuffer;
+        uint8_t* geometry = nullptr;
+
+        if (stageUpload)
         {
-            PFG_EDITORLOGERROR("Failed to create face buffer for shared mesh instance id " + std::to_string(instanceId));
-            success = false;
+            if (stagingBuffer.Create(
+                device_,
+                physicalDeviceMemoryProperties_,
+                geometrySize,
+                VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                Vulkan::Buffer::kDefaultMemoryPropertyFlags,
+                Vulkan::MemoryCategory::Staging)
+                != VK_SUCCESS)
+            {
+                PFG_EDITORLOGERROR("Failed to create staging buffer for shared mesh instance id " + std::to_string(instanceId));
+                geometryBuffer_.Free(sentMesh->geometry);
+                return -1;
+            }
+
+            geometry = reinterpret_cast<uint8_t*>(stagingBuffer.Map());
         }
-    
-        
-        if (!success)
+        else
         {
-            return -1;
+            geometry = reinterpret_cast<uint8_t*>(geometryBuffer_.GetMappedData(sentMesh->geometry));
         }
-    
-        // Creating buffers was successful.  Move onto getting the data in there
-        auto vertices = reinterpret_cast<vec3*>(sentMesh->vertexBuffer.Map());
-        auto indices = reinterpret_cast<uint32_t*>(sentMesh->indexBuffer.Map());
-        auto vertexAttributes = reinterpret_cast<ShaderVertexAttribute*>(sentMeshAttributes.Map()); 
-        auto faces = reinterpret_cast<ShaderFace*>(sentMeshFaces.Map());
+
+        auto vertexAttributes = reinterpret_cast<ShaderVertexAttribute*>(geometry + sentMesh->attributesOffset);
+        auto faces = reinterpret_cast<ShaderFace*>(geometry + sentMesh->facesOffset);
+        auto vertices = reinterpret_cast<vec3*>(geometry + sentMesh->verticesOffset);
+        auto indices = reinterpret_cast<uint32_t*>(geometry + sentMesh->indicesOffset);
         
         // verticesArray and normalsArray are size vertexCount * 3 since they actually represent an array of vec3
         // uvsArray is size vertexCount * 2 since it actually represents an array of vec2
@@ -674,6 +1041,7 @@ namespace PixelsForGlory::Vulkan
             vertices[i].x = verticesArray[3 * i + 0];
             vertices[i].y = verticesArray[3 * i + 1];
             vertices[i].z = verticesArray[3 * i + 2];
+            sentMesh->bounds.Add(vertices[i]);
             
             //PFG_EDITORLOG("vertex #" + std::to_string(i) + ": " + std::to_string(vertices[i].x) + ", " + std::to_string(vertices[i].y) + ", " + std::to_string(vertices[i].z));
 
@@ -701,17 +1069,91 @@ namespace PixelsForGlory::Vulkan
             faces[i].index1 = static_cast<uint32_t>(indicesArray[3 * i + 1]);
             faces[i].index2 = static_cast<uint32_t>(indicesArray[3 * i + 2]);
         }
+
+        if (sourceInstanceIds != nullptr)
+        {
+            std::memcpy(geometry + sentMesh->sourceInstancesOffset, sourceInstanceIds->data(), static_cast<size_t>(sourceInstancesSize));
+        }
+
+        // Host builds read geometry from host memory, keep a copy until the blas is built.  Deformable blases are
+        // refit on the device, so they are built there too.  So are merged meshes, their members stop being traced as
+        // soon as the batch is built
+        if (hostBuildsSupported_ && hostBuildThreadCount_ > 0 && !sentMesh->deformable && !sentMesh->isStaticBatch)
+        {
+            sentMesh->hostVertices.resize(vertexCount);
+            for (int i = 0; i < vertexCount; ++i)
+            {
+                sentMesh->hostVertices[i] = vec3(verticesArray[3 * i + 0], verticesArray[3 * i + 1], verticesArray[3 * i + 2]);
+            }
+
+            sentMesh->hostIndices.assign(indicesArray, indicesArray + indexCount);
+        }
+
+        // Static batches are merged on the host from a copy of their members' geometry
+        if (staticBatchingEnabled_ && !sentMesh->deformable && !sentMesh->isStaticBatch)
+        {
+            sentMesh->batchVertices.resize(vertexCount);
+            sentMesh->batchAttributes.resize(vertexCount);
+            for (int i = 0; i < vertexCount; ++i)
+            {
+                sentMesh->batchVertices[i] = vec3(verticesArray[3 * i + 0], verticesArray[3 * i + 1], verticesArray[3 * i + 2]);
+                sentMesh->batchAttributes[i].normal = vec3(normalsArray[3 * i + 0], normalsArray[3 * i + 1], normalsArray[3 * i + 2]);
+                sentMesh->batchAttributes[i].uv = vec2(uvsArray[2 * i + 0], uvsArray[2 * i + 1]);
+            }
+
+            sentMesh->batchIndices.assign(indicesArray, indicesArray + indexCount);
+        }
         
-        sentMesh->vertexBuffer.Unmap();
-        sentMesh->indexBuffer.Unmap();
-        sentMeshAttributes.Unmap();
-        sentMeshFaces.Unmap();
+        if (stageUpload)
+        {
+            stagingBuffer.Flush();
+
+            // The layout matches the range, so a single copy covers the whole mesh
+            VkBufferCopy geometryCopy = { 0, sentMesh->geometry.offset, geometrySize };
+
+            VkCommandBuffer commandBuffer;
+            CreateWorkerCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, graphicsCommandPool_, commandBuffer);
+            vkCmdCopyBuffer(commandBuffer, stagingBuffer.GetBuffer(), geometryBuffer_.GetPage(sentMesh->geometry.page).GetBuffer(), 1, &geometryCopy);
+
+            // Make the copy visible to the blas build and closest hit shaders
+            VkMemoryBarrier memoryBarrier = {};
+            memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_SHADER_READ_BIT;
+            vkCmdPipelineBarrier(
+                commandBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+            // The copy is still in flight, keep the staging buffer until it is done
+            const uint64_t timelineValue = SubmitWorkerCommandBuffer(commandBuffer, graphicsCommandPool_, graphicsQueue_);
+            submissionRetiredBuffers_.push_back(std::make_pair(timelineValue, stagingBuffer));
+        }
+        else
+        {
+            geometryBuffer_.Flush(sentMesh->geometry);
+        }
+
+        // A new page means the page descriptor arrays have to be rewritten
+        if (geometryBuffer_.GetPageCount() != pageCount)
+        {
+            for (auto& renderTarget : renderTargets_)
+            {
+                renderTarget.second->updateDescriptorSetsData = true;
+            }
+        }
 
         // All done creating the data, get it added to the pool
         int sharedMeshIndex = sharedMeshesPool_.add(std::move(sentMesh));
+
+        if (!UpdateMeshData(sharedMeshIndex))
+        {
+            PFG_EDITORLOGERROR("Failed to update mesh data for shared mesh instance id " + std::to_string(instanceId));
+        }
     
-        // Build blas here so we don't have to do it later
-        BuildBlas(sharedMeshIndex);
+        // Blases of every mesh added this frame are built together before the next tlas build
+        pendingBlasBuilds_.push_back(sharedMeshIndex);
     
         PFG_EDITORLOG("Added mesh (sharedMeshInstanceId: " + std::to_string(instanceId) + ")");
     
@@ -719,637 +1161,3446 @@ namespace PixelsForGlory::Vulkan
     
     }
 
-    int RayTracer::GetTlasInstanceIndex(int gameObjectInstanceId)
+    void RayTracer::RemoveSharedMesh(int sharedMeshIndex)
     {
-        for (auto itr = meshInstancePool_.in_use_begin(); itr != meshInstancePool_.in_use_end(); ++itr)
+        if (sharedMeshIndex < 0 || sharedMeshIndex >= static_cast<int>(sharedMeshesPool_.pool_size()) || !sharedMeshesPool_[sharedMeshIndex])
         {
-            auto index = *itr;
-            if (meshInstancePool_[index]->gameObjectInstanceId == gameObjectInstanceId)
-            {
-                return index;
-            }
+            PFG_EDITORLOGERROR("Can't remove unknown shared mesh index " + std::to_string(sharedMeshIndex));
+            return;
         }
 
-        return -1;
-    }
-
-    int RayTracer::AddTlasInstance(int gameObjectInstanceId, int sharedMeshIndex, float* l2wMatrix) 
-    { 
-        auto instance = std::make_unique<RayTracerMeshInstanceData>();
-
-        instance->gameObjectInstanceId = gameObjectInstanceId;
-        instance->sharedMeshIndex = sharedMeshIndex;
-        FloatArrayToMatrix(l2wMatrix, instance->localToWorld);
-
-        int index = meshInstancePool_.add(std::move(instance));
-
-        PFG_EDITORLOG("Added mesh instance (sharedMeshIndex: " + std::to_string(sharedMeshIndex) + ")");
-
-        // If we added an instance, we need to rebuild the tlas
-        rebuildTlas_ = true;
-
-        return index; 
-    }
-
-    void RayTracer::RemoveTlasInstance(int meshInstanceIndex) 
-    {
-        meshInstancePool_.remove(meshInstanceIndex);
-
-        // If we added an instance, we need to rebuild the tlas
-        rebuildTlas_ = true;
-    }
-
-    void RayTracer::BuildTlas() 
-    {
-        // If there is nothing to do, skip building the tlas
-        if (rebuildTlas_ == false && updateTlas_ == false)
+        // Instances hold a reference, the mesh goes away with the last of them
+        if (sharedMeshesPool_[sharedMeshIndex]->instanceCount > 0)
         {
+            PFG_EDITORLOG("Shared mesh index " + std::to_string(sharedMeshIndex) + " still has " + std::to_string(sharedMeshesPool_[sharedMeshIndex]->instanceCount) + " instances, it is removed with the last one");
             return;
         }
 
-        bool update = updateTlas_;
-        if (rebuildTlas_)
+        if (std::find(releasedSharedMeshes_.begin(), releasedSharedMeshes_.end(), sharedMeshIndex) == releasedSharedMeshes_.end())
         {
-            update = false;
+            releasedSharedMeshes_.push_back(sharedMeshIndex);
         }
+    }
 
-        if (meshInstancePool_.in_use_size() == 0)
+    void RayTracer::UpdateSharedMeshVertices(int sharedMeshIndex, float* verticesArray, float* normalsArray)
+    {
+        if (sharedMeshIndex < 0 || sharedMeshIndex >= static_cast<int>(sharedMeshesPool_.pool_size()) || !sharedMeshesPool_[sharedMeshIndex])
         {
-            // We have no instances, so there is nothing to build 
+            PFG_EDITORLOGERROR("Can't update vertices of unknown shared mesh index " + std::to_string(sharedMeshIndex));
             return;
         }
-     
-        if (!update)
+
+        const auto& mesh = sharedMeshesPool_[sharedMeshIndex];
+        const int vertexCount = mesh->vertexCount;
+
+        // Frames in flight may see the new vertices early, which is fine for animated geometry
+        if ((geometryMemoryProperties_ & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0)
         {
-            // Build instance buffer from scratch
-            std::vector<VkAccelerationStructureInstanceKHR> instanceAccelerationStructures;
-            instanceAccelerationStructures.resize(meshInstancePool_.in_use_size(), VkAccelerationStructureInstanceKHR{});
+            uint8_t* geometry = reinterpret_cast<uint8_t*>(geometryBuffer_.GetMappedData(mesh->geometry));
+            auto vertexAttributes = reinterpret_cast<ShaderVertexAttribute*>(geometry + mesh->attributesOffset);
+            auto vertices = reinterpret_cast<vec3*>(geometry + mesh->verticesOffset);
 
-            // Gather instances
-            uint32_t instanceAccelerationStructuresIndex = 0;
-            for (auto i = meshInstancePool_.in_use_begin(); i != meshInstancePool_.in_use_end(); ++i)
+            for (int i = 0; i < vertexCount; ++i)
             {
-                auto instanceIndex = (*i);
+                vertices[i] = vec3(verticesArray[3 * i + 0], verticesArray[3 * i + 1], verticesArray[3 * i + 2]);
 
-                const auto& t = meshInstancePool_[instanceIndex]->localToWorld;
-                VkTransformMatrixKHR transformMatrix = {
-                    t[0][0], t[0][1], t[0][2], t[0][3],
-                    t[1][0], t[1][1], t[1][2], t[1][3],
-                    t[2][0], t[2][1], t[2][2], t[2][3]
-                };
-
-                /*PFG_EDITORLOG("Instance transform matrix loop: ");
-                PFG_EDITORLOG(std::to_string(transformMatrix.matrix[0][0]) + ", " + std::to_string(transformMatrix.matrix[0][1]) + ", " + std::to_string(transformMatrix.matrix[0][2]) + ", " + std::to_string(transformMatrix.matrix[0][3]));
-                PFG_EDITORLOG(std::to_string(transformMatrix.matrix[1][0]) + ", " + std::to_string(transformMatrix.matrix[1][1]) + ", " + std::to_string(transformMatrix.matrix[1][2]) + ", " + std::to_string(transformMatrix.matrix[1][3]));
-                PFG_EDITORLOG(std::to_string(transformMatrix.matrix[2][0]) + ", " + std::to_string(transformMatrix.matrix[2][1]) + ", " + std::to_string(transformMatrix.matrix[2][2]) + ", " + std::to_string(transformMatrix.matrix[2][3]));*/
+                if (normalsArray != nullptr)
+                {
+                    vertexAttributes[i].normal = vec3(normalsArray[3 * i + 0], normalsArray[3 * i + 1], normalsArray[3 * i + 2]);
+                }
+            }
 
-                auto sharedMeshIndex = meshInstancePool_[instanceIndex]->sharedMeshIndex;
+            geometryBuffer_.Flush(mesh->geometry);
+        }
+        else
+        {
+            // The shader folder is only known once Unity has set it, so the pipeline is created on first use
+            if (normalsArray != nullptr && !normalWriter_.IsLoaded() && !normalWriter_.Load(shaderFolder_))
+            {
+                PFG_EDITORLOGERROR("Failed to load normal writing shader");
+                return;
+            }
+
+            // Positions and normals are packed one after another in the upload ring.  Positions are contiguous in the
+            // geometry range and go out as one copy, normals are written into the interleaved attributes by a dispatch
+            const VkDeviceSize verticesSize = sizeof(vec3) * vertexCount;
+            const VkDeviceSize stagingSize = normalsArray != nullptr ? verticesSize * 2 : verticesSize;
+
+            Vulkan::RingAllocation stagingAllocation;
+            if (!uploadRing_.Allocate(stagingSize, sizeof(vec4), stagingAllocation))
+            {
+                PFG_EDITORLOGERROR("Failed to allocate vertex updates from upload ring");
+                return;
+            }
+
+            auto stagedVertices = reinterpret_cast<vec3*>(stagingAllocation.data);
+            std::memcpy(stagedVertices, verticesArray, static_cast<size_t>(verticesSize));
+            if (normalsArray != nullptr)
+            {
+                std::memcpy(stagedVertices + vertexCount, normalsArray, static_cast<size_t>(verticesSize));
+            }
+            uploadRing_.Flush(stagingAllocation, stagingSize);
+
+            VkBufferCopy verticesCopy = { stagingAllocation.offset, mesh->geometry.offset + mesh->verticesOffset, verticesSize };
+
+            VkCommandBuffer commandBuffer;
+            CreateWorkerCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, graphicsCommandPool_, commandBuffer);
+
+            // Traces and builds already submitted must be done reading the old vertices
+            vkCmdPipelineBarrier(
+                commandBuffer,
+                VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+            vkCmdCopyBuffer(commandBuffer, stagingAllocation.buffer, geometryBuffer_.GetPage(mesh->geometry.page).GetBuffer(), 1, &verticesCopy);
+
+            if (normalsArray != nullptr)
+            {
+                normalWriter_.Record(
+                    commandBuffer,
+                    stagingAllocation.deviceAddress + verticesSize,
+                    geometryBuffer_.GetDeviceAddress(mesh->geometry) + mesh->attributesOffset,
+                    static_cast<uint32_t>(vertexCount));
+            }
+
+            // Make the copy visible to the blas refit and closest hit shaders
+            VkMemoryBarrier memoryBarrier = {};
+            memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_SHADER_READ_BIT;
+            vkCmdPipelineBarrier(
+                commandBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+            SubmitWorkerCommandBuffer(commandBuffer, graphicsCommandPool_, graphicsQueue_);
+        }
+
+        // The geometry no longer matches what the cache entry was built from
+        mesh->cacheKey = RayTracerMeshSharedData::kNoCacheKey;
+
+        // Static batches were merged from the old vertices, instances of the mesh are traced on their own from now on
+        if (!mesh->batchVertices.empty())
+        {
+            mesh->batchVertices = std::vector<vec3>();
+            mesh->batchAttributes = std::vector<ShaderVertexAttribute>();
+            mesh->batchIndices = std::vector<uint32_t>();
+
+            for (auto itr = meshInstancePool_.in_use_begin(); itr != meshInstancePool_.in_use_end(); ++itr)
+            {
+                if (meshInstancePool_[*itr]->sharedMeshIndex == sharedMeshIndex && meshInstancePool_[*itr]->inStaticBatch)
+                {
+                    RemoveFromStaticBatch(*itr);
+                }
+            }
+        }
+
+        // How far the vertices drifted from the blas decides when refitting it stops paying off
+        mesh->bounds = Vulkan::Bounds();
+        for (int i = 0; i < vertexCount; ++i)
+        {
+            mesh->bounds.Add(vec3(verticesArray[3 * i + 0], verticesArray[3 * i + 1], verticesArray[3 * i + 2]));
+        }
+
+        // Not built yet, the pending build reads the new vertices.  It has to be a device build so it can be refit later
+        if (mesh->blas.accelerationStructure == VK_NULL_HANDLE)
+        {
+            mesh->deformable = true;
+            mesh->hostVertices = std::vector<vec3>();
+            mesh->hostIndices = std::vector<uint32_t>();
+            return;
+        }
+
+        if (!mesh->blasDirty)
+        {
+            mesh->blasDirty = true;
+            dirtyBlases_.push_back(sharedMeshIndex);
+        }
+    }
+
+    int RayTracer::GetTlasInstanceIndex(int gameObjectInstanceId)
+    {
+        for (auto itr = meshInstancePool_.in_use_begin(); itr != meshInstancePool_.in_use_end(); ++itr)
+        {
+            auto index = *itr;
+            if (meshInstancePool_[index]->gameObjectInstanceId == gameObjectInstanceId && !meshInstancePool_[index]->isStaticBatch)
+            {
+                return index;
+            }
+        }
+
+        return -1;
+    }
+
+    int RayTracer::AddTlasInstance(int gameObjectInstanceId, int sharedMeshIndex, float* l2wMatrix) 
+    { 
+        if (sharedMeshIndex < 0 || sharedMeshIndex >= static_cast<int>(sharedMeshesPool_.pool_size()) || !sharedMeshesPool_[sharedMeshIndex])
+        {
+            PFG_EDITORLOGERROR("Can't add instance of unknown shared mesh index " + std::to_string(sharedMeshIndex));
+            return -1;
+        }
+
+        // Keeps the mesh alive, even if it was queued for release
+        ++sharedMeshesPool_[sharedMeshIndex]->instanceCount;
+
+        auto instance = std::make_unique<RayTracerMeshInstanceData>();
+
+        instance->gameObjectInstanceId = gameObjectInstanceId;
+        instance->sharedMeshIndex = sharedMeshIndex;
+        FloatArrayToMatrix(l2wMatrix, instance->localToWorld);
+
+        int index = meshInstancePool_.add(std::move(instance));
+        dirtyInstanceSlots_.push_back(static_cast<uint32_t>(index));
+
+        PFG_EDITORLOG("Added mesh instance (sharedMeshIndex: " + std::to_string(sharedMeshIndex) + ")");
+
+        // If we added an instance, we need to rebuild the tlas
+        rebuildTlas_ = true;
+
+        return index; 
+    }
+
+    void RayTracer::RemoveTlasInstance(int meshInstanceIndex) 
+    {
+        if (meshInstanceIndex < 0 || meshInstanceIndex >= static_cast<int>(meshInstancePool_.pool_size()) || !meshInstancePool_[meshInstanceIndex])
+        {
+            PFG_EDITORLOGERROR("Can't remove unknown mesh instance index " + std::to_string(meshInstanceIndex));
+            return;
+        }
+
+        if (meshInstancePool_[meshInstanceIndex]->isStaticBatch)
+        {
+            PFG_EDITORLOGERROR("Can't remove mesh instance index " + std::to_string(meshInstanceIndex) + ", it belongs to a static batch");
+            return;
+        }
+
+        // Its triangles are part of the batch's merged mesh until the batch is merged again
+        if (meshInstancePool_[meshInstanceIndex]->inStaticBatch)
+        {
+            RemoveFromStaticBatch(meshInstanceIndex);
+        }
+
+        const int sharedMeshIndex = meshInstancePool_[meshInstanceIndex]->sharedMeshIndex;
+        meshInstancePool_.remove(meshInstanceIndex);
+
+        // The slot's record becomes inactive
+        dirtyInstanceSlots_.push_back(static_cast<uint32_t>(meshInstanceIndex));
+
+        // The last instance of a mesh takes the mesh with it
+        auto& mesh = sharedMeshesPool_[sharedMeshIndex];
+        --mesh->instanceCount;
+        if (mesh->instanceCount == 0 && std::find(releasedSharedMeshes_.begin(), releasedSharedMeshes_.end(), sharedMeshIndex) == releasedSharedMeshes_.end())
+        {
+            releasedSharedMeshes_.push_back(sharedMeshIndex);
+        }
+
+        // If we added an instance, we need to rebuild the tlas
+        rebuildTlas_ = true;
+    }
+
+    void RayTracer::UpdateTlasInstanceTransform(int meshInstanceIndex, float* l2wMatrix)
+    {
+        if (meshInstanceIndex < 0 || meshInstanceIndex >= static_cast<int>(meshInstancePool_.pool_size()) || !meshInstancePool_[meshInstanceIndex])
+        {
+            PFG_EDITORLOGERROR("Can't move unknown mesh instance index " + std::to_string(meshInstanceIndex));
+            return;
+        }
+
+        if (meshInstancePool_[meshInstanceIndex]->isStaticBatch)
+        {
+            PFG_EDITORLOGERROR("Can't move mesh instance index " + std::to_string(meshInstanceIndex) + ", it belongs to a static batch");
+            return;
+        }
+
+        // Static scenery that moves anyway is traced on its own rather than merging its batch again every frame
+        if (meshInstancePool_[meshInstanceIndex]->inStaticBatch)
+        {
+            RemoveFromStaticBatch(meshInstanceIndex);
+        }
+
+        FloatArrayToMatrix(l2wMatrix, meshInstancePool_[meshInstanceIndex]->localToWorld);
+        dirtyInstanceSlots_.push_back(static_cast<uint32_t>(meshInstanceIndex));
+
+        // Only the transform changed, refit the tlas unless something else needs a rebuild
+        updateTlas_ = true;
+    }
+
+    void RayTracer::SetTlasInstanceStatic(int meshInstanceIndex, int isStatic)
+    {
+        if (meshInstanceIndex < 0 || meshInstanceIndex >= static_cast<int>(meshInstancePool_.pool_size()) || !meshInstancePool_[meshInstanceIndex])
+        {
+            PFG_EDITORLOGERROR("Can't mark unknown mesh instance index " + std::to_string(meshInstanceIndex) + " static");
+            return;
+        }
+
+        auto& instance = meshInstancePool_[meshInstanceIndex];
+        if (instance->isStaticBatch)
+        {
+            PFG_EDITORLOGERROR("Can't mark mesh instance index " + std::to_string(meshInstanceIndex) + " static, it belongs to a static batch");
+            return;
+        }
+
+        instance->isStatic = isStatic != 0;
+
+        if (!instance->isStatic && instance->inStaticBatch)
+        {
+            RemoveFromStaticBatch(meshInstanceIndex);
+        }
+        else if (instance->isStatic && !instance->inStaticBatch && staticBatchingEnabled_)
+        {
+            AddToStaticBatch(meshInstanceIndex);
+        }
+    }
+
+    void RayTracer::SetTlasBuildPolicy(int buildPolicy)
+    {
+        if (buildPolicy < 0 || buildPolicy >= static_cast<int>(RayTracerBuildPolicy::Count))
+        {
+            PFG_EDITORLOGERROR("Unknown tlas build policy " + std::to_string(buildPolicy));
+            return;
+        }
+
+        if (tlasBuildPolicy_ == static_cast<RayTracerBuildPolicy>(buildPolicy))
+        {
+            return;
+        }
+
+        // The current tlas was built with the old flags, it can't be refit with the new ones
+        tlasBuildPolicy_ = static_cast<RayTracerBuildPolicy>(buildPolicy);
+        rebuildTlas_ = true;
+    }
+
+    void RayTracer::AddToStaticBatch(int meshInstanceIndex)
+    {
+        auto& instance = meshInstancePool_[meshInstanceIndex];
+        const auto& mesh = sharedMeshesPool_[instance->sharedMeshIndex];
+
+        // Only meshes added while batching was on have a copy to merge from, and deforming meshes would have to be
+        // merged again every time they change
+        if (mesh->batchVertices.empty() || mesh->deformable)
+        {
+            return;
+        }
+
+        const Vulkan::Bounds bounds = mesh->bounds.Transformed(instance->localToWorld);
+        if (bounds.IsEmpty())
+        {
+            return;
+        }
+
+        instance->staticBatchKey = StaticBatchCellKey((bounds.min + bounds.max) * 0.5f, staticBatchCellSize_);
+        instance->inStaticBatch = true;
+
+        auto& batch = staticBatches_[instance->staticBatchKey];
+        batch.memberInstances.push_back(meshInstanceIndex);
+        batch.dirty = true;
+    }
+
+    void RayTracer::RemoveFromStaticBatch(int meshInstanceIndex)
+    {
+        auto& instance = meshInstancePool_[meshInstanceIndex];
+
+        auto batch = staticBatches_.find(instance->staticBatchKey);
+        if (batch != staticBatches_.end())
+        {
+            auto& members = batch->second.memberInstances;
+            members.erase(std::remove(members.begin(), members.end(), meshInstanceIndex), members.end());
+            batch->second.dirty = true;
+        }
+
+        instance->inStaticBatch = false;
+
+        // Traced on its own again, its record has to be written with its blas
+        if (instance->mergedIntoStaticBatch)
+        {
+            instance->mergedIntoStaticBatch = false;
+            instance->hasDescription = false;
+            dirtyInstanceSlots_.push_back(static_cast<uint32_t>(meshInstanceIndex));
+            rebuildTlas_ = true;
+        }
+    }
+
+    void RayTracer::BuildStaticBatches()
+    {
+        for (auto itr = staticBatches_.begin(); itr != staticBatches_.end();)
+        {
+            auto& batch = itr->second;
+            if (!batch.dirty)
+            {
+                ++itr;
+                continue;
+            }
+
+            batch.dirty = false;
+
+            // The old merged mesh goes away with its instance, and its members are traced on their own until they are
+            // merged again
+            ReleaseStaticBatchInstance(batch);
+            for (auto memberIndex : batch.memberInstances)
+            {
+                auto& member = meshInstancePool_[memberIndex];
+                if (member->mergedIntoStaticBatch)
+                {
+                    member->mergedIntoStaticBatch = false;
+                    member->hasDescription = false;
+                    dirtyInstanceSlots_.push_back(static_cast<uint32_t>(memberIndex));
+                }
+            }
+
+            if (batch.memberInstances.empty())
+            {
+                itr = staticBatches_.erase(itr);
+                continue;
+            }
+
+            if (batch.memberInstances.size() < kStaticBatchMinInstances)
+            {
+                ++itr;
+                continue;
+            }
+
+            // Members are pre-transformed to world space, so the merged mesh is traced with an identity transform
+            std::vector<float> vertices;
+            std::vector<float> normals;
+            std::vector<float> uvs;
+            std::vector<int> vertexStarts;
+            size_t submeshCount = 0;
+            for (auto memberIndex : batch.memberInstances)
+            {
+                const auto& member = meshInstancePool_[memberIndex];
+                const auto& mesh = sharedMeshesPool_[member->sharedMeshIndex];
+
+                // localToWorld holds the transform's rows, so as a glm matrix it is the transpose and its inverse is
+                // the inverse transpose normals need
+                const mat4& t = member->localToWorld;
+                const mat3 normalTransform = glm::inverse(mat3(t));
+
+                vertexStarts.push_back(static_cast<int>(vertices.size() / 3));
+                for (size_t i = 0; i < mesh->batchVertices.size(); ++i)
+                {
+                    const vec4 position = vec4(mesh->batchVertices[i], 1.0f);
+                    vertices.push_back(glm::dot(t[0], position));
+                    vertices.push_back(glm::dot(t[1], position));
+                    vertices.push_back(glm::dot(t[2], position));
+
+                    vec3 normal = normalTransform * mesh->batchAttributes[i].normal;
+                    const float normalLength = glm::length(normal);
+                    if (normalLength > 0.0f)
+                    {
+                        normal /= normalLength;
+                    }
+                    normals.push_back(normal.x);
+                    normals.push_back(normal.y);
+                    normals.push_back(normal.z);
+
+                    uvs.push_back(mesh->batchAttributes[i].uv.x);
+                    uvs.push_back(mesh->batchAttributes[i].uv.y);
+                }
+
+                submeshCount = std::max(submeshCount, mesh->submeshes.size());
+            }
+
+            // Submesh i of every member becomes geometry i of the merged blas, so material slots are kept.  Every
+            // triangle remembers the game object it came from
+            std::vector<int> indices;
+            std::vector<uint32_t> sourceInstanceIds;
+            std::vector<int> submeshIndexStarts;
+            std::vector<int> submeshIndexCounts;
+            for (size_t submesh = 0; submesh < submeshCount; ++submesh)
+            {
+                submeshIndexStarts.push_back(static_cast<int>(indices.size()));
+
+                for (size_t m = 0; m < batch.memberInstances.size(); ++m)
+                {
+                    const auto& member = meshInstancePool_[batch.memberInstances[m]];
+                    const auto& mesh = sharedMeshesPool_[member->sharedMeshIndex];
+                    if (submesh >= mesh->submeshes.size())
+                    {
+                        continue;
+                    }
+
+                    const RayTracerSubmesh& range = mesh->submeshes[submesh];
+                    for (uint32_t i = 0; i < range.indexCount; ++i)
+                    {
+                        indices.push_back(vertexStarts[m] + static_cast<int>(mesh->batchIndices[range.indexStart + i]));
+                    }
+                    sourceInstanceIds.insert(sourceInstanceIds.end(), range.indexCount / 3, static_cast<uint32_t>(member->gameObjectInstanceId));
+                }
+
+                submeshIndexCounts.push_back(static_cast<int>(indices.size()) - submeshIndexStarts.back());
+            }
+
+            const int sharedMeshIndex = AddSharedMeshGeometry(
+                0,
+                vertices.data(),
+                normals.data(),
+                uvs.data(),
+                static_cast<int>(vertices.size() / 3),
+                indices.data(),
+                static_cast<int>(indices.size()),
+                submeshIndexStarts.data(),
+                submeshIndexCounts.data(),
+                static_cast<int>(submeshCount),
+                static_cast<int>(RayTracerBuildPolicy::Static),
+                &sourceInstanceIds);
+
+            if (sharedMeshIndex < 0)
+            {
+                PFG_EDITORLOGERROR("Failed to merge static batch of " + std::to_string(batch.memberInstances.size()) + " instances, they are traced on their own");
+                ++itr;
+                continue;
+            }
+
+            auto batchInstance = std::make_unique<RayTracerMeshInstanceData>();
+            batchInstance->sharedMeshIndex = sharedMeshIndex;
+            batchInstance->localToWorld = mat4(1.0f);
+            batchInstance->isStaticBatch = true;
+            ++sharedMeshesPool_[sharedMeshIndex]->instanceCount;
+
+            batch.sharedMeshIndex = sharedMeshIndex;
+            batch.meshInstanceIndex = meshInstancePool_.add(std::move(batchInstance));
+            dirtyInstanceSlots_.push_back(static_cast<uint32_t>(batch.meshInstanceIndex));
+
+            // The members' own records become inactive
+            for (auto memberIndex : batch.memberInstances)
+            {
+                meshInstancePool_[memberIndex]->mergedIntoStaticBatch = true;
+                dirtyInstanceSlots_.push_back(static_cast<uint32_t>(memberIndex));
+            }
+
+            rebuildTlas_ = true;
+
+            PFG_EDITORLOG("Merged " + std::to_string(batch.memberInstances.size()) + " static instances into shared mesh index " + std::to_string(sharedMeshIndex));
+
+            ++itr;
+        }
+    }
+
+    void RayTracer::ReleaseStaticBatchInstance(RayTracerStaticBatch& batch)
+    {
+        if (batch.meshInstanceIndex < 0)
+        {
+            return;
+        }
+
+        meshInstancePool_.remove(batch.meshInstanceIndex);
+        dirtyInstanceSlots_.push_back(static_cast<uint32_t>(batch.meshInstanceIndex));
+
+        // Nothing else references the merged mesh
+        auto& mesh = sharedMeshesPool_[batch.sharedMeshIndex];
+        --mesh->instanceCount;
+        if (mesh->instanceCount == 0 && std::find(releasedSharedMeshes_.begin(), releasedSharedMeshes_.end(), batch.sharedMeshIndex) == releasedSharedMeshes_.end())
+        {
+            releasedSharedMeshes_.push_back(batch.sharedMeshIndex);
+        }
+
+        batch.sharedMeshIndex = -1;
+        batch.meshInstanceIndex = -1;
+        rebuildTlas_ = true;
+    }
+
+    void RayTracer::BuildTlas() 
+    {
+        // BuildTlas is the first call the render pipeline makes each frame, so start the next upload frame here.
+        // Unity may still be recording the previous frame on the render thread, so tag uploads one frame past the
+        // next frame Unity will record.
+        UpdateCompletedSubmissions();
+        uploadRing_.BeginFrame(currentFrameNumber_ + 2, safeFrameNumber_);
+        renderTargetPool_.Trim(currentFrameNumber_, safeFrameNumber_);
+        ReleaseRetiredResources(safeFrameNumber_);
+        ReadTimestamps();
+
+        // Batches replace their merged meshes, before the old ones are released and the new ones built
+        BuildStaticBatches();
+
+        // Before any blas work, so meshes that are gone aren't built
+        ReleaseSharedMeshes();
+
+        // Deformed meshes seen for the first time are queued for a full build here
+        RefitBlases();
+
+        // Meshes added since the last frame need their blases before instances can reference them.  Those seen on a
+        // previous run come from the acceleration structure cache instead of being built
+        LoadCachedBlases();
+        BuildPendingBlases();
+        UploadHostBlases();
+
+        // Compacted blases are picked up by the rebuild below as well
+        CompactBlases();
+        SerializeBlases();
+
+        // Moved blases are picked up by the rebuild below
+        Defragment(defragmentationBudgetMilliseconds_);
+
+        // If there is nothing to do, skip building the tlas
+        if (rebuildTlas_ == false && updateTlas_ == false)
+        {
+            return;
+        }
+
+        // Without instances there is nothing to build until the first one is added.  Once layers exist they are built
+        // empty instead, they may still reference blases of meshes released with the last instance
+        if (meshInstancePool_.in_use_size() == 0 && staticTlas_.tlas.accelerationStructure == VK_NULL_HANDLE && dynamicTlas_.tlas.accelerationStructure == VK_NULL_HANDLE)
+        {
+            rebuildTlas_ = false;
+            updateTlas_ = false;
+            return;
+        }
+
+        // Build the acceleration structures on the device via a one-time command buffer submission.  Instance records
+        // are generated first, which may replace the instance buffer
+        VkCommandBuffer commandBuffer;
+        CreateWorkerCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, graphicsCommandPool_, commandBuffer);
+
+        std::vector<uint32_t> writtenSlots;
+        std::vector<uint32_t> describedSlots;
+        std::vector<Vulkan::Buffer> uploadBuffers;
+        if (!WriteDirtyInstances(commandBuffer, writtenSlots, describedSlots, uploadBuffers))
+        {
+            PFG_EDITORLOGERROR("Failed to write tlas instances");
+
+            // Nothing was recorded, submit anyway so the command buffer is recycled with the others
+            SubmitWorkerCommandBuffer(commandBuffer, graphicsCommandPool_, graphicsQueue_);
+            return;
+        }
+
+        // Instances merged into a static batch are traced through the batch's instance.  Deformed meshes change every
+        // frame, so their instances are dynamic even when flagged static
+        std::vector<uint32_t> staticSlots;
+        std::vector<uint32_t> dynamicSlots;
+        for (auto itr = meshInstancePool_.in_use_begin(); itr != meshInstancePool_.in_use_end(); ++itr)
+        {
+            const auto& instance = meshInstancePool_[*itr];
+            if (instance->mergedIntoStaticBatch)
+            {
+                continue;
+            }
+
+            if ((instance->isStatic || instance->isStaticBatch) && !sharedMeshesPool_[instance->sharedMeshIndex]->deformable)
+            {
+                staticSlots.push_back(*itr);
+            }
+            else
+            {
+                dynamicSlots.push_back(*itr);
+            }
+        }
+        std::sort(staticSlots.begin(), staticSlots.end());
+        std::sort(dynamicSlots.begin(), dynamicSlots.end());
+
+        const auto containsAny = [](const std::vector<uint32_t>& layerSlots, const std::vector<uint32_t>& slots)
+        {
+            for (auto slot : slots)
+            {
+                if (std::binary_search(layerSlots.begin(), layerSlots.end(), slot))
+                {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        // Tlas layers point at records in the instance buffer, growing it moves them all
+        const VkDeviceAddress recordsAddress = instancesBuffer_.GetBufferDeviceAddress().deviceAddress;
+
+        // The static tlas is never refit, anything in it changing is a rebuild.  It is rebuilt in place, so it is never
+        // compacted either
+        const VkBuildAccelerationStructureFlagsKHR staticBuildFlags = GetBuildPolicyFlags(RayTracerBuildPolicy::Static) & ~VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+        const bool buildStatic =
+            staticTlas_.tlas.accelerationStructure == VK_NULL_HANDLE ||
+            staticTlas_.recordsAddress != recordsAddress ||
+            staticTlas_.buildFlags != staticBuildFlags ||
+            staticTlas_.slots != staticSlots ||
+            containsAny(staticSlots, writtenSlots);
+
+        // The dynamic tlas is refit when only transforms or blas bounds changed, updateTlas_ covers the latter
+        const VkBuildAccelerationStructureFlagsKHR dynamicBuildFlags = GetBuildPolicyFlags(tlasBuildPolicy_) & ~VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+        const bool dynamicChanged = updateTlas_ || containsAny(dynamicSlots, writtenSlots);
+        const bool rebuildDynamic =
+            dynamicTlas_.tlas.accelerationStructure == VK_NULL_HANDLE ||
+            dynamicTlas_.recordsAddress != recordsAddress ||
+            dynamicTlas_.buildFlags != dynamicBuildFlags ||
+            dynamicTlas_.slots != dynamicSlots ||
+            containsAny(dynamicSlots, describedSlots) ||
+            (dynamicChanged && (dynamicBuildFlags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR) == 0);
+        const bool buildDynamic = rebuildDynamic || dynamicChanged;
+        bool updateDynamic = !rebuildDynamic;
+
+        // Refits keep the tree built for where instances were.  Rebuild once the trace time lost to that adds up to
+        // more than a rebuild costs over a refit, or instances drifted too far
+        if (buildDynamic && updateDynamic)
+        {
+            float driftSurfaceArea = 0.0f;
+            for (auto slot : dynamicSlots)
+            {
+                const auto& instance = meshInstancePool_[slot];
+
+                Vulkan::Bounds drift = instance->tlasBounds;
+                drift.Add(sharedMeshesPool_[instance->sharedMeshIndex]->bounds.Transformed(instance->localToWorld));
+                driftSurfaceArea += drift.SurfaceArea();
+            }
+            tlasQuality_.Updated(driftSurfaceArea);
+
+            const float rebuildMilliseconds = (tlasBuildMilliseconds_ > 0.0f && tlasRefitMilliseconds_ > 0.0f) ? std::max(tlasBuildMilliseconds_ - tlasRefitMilliseconds_, 0.001f) : 0.0f;
+            if (tlasQuality_.NeedsRebuild(rebuildMilliseconds, kTlasUpdatesPerRebuild, kTlasMaxBoundsGrowth))
+            {
+                PFG_EDITORLOG("Rebuilding dynamic tlas after " + std::to_string(tlasQuality_.GetUpdateCount()) + " refits (bounds growth: " + std::to_string(tlasQuality_.GetBoundsGrowth()) + ", lost trace time: " + std::to_string(tlasQuality_.GetLostMilliseconds()) + " ms)");
+                updateDynamic = false;
+            }
+        }
+
+        const VkAccelerationStructureBuildSizesInfoKHR staticBuildSizes = GetTlasBuildSizes(staticBuildFlags, static_cast<uint32_t>(staticSlots.size()));
+        const VkAccelerationStructureBuildSizesInfoKHR dynamicBuildSizes = GetTlasBuildSizes(dynamicBuildFlags, static_cast<uint32_t>(dynamicSlots.size()));
+
+        // Scratch comes from the shared arena, worker command buffers start with a barrier so earlier builds are done
+        // with it.  Both layers are built side by side, so each gets its own slice
+        VkDeviceSize scratchSize = 0;
+        if (buildStatic)
+        {
+            scratchSize += scratchBuffer_.GetAlignedSize(staticBuildSizes.buildScratchSize);
+        }
+        if (buildDynamic)
+        {
+            scratchSize += scratchBuffer_.GetAlignedSize(updateDynamic ? dynamicBuildSizes.updateScratchSize : dynamicBuildSizes.buildScratchSize);
+        }
+        scratchBuffer_.Reset();
+
+        Vulkan::Buffer releasedScratch;
+        VkResult scratchResult = scratchBuffer_.Reserve(scratchSize, releasedScratch);
+        if (releasedScratch.GetBuffer() != VK_NULL_HANDLE)
+        {
+            submissionRetiredBuffers_.push_back(std::make_pair(submittedTimelineValue_, releasedScratch));
+        }
+
+        bool recorded = scratchResult == VK_SUCCESS;
+        if (!recorded)
+        {
+            PFG_EDITORLOGERROR("Failed to reserve scratch memory for tlas");
+        }
+
+        if (recorded && buildStatic)
+        {
+            recorded = RecordTlasLayerBuild(commandBuffer, staticTlas_, staticSlots, staticBuildFlags, false, staticBuildSizes, uploadBuffers);
+            if (recorded)
+            {
+                PFG_EDITORLOG("Successfully built static tlas (instances: " + std::to_string(staticSlots.size()) + ")");
+            }
+        }
+
+        // Time builds and refits so their difference can be weighed against the trace time refits lose.  Only the
+        // dynamic tlas is timed, it is the one refits are traded against
+        const bool timeBuild = recorded && buildDynamic && timestampQueryPool_ != VK_NULL_HANDLE && tlasTimingTimelineValue_ == 0;
+        if (timeBuild)
+        {
+            vkCmdResetQueryPool(commandBuffer, timestampQueryPool_, 0, 2);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool_, 0);
+        }
+
+        if (recorded && buildDynamic)
+        {
+            recorded = RecordTlasLayerBuild(commandBuffer, dynamicTlas_, dynamicSlots, dynamicBuildFlags, updateDynamic, dynamicBuildSizes, uploadBuffers);
+            // Refits happen every frame moving instances are, only log rebuilds
+            if (recorded && !updateDynamic)
+            {
+                PFG_EDITORLOG("Successfully built dynamic tlas (instances: " + std::to_string(dynamicSlots.size()) + ")");
+            }
+        }
+
+        if (timeBuild)
+        {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, timestampQueryPool_, 1);
+        }
+
+        const uint64_t timelineValue = SubmitWorkerCommandBuffer(commandBuffer, graphicsCommandPool_, graphicsQueue_);
+
+        // The copies are still in flight, keep their sources until they are done
+        for (auto& uploadBuffer : uploadBuffers)
+        {
+            submissionRetiredBuffers_.push_back(std::make_pair(timelineValue, uploadBuffer));
+        }
+
+        if (!recorded)
+        {
+            // Layers are picked by the slots written this time, keep them dirty so the next build sees them again
+            dirtyInstanceSlots_.insert(dirtyInstanceSlots_.end(), writtenSlots.begin(), writtenSlots.end());
+
+            PFG_EDITORLOGERROR("Failed to build tlas");
+            return;
+        }
+
+        if (timeBuild)
+        {
+            tlasTimingTimelineValue_ = timelineValue;
+            tlasTimingUpdate_ = updateDynamic;
+        }
+
+        // Refits are measured against the dynamic instances' bounds at the last full build
+        if (buildDynamic && !updateDynamic)
+        {
+            float surfaceArea = 0.0f;
+            for (auto slot : dynamicSlots)
+            {
+                const auto& instance = meshInstancePool_[slot];
+                instance->tlasBounds = sharedMeshesPool_[instance->sharedMeshIndex]->bounds.Transformed(instance->localToWorld);
+                surfaceArea += instance->tlasBounds.SurfaceArea();
+            }
+            tlasQuality_.Built(surfaceArea);
+            ++tlasBuildCount_;
+        }
+        
+        // We did any pending work, reset flags
+        rebuildTlas_= false;
+        updateTlas_ = false;
+    }
+
+    bool RayTracer::WriteDirtyInstances(VkCommandBuffer commandBuffer, std::vector<uint32_t>& outWrittenSlots, std::vector<uint32_t>& outDescribedSlots, std::vector<Vulkan::Buffer>& outReleasedBuffers)
+    {
+        // The shader folder is only known once Unity has set it, so the pipeline is created on first use
+        if (!instanceGenerator_.IsLoaded() && !instanceGenerator_.Load(shaderFolder_))
+        {
+            return false;
+        }
+
+        const uint32_t instanceSlotCount = static_cast<uint32_t>(meshInstancePool_.pool_size());
+        const VkDeviceSize recordSize = sizeof(VkAccelerationStructureInstanceKHR);
+        const VkDeviceSize descriptionSize = sizeof(ShaderInstanceDescription);
+
+        // Blases move when they are built, compacted, loaded or defragmented, all of which rebuild the tlas
+        if (rebuildTlas_)
+        {
+            for (auto itr = meshInstancePool_.in_use_begin(); itr != meshInstancePool_.in_use_end(); ++itr)
+            {
+                const auto& instance = meshInstancePool_[*itr];
+                const auto& mesh = sharedMeshesPool_[instance->sharedMeshIndex];
+                if (!instance->mergedIntoStaticBatch && (instance->recordBlasAddress != mesh->blas.deviceAddress || instance->recordCustomIndex != mesh->meshDataOffset))
+                {
+                    dirtyInstanceSlots_.push_back(*itr);
+                }
+            }
+        }
+
+        // Grow by doubling so adding instances one at a time doesn't copy the records every build
+        Vulkan::Buffer grownRecords;
+        Vulkan::Buffer grownDescriptions;
+        uint32_t grownCapacity = instancesCapacity_;
+        if (instanceSlotCount > instancesCapacity_)
+        {
+            grownCapacity = std::max(instanceSlotCount, std::max(instancesCapacity_ * 2, 64u));
+
+            // Both are written by copies and read by the instance generation shader through their address
+            const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+            if (grownRecords.Create(
+                    device_,
+                    physicalDeviceMemoryProperties_,
+                    grownCapacity * recordSize,
+                    usage | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    Vulkan::MemoryCategory::TopLevelAccelerationStructure)
+                    != VK_SUCCESS ||
+                grownDescriptions.Create(
+                    device_,
+                    physicalDeviceMemoryProperties_,
+                    grownCapacity * descriptionSize,
+                    usage,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    Vulkan::MemoryCategory::TopLevelAccelerationStructure)
+                    != VK_SUCCESS)
+            {
+                grownRecords.Destroy();
+                grownDescriptions.Destroy();
+                return false;
+            }
+
+            // Nothing to copy from, every record has to be written
+            if (instancesBuffer_.GetBuffer() == VK_NULL_HANDLE)
+            {
+                dirtyInstanceSlots_.insert(dirtyInstanceSlots_.end(), meshInstancePool_.in_use_begin(), meshInstancePool_.in_use_end());
+            }
+        }
+
+        // Slots are marked every time they change, write each once
+        std::sort(dirtyInstanceSlots_.begin(), dirtyInstanceSlots_.end());
+        dirtyInstanceSlots_.erase(std::unique(dirtyInstanceSlots_.begin(), dirtyInstanceSlots_.end()), dirtyInstanceSlots_.end());
+
+        // Descriptions only change when instances come and go or their blas moves.  Moving an instance only streams
+        // its transform
+        std::vector<ShaderInstanceDescription> descriptions;
+        std::vector<VkBufferCopy> descriptionCopies;
+        for (auto slot : dirtyInstanceSlots_)
+        {
+            // Empty slots and instances merged into a static batch get a description without a blas, which makes their
+            // record inactive
+            ShaderInstanceDescription description = {};
+
+            const auto& instance = meshInstancePool_[slot];
+            if (instance && instance->mergedIntoStaticBatch)
+            {
+                instance->hasDescription = false;
+            }
+            else if (instance)
+            {
+                const auto& mesh = sharedMeshesPool_[instance->sharedMeshIndex];
+                if (instance->hasDescription && instance->recordBlasAddress == mesh->blas.deviceAddress && instance->recordCustomIndex == mesh->meshDataOffset)
+                {
+                    continue;
+                }
+
+                // Hit shaders find the mesh's geometry through the mesh data table, one entry per blas geometry
+                description.blasAddressLow = static_cast<uint32_t>(mesh->blas.deviceAddress);
+                description.blasAddressHigh = static_cast<uint32_t>(mesh->blas.deviceAddress >> 32);
+                description.customIndexAndMask = (mesh->meshDataOffset & 0xFFFFFF) | (0xFFu << 24);
+                description.sbtOffsetAndFlags = static_cast<uint32_t>(VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR) << 24;
+
+                instance->recordBlasAddress = mesh->blas.deviceAddress;
+                instance->recordCustomIndex = mesh->meshDataOffset;
+                instance->hasDescription = true;
+            }
+
+            outDescribedSlots.push_back(slot);
+
+            // Runs of consecutive slots go out as one copy region, srcOffset is relative to the upload until it is known
+            const VkDeviceSize dstOffset = slot * descriptionSize;
+            if (!descriptionCopies.empty() && descriptionCopies.back().dstOffset + descriptionCopies.back().size == dstOffset)
+            {
+                descriptionCopies.back().size += descriptionSize;
+            }
+            else
+            {
+                VkBufferCopy descriptionCopy = { descriptions.size() * descriptionSize, dstOffset, descriptionSize };
+                descriptionCopies.push_back(descriptionCopy);
+            }
+
+            descriptions.push_back(description);
+        }
+
+        const VkDeviceSize transformsSize = dirtyInstanceSlots_.size() * sizeof(ShaderInstanceTransform);
+        const VkDeviceSize descriptionsSize = descriptions.size() * descriptionSize;
+
+        Vulkan::RingAllocation transformsAllocation;
+        Vulkan::RingAllocation descriptionsAllocation;
+        bool transformsStaged = false;
+        bool descriptionsStaged = false;
+        if ((transformsSize > 0 && !AllocateUpload(transformsSize, transformsAllocation, transformsStaged, outReleasedBuffers)) ||
+            (descriptionsSize > 0 && !AllocateUpload(descriptionsSize, descriptionsAllocation, descriptionsStaged, outReleasedBuffers)))
+        {
+            grownRecords.Destroy();
+            grownDescriptions.Destroy();
+            return false;
+        }
+
+        if (grownRecords.GetBuffer() != VK_NULL_HANDLE)
+        {
+            if (instancesBuffer_.GetBuffer() != VK_NULL_HANDLE)
+            {
+                VkBufferCopy recordsCopy = { 0, 0, instancesCapacity_ * recordSize };
+                vkCmdCopyBuffer(commandBuffer, instancesBuffer_.GetBuffer(), grownRecords.GetBuffer(), 1, &recordsCopy);
+
+                VkBufferCopy descriptionsCopy = { 0, 0, instancesCapacity_ * descriptionSize };
+                vkCmdCopyBuffer(commandBuffer, instanceDescriptionsBuffer_.GetBuffer(), grownDescriptions.GetBuffer(), 1, &descriptionsCopy);
+
+                // Earlier builds and the copies above still read them
+                outReleasedBuffers.push_back(instancesBuffer_);
+                outReleasedBuffers.push_back(instanceDescriptionsBuffer_);
+            }
+
+            // Slots past the old capacity start out inactive
+            vkCmdFillBuffer(commandBuffer, grownRecords.GetBuffer(), instancesCapacity_ * recordSize, VK_WHOLE_SIZE, 0);
+            vkCmdFillBuffer(commandBuffer, grownDescriptions.GetBuffer(), instancesCapacity_ * descriptionSize, VK_WHOLE_SIZE, 0);
+
+            // Dirty descriptions and records are written over the copied ones
+            VkMemoryBarrier memoryBarrier = {};
+            memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            vkCmdPipelineBarrier(
+                commandBuffer,
+                VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+            instancesBuffer_ = grownRecords;
+            instanceDescriptionsBuffer_ = grownDescriptions;
+            instancesCapacity_ = grownCapacity;
+        }
+
+        if (descriptionsSize > 0)
+        {
+            std::memcpy(descriptionsAllocation.data, descriptions.data(), descriptionsSize);
+            if (!descriptionsStaged)
+            {
+                uploadRing_.Flush(descriptionsAllocation, descriptionsSize);
+            }
+
+            for (auto& descriptionCopy : descriptionCopies)
+            {
+                descriptionCopy.srcOffset += descriptionsAllocation.offset;
+            }
+            vkCmdCopyBuffer(commandBuffer, descriptionsAllocation.buffer, instanceDescriptionsBuffer_.GetBuffer(), static_cast<uint32_t>(descriptionCopies.size()), descriptionCopies.data());
+        }
+
+        if (transformsSize > 0)
+        {
+            // The generation shader only needs the transform, everything else comes from the slot's description
+            auto transforms = reinterpret_cast<ShaderInstanceTransform*>(transformsAllocation.data);
+            for (size_t i = 0; i < dirtyInstanceSlots_.size(); ++i)
+            {
+                const uint32_t slot = dirtyInstanceSlots_[i];
+
+                ShaderInstanceTransform transform = {};
+                transform.slot = slot;
+
+                const auto& instance = meshInstancePool_[slot];
+                if (instance)
+                {
+                    const auto& t = instance->localToWorld;
+                    for (int row = 0; row < 3; ++row)
+                    {
+                        for (int column = 0; column < 4; ++column)
+                        {
+                            transform.rows[row * 4 + column] = t[row][column];
+                        }
+                    }
+                }
+
+                transforms[i] = transform;
+            }
+
+            if (!transformsStaged)
+            {
+                uploadRing_.Flush(transformsAllocation, transformsSize);
+            }
+
+            instanceGenerator_.Record(
+                commandBuffer,
+                transformsAllocation.deviceAddress,
+                instanceDescriptionsBuffer_.GetBufferDeviceAddress().deviceAddress,
+                instancesBuffer_.GetBufferDeviceAddress().deviceAddress,
+                static_cast<uint32_t>(dirtyInstanceSlots_.size()));
+        }
+
+        outWrittenSlots.swap(dirtyInstanceSlots_);
+        dirtyInstanceSlots_.clear();
+
+        return true;
+    }
+
+    bool RayTracer::AllocateUpload(VkDeviceSize size, Vulkan::RingAllocation& outAllocation, bool& outStaged, std::vector<Vulkan::Buffer>& outReleasedBuffers)
+    {
+        outStaged = false;
+        if (uploadRing_.Allocate(size, kAccelerationStructureInstanceAlignment, outAllocation))
+        {
+            return true;
+        }
+
+        Vulkan::Buffer stagingBuffer;
+        if (stagingBuffer.Create(
+            device_,
+            physicalDeviceMemoryProperties_,
+            size,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            Vulkan::Buffer::kDefaultMemoryPropertyFlags,
+            Vulkan::MemoryCategory::Staging)
+            != VK_SUCCESS)
+        {
+            return false;
+        }
+
+        outStaged = true;
+        outAllocation.buffer = stagingBuffer.GetBuffer();
+        outAllocation.offset = 0;
+        outAllocation.deviceAddress = stagingBuffer.GetBufferDeviceAddress().deviceAddress;
+        outAllocation.data = stagingBuffer.Map();
+        outReleasedBuffers.push_back(stagingBuffer);
+        return true;
+    }
+
+    VkAccelerationStructureBuildSizesInfoKHR RayTracer::GetTlasBuildSizes(VkBuildAccelerationStructureFlagsKHR buildFlags, uint32_t instanceCount) const
+    {
+        VkAccelerationStructureGeometryKHR accelerationStructureGeometry = {};
+        accelerationStructureGeometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+        accelerationStructureGeometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+        accelerationStructureGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+        accelerationStructureGeometry.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+        accelerationStructureGeometry.geometry.instances.arrayOfPointers = VK_TRUE;
+
+        VkAccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo = {};
+        accelerationStructureBuildGeometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+        accelerationStructureBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+        accelerationStructureBuildGeometryInfo.flags = buildFlags;
+        accelerationStructureBuildGeometryInfo.geometryCount = 1;
+        accelerationStructureBuildGeometryInfo.pGeometries = &accelerationStructureGeometry;
+
+        VkAccelerationStructureBuildSizesInfoKHR accelerationStructureBuildSizesInfo = {};
+        accelerationStructureBuildSizesInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+        vkGetAccelerationStructureBuildSizesKHR(
+            device_,
+            VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+            &accelerationStructureBuildGeometryInfo,
+            &instanceCount,
+            &accelerationStructureBuildSizesInfo);
+
+        return accelerationStructureBuildSizesInfo;
+    }
+
+    bool RayTracer::RecordTlasLayerBuild(VkCommandBuffer commandBuffer, RayTracerTlasLayer& layer, const std::vector<uint32_t>& slots, VkBuildAccelerationStructureFlagsKHR buildFlags, bool update, const VkAccelerationStructureBuildSizesInfoKHR& buildSizes, std::vector<Vulkan::Buffer>& outReleasedBuffers)
+    {
+        const VkDeviceAddress recordsAddress = instancesBuffer_.GetBufferDeviceAddress().deviceAddress;
+
+        // Refits read the same pointers the tlas was built with.  Rebuilds write the address of each slot's record,
+        // the tlas only sees the instances of its layer
+        if (!update)
+        {
+            // Grow by doubling so adding instances one at a time doesn't replace the pointers every build
+            const uint32_t instanceCount = static_cast<uint32_t>(slots.size());
+            if (instanceCount > layer.instancePointersCapacity || layer.instancePointers.GetBuffer() == VK_NULL_HANDLE)
+            {
+                const uint32_t capacity = std::max(instanceCount, std::max(layer.instancePointersCapacity * 2, 64u));
+
+                Vulkan::Buffer instancePointers;
+                if (instancePointers.Create(
+                    device_,
+                    physicalDeviceMemoryProperties_,
+                    capacity * sizeof(VkDeviceAddress),
+                    VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    Vulkan::MemoryCategory::TopLevelAccelerationStructure)
+                    != VK_SUCCESS)
+                {
+                    layer.recordsAddress = 0;
+                    return false;
+                }
+
+                // Earlier builds may still read them
+                if (layer.instancePointers.GetBuffer() != VK_NULL_HANDLE)
+                {
+                    outReleasedBuffers.push_back(layer.instancePointers);
+                }
+
+                layer.instancePointers = instancePointers;
+                layer.instancePointersCapacity = capacity;
+            }
+
+            if (instanceCount > 0)
+            {
+                const VkDeviceSize pointersSize = instanceCount * sizeof(VkDeviceAddress);
+
+                Vulkan::RingAllocation pointersAllocation;
+                bool pointersStaged = false;
+                if (!AllocateUpload(pointersSize, pointersAllocation, pointersStaged, outReleasedBuffers))
+                {
+                    layer.recordsAddress = 0;
+                    return false;
+                }
+
+                auto pointers = reinterpret_cast<VkDeviceAddress*>(pointersAllocation.data);
+                for (uint32_t i = 0; i < instanceCount; ++i)
+                {
+                    pointers[i] = recordsAddress + slots[i] * sizeof(VkAccelerationStructureInstanceKHR);
+                }
+
+                if (!pointersStaged)
+                {
+                    uploadRing_.Flush(pointersAllocation, pointersSize);
+                }
+
+                VkBufferCopy pointersCopy = { pointersAllocation.offset, 0, pointersSize };
+                vkCmdCopyBuffer(commandBuffer, pointersAllocation.buffer, layer.instancePointers.GetBuffer(), 1, &pointersCopy);
+
+                VkMemoryBarrier memoryBarrier = {};
+                memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_SHADER_READ_BIT;
+                vkCmdPipelineBarrier(
+                    commandBuffer,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                    0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+            }
+
+            layer.slots = slots;
+            layer.recordsAddress = recordsAddress;
+            layer.buildFlags = buildFlags;
+        }
+
+        // Rebuilds go into the current tlas while it is big enough, it is only replaced when the instances outgrow it
+        bool tlasReplaced = false;
+        if (!update && (layer.tlas.accelerationStructure == VK_NULL_HANDLE || layer.tlas.buffer.GetSize() < buildSizes.accelerationStructureSize))
+        {
+            tlasReplaced = true;
+
+            const VkDeviceSize tlasSize = std::max(buildSizes.accelerationStructureSize, layer.tlas.accelerationStructure != VK_NULL_HANDLE ? layer.tlas.buffer.GetSize() * 2 : 0);
+
+            // Frames in flight may still trace the previous tlas, keep it until they are done
+            if (layer.tlas.accelerationStructure != VK_NULL_HANDLE)
+            {
+                retiredAccelerationStructures_.push_back(std::make_pair(currentFrameNumber_ + 2, layer.tlas.accelerationStructure));
+                retiredBuffers_.push_back(std::make_pair(currentFrameNumber_ + 2, layer.tlas.buffer));
+                layer.tlas = RayTracerAccelerationStructure();
+            }
+
+            // Create a buffer to hold the acceleration structure
+            layer.tlas.buffer.Create(
+                device_,
+                physicalDeviceMemoryProperties_,
+                tlasSize,
+                VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                Vulkan::MemoryCategory::TopLevelAccelerationStructure);
+
+            // Create the acceleration structure
+            VkAccelerationStructureCreateInfoKHR accelerationStructureCreateInfo = {};
+            accelerationStructureCreateInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+            accelerationStructureCreateInfo.buffer = layer.tlas.buffer.GetBuffer();
+            accelerationStructureCreateInfo.size = tlasSize;
+            accelerationStructureCreateInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+            VK_CHECK("vkCreateAccelerationStructureKHR", vkCreateAccelerationStructureKHR(device_, &accelerationStructureCreateInfo, HostAllocator::Instance().GetCallbacks(), &layer.tlas.accelerationStructure));
+
+            // Get the top acceleration structure's handle, which will be used to setup it's descriptor
+            VkAccelerationStructureDeviceAddressInfoKHR accelerationStructureDeviceAddressInfo = {};
+            accelerationStructureDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+            accelerationStructureDeviceAddressInfo.accelerationStructure = layer.tlas.accelerationStructure;
+            layer.tlas.deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(device_, &accelerationStructureDeviceAddressInfo);
+
+            // Descriptor sets have to point at the new tlas
+            for (auto& renderTarget : renderTargets_)
+            {
+                renderTarget.second->updateDescriptorSetsData = true;
+            }
+        }
+        else
+        {
+            // Refits and rebuilds write the tlas in place, traces already submitted must be done reading it
+            VkMemoryBarrier memoryBarrier = {};
+            memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+            memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+            vkCmdPipelineBarrier(
+                commandBuffer,
+                VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+        }
+
+        VkAccelerationStructureGeometryKHR accelerationStructureGeometry = {};
+        accelerationStructureGeometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+        accelerationStructureGeometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+        accelerationStructureGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+        accelerationStructureGeometry.geometry.instances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+        accelerationStructureGeometry.geometry.instances.arrayOfPointers = VK_TRUE;
+        accelerationStructureGeometry.geometry.instances.data = layer.instancePointers.GetBufferDeviceAddressConst();
+
+        VkAccelerationStructureBuildGeometryInfoKHR accelerationBuildGeometryInfo = {};
+        accelerationBuildGeometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+        accelerationBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+        accelerationBuildGeometryInfo.flags = layer.buildFlags;
+        accelerationBuildGeometryInfo.mode = update ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+        accelerationBuildGeometryInfo.srcAccelerationStructure = update ? layer.tlas.accelerationStructure : VK_NULL_HANDLE;
+        accelerationBuildGeometryInfo.dstAccelerationStructure = layer.tlas.accelerationStructure;
+        accelerationBuildGeometryInfo.geometryCount = 1;
+        accelerationBuildGeometryInfo.pGeometries = &accelerationStructureGeometry;
+        accelerationBuildGeometryInfo.scratchData = scratchBuffer_.Allocate(update ? buildSizes.updateScratchSize : buildSizes.buildScratchSize);
+
+        VkAccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo;
+        accelerationStructureBuildRangeInfo.primitiveCount = static_cast<uint32_t>(layer.slots.size());
+        accelerationStructureBuildRangeInfo.primitiveOffset = 0;
+        accelerationStructureBuildRangeInfo.firstVertex = 0;
+        accelerationStructureBuildRangeInfo.transformOffset = 0;
+
+        const VkAccelerationStructureBuildRangeInfoKHR* constAccelerationStructureBuildRangeInfo = &accelerationStructureBuildRangeInfo;
+
+        vkCmdBuildAccelerationStructuresKHR(
+            commandBuffer,
+            1,
+            &accelerationBuildGeometryInfo,
+            &constAccelerationStructureBuildRangeInfo);
+
+        return true;
+    }
+
+    void RayTracer::DestroyTlasLayer(RayTracerTlasLayer& layer)
+    {
+        if (layer.tlas.accelerationStructure != VK_NULL_HANDLE)
+        {
+            vkDestroyAccelerationStructureKHR(device_, layer.tlas.accelerationStructure, HostAllocator::Instance().GetCallbacks());
+        }
+        layer.tlas.buffer.Destroy();
+        layer.instancePointers.Destroy();
+        layer = RayTracerTlasLayer();
+    }
+
+    void RayTracer::Prepare() 
+    {
+        if (alreadyPrepared_)
+        {
+            return;
+        }
+
+        CreateDescriptorSetsLayouts();
+        CreateDescriptorPool();
+
+        alreadyPrepared_ = true;
+    }
+
+    void RayTracer::ResetPipeline()
+    {
+        if (pipeline_ != VK_NULL_HANDLE)
+        {
+            vkDestroyPipeline(device_, pipeline_, HostAllocator::Instance().GetCallbacks());
+            pipeline_ = VK_NULL_HANDLE;
+        }
+
+        // Reloaded by the next tlas build.  Worker submits may still be generating instances with it
+        if (instanceGenerator_.IsLoaded())
+        {
+            WaitForSubmission(submittedTimelineValue_);
+            instanceGenerator_.Destroy();
+        }
+
+        // Reloaded by the next vertex update, which may be in flight as well
+        if (normalWriter_.IsLoaded())
+        {
+            WaitForSubmission(submittedTimelineValue_);
+            normalWriter_.Destroy();
+        }
+    }
+
+    void RayTracer::UpdateCamera(int cameraInstanceId, float* camPos, float* camDir, float* camUp, float* camSide, float* camNearFarFov)
+    {
+        if (renderTargets_.find(cameraInstanceId) == renderTargets_.end())
+        {
+            // The camera isn't in the system yet, don't attempt to update
+            return;
+        }
+
+        auto& renderTarget = renderTargets_[cameraInstanceId];
+        renderTarget->camPos = vec3(camPos[0], camPos[1], camPos[2]);
+        renderTarget->camDir = vec3(camDir[0], camDir[1], camDir[2]);
+        renderTarget->camUp = vec3(camUp[0], camUp[1], camUp[2]);
+        renderTarget->camSide = vec3(camSide[0], camSide[1], camSide[2]);
+        renderTarget->camNearFarFov = vec3(camNearFarFov[0], camNearFarFov[1], camNearFarFov[2]);
+
+        if (!WriteCameraData(*renderTarget))
+        {
+            PFG_EDITORLOGERROR("Failed to allocate camera data from upload ring");
+            return;
+        }
+
+        renderTarget->hasCameraData = true;
+        
+        //PFG_EDITORLOG("Updated camera " + std::to_string(cameraInstanceId));
+    }
+
+    void RayTracer::UpdateSceneData(float* color) 
+    {
+        sceneAmbient_ = vec4(color[0], color[1], color[2], color[3]);
+
+        if (!WriteSceneData())
+        {
+            PFG_EDITORLOGERROR("Failed to allocate scene data from upload ring");
+            return;
+        }
+
+        hasSceneData_ = true;
+    }
+
+    bool RayTracer::WriteCameraData(RayTracerRenderTarget& renderTarget)
+    {
+        // Each update gets its own slice so a trace still in flight keeps reading the previous values
+        Vulkan::RingAllocation cameraAllocation;
+        if (!uploadRing_.Allocate(sizeof(ShaderCameraParam), physicalDeviceProperties_.limits.minUniformBufferOffsetAlignment, cameraAllocation))
+        {
+            return false;
+        }
+
+        auto camera = reinterpret_cast<ShaderCameraParam*>(cameraAllocation.data);
+        camera->camPos = vec4(renderTarget.camPos, 0.0f);
+        camera->camDir = vec4(renderTarget.camDir, 0.0f);
+        camera->camUp = vec4(renderTarget.camUp, 0.0f);
+        camera->camSide = vec4(renderTarget.camSide, 0.0f);
+        camera->camNearFarFov = vec4(renderTarget.camNearFarFov, 0.0f);
+
+        uploadRing_.Flush(cameraAllocation, sizeof(ShaderCameraParam));
+
+        renderTarget.cameraDataOffset = static_cast<uint32_t>(cameraAllocation.offset);
+        renderTarget.cameraDataBuffer = cameraAllocation.buffer;
+        return true;
+    }
+
+    bool RayTracer::WriteSceneData()
+    {
+        Vulkan::RingAllocation sceneAllocation;
+        if (!uploadRing_.Allocate(sizeof(ShaderSceneParam), physicalDeviceProperties_.limits.minUniformBufferOffsetAlignment, sceneAllocation))
+        {
+            return false;
+        }
+
+        auto scene = reinterpret_cast<ShaderSceneParam*>(sceneAllocation.data);
+        scene->ambient = sceneAmbient_;
+
+        uploadRing_.Flush(sceneAllocation, sizeof(ShaderSceneParam));
+
+        sceneDataOffset_ = static_cast<uint32_t>(sceneAllocation.offset);
+        sceneDataBuffer_ = sceneAllocation.buffer;
+        return true;
+    }
+
+    void RayTracer::TraceRays(int cameraInstanceId)
+    {
+        if (renderTargets_.find(cameraInstanceId) == renderTargets_.end())
+        {
+            // The camera isn't in the system yet, don't attempt to trace
+            return;
+        }
+
+        if (!renderTargets_[cameraInstanceId]->hasCameraData)
+        {
+            // This camera hasn't been updated get for render
+            return;
+        }
+
+        if (!hasSceneData_)
+        {
+            // Scene data hasn't been updated yet for render
+            return;
+        }
+
+        if (staticTlas_.tlas.accelerationStructure == VK_NULL_HANDLE || dynamicTlas_.tlas.accelerationStructure == VK_NULL_HANDLE)
+        {
+            PFG_EDITORLOG("We don't have a tlas, so we cannot trace rays!");
+            return;
+        }
+
+        if (pipelineLayout_ == VK_NULL_HANDLE)
+        {
+            CreatePipelineLayout();
+            if (pipelineLayout_ == VK_NULL_HANDLE)
+            {
+                PFG_EDITORLOG("Something went wrong with creating the pipeline layout");
+                // Something went wrong, don't continue
+                return;
+            }
+        }
+
+        if (pipeline_ == VK_NULL_HANDLE)
+        {
+            CreatePipeline();
+            if (pipeline_ == VK_NULL_HANDLE)
+            {
+                PFG_EDITORLOG("Something went wrong with creating the pipeline");
+                return;
+            }
+        }
+        
+        if (pipeline_ != VK_NULL_HANDLE && pipelineLayout_!= VK_NULL_HANDLE)
+        {
+            BuildDescriptorBufferInfos(cameraInstanceId);
+            UpdateDescriptorSets(cameraInstanceId);
+
+            // cannot manage resources inside renderpass
+            graphicsInterface_->EnsureOutsideRenderPass();
+
+            UnityVulkanRecordingState recordingState;
+            if (!graphicsInterface_->CommandRecordingState(&recordingState, kUnityVulkanGraphicsQueueAccess_DontCare))
+            {
+                return;
+            }
+
+            // Upload ring slices are released based on how far along Unity's frames are
+            currentFrameNumber_ = recordingState.currentFrameNumber;
+            safeFrameNumber_ = recordingState.safeFrameNumber;
+
+            BuildAndSubmitRayTracingCommandBuffer(cameraInstanceId, recordingState.commandBuffer);
+            CopyRenderToRenderTarget(cameraInstanceId, recordingState.commandBuffer);
+        }
+    }
+
+    void RayTracer::GetMemoryStatistics(RayTracerMemoryStatistics* outStatistics)
+    {
+        if (outStatistics == nullptr) {
+            return;
+        }
+
+        *outStatistics = RayTracerMemoryStatistics();
+
+        Vulkan::MemoryAllocatorStatistics statistics;
+        Vulkan::MemoryAllocator::Instance().GetStatistics(statistics);
+
+        auto categoryBytes = [&statistics](Vulkan::MemoryCategory category) {
+            return static_cast<uint64_t>(statistics.categoryBytes[static_cast<uint32_t>(category)]);
+        };
+
+        outStatistics->meshGeometryBytes = categoryBytes(Vulkan::MemoryCategory::MeshGeometry);
+        outStatistics->bottomLevelAccelerationStructureBytes = categoryBytes(Vulkan::MemoryCategory::BottomLevelAccelerationStructure);
+        outStatistics->topLevelAccelerationStructureBytes = categoryBytes(Vulkan::MemoryCategory::TopLevelAccelerationStructure);
+        outStatistics->renderTargetBytes = categoryBytes(Vulkan::MemoryCategory::RenderTarget);
+        outStatistics->shaderBindingTableBytes = categoryBytes(Vulkan::MemoryCategory::ShaderBindingTable);
+        outStatistics->scratchBytes = categoryBytes(Vulkan::MemoryCategory::Scratch);
+        outStatistics->uploadBytes = categoryBytes(Vulkan::MemoryCategory::Upload);
+        outStatistics->stagingBytes = categoryBytes(Vulkan::MemoryCategory::Staging);
+        outStatistics->otherBytes = categoryBytes(Vulkan::MemoryCategory::Other);
+        outStatistics->blockBytes = statistics.blockBytes;
+        outStatistics->allocatedBytes = statistics.allocatedBytes;
+        outStatistics->blockCount = statistics.blockCount;
+        outStatistics->allocationCount = statistics.allocationCount;
+
+        Vulkan::HostAllocatorStatistics hostStatistics;
+        Vulkan::HostAllocator::Instance().GetStatistics(hostStatistics);
+
+        outStatistics->hostCommandBytes = hostStatistics.scopeBytes[VK_SYSTEM_ALLOCATION_SCOPE_COMMAND];
+        outStatistics->hostObjectBytes = hostStatistics.scopeBytes[VK_SYSTEM_ALLOCATION_SCOPE_OBJECT];
+        outStatistics->hostCacheBytes = hostStatistics.scopeBytes[VK_SYSTEM_ALLOCATION_SCOPE_CACHE];
+        outStatistics->hostDeviceBytes = hostStatistics.scopeBytes[VK_SYSTEM_ALLOCATION_SCOPE_DEVICE];
+        outStatistics->hostInstanceBytes = hostStatistics.scopeBytes[VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE];
+        outStatistics->hostPeakBytes = hostStatistics.peakBytes;
+        outStatistics->hostInternalBytes = hostStatistics.internalBytes;
+        outStatistics->hostSlabBytes = hostStatistics.slabBytes;
+        outStatistics->hostAllocationCount = hostStatistics.allocationCount;
+
+        // Budget and usage reported by the driver include every other allocation in the process (i.e. Unity's)
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT memoryBudgetProperties = {};
+        memoryBudgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+        const bool budgetAvailable = memoryBudgetSupported_ && graphicsInterface_ != nullptr;
+        if (budgetAvailable) {
+            VkPhysicalDeviceMemoryProperties2 memoryProperties = {};
+            memoryProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+            memoryProperties.pNext = &memoryBudgetProperties;
+
+            vkGetPhysicalDeviceMemoryProperties2(graphicsInterface_->Instance().physicalDevice, &memoryProperties);
+        }
+
+        outStatistics->memoryBudgetSupported = budgetAvailable ? 1 : 0;
+
+        for (uint32_t heapIndex = 0; heapIndex < physicalDeviceMemoryProperties_.memoryHeapCount; ++heapIndex) {
+            const VkMemoryHeap& heap = physicalDeviceMemoryProperties_.memoryHeaps[heapIndex];
+            if ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) == 0) {
+                continue;
+            }
+
+            outStatistics->deviceLocalBlockBytes += statistics.heapBlockBytes[heapIndex];
+
+            if (budgetAvailable) {
+                outStatistics->deviceLocalBudgetBytes += memoryBudgetProperties.heapBudget[heapIndex];
+                outStatistics->deviceLocalUsageBytes += memoryBudgetProperties.heapUsage[heapIndex];
+            }
+            else {
+                outStatistics->deviceLocalBudgetBytes += heap.size;
+                outStatistics->deviceLocalUsageBytes += statistics.heapBlockBytes[heapIndex];
+            }
+        }
+    }
+
+    void RayTracer::SetDefragmentationBudget(float milliseconds)
+    {
+        defragmentationBudgetMilliseconds_ = std::max(milliseconds, 0.0f);
+    }
+
+    void RayTracer::SetHostMemoryAccounting(int enabled)
+    {
+        Vulkan::HostAllocator::Instance().SetAccountingEnabled(enabled != 0);
+    }
+
+    void RayTracer::SetHostBlasBuildThreads(int threadCount)
+    {
+        if (!hostBuildsSupported_)
+        {
+            PFG_EDITORLOG("Acceleration structure host commands aren't supported, blases are built on the device");
+            return;
+        }
+
+        // Lets host builds already running finish on the old threads
+        deferredOperationPool_.Destroy();
+
+        hostBuildThreadCount_ = static_cast<uint32_t>(std::max(threadCount, 0));
+        deferredOperationPool_.Initialize(device_, hostBuildThreadCount_);
+    }
+
+    void RayTracer::SetStaticBatching(int enabled, float cellSize)
+    {
+        if (!(cellSize > 0.0f))
+        {
+            PFG_EDITORLOGERROR("Static batching cell size has to be positive, got " + std::to_string(cellSize));
+            return;
+        }
+
+        if ((enabled != 0) == staticBatchingEnabled_ && cellSize == staticBatchCellSize_)
+        {
+            return;
+        }
+
+        // Batches are laid out for the old cells.  Take every instance out, emptied batches release their merged mesh
+        // on the next tlas build
+        for (auto itr = meshInstancePool_.in_use_begin(); itr != meshInstancePool_.in_use_end(); ++itr)
+        {
+            if (meshInstancePool_[*itr]->inStaticBatch)
+            {
+                RemoveFromStaticBatch(*itr);
+            }
+        }
+
+        staticBatchingEnabled_ = enabled != 0;
+        staticBatchCellSize_ = cellSize;
+
+        if (!staticBatchingEnabled_)
+        {
+            // The copies are only kept to merge batches from
+            for (auto itr = sharedMeshesPool_.in_use_begin(); itr != sharedMeshesPool_.in_use_end(); ++itr)
+            {
+                auto& mesh = sharedMeshesPool_[*itr];
+                mesh->batchVertices = std::vector<vec3>();
+                mesh->batchAttributes = std::vector<ShaderVertexAttribute>();
+                mesh->batchIndices = std::vector<uint32_t>();
+            }
+            return;
+        }
+
+        for (auto itr = meshInstancePool_.in_use_begin(); itr != meshInstancePool_.in_use_end(); ++itr)
+        {
+            if (meshInstancePool_[*itr]->isStatic)
+            {
+                AddToStaticBatch(*itr);
+            }
+        }
+    }
+
+#pragma endregion RayTracerAPI
+
+    void RayTracer::CreateCommandPool(uint32_t queueFamilyIndex, VkCommandPool& outCommandPool)
+    {
+        VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+        commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndex;
+        commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+        VK_CHECK("vkCreateCommandPool", vkCreateCommandPool(device_, &commandPoolCreateInfo, HostAllocator::Instance().GetCallbacks(), &outCommandPool));
+    }
+
+    void RayTracer::CreateWorkerCommandBuffer(VkCommandBufferLevel level, VkCommandPool commandPool, VkCommandBuffer& outCommandBuffer)
+    {
+        //TODO : Can we just use a recording state from unity?
+        VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
+        commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        commandBufferAllocateInfo.commandPool = commandPool;
+        commandBufferAllocateInfo.level = level;
+        commandBufferAllocateInfo.commandBufferCount = 1;
+
+        VK_CHECK("vkAllocateCommandBuffers", vkAllocateCommandBuffers(device_, &commandBufferAllocateInfo, &outCommandBuffer));
+    
+        // Start recording for the new command buffer
+        VkCommandBufferBeginInfo commandBufferBeginInfo = { };
+        commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VK_CHECK("vkBeginCommandBuffer", vkBeginCommandBuffer(outCommandBuffer, &commandBufferBeginInfo));
+
+        // Worker submits don't wait for each other on the CPU anymore.  Order this one after the writes of every earlier
+        // submit on the queue, e.g. a blas build reusing the scratch of the previous one or a tlas build reading blases
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        vkCmdPipelineBarrier(
+            outCommandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+    }
+
+    uint64_t RayTracer::SubmitWorkerCommandBuffer(VkCommandBuffer commandBuffer, VkCommandPool commandPool, const VkQueue& queue)
+    {
+        VK_CHECK("vkEndCommandBuffer", vkEndCommandBuffer(commandBuffer));
+
+        const uint64_t timelineValue = submittedTimelineValue_ + 1;
+
+        // Signal the next timeline value instead of waiting on a fence, the caller never blocks on the GPU
+        VkTimelineSemaphoreSubmitInfo timelineSemaphoreSubmitInfo = {};
+        timelineSemaphoreSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineSemaphoreSubmitInfo.signalSemaphoreValueCount = 1;
+        timelineSemaphoreSubmitInfo.pSignalSemaphoreValues = &timelineValue;
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineSemaphoreSubmitInfo;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &timelineSemaphore_;
+    
+        // Submit to the queue
+        VkResult result = vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+        VK_CHECK("vkQueueSubmit", result);
+
+        RayTracerWorkerSubmission submission;
+        submission.commandPool = commandPool;
+        submission.commandBuffer = commandBuffer;
+
+        if (result != VK_SUCCESS)
+        {
+            // Nothing will signal the value, free the command buffer right away
+            submission.timelineValue = completedTimelineValue_;
+        }
+        else
+        {
+            submittedTimelineValue_ = timelineValue;
+            submission.timelineValue = timelineValue;
+        }
+
+        if (commandPool != VK_NULL_HANDLE)
+        {
+            workerSubmissions_.push_back(submission);
+        }
+
+        return submission.timelineValue;
+    }
+
+    void RayTracer::UpdateCompletedSubmissions()
+    {
+        if (timelineSemaphore_ == VK_NULL_HANDLE)
+        {
+            return;
+        }
+
+        VK_CHECK("vkGetSemaphoreCounterValue", vkGetSemaphoreCounterValue(device_, timelineSemaphore_, &completedTimelineValue_));
+
+        for (auto itr = workerSubmissions_.begin(); itr != workerSubmissions_.end();)
+        {
+            if (itr->timelineValue <= completedTimelineValue_)
+            {
+                vkFreeCommandBuffers(device_, itr->commandPool, 1, &itr->commandBuffer);
+                itr = workerSubmissions_.erase(itr);
+            }
+            else
+            {
+                ++itr;
+            }
+        }
+
+        for (auto itr = submissionRetiredBuffers_.begin(); itr != submissionRetiredBuffers_.end();)
+        {
+            if (itr->first <= completedTimelineValue_)
+            {
+                itr->second.Destroy();
+                itr = submissionRetiredBuffers_.erase(itr);
+            }
+            else
+            {
+                ++itr;
+            }
+        }
+    }
+
+    void RayTracer::WaitForSubmission(uint64_t timelineValue)
+    {
+        if (timelineSemaphore_ == VK_NULL_HANDLE || timelineValue <= completedTimelineValue_)
+        {
+            return;
+        }
+
+        VkSemaphoreWaitInfo semaphoreWaitInfo = {};
+        semaphoreWaitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        semaphoreWaitInfo.semaphoreCount = 1;
+        semaphoreWaitInfo.pSemaphores = &timelineSemaphore_;
+        semaphoreWaitInfo.pValues = &timelineValue;
+
+        const uint64_t DEFAULT_TIMEOUT = 100000000000;
+        VK_CHECK("vkWaitSemaphores", vkWaitSemaphores(device_, &semaphoreWaitInfo, DEFAULT_TIMEOUT));
+
+        UpdateCompletedSubmissions();
+    }
+
+    void RayTracer::BuildPendingBlases()
+    {
+        if (pendingBlasBuilds_.empty())
+        {
+            return;
+        }
+
+        // Meshes with a host copy of their geometry go to the CPU threads, the rest are built on the device
+        if (hostBuildsSupported_ && hostBuildThreadCount_ > 0)
+        {
+            std::vector<int> hostBuilds;
+            std::vector<int> deviceBuilds;
+            for (auto sharedMeshIndex : pendingBlasBuilds_)
+            {
+                if (sharedMeshesPool_[sharedMeshIndex]->hostVertices.empty())
+                {
+                    deviceBuilds.push_back(sharedMeshIndex);
+                }
+                else
+                {
+                    hostBuilds.push_back(sharedMeshIndex);
+                }
+            }
+
+            BuildHostBlases(hostBuilds);
+
+            pendingBlasBuilds_ = deviceBuilds;
+            if (pendingBlasBuilds_.empty())
+            {
+                return;
+            }
+        }
+
+        // Build infos point at the geometries each build owns, which stay put when the build is moved
+        std::vector<RayTracerBlasBuild> builds;
+        builds.reserve(pendingBlasBuilds_.size());
+
+        for (auto sharedMeshIndex : pendingBlasBuilds_)
+        {
+            RayTracerBlasBuild build;
+            if (PrepareBlasBuild(sharedMeshIndex, false, build))
+            {
+                builds.push_back(std::move(build));
+            }
+        }
+        pendingBlasBuilds_.clear();
+
+        if (builds.empty())
+        {
+            return;
+        }
+
+        // Split the builds into chunks whose scratch fits the budget.  A build larger than the budget gets a chunk of
+        // its own.  Every chunk reuses the same scratch, so reserve for the largest one before recording anything
+        std::vector<size_t> chunkEnds;
+        VkDeviceSize chunkScratchSize = 0;
+        VkDeviceSize maxChunkScratchSize = 0;
+        for (size_t buildIndex = 0; buildIndex < builds.size(); ++buildIndex)
+        {
+            const VkDeviceSize scratchSize = scratchBuffer_.GetAlignedSize(builds[buildIndex].scratchSize);
+            if (chunkScratchSize > 0 && chunkScratchSize + scratchSize > kBlasBuildScratchBudget)
+            {
+                chunkEnds.push_back(buildIndex);
+                chunkScratchSize = 0;
+            }
+
+            chunkScratchSize += scratchSize;
+            maxChunkScratchSize = std::max(maxChunkScratchSize, chunkScratchSize);
+        }
+        chunkEnds.push_back(builds.size());
+
+        // Scratch comes from the shared arena, worker command buffers start with a barrier so earlier builds are done with it
+        scratchBuffer_.Reset();
+
+        Vulkan::Buffer releasedScratch;
+        VkResult scratchResult = scratchBuffer_.Reserve(maxChunkScratchSize, releasedScratch);
+        if (releasedScratch.GetBuffer() != VK_NULL_HANDLE)
+        {
+            submissionRetiredBuffers_.push_back(std::make_pair(submittedTimelineValue_, releasedScratch));
+        }
+        if (scratchResult != VK_SUCCESS)
+        {
+            PFG_EDITORLOGERROR("Failed to reserve scratch memory for blas");
+
+            // Nothing was built, queue the meshes up again for the next frame
+            for (const auto& build : builds)
+            {
+                auto& mesh = sharedMeshesPool_[build.sharedMeshIndex];
+                vkDestroyAccelerationStructureKHR(device_, mesh->blas.accelerationStructure, HostAllocator::Instance().GetCallbacks());
+                blasBuffer_.Free(mesh->blas.storage);
+                mesh->blas = RayTracerAccelerationStructure();
+
+                pendingBlasBuilds_.push_back(build.sharedMeshIndex);
+            }
+            return;
+        }
+
+        // Build the acceleration structures on the device via a one-time command buffer submission.  We will NOT use the Unity command buffer in this case
+        VkCommandBuffer buildCommandBuffer;
+        CreateWorkerCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, graphicsCommandPool_, buildCommandBuffer);
+
+        // Builds write scratch and the blases, the next chunk and the compaction queries read them
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+
+        std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildGeometryInfos;
+        std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> buildRangeInfos;
+
+        size_t chunkStart = 0;
+        for (auto chunkEnd : chunkEnds)
+        {
+            if (chunkStart > 0)
+            {
+                vkCmdPipelineBarrier(
+                    buildCommandBuffer,
+                    VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                    VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                    0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+            }
+
+            scratchBuffer_.Reset();
+            buildGeometryInfos.clear();
+            buildRangeInfos.clear();
+
+            for (size_t buildIndex = chunkStart; buildIndex < chunkEnd; ++buildIndex)
+            {
+                auto& build = builds[buildIndex];
+                build.buildGeometryInfo.scratchData = scratchBuffer_.Allocate(build.scratchSize);
+
+                buildGeometryInfos.push_back(build.buildGeometryInfo);
+                buildRangeInfos.push_back(build.buildRangeInfos.data());
+            }
+
+            vkCmdBuildAccelerationStructuresKHR(
+                buildCommandBuffer,
+                static_cast<uint32_t>(buildGeometryInfos.size()),
+                buildGeometryInfos.data(),
+                buildRangeInfos.data());
+
+            chunkStart = chunkEnd;
+        }
+
+        vkCmdPipelineBarrier(
+            buildCommandBuffer,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+        // Ask for the compacted sizes, CompactBlases swaps in the smaller copies once they are known.  If every query
+        // is taken the blas simply stays at its build size
+        for (const auto& build : builds)
+        {
+            if (freeCompactionQueries_.empty())
+            {
+                break;
+            }
+
+            auto& mesh = sharedMeshesPool_[build.sharedMeshIndex];
+            if ((build.buildGeometryInfo.flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR) == 0)
+            {
+                continue;
+            }
+            mesh->compactionQuery = freeCompactionQueries_.back();
+            freeCompactionQueries_.pop_back();
+
+            vkCmdResetQueryPool(buildCommandBuffer, compactionQueryPool_, mesh->compactionQuery, 1);
+            vkCmdWriteAccelerationStructuresPropertiesKHR(
+                buildCommandBuffer,
+                1,
+                &mesh->blas.accelerationStructure,
+                VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+                compactionQueryPool_,
+                mesh->compactionQuery);
+
+            pendingCompactions_.push_back(build.sharedMeshIndex);
+        }
+
+        // One timeline value covers the whole batch.  The tlas build and traces run after it on the same queue, so
+        // the blases can be referenced right away
+        const uint64_t timelineValue = SubmitWorkerCommandBuffer(buildCommandBuffer, graphicsCommandPool_, graphicsQueue_);
+
+        // Get the bottom acceleration structures' handles, which will be used during the top level acceleration build
+        for (const auto& build : builds)
+        {
+            auto& mesh = sharedMeshesPool_[build.sharedMeshIndex];
+            mesh->blasTimelineValue = timelineValue;
+
+            VkAccelerationStructureDeviceAddressInfoKHR accelerationStructureDeviceAddressInfo{};
+            accelerationStructureDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+            accelerationStructureDeviceAddressInfo.accelerationStructure = mesh->blas.accelerationStructure;
+            mesh->blas.deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(device_, &accelerationStructureDeviceAddressInfo);
+        }
+
+        PFG_EDITORLOG("Built " + std::to_string(builds.size()) + " blases in " + std::to_string(chunkEnds.size()) + " batches");
+    }
+
+    void RayTracer::DescribeBlasBuild(int sharedMeshPoolIndex, bool hostBuild, RayTracerBlasBuild& outBuild, VkAccelerationStructureBuildSizesInfoKHR& outSizes)
+    {
+        const auto& mesh = sharedMeshesPool_[sharedMeshPoolIndex];
+        const VkDeviceAddress geometryAddress = hostBuild ? 0 : geometryBuffer_.GetDeviceAddress(mesh->geometry);
+
+        outBuild.sharedMeshIndex = sharedMeshPoolIndex;
+
+        // The bottom level acceleration structure contains one set of triangles per submesh as the input geometry.
+        // Every geometry reads the mesh's whole vertex and index data, the build ranges pick the submesh's triangles
+        VkAccelerationStructureGeometryKHR accelerationStructureGeometry = {};
+        accelerationStructureGeometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+        accelerationStructureGeometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+        accelerationStructureGeometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+
+        accelerationStructureGeometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
+        accelerationStructureGeometry.geometry.triangles.pNext = nullptr;
+        accelerationStructureGeometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+        accelerationStructureGeometry.geometry.triangles.maxVertex = mesh->vertexCount;
+        accelerationStructureGeometry.geometry.triangles.vertexStride = sizeof(vec3);
+        accelerationStructureGeometry.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
+        if (hostBuild)
+        {
+            accelerationStructureGeometry.geometry.triangles.vertexData.hostAddress = mesh->hostVertices.data();
+            accelerationStructureGeometry.geometry.triangles.indexData.hostAddress = mesh->hostIndices.data();
+        }
+        else
+        {
+            accelerationStructureGeometry.geometry.triangles.vertexData.deviceAddress = geometryAddress + mesh->verticesOffset;
+            accelerationStructureGeometry.geometry.triangles.indexData.deviceAddress = geometryAddress + mesh->indicesOffset;
+        }
+        // No transform data, geometry is used as is
+        accelerationStructureGeometry.geometry.triangles.transformData.deviceAddress = 0;
+
+        const uint32_t geometryCount = static_cast<uint32_t>(mesh->submeshes.size());
+        outBuild.geometries.assign(geometryCount, accelerationStructureGeometry);
+
+        // Number of triangles of each geometry
+        std::vector<uint32_t> primitiveCounts(geometryCount);
+        outBuild.buildRangeInfos.resize(geometryCount);
+        for (uint32_t i = 0; i < geometryCount; ++i)
+        {
+            primitiveCounts[i] = mesh->submeshes[i].indexCount / 3;
+
+            outBuild.buildRangeInfos[i].primitiveCount = primitiveCounts[i];
+            outBuild.buildRangeInfos[i].primitiveOffset = mesh->submeshes[i].indexStart * sizeof(uint32_t);
+            outBuild.buildRangeInfos[i].firstVertex = 0;
+            outBuild.buildRangeInfos[i].transformOffset = 0;
+        }
+
+        // Get the size requirements for buffers involved in the acceleration structure build process
+        VkAccelerationStructureBuildGeometryInfoKHR& accelerationBuildGeometryInfo = outBuild.buildGeometryInfo;
+        accelerationBuildGeometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+        accelerationBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        accelerationBuildGeometryInfo.flags = GetBlasBuildFlags(*mesh);
+        accelerationBuildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+        accelerationBuildGeometryInfo.geometryCount = geometryCount;
+        accelerationBuildGeometryInfo.pGeometries = outBuild.geometries.data();
+
+        outSizes = {};
+        outSizes.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+        vkGetAccelerationStructureBuildSizesKHR(
+            device_,
+            hostBuild ? VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR : VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+            &accelerationBuildGeometryInfo,
+            primitiveCounts.data(),
+            &outSizes);
+    }
+
+    bool RayTracer::PrepareBlasBuild(int sharedMeshPoolIndex, bool hostBuild, RayTracerBlasBuild& outBuild)
+    {
+        const auto& mesh = sharedMeshesPool_[sharedMeshPoolIndex];
+        Vulkan::GeometryBuffer& storageBuffer = hostBuild ? hostBlasBuffer_ : blasBuffer_;
+
+        VkAccelerationStructureBuildSizesInfoKHR accelerationStructureBuildSizesInfo;
+        DescribeBlasBuild(sharedMeshPoolIndex, hostBuild, outBuild, accelerationStructureBuildSizesInfo);
+        VkAccelerationStructureBuildGeometryInfoKHR& accelerationBuildGeometryInfo = outBuild.buildGeometryInfo;
+
+        // Reserve a range of the blas pages to hold the acceleration structure
+        if (!storageBuffer.Allocate(accelerationStructureBuildSizesInfo.accelerationStructureSize, kAccelerationStructureAlignment, mesh->blas.storage))
+        {
+            PFG_EDITORLOGERROR("Failed to allocate blas storage for mesh (sharedMeshInstanceId: " + std::to_string(mesh->sharedMeshInstanceId) + ")");
+            return false;
+        }
+
+        // Create the acceleration structure
+        VkAccelerationStructureCreateInfoKHR accelerationStructureCreateInfo = {};
+        accelerationStructureCreateInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+        accelerationStructureCreateInfo.buffer = storageBuffer.GetPage(mesh->blas.storage.page).GetBuffer();
+        accelerationStructureCreateInfo.offset = mesh->blas.storage.offset;
+        accelerationStructureCreateInfo.size = accelerationStructureBuildSizesInfo.accelerationStructureSize;
+        accelerationStructureCreateInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+
+        VkResult result = vkCreateAccelerationStructureKHR(device_, &accelerationStructureCreateInfo, HostAllocator::Instance().GetCallbacks(), &mesh->blas.accelerationStructure);
+        VK_CHECK("vkCreateAccelerationStructureKHR", result);
+        if (result != VK_SUCCESS)
+        {
+            storageBuffer.Free(mesh->blas.storage);
+            mesh->blas = RayTracerAccelerationStructure();
+            return false;
+        }
+
+        accelerationBuildGeometryInfo.dstAccelerationStructure = mesh->blas.accelerationStructure;
+
+        outBuild.scratchSize = accelerationStructureBuildSizesInfo.buildScratchSize;
+
+        mesh->blasBounds = mesh->bounds;
+        mesh->blasQuality.Built(mesh->bounds.SurfaceArea());
+
+        return true;
+    }
+
+    void RayTracer::RefitBlases()
+    {
+        if (dirtyBlases_.empty())
+        {
+            return;
+        }
+
+        // Build infos point at the geometries each build owns, which stay put when the build is moved
+        std::vector<RayTracerBlasBuild> builds;
+        builds.reserve(dirtyBlases_.size());
+
+        VkDeviceSize scratchSize = 0;
+        uint32_t rebuildCount = 0;
+
+        // Refits loosen the bvh as vertices move.  Rebuilding costs a lot more than refitting, so only the most
+        // degraded blases are rebuilt each frame and the rest wait their turn
+        std::vector<std::pair<float, int>> rebuilds;
+        for (auto sharedMeshIndex : dirtyBlases_)
+        {
+            const auto& mesh = sharedMeshesPool_[sharedMeshIndex];
+            if (mesh->deformable && !mesh->hostBlasBuild && mesh->compactionQuery == RayTracerMeshSharedData::kNoCompactionQuery &&
+                mesh->blasQuality.NeedsRebuild(0.0f, kBlasRefitsPerRebuild, kBlasMaxBoundsGrowth))
+            {
+                rebuilds.push_back(std::make_pair(mesh->blasQuality.GetBoundsGrowth(), sharedMeshIndex));
+            }
+        }
+        std::sort(rebuilds.begin(), rebuilds.end(), [](const std::pair<float, int>& a, const std::pair<float, int>& b) { return a.first > b.first; });
+        if (rebuilds.size() > kBlasRebuildsPerFrame)
+        {
+            rebuilds.resize(kBlasRebuildsPerFrame);
+        }
+
+        for (auto itr = dirtyBlases_.begin(); itr != dirtyBlases_.end();)
+        {
+            const int sharedMeshIndex = (*itr);
+            auto& mesh = sharedMeshesPool_[sharedMeshIndex];
+
+            // Host builds and compactions still in flight replace the blas, refit it once they are done
+            if (mesh->hostBlasBuild || mesh->compactionQuery != RayTracerMeshSharedData::kNoCompactionQuery)
+            {
+                ++itr;
+                continue;
+            }
+
+            itr = dirtyBlases_.erase(itr);
+            mesh->blasDirty = false;
+
+            // The blas wasn't built to be updated.  Build a new one that can be, frames in flight keep the old one
+            if (!mesh->deformable)
+            {
+                retiredAccelerationStructures_.push_back(std::make_pair(currentFrameNumber_ + 2, mesh->blas.accelerationStructure));
+                retiredBlasStorage_.push_back(std::make_pair(currentFrameNumber_ + 2, mesh->blas.storage));
+                mesh->blas = RayTracerAccelerationStructure();
+                mesh->deformable = true;
+
+                pendingBlasBuilds_.push_back(sharedMeshIndex);
+
+                // Instances reference blases by address
+                rebuildTlas_ = true;
+                continue;
+            }
+
+            RayTracerBlasBuild build;
+            VkAccelerationStructureBuildSizesInfoKHR buildSizes;
+            DescribeBlasBuild(sharedMeshIndex, false, build, buildSizes);
+
+            // Rebuilds happen in place.  Same geometry, so the existing storage still fits
+            const bool rebuild = std::find_if(rebuilds.begin(), rebuilds.end(), [sharedMeshIndex](const std::pair<float, int>& r) { return r.second == sharedMeshIndex; }) != rebuilds.end();
+            if (rebuild)
+            {
+                mesh->blasBounds = mesh->bounds;
+                mesh->blasQuality.Built(mesh->bounds.SurfaceArea());
+                ++rebuildCount;
+            }
+            else
+            {
+                Vulkan::Bounds drift = mesh->blasBounds;
+                drift.Add(mesh->bounds);
+                mesh->blasQuality.Updated(drift.SurfaceArea());
+
+                build.buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+                build.buildGeometryInfo.srcAccelerationStructure = mesh->blas.accelerationStructure;
+            }
+            build.buildGeometryInfo.dstAccelerationStructure = mesh->blas.accelerationStructure;
+            build.scratchSize = rebuild ? buildSizes.buildScratchSize : buildSizes.updateScratchSize;
+
+            scratchSize += scratchBuffer_.GetAlignedSize(build.scratchSize);
+            builds.push_back(std::move(build));
+        }
+
+        if (builds.empty())
+        {
+            return;
+        }
+
+        // Scratch comes from the shared arena, worker command buffers start with a barrier so earlier builds are done with it
+        scratchBuffer_.Reset();
+
+        Vulkan::Buffer releasedScratch;
+        VkResult scratchResult = scratchBuffer_.Reserve(scratchSize, releasedScratch);
+        if (releasedScratch.GetBuffer() != VK_NULL_HANDLE)
+        {
+            submissionRetiredBuffers_.push_back(std::make_pair(submittedTimelineValue_, releasedScratch));
+        }
+        if (scratchResult != VK_SUCCESS)
+        {
+            PFG_EDITORLOGERROR("Failed to reserve scratch memory for blas refits");
+
+            // Try again next frame
+            for (const auto& build : builds)
+            {
+                sharedMeshesPool_[build.sharedMeshIndex]->blasDirty = true;
+                dirtyBlases_.push_back(build.sharedMeshIndex);
+            }
+            return;
+        }
+
+        std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildGeometryInfos;
+        std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> buildRangeInfos;
+        for (auto& build : builds)
+        {
+            build.buildGeometryInfo.scratchData = scratchBuffer_.Allocate(build.scratchSize);
+
+            buildGeometryInfos.push_back(build.buildGeometryInfo);
+            buildRangeInfos.push_back(build.buildRangeInfos.data());
+        }
+
+        VkCommandBuffer commandBuffer;
+        CreateWorkerCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, graphicsCommandPool_, commandBuffer);
+
+        // Refits write the blases in place, traces already submitted must be done reading them
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+        memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+        vkCmdBuildAccelerationStructuresKHR(
+            commandBuffer,
+            static_cast<uint32_t>(buildGeometryInfos.size()),
+            buildGeometryInfos.data(),
+            buildRangeInfos.data());
+
+        // Make the refit blases visible to the tlas build
+        memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+        const uint64_t timelineValue = SubmitWorkerCommandBuffer(commandBuffer, graphicsCommandPool_, graphicsQueue_);
+        for (const auto& build : builds)
+        {
+            sharedMeshesPool_[build.sharedMeshIndex]->blasTimelineValue = timelineValue;
+        }
+
+        // Blas addresses didn't change, but their bounds did
+        updateTlas_ = true;
+
+        PFG_EDITORLOG("Refit " + std::to_string(builds.size() - rebuildCount) + " blases, rebuilt " + std::to_string(rebuildCount));
+    }
+
+    void RayTracer::BuildHostBlases(const std::vector<int>& sharedMeshIndices)
+    {
+        if (sharedMeshIndices.empty())
+        {
+            return;
+        }
+
+        auto batch = std::make_unique<RayTracerHostBlasBatch>();
+
+        // Build infos point at the geometries each build owns, which stay put when the build is moved
+        batch->builds.reserve(sharedMeshIndices.size());
+        for (auto sharedMeshIndex : sharedMeshIndices)
+        {
+            RayTracerBlasBuild build;
+            if (PrepareBlasBuild(sharedMeshIndex, true, build))
+            {
+                batch->builds.push_back(std::move(build));
+            }
+        }
+
+        if (batch->builds.empty())
+        {
+            return;
+        }
+
+        // Every build gets its own slice of host scratch, the threads build them in parallel
+        auto alignedScratchSize = [](VkDeviceSize size) { return (size + kAccelerationStructureAlignment - 1) / kAccelerationStructureAlignment * kAccelerationStructureAlignment; };
+
+        VkDeviceSize scratchSize = 0;
+        for (const auto& build : batch->builds)
+        {
+            scratchSize += alignedScratchSize(build.scratchSize);
+        }
+        batch->scratch.resize(static_cast<size_t>(scratchSize + kAccelerationStructureAlignment));
+
+        const uintptr_t scratchBase = reinterpret_cast<uintptr_t>(batch->scratch.data());
+        uint8_t* scratch = batch->scratch.data() + (alignedScratchSize(scratchBase) - scratchBase);
+        for (auto& build : batch->builds)
+        {
+            build.buildGeometryInfo.scratchData.hostAddress = scratch;
+            scratch += alignedScratchSize(build.scratchSize);
+
+            batch->buildGeometryInfos.push_back(build.buildGeometryInfo);
+            batch->buildRangeInfos.push_back(build.buildRangeInfos.data());
+        }
+
+        VkResult result = vkCreateDeferredOperationKHR(device_, HostAllocator::Instance().GetCallbacks(), &batch->operation);
+        VK_CHECK("vkCreateDeferredOperationKHR", result);
+        if (result == VK_SUCCESS)
+        {
+            result = vkBuildAccelerationStructuresKHR(
+                device_,
+                batch->operation,
+                static_cast<uint32_t>(batch->buildGeometryInfos.size()),
+                batch->buildGeometryInfos.data(),
+                batch->buildRangeInfos.data());
+
+            if (result == VK_OPERATION_DEFERRED_KHR)
+            {
+                deferredOperationPool_.Run(batch->operation);
+            }
+            else
+            {
+                // Completed (or failed) on this thread, nothing for the pool to join
+                VK_CHECK("vkBuildAccelerationStructuresKHR", result);
+            }
+        }
+
+        if (result != VK_SUCCESS && result != VK_OPERATION_DEFERRED_KHR && result != VK_OPERATION_NOT_DEFERRED_KHR)
+        {
+            PFG_EDITORLOGERROR("Failed to start host blas builds, building them on the device");
+
+            if (batch->operation != VK_NULL_HANDLE)
+            {
+                vkDestroyDeferredOperationKHR(device_, batch->operation, HostAllocator::Instance().GetCallbacks());
+            }
+
+            // Device builds read the geometry pages, the host copy is no longer needed
+            for (const auto& build : batch->builds)
+            {
+                auto& mesh = sharedMeshesPool_[build.sharedMeshIndex];
+                vkDestroyAccelerationStructureKHR(device_, mesh->blas.accelerationStructure, HostAllocator::Instance().GetCallbacks());
+                hostBlasBuffer_.Free(mesh->blas.storage);
+                mesh->blas = RayTracerAccelerationStructure();
+                mesh->hostVertices = std::vector<vec3>();
+                mesh->hostIndices = std::vector<uint32_t>();
+
+                pendingBlasBuilds_.push_back(build.sharedMeshIndex);
+            }
+            return;
+        }
+
+        // Instances of these meshes stay inactive until UploadHostBlases copies the blases to the device
+        for (const auto& build : batch->builds)
+        {
+            sharedMeshesPool_[build.sharedMeshIndex]->hostBlasBuild = true;
+        }
+
+        PFG_EDITORLOG("Started " + std::to_string(batch->builds.size()) + " host blas builds on " + std::to_string(deferredOperationPool_.GetThreadCount()) + " threads");
+
+        hostBlasBatches_.push_back(std::move(batch));
+    }
+
+    void RayTracer::UploadHostBlases()
+    {
+        if (hostBlasBatches_.empty())
+        {
+            return;
+        }
+
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        std::vector<std::pair<int, RayTracerAccelerationStructure>> uploadedBlases;
+        std::vector<RayTracerHostBlasBatch*> uploadedBatches;
+
+        for (auto& batch : hostBlasBatches_)
+        {
+            if (batch->operation == VK_NULL_HANDLE)
+            {
+                continue;
+            }
+
+            // Don't wait on the threads, builds that haven't finished are checked again next frame
+            if (!deferredOperationPool_.IsReleased(batch->operation))
+            {
+                continue;
+            }
+
+            const VkResult buildResult = vkGetDeferredOperationResultKHR(device_, batch->operation);
+            if (buildResult == VK_NOT_READY)
+            {
+                continue;
+            }
+
+            vkDestroyDeferredOperationKHR(device_, batch->operation, HostAllocator::Instance().GetCallbacks());
+            batch->operation = VK_NULL_HANDLE;
+
+            // Scratch is only needed while building
+            batch->scratch = std::vector<uint8_t>();
+
+            VK_CHECK("vkBuildAccelerationStructuresKHR", buildResult);
+            if (buildResult != VK_SUCCESS)
+            {
+                PFG_EDITORLOGERROR("Host blas builds failed, building them on the device");
+
+                for (const auto& build : batch->builds)
+                {
+                    auto& mesh = sharedMeshesPool_[build.sharedMeshIndex];
+                    batch->hostBlases.push_back(mesh->blas);
+                    mesh->blas = RayTracerAccelerationStructure();
+                    mesh->hostBlasBuild = false;
+                    mesh->hostVertices = std::vector<vec3>();
+                    mesh->hostIndices = std::vector<uint32_t>();
+
+                    pendingBlasBuilds_.push_back(build.sharedMeshIndex);
+                }
+                continue;
+            }
+
+            for (const auto& build : batch->builds)
+            {
+                auto& mesh = sharedMeshesPool_[build.sharedMeshIndex];
+
+                // Compacted size is known right away on the host, so the upload doubles as compaction
+                VkDeviceSize compactedSize = 0;
+                VkResult result = VK_SUCCESS;
+                if ((build.buildGeometryInfo.flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR) != 0)
+                {
+                    result = vkWriteAccelerationStructuresPropertiesKHR(
+                        device_,
+                        1,
+                        &mesh->blas.accelerationStructure,
+                        VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+                        sizeof(VkDeviceSize),
+                        &compactedSize,
+                        sizeof(VkDeviceSize));
+                    VK_CHECK("vkWriteAccelerationStructuresPropertiesKHR", result);
+                }
+
+                const bool compact = result == VK_SUCCESS && compactedSize > 0 && compactedSize < mesh->blas.storage.size;
+                const VkDeviceSize size = compact ? compactedSize : mesh->blas.storage.size;
+
+                RayTracerAccelerationStructure blas;
+                if (!blasBuffer_.Allocate(size, kAccelerationStructureAlignment, blas.storage))
+                {
+                    PFG_EDITORLOGERROR("Failed to allocate blas storage for mesh (sharedMeshInstanceId: " + std::to_string(mesh->sharedMeshInstanceId) + ")");
+                    continue;
+                }
+
+                VkAccelerationStructureCreateInfoKHR accelerationStructureCreateInfo = {};
+                accelerationStructureCreateInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+                accelerationStructureCreateInfo.buffer = blasBuffer_.GetPage(blas.storage.page).GetBuffer();
+                accelerationStructureCreateInfo.offset = blas.storage.offset;
+                accelerationStructureCreateInfo.size = size;
+                accelerationStructureCreateInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+
+                result = vkCreateAccelerationStructureKHR(device_, &accelerationStructureCreateInfo, HostAllocator::Instance().GetCallbacks(), &blas.accelerationStructure);
+                VK_CHECK("vkCreateAccelerationStructureKHR", result);
+                if (result != VK_SUCCESS)
+                {
+                    blasBuffer_.Free(blas.storage);
+                    continue;
+                }
+
+                if (commandBuffer == VK_NULL_HANDLE)
+                {
+                    CreateWorkerCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, graphicsCommandPool_, commandBuffer);
+                }
+
+                // The host blas' memory is host visible, the device reads it directly
+                VkCopyAccelerationStructureInfoKHR copyAccelerationStructureInfo = {};
+                copyAccelerationStructureInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR;
+                copyAccelerationStructureInfo.src = mesh->blas.accelerationStructure;
+                copyAccelerationStructureInfo.dst = blas.accelerationStructure;
+                copyAccelerationStructureInfo.mode = compact ? VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR : VK_COPY_ACCELERATION_STRUCTURE_MODE_CLONE_KHR;
+                vkCmdCopyAccelerationStructureKHR(commandBuffer, &copyAccelerationStructureInfo);
+
+                // Released with the batch once the copy is done
+                batch->hostBlases.push_back(mesh->blas);
+                uploadedBlases.push_back(std::make_pair(build.sharedMeshIndex, blas));
+            }
+
+            uploadedBatches.push_back(batch.get());
+        }
+
+        if (commandBuffer != VK_NULL_HANDLE)
+        {
+            // Make the uploaded blases visible to the tlas build
+            VkMemoryBarrier memoryBarrier = {};
+            memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+            memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+            vkCmdPipelineBarrier(
+                commandBuffer,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+            const uint64_t timelineValue = SubmitWorkerCommandBuffer(commandBuffer, graphicsCommandPool_, graphicsQueue_);
+
+            for (auto& uploadedBlas : uploadedBlases)
+            {
+                auto& mesh = sharedMeshesPool_[uploadedBlas.first];
+                auto& blas = uploadedBlas.second;
+
+                VkAccelerationStructureDeviceAddressInfoKHR accelerationStructureDeviceAddressInfo = {};
+                accelerationStructureDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+                accelerationStructureDeviceAddressInfo.accelerationStructure = blas.accelerationStructure;
+                blas.deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(device_, &accelerationStructureDeviceAddressInfo);
+
+                mesh->blas = blas;
+                mesh->blasTimelineValue = timelineValue;
+            }
+
+            for (auto batch : uploadedBatches)
+            {
+                batch->uploadTimelineValue = timelineValue;
+            }
+
+            // Instances reference blases by address
+            rebuildTlas_ = true;
+
+            PFG_EDITORLOG("Uploaded " + std::to_string(uploadedBlases.size()) + " host built blases");
+        }
+
+        // Meshes whose upload failed go back to device builds
+        for (auto batch : uploadedBatches)
+        {
+            for (const auto& build : batch->builds)
+            {
+                auto& mesh = sharedMeshesPool_[build.sharedMeshIndex];
+                if (!mesh->hostBlasBuild)
+                {
+                    continue;
+                }
+
+                if (mesh->blas.storage.page != Vulkan::GeometryAllocation::kInvalidPage && mesh->blas.deviceAddress == 0)
+                {
+                    batch->hostBlases.push_back(mesh->blas);
+                    mesh->blas = RayTracerAccelerationStructure();
+                    pendingBlasBuilds_.push_back(build.sharedMeshIndex);
+                }
+
+                mesh->hostBlasBuild = false;
+                mesh->hostVertices = std::vector<vec3>();
+                mesh->hostIndices = std::vector<uint32_t>();
+            }
+        }
+
+        // Release host blases once the device is done copying them
+        for (auto itr = hostBlasBatches_.begin(); itr != hostBlasBatches_.end();)
+        {
+            auto& batch = (*itr);
+            if (batch->operation != VK_NULL_HANDLE || batch->uploadTimelineValue > completedTimelineValue_)
+            {
+                ++itr;
+                continue;
+            }
+
+            for (auto& hostBlas : batch->hostBlases)
+            {
+                vkDestroyAccelerationStructureKHR(device_, hostBlas.accelerationStructure, HostAllocator::Instance().GetCallbacks());
+                hostBlasBuffer_.Free(hostBlas.storage);
+            }
+
+            itr = hostBlasBatches_.erase(itr);
+        }
+
+        // Host pages are only needed while builds are in flight
+        Vulkan::Buffer releasedPage;
+        while (hostBlasBuffer_.ReleaseLastPage(releasedPage))
+        {
+            releasedPage.Destroy();
+        }
+    }
+
+    void RayTracer::CompactBlases()
+    {
+        if (pendingCompactions_.empty())
+        {
+            return;
+        }
+
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        std::vector<std::pair<int, RayTracerAccelerationStructure>> compactedBlases;
+        VkDeviceSize savedBytes = 0;
+
+        for (auto itr = pendingCompactions_.begin(); itr != pendingCompactions_.end();)
+        {
+            const int sharedMeshIndex = (*itr);
+            auto& mesh = sharedMeshesPool_[sharedMeshIndex];
+
+            // Don't wait on the GPU, builds that haven't finished are checked again next frame
+            if (mesh->blasTimelineValue > completedTimelineValue_)
+            {
+                ++itr;
+                continue;
+            }
+
+            VkDeviceSize compactedSize = 0;
+            const VkResult result = vkGetQueryPoolResults(
+                device_,
+                compactionQueryPool_,
+                mesh->compactionQuery,
+                1,
+                sizeof(VkDeviceSize),
+                &compactedSize,
+                sizeof(VkDeviceSize),
+                VK_QUERY_RESULT_64_BIT);
+
+            if (result == VK_NOT_READY)
+            {
+                ++itr;
+                continue;
+            }
 
-                VkAccelerationStructureInstanceKHR& accelerationStructureInstance = instanceAccelerationStructures[instanceAccelerationStructuresIndex];
-                accelerationStructureInstance.transform = transformMatrix;
-                accelerationStructureInstance.instanceCustomIndex = instanceIndex;
-                accelerationStructureInstance.mask = 0xFF;
-                accelerationStructureInstance.instanceShaderBindingTableRecordOffset = 0;
-                accelerationStructureInstance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-                accelerationStructureInstance.accelerationStructureReference = sharedMeshesPool_[meshInstancePool_[instanceIndex]->sharedMeshIndex]->blas.deviceAddress;
+            VK_CHECK("vkGetQueryPoolResults", result);
 
-                /*PFG_EDITORLOG("VkAccelerationStructureInstanceKHR.transform: ");
-                PFG_EDITORLOG(std::to_string(accelerationStructureInstance.transform.matrix[0][0]) + ", " + std::to_string(accelerationStructureInstance.transform.matrix[0][1]) + ", " + std::to_string(accelerationStructureInstance.transform.matrix[0][2]) + ", " + std::to_string(accelerationStructureInstance.transform.matrix[0][3]));
-                PFG_EDITORLOG(std::to_string(accelerationStructureInstance.transform.matrix[1][0]) + ", " + std::to_string(accelerationStructureInstance.transform.matrix[1][1]) + ", " + std::to_string(accelerationStructureInstance.transform.matrix[1][2]) + ", " + std::to_string(accelerationStructureInstance.transform.matrix[1][3]));
-                PFG_EDITORLOG(std::to_string(accelerationStructureInstance.transform.matrix[2][0]) + ", " + std::to_string(accelerationStructureInstance.transform.matrix[2][1]) + ", " + std::to_string(accelerationStructureInstance.transform.matrix[2][2]) + ", " + std::to_string(accelerationStructureInstance.transform.matrix[2][3]));*/
+            freeCompactionQueries_.push_back(mesh->compactionQuery);
+            mesh->compactionQuery = RayTracerMeshSharedData::kNoCompactionQuery;
+            itr = pendingCompactions_.erase(itr);
 
-                // Consumed current index, advance
-                ++instanceAccelerationStructuresIndex;
+            if (result != VK_SUCCESS || compactedSize == 0 || compactedSize >= mesh->blas.storage.size)
+            {
+                continue;
             }
 
-            // Destroy anytihng if created before
-            instancesAccelerationStructuresBuffer_.Destroy();
+            RayTracerAccelerationStructure blas;
+            if (!blasBuffer_.Allocate(compactedSize, kAccelerationStructureAlignment, blas.storage))
+            {
+                continue;
+            }
 
-            instancesAccelerationStructuresBuffer_.Create(
-                device_,
-                physicalDeviceMemoryProperties_,
-                instanceAccelerationStructures.size() * sizeof(VkAccelerationStructureInstanceKHR),
-                VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-                Vulkan::Buffer::kDefaultMemoryPropertyFlags);
-            instancesAccelerationStructuresBuffer_.UploadData(instanceAccelerationStructures.data(), instancesAccelerationStructuresBuffer_.GetSize());
+            VkAccelerationStructureCreateInfoKHR accelerationStructureCreateInfo = {};
+            accelerationStructureCreateInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+            accelerationStructureCreateInfo.buffer = blasBuffer_.GetPage(blas.storage.page).GetBuffer();
+            accelerationStructureCreateInfo.offset = blas.storage.offset;
+            accelerationStructureCreateInfo.size = compactedSize;
+            accelerationStructureCreateInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+
+            VkResult createResult = vkCreateAccelerationStructureKHR(device_, &accelerationStructureCreateInfo, HostAllocator::Instance().GetCallbacks(), &blas.accelerationStructure);
+            VK_CHECK("vkCreateAccelerationStructureKHR", createResult);
+            if (createResult != VK_SUCCESS)
+            {
+                blasBuffer_.Free(blas.storage);
+                continue;
+            }
 
-            /*auto instances = reinterpret_cast<VkAccelerationStructureInstanceKHR*>(instancesAccelerationStructuresBuffer_.Map());
-            for (int i = 0; i < meshInstancePool_.in_use_size(); ++i)
+            if (commandBuffer == VK_NULL_HANDLE)
             {
+                CreateWorkerCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, graphicsCommandPool_, commandBuffer);
+            }
 
-                PFG_EDITORLOG("Instance transform matrix after upload: ");
-                PFG_EDITORLOG(std::to_string(instances[i].transform.matrix[0][0]) + ", " + std::to_string(instances[i].transform.matrix[0][1]) + ", " + std::to_string(instances[i].transform.matrix[0][2]) + ", " + std::to_string(instances[i].transform.matrix[0][3]));
-                PFG_EDITORLOG(std::to_string(instances[i].transform.matrix[1][0]) + ", " + std::to_string(instances[i].transform.matrix[1][1]) + ", " + std::to_string(instances[i].transform.matrix[1][2]) + ", " + std::to_string(instances[i].transform.matrix[1][3]));
-                PFG_EDITORLOG(std::to_string(instances[i].transform.matrix[2][0]) + ", " + std::to_string(instances[i].transform.matrix[2][1]) + ", " + std::to_string(instances[i].transform.matrix[2][2]) + ", " + std::to_string(instances[i].transform.matrix[2][3]));
+            VkCopyAccelerationStructureInfoKHR copyAccelerationStructureInfo = {};
+            copyAccelerationStructureInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR;
+            copyAccelerationStructureInfo.src = mesh->blas.accelerationStructure;
+            copyAccelerationStructureInfo.dst = blas.accelerationStructure;
+            copyAccelerationStructureInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+            vkCmdCopyAccelerationStructureKHR(commandBuffer, &copyAccelerationStructureInfo);
 
-            }
-            instancesAccelerationStructuresBuffer_.Unmap();*/
+            savedBytes += mesh->blas.storage.size - compactedSize;
+            compactedBlases.push_back(std::make_pair(sharedMeshIndex, blas));
         }
-        else
+
+        if (commandBuffer == VK_NULL_HANDLE)
+        {
+            return;
+        }
+
+        // Make the compacted blases visible to the tlas build
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+        SubmitWorkerCommandBuffer(commandBuffer, graphicsCommandPool_, graphicsQueue_);
+
+        // Swap in the compacted blases.  Frames in flight keep using the originals until they are done
+        for (auto& compactedBlas : compactedBlases)
+        {
+            auto& mesh = sharedMeshesPool_[compactedBlas.first];
+            auto& blas = compactedBlas.second;
+
+            retiredAccelerationStructures_.push_back(std::make_pair(currentFrameNumber_ + 2, mesh->blas.accelerationStructure));
+            retiredBlasStorage_.push_back(std::make_pair(currentFrameNumber_ + 2, mesh->blas.storage));
+
+            VkAccelerationStructureDeviceAddressInfoKHR accelerationStructureDeviceAddressInfo = {};
+            accelerationStructureDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+            accelerationStructureDeviceAddressInfo.accelerationStructure = blas.accelerationStructure;
+            blas.deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(device_, &accelerationStructureDeviceAddressInfo);
+
+            mesh->blas = blas;
+        }
+
+        // Instances reference blases by address
+        rebuildTlas_ = true;
+
+        PFG_EDITORLOG("Compacted " + std::to_string(compactedBlases.size()) + " blases, saved " + std::to_string(savedBytes) + " bytes");
+    }
+
+    void RayTracer::LoadCachedBlases()
+    {
+        if (!accelerationStructureCache_.IsEnabled() || pendingBlasBuilds_.empty())
+        {
+            return;
+        }
+
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        std::vector<int> loadedMeshes;
+        std::vector<Vulkan::Buffer> stagingBuffers;
+        std::vector<uint8_t> data;
+
+        for (auto itr = pendingBlasBuilds_.begin(); itr != pendingBlasBuilds_.end();)
         {
-            // Update transforms in buffer, should be the exact same layout
+            const int sharedMeshIndex = (*itr);
+            auto& mesh = sharedMeshesPool_[sharedMeshIndex];
 
-            auto instances = reinterpret_cast<VkAccelerationStructureInstanceKHR*>(instancesAccelerationStructuresBuffer_.Map());
+            if (mesh->cacheKey == RayTracerMeshSharedData::kNoCacheKey || mesh->deformable)
+            {
+                ++itr;
+                continue;
+            }
 
-            // Gather instances
-            uint32_t instanceAccelerationStructuresIndex = 0;
-            for (auto i = meshInstancePool_.in_use_begin(); i != meshInstancePool_.in_use_end(); ++i)
+            if (!accelerationStructureCache_.Load(mesh->cacheKey, data))
             {
-                auto instanceIndex = (*i);
+                // Built as usual, then written to the cache once it is final
+                RayTracerBlasSerialization serialization;
+                serialization.sharedMeshIndex = sharedMeshIndex;
+                serialization.cacheKey = mesh->cacheKey;
+                pendingSerializations_.push_back(serialization);
+
+                ++itr;
+                continue;
+            }
 
-                const auto& t = meshInstancePool_[instanceIndex]->localToWorld;
-                VkTransformMatrixKHR transformMatrix = {
-                    t[0][0], t[0][1], t[0][2], t[0][3],
-                    t[1][0], t[1][1], t[1][2], t[1][3],
-                    t[2][0], t[2][1], t[2][2], t[2][3]
-                };
+            const VkDeviceSize size = Vulkan::AccelerationStructureCache::GetDeserializedSize(data);
+
+            // Deserialization reads the data through its device address, which has to be 256 byte aligned
+            Vulkan::Buffer stagingBuffer;
+            if (size == 0 ||
+                stagingBuffer.Create(
+                    device_,
+                    physicalDeviceMemoryProperties_,
+                    data.size(),
+                    VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                    Vulkan::Buffer::kDefaultMemoryPropertyFlags,
+                    Vulkan::MemoryCategory::Staging,
+                    kAccelerationStructureAlignment)
+                != VK_SUCCESS)
+            {
+                ++itr;
+                continue;
+            }
 
-                //PFG_EDITORLOG("Instance transform matrix: ");
-                //PFG_EDITORLOG(std::to_string(t[0][0]) + ", " + std::to_string(t[0][1]) + ", " + std::to_string(t[0][2]) + ", " + std::to_string(t[0][3]));
-                //PFG_EDITORLOG(std::to_string(t[1][0]) + ", " + std::to_string(t[1][1]) + ", " + std::to_string(t[1][2]) + ", " + std::to_string(t[1][3]));
-                //PFG_EDITORLOG(std::to_string(t[2][0]) + ", " + std::to_string(t[2][1]) + ", " + std::to_string(t[2][2]) + ", " + std::to_string(t[2][3]));
+            if (!stagingBuffer.UploadData(data.data(), data.size()))
+            {
+                stagingBuffer.Destroy();
+                ++itr;
+                continue;
+            }
 
-                instances[instanceAccelerationStructuresIndex].transform = transformMatrix;
-                
-                // Consumed current index, advance
-                ++instanceAccelerationStructuresIndex;
+            RayTracerAccelerationStructure blas;
+            if (!blasBuffer_.Allocate(size, kAccelerationStructureAlignment, blas.storage))
+            {
+                stagingBuffer.Destroy();
+                ++itr;
+                continue;
             }
-            instancesAccelerationStructuresBuffer_.Unmap();
+
+            VkAccelerationStructureCreateInfoKHR accelerationStructureCreateInfo = {};
+            accelerationStructureCreateInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+            accelerationStructureCreateInfo.buffer = blasBuffer_.GetPage(blas.storage.page).GetBuffer();
+            accelerationStructureCreateInfo.offset = blas.storage.offset;
+            accelerationStructureCreateInfo.size = size;
+            accelerationStructureCreateInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+
+            VkResult createResult = vkCreateAccelerationStructureKHR(device_, &accelerationStructureCreateInfo, HostAllocator::Instance().GetCallbacks(), &blas.accelerationStructure);
+            VK_CHECK("vkCreateAccelerationStructureKHR", createResult);
+            if (createResult != VK_SUCCESS)
+            {
+                blasBuffer_.Free(blas.storage);
+                stagingBuffer.Destroy();
+                ++itr;
+                continue;
+            }
+
+            if (commandBuffer == VK_NULL_HANDLE)
+            {
+                CreateWorkerCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, graphicsCommandPool_, commandBuffer);
+            }
+
+            VkCopyMemoryToAccelerationStructureInfoKHR copyMemoryToAccelerationStructureInfo = {};
+            copyMemoryToAccelerationStructureInfo.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR;
+            copyMemoryToAccelerationStructureInfo.src = stagingBuffer.GetBufferDeviceAddressConst();
+            copyMemoryToAccelerationStructureInfo.dst = blas.accelerationStructure;
+            copyMemoryToAccelerationStructureInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR;
+            vkCmdCopyMemoryToAccelerationStructureKHR(commandBuffer, &copyMemoryToAccelerationStructureInfo);
+
+            VkAccelerationStructureDeviceAddressInfoKHR accelerationStructureDeviceAddressInfo = {};
+            accelerationStructureDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+            accelerationStructureDeviceAddressInfo.accelerationStructure = blas.accelerationStructure;
+            blas.deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(device_, &accelerationStructureDeviceAddressInfo);
+
+            // Stored compacted, so there is nothing left to do for it but trace
+            mesh->blas = blas;
+            mesh->hostVertices = std::vector<vec3>();
+            mesh->hostIndices = std::vector<uint32_t>();
+
+            loadedMeshes.push_back(sharedMeshIndex);
+            stagingBuffers.push_back(stagingBuffer);
+            itr = pendingBlasBuilds_.erase(itr);
         }
 
-        //auto instances = reinterpret_cast<VkAccelerationStructureInstanceKHR*>(instancesAccelerationStructuresBuffer_.Map());
-        //for (int i = 0; i < meshInstancePool_.in_use_size(); ++i)
-        //{
-        //    
-        //    PFG_EDITORLOG("Instance transform matrix: ");
-        //        PFG_EDITORLOG(std::to_string(instances[i].transform.matrix[0][0]) + ", " + std::to_string(instances[i].transform.matrix[0][1]) + ", " + std::to_string(instances[i].transform.matrix[0][2]) + ", " + std::to_string(instances[i].transform.matrix[0][3]));
-        //        PFG_EDITORLOG(std::to_string(instances[i].transform.matrix[1][0]) + ", " + std::to_string(instances[i].transform.matrix[1][1]) + ", " + std::to_string(instances[i].transform.matrix[1][2]) + ", " + std::to_string(instances[i].transform.matrix[1][3]));
-        //        PFG_EDITORLOG(std::to_string(instances[i].transform.matrix[2][0]) + ", " + std::to_string(instances[i].transform.matrix[2][1]) + ", " + std::to_string(instances[i].transform.matrix[2][2]) + ", " + std::to_string(instances[i].transform.matrix[2][3]));
-        //        
-        //}
-        //instancesAccelerationStructuresBuffer_.Unmap();
+        if (commandBuffer == VK_NULL_HANDLE)
+        {
+            return;
+        }
 
-        // The top level acceleration structure contains (bottom level) instance as the input geometry
-        VkAccelerationStructureGeometryInstancesDataKHR accelerationStructureGeometryInstancesData = {};
-        accelerationStructureGeometryInstancesData.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
-        accelerationStructureGeometryInstancesData.arrayOfPointers = VK_FALSE;
-        accelerationStructureGeometryInstancesData.data.deviceAddress = instancesAccelerationStructuresBuffer_.GetBufferDeviceAddressConst().deviceAddress;
+        // Make the deserialized blases visible to the tlas build
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
 
-        VkAccelerationStructureGeometryKHR accelerationStructureGeometry = {};
-        accelerationStructureGeometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
-        accelerationStructureGeometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
-        accelerationStructureGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
-        accelerationStructureGeometry.geometry.instances = accelerationStructureGeometryInstancesData;
+        const uint64_t timelineValue = SubmitWorkerCommandBuffer(commandBuffer, graphicsCommandPool_, graphicsQueue_);
 
-        // Get the size requirements for buffers involved in the acceleration structure build process
-        VkAccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo = {};
-        accelerationStructureBuildGeometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-        accelerationStructureBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-        accelerationStructureBuildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-        accelerationStructureBuildGeometryInfo.geometryCount = 1;
-        accelerationStructureBuildGeometryInfo.pGeometries = &accelerationStructureGeometry;
+        for (auto sharedMeshIndex : loadedMeshes)
+        {
+            sharedMeshesPool_[sharedMeshIndex]->blasTimelineValue = timelineValue;
+        }
 
-        // Number of instances
-        uint32_t instancesCount = static_cast<uint32_t>(meshInstancePool_.in_use_size());
+        // The copies are still in flight, keep the staging buffers until they are done
+        for (auto& stagingBuffer : stagingBuffers)
+        {
+            submissionRetiredBuffers_.push_back(std::make_pair(timelineValue, stagingBuffer));
+        }
 
-        VkAccelerationStructureBuildSizesInfoKHR accelerationStructureBuildSizesInfo = {};
-        accelerationStructureBuildSizesInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
-        vkGetAccelerationStructureBuildSizesKHR(
-            device_,
-            VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-            &accelerationStructureBuildGeometryInfo,
-            &instancesCount,
-            &accelerationStructureBuildSizesInfo);
+        // Instances reference blases by address
+        rebuildTlas_ = true;
 
-        if (!update)
+        PFG_EDITORLOG("Loaded " + std::to_string(loadedMeshes.size()) + " blases from the acceleration structure cache");
+    }
+
+    void RayTracer::SerializeBlases()
+    {
+        if (pendingSerializations_.empty())
         {
-            tlas_.buffer.Destroy();
+            return;
+        }
 
-            // Create a buffer to hold the acceleration structure
-            tlas_.buffer.Create(
+        // Serializations recorded below are tagged with this until the submit's timeline value is known
+        const uint64_t kSubmitPending = UINT64_MAX;
+
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        uint32_t storedCount = 0;
+
+        auto beginCommandBuffer = [this, &commandBuffer]()
+        {
+            if (commandBuffer != VK_NULL_HANDLE)
+            {
+                return;
+            }
+
+            CreateWorkerCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, graphicsCommandPool_, commandBuffer);
+
+            // Blases written by earlier submits must be done before they are read
+            VkMemoryBarrier memoryBarrier = {};
+            memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+            memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+            vkCmdPipelineBarrier(
+                commandBuffer,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+        };
+
+        for (auto itr = pendingSerializations_.begin(); itr != pendingSerializations_.end();)
+        {
+            auto& serialization = (*itr);
+
+            // Meshes that were removed or changed since they were queued no longer match the key
+            const int sharedMeshIndex = serialization.sharedMeshIndex;
+            const bool meshMatches =
+                sharedMeshIndex < static_cast<int>(sharedMeshesPool_.pool_size()) &&
+                sharedMeshesPool_[sharedMeshIndex] &&
+                sharedMeshesPool_[sharedMeshIndex]->cacheKey == serialization.cacheKey;
+
+            if (!meshMatches)
+            {
+                if (serialization.query != RayTracerBlasSerialization::kNoQuery)
+                {
+                    freeSerializationQueries_.push_back(serialization.query);
+                }
+                if (serialization.buffer.GetBuffer() != VK_NULL_HANDLE)
+                {
+                    submissionRetiredBuffers_.push_back(std::make_pair(serialization.timelineValue, serialization.buffer));
+                }
+                itr = pendingSerializations_.erase(itr);
+                continue;
+            }
+
+            // Don't wait on the GPU, serializations that haven't gotten this far are checked again next frame
+            if (serialization.timelineValue > completedTimelineValue_)
+            {
+                ++itr;
+                continue;
+            }
+
+            auto& mesh = sharedMeshesPool_[sharedMeshIndex];
+
+            if (serialization.buffer.GetBuffer() != VK_NULL_HANDLE)
+            {
+                // Serialized data has reached host memory
+                serialization.buffer.Invalidate();
+                if (accelerationStructureCache_.Store(serialization.cacheKey, serialization.buffer.Map(), static_cast<size_t>(serialization.buffer.GetSize())))
+                {
+                    ++storedCount;
+                }
+
+                serialization.buffer.Destroy();
+                itr = pendingSerializations_.erase(itr);
+                continue;
+            }
+
+            if (serialization.query == RayTracerBlasSerialization::kNoQuery)
+            {
+                // The blas is final once it is built, uploaded from the host and compacted
+                if (mesh->blas.accelerationStructure == VK_NULL_HANDLE || mesh->hostBlasBuild ||
+                    mesh->compactionQuery != RayTracerMeshSharedData::kNoCompactionQuery ||
+                    freeSerializationQueries_.empty())
+                {
+                    ++itr;
+                    continue;
+                }
+
+                beginCommandBuffer();
+
+                serialization.query = freeSerializationQueries_.back();
+                freeSerializationQueries_.pop_back();
+
+                vkCmdResetQueryPool(commandBuffer, serializationQueryPool_, serialization.query, 1);
+                vkCmdWriteAccelerationStructuresPropertiesKHR(
+                    commandBuffer,
+                    1,
+                    &mesh->blas.accelerationStructure,
+                    VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR,
+                    serializationQueryPool_,
+                    serialization.query);
+
+                serialization.timelineValue = kSubmitPending;
+                ++itr;
+                continue;
+            }
+
+            VkDeviceSize serializedSize = 0;
+            const VkResult result = vkGetQueryPoolResults(
                 device_,
-                physicalDeviceMemoryProperties_,
-                accelerationStructureBuildSizesInfo.accelerationStructureSize,
-                VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
-                Vulkan::Buffer::kDefaultMemoryPropertyFlags);
+                serializationQueryPool_,
+                serialization.query,
+                1,
+                sizeof(VkDeviceSize),
+                &serializedSize,
+                sizeof(VkDeviceSize),
+                VK_QUERY_RESULT_64_BIT);
+
+            if (result == VK_NOT_READY)
+            {
+                ++itr;
+                continue;
+            }
 
-            // Create the acceleration structure
-            VkAccelerationStructureCreateInfoKHR accelerationStructureCreateInfo = {};
-            accelerationStructureCreateInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
-            accelerationStructureCreateInfo.buffer = tlas_.buffer.GetBuffer();
-            accelerationStructureCreateInfo.size = accelerationStructureBuildSizesInfo.accelerationStructureSize;
-            accelerationStructureCreateInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-            VK_CHECK("vkCreateAccelerationStructureKHR", vkCreateAccelerationStructureKHR(device_, &accelerationStructureCreateInfo, nullptr, &tlas_.accelerationStructure));
-        }
+            VK_CHECK("vkGetQueryPoolResults", result);
+
+            freeSerializationQueries_.push_back(serialization.query);
+            serialization.query = RayTracerBlasSerialization::kNoQuery;
+
+            if (result != VK_SUCCESS || serializedSize == 0 ||
+                serialization.buffer.Create(
+                    device_,
+                    physicalDeviceMemoryProperties_,
+                    serializedSize,
+                    VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                    Vulkan::Buffer::kDefaultMemoryPropertyFlags,
+                    Vulkan::MemoryCategory::Staging,
+                    kAccelerationStructureAlignment)
+                != VK_SUCCESS)
+            {
+                itr = pendingSerializations_.erase(itr);
+                continue;
+            }
 
-        // The actual build process starts here
+            beginCommandBuffer();
 
-        // Create a scratch buffer as a temporary storage for the acceleration structure build
-        Vulkan::Buffer scratchBuffer;
-        scratchBuffer.Create(
-            device_,
-            physicalDeviceMemoryProperties_,
-            accelerationStructureBuildSizesInfo.buildScratchSize,
-            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            // Defragmentation clones the blas, which serializes to the same size
+            VkCopyAccelerationStructureToMemoryInfoKHR copyAccelerationStructureToMemoryInfo = {};
+            copyAccelerationStructureToMemoryInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR;
+            copyAccelerationStructureToMemoryInfo.src = mesh->blas.accelerationStructure;
+            copyAccelerationStructureToMemoryInfo.dst = serialization.buffer.GetBufferDeviceAddress();
+            copyAccelerationStructureToMemoryInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR;
+            vkCmdCopyAccelerationStructureToMemoryKHR(commandBuffer, &copyAccelerationStructureToMemoryInfo);
 
-        VkAccelerationStructureBuildGeometryInfoKHR accelerationBuildGeometryInfo = {};
-        accelerationBuildGeometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-        accelerationBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-        accelerationBuildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-        accelerationBuildGeometryInfo.mode = update ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-        accelerationBuildGeometryInfo.srcAccelerationStructure = update ? tlas_.accelerationStructure : VK_NULL_HANDLE;
-        accelerationBuildGeometryInfo.dstAccelerationStructure = tlas_.accelerationStructure;
-        accelerationBuildGeometryInfo.geometryCount = 1;
-        accelerationBuildGeometryInfo.pGeometries = &accelerationStructureGeometry;
-        accelerationBuildGeometryInfo.scratchData = scratchBuffer.GetBufferDeviceAddress();
+            serialization.timelineValue = kSubmitPending;
+            ++itr;
+        }
 
+        if (storedCount > 0)
+        {
+            PFG_EDITORLOG("Stored " + std::to_string(storedCount) + " blases in the acceleration structure cache");
+        }
 
-        VkAccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo;
-        accelerationStructureBuildRangeInfo.primitiveCount = static_cast<uint32_t>(meshInstancePool_.in_use_size());
-        accelerationStructureBuildRangeInfo.primitiveOffset = 0;
-        accelerationStructureBuildRangeInfo.firstVertex = 0;
-        accelerationStructureBuildRangeInfo.transformOffset = 0;
+        if (commandBuffer == VK_NULL_HANDLE)
+        {
+            return;
+        }
 
-        const VkAccelerationStructureBuildRangeInfoKHR* constAccelerationStructureBuildRangeInfo = &accelerationStructureBuildRangeInfo;
-        
-        // Build the acceleration structure on the device via a one-time command buffer submission
-        // Some implementations may support acceleration structure building on the host (VkPhysicalDeviceAccelerationStructureFeaturesKHR->accelerationStructureHostCommands), but we prefer device builds
-        VkCommandBuffer commandBuffer;
-        CreateWorkerCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, graphicsCommandPool_, commandBuffer);
-        vkCmdBuildAccelerationStructuresKHR(
+        // Make the serialized data visible to the host
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(
             commandBuffer,
-            1,
-            &accelerationBuildGeometryInfo,
-            &constAccelerationStructureBuildRangeInfo);
-        SubmitWorkerCommandBuffer(commandBuffer, graphicsCommandPool_, graphicsQueue_);
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_HOST_BIT,
+            0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
 
-        scratchBuffer.Destroy();
+        const uint64_t timelineValue = SubmitWorkerCommandBuffer(commandBuffer, graphicsCommandPool_, graphicsQueue_);
+        for (auto& serialization : pendingSerializations_)
+        {
+            if (serialization.timelineValue == kSubmitPending)
+            {
+                serialization.timelineValue = timelineValue;
+            }
+        }
+    }
 
-        // Get the top acceleration structure's handle, which will be used to setup it's descriptor
-        VkAccelerationStructureDeviceAddressInfoKHR accelerationStructureDeviceAddressInfo = {};
-        accelerationStructureDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
-        accelerationStructureDeviceAddressInfo.accelerationStructure = tlas_.accelerationStructure;
-        tlas_.deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(device_, &accelerationStructureDeviceAddressInfo);
+    void RayTracer::ReadTimestamps()
+    {
+        if (timestampQueryPool_ == VK_NULL_HANDLE)
+        {
+            return;
+        }
 
-        PFG_EDITORLOG("Succesfully built tlas");
-        
-        // We did any pending work, reset flags
-        rebuildTlas_= false;
-        updateTlas_ = false;
+        const float millisecondsPerTick = physicalDeviceProperties_.limits.timestampPeriod / 1000000.0f;
+        uint64_t timestamps[2];
+
+        if (tlasTimingTimelineValue_ != 0 && completedTimelineValue_ >= tlasTimingTimelineValue_)
+        {
+            if (vkGetQueryPoolResults(device_, timestampQueryPool_, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+            {
+                const float milliseconds = (timestamps[1] - timestamps[0]) * millisecondsPerTick;
+
+                float& average = tlasTimingUpdate_ ? tlasRefitMilliseconds_ : tlasBuildMilliseconds_;
+                average = average > 0.0f ? average * 0.75f + milliseconds * 0.25f : milliseconds;
+            }
+
+            tlasTimingTimelineValue_ = 0;
+        }
+
+        for (uint32_t slot = 0; slot < kTraceTimingSlots; ++slot)
+        {
+            auto& timing = traceTimings_[slot];
+
+            // Unity's frames aren't tracked by the timeline, the safe frame says when they are done
+            if (!timing.pending || timing.frameNumber > safeFrameNumber_)
+            {
+                continue;
+            }
+
+            if (vkGetQueryPoolResults(device_, timestampQueryPool_, 2 + 2 * slot, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS &&
+                timing.tlasBuildCount == tlasBuildCount_ && timing.megapixels > 0.0f)
+            {
+                const float milliseconds = (timestamps[1] - timestamps[0]) * millisecondsPerTick;
+                tlasQuality_.Traced(milliseconds / timing.megapixels, timing.megapixels);
+            }
+
+            timing.pending = false;
+        }
     }
 
-    void RayTracer::Prepare() 
+    void RayTracer::ReleaseSharedMeshes()
     {
-        if (alreadyPrepared_)
+        for (auto itr = releasedSharedMeshes_.begin(); itr != releasedSharedMeshes_.end();)
         {
-            return;
+            const int sharedMeshIndex = (*itr);
+            auto& mesh = sharedMeshesPool_[sharedMeshIndex];
+
+            // An instance was added again since the mesh was queued
+            if (mesh->instanceCount > 0)
+            {
+                itr = releasedSharedMeshes_.erase(itr);
+                continue;
+            }
+
+            // Host builds and compactions still in flight replace the blas, release it once they are done
+            if (mesh->hostBlasBuild || mesh->compactionQuery != RayTracerMeshSharedData::kNoCompactionQuery)
+            {
+                ++itr;
+                continue;
+            }
+
+            pendingBlasBuilds_.erase(std::remove(pendingBlasBuilds_.begin(), pendingBlasBuilds_.end(), sharedMeshIndex), pendingBlasBuilds_.end());
+            dirtyBlases_.erase(std::remove(dirtyBlases_.begin(), dirtyBlases_.end(), sharedMeshIndex), dirtyBlases_.end());
+
+            // Frames in flight may still trace the blas and read the geometry and mesh data
+            if (mesh->blas.accelerationStructure != VK_NULL_HANDLE)
+            {
+                retiredAccelerationStructures_.push_back(std::make_pair(currentFrameNumber_ + 2, mesh->blas.accelerationStructure));
+                retiredBlasStorage_.push_back(std::make_pair(currentFrameNumber_ + 2, mesh->blas.storage));
+            }
+
+            retiredGeometry_.push_back(std::make_pair(currentFrameNumber_ + 2, mesh->geometry));
+
+            if (mesh->meshDataOffset != RayTracerMeshSharedData::kNoMeshData)
+            {
+                retiredMeshData_.push_back(std::make_pair(currentFrameNumber_ + 2, std::make_pair(mesh->meshDataOffset, static_cast<uint32_t>(mesh->submeshes.size()))));
+            }
+
+            PFG_EDITORLOG("Removed mesh (sharedMeshInstanceId: " + std::to_string(mesh->sharedMeshInstanceId) + ")");
+
+            // Queued serializations of the mesh see the empty slot and drop themselves
+            sharedMeshesPool_.remove(sharedMeshIndex);
+            itr = releasedSharedMeshes_.erase(itr);
         }
+    }
 
-        CreateDescriptorSetsLayouts();
-        CreateDescriptorPool();
+    bool RayTracer::UpdateMeshData(int sharedMeshPoolIndex)
+    {
+        const auto& mesh = sharedMeshesPool_[sharedMeshPoolIndex];
+        const uint32_t entryCount = static_cast<uint32_t>(mesh->submeshes.size());
 
-        alreadyPrepared_ = true;
+        if (mesh->meshDataOffset == RayTracerMeshSharedData::kNoMeshData)
+        {
+            uint64_t offset = meshDataRanges_.Allocate(entryCount, 1);
+            if (offset == RangeAllocator::kInvalidOffset)
+            {
+                const uint32_t newCapacity = std::max(meshDataCapacity_ + entryCount, std::max(meshDataCapacity_ * 2, 64u));
+
+                Vulkan::Buffer newBuffer;
+                if (newBuffer.Create(
+                    device_,
+                    physicalDeviceMemoryProperties_,
+                    sizeof(ShaderMeshData) * newCapacity,
+                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                    Vulkan::Buffer::kDefaultMemoryPropertyFlags,
+                    Vulkan::MemoryCategory::MeshGeometry)
+                    != VK_SUCCESS)
+                {
+                    return false;
+                }
+
+                if (meshDataCapacity_ > 0)
+                {
+                    newBuffer.UploadData(meshDataBuffer_.Map(), sizeof(ShaderMeshData) * meshDataCapacity_);
+
+                    // Frames in flight may still read the old table, keep it until they are done
+                    retiredBuffers_.push_back(std::make_pair(currentFrameNumber_ + 2, meshDataBuffer_));
+                }
+
+                meshDataBuffer_ = newBuffer;
+                meshDataCapacity_ = newCapacity;
+                meshDataRanges_.Grow(newCapacity);
+
+                meshDataBufferInfo_.buffer = meshDataBuffer_.GetBuffer();
+                meshDataBufferInfo_.offset = 0;
+                meshDataBufferInfo_.range = meshDataBuffer_.GetSize();
+
+                for (auto& renderTarget : renderTargets_)
+                {
+                    renderTarget.second->updateDescriptorSetsData = true;
+                }
+
+                offset = meshDataRanges_.Allocate(entryCount, 1);
+            }
+
+            mesh->meshDataOffset = static_cast<uint32_t>(offset);
+        }
+
+        // Only this mesh's entries change.  The range is always freshly allocated, either for a new mesh or for one whose
+        // geometry was moved, so frames in flight never see these entries change under them
+        std::vector<ShaderMeshData> meshData(entryCount);
+        for (uint32_t i = 0; i < entryCount; ++i)
+        {
+            meshData[i].geometryPage = mesh->geometry.page;
+            meshData[i].attributeOffset = static_cast<uint32_t>((mesh->geometry.offset + mesh->attributesOffset) / sizeof(ShaderVertexAttribute));
+            meshData[i].faceOffset = static_cast<uint32_t>((mesh->geometry.offset + mesh->facesOffset) / sizeof(ShaderFace)) + mesh->submeshes[i].indexStart / 3;
+            meshData[i].materialIndex = i;
+            meshData[i].sourceInstanceOffset = mesh->isStaticBatch ? static_cast<uint32_t>((mesh->geometry.offset + mesh->sourceInstancesOffset) / sizeof(uint32_t)) + mesh->submeshes[i].indexStart / 3 : NO_SOURCE_INSTANCES;
+        }
+
+        return meshDataBuffer_.UploadData(meshData.data(), sizeof(ShaderMeshData) * entryCount, sizeof(ShaderMeshData) * mesh->meshDataOffset);
     }
 
-    void RayTracer::ResetPipeline()
+    void RayTracer::ReleaseRetiredResources(uint64_t safeFrameNumber)
     {
-        if (pipeline_ != VK_NULL_HANDLE)
+        for (auto itr = retiredAccelerationStructures_.begin(); itr != retiredAccelerationStructures_.end();)
         {
-            vkDestroyPipeline(device_, pipeline_, nullptr);
-            pipeline_ = VK_NULL_HANDLE;
+            if (itr->first <= safeFrameNumber)
+            {
+                vkDestroyAccelerationStructureKHR(device_, itr->second, HostAllocator::Instance().GetCallbacks());
+                itr = retiredAccelerationStructures_.erase(itr);
+            }
+            else
+            {
+                ++itr;
+            }
+        }
+
+        for (auto itr = retiredBlasStorage_.begin(); itr != retiredBlasStorage_.end();)
+        {
+            if (itr->first <= safeFrameNumber)
+            {
+                blasBuffer_.Free(itr->second);
+                itr = retiredBlasStorage_.erase(itr);
+            }
+            else
+            {
+                ++itr;
+            }
         }
-    }
 
-    void RayTracer::UpdateCamera(int cameraInstanceId, float* camPos, float* camDir, float* camUp, float* camSide, float* camNearFarFov)
-    {
-        if (renderTargets_.find(cameraInstanceId) == renderTargets_.end())
+        for (auto itr = retiredGeometry_.begin(); itr != retiredGeometry_.end();)
         {
-            // The camera isn't in the system yet, don't attempt to update
-            return;
+            if (itr->first <= safeFrameNumber)
+            {
+                geometryBuffer_.Free(itr->second);
+                itr = retiredGeometry_.erase(itr);
+            }
+            else
+            {
+                ++itr;
+            }
         }
 
-        auto& renderTarget = renderTargets_[cameraInstanceId];
-
-        if (renderTarget->cameraData.GetBuffer() == VK_NULL_HANDLE)
+        for (auto itr = retiredMeshData_.begin(); itr != retiredMeshData_.end();)
         {
-            renderTarget->cameraData.Create(
-                device_,
-                physicalDeviceMemoryProperties_,
-                sizeof(ShaderCameraParam),
-                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-                Vulkan::Buffer::kDefaultMemoryPropertyFlags);
+            if (itr->first <= safeFrameNumber)
+            {
+                meshDataRanges_.Free(itr->second.first, itr->second.second);
+                itr = retiredMeshData_.erase(itr);
+            }
+            else
+            {
+                ++itr;
+            }
         }
 
-        auto camera = reinterpret_cast<ShaderCameraParam*>(renderTarget->cameraData.Map());
-        camera->camPos.x = camPos[0];
-        camera->camPos.y = camPos[1];
-        camera->camPos.z = camPos[2];
-
-        camera->camDir.x = camDir[0];
-        camera->camDir.y = camDir[1];
-        camera->camDir.z = camDir[2];
-
-        camera->camUp.x = camUp[0];
-        camera->camUp.y = camUp[1];
-        camera->camUp.z = camUp[2];
-
-        camera->camSide.x = camSide[0];
-        camera->camSide.y = camSide[1];
-        camera->camSide.z = camSide[2];
+        // Pages emptied by the frees above.  Descriptor sets of frames in flight may still point at a geometry page,
+        // so the buffers go through the retired list as well
+        Vulkan::Buffer releasedPage;
+        while (blasBuffer_.ReleaseLastPage(releasedPage))
+        {
+            retiredBuffers_.push_back(std::make_pair(currentFrameNumber_ + 2, releasedPage));
+        }
 
-        camera->camNearFarFov.x = camNearFarFov[0];
-        camera->camNearFarFov.y = camNearFarFov[1];
-        camera->camNearFarFov.z = camNearFarFov[2];
+        while (geometryBuffer_.ReleaseLastPage(releasedPage))
+        {
+            retiredBuffers_.push_back(std::make_pair(currentFrameNumber_ + 2, releasedPage));
 
-        renderTarget->cameraData.Unmap();
-        
-        //PFG_EDITORLOG("Updated camera " + std::to_string(cameraInstanceId));
-    }
+            for (auto& renderTarget : renderTargets_)
+            {
+                renderTarget.second->updateDescriptorSetsData = true;
+            }
+        }
 
-    void RayTracer::UpdateSceneData(float* color) 
-    {
-        if (sceneData_.GetBuffer() == VK_NULL_HANDLE)
+        for (auto itr = retiredBuffers_.begin(); itr != retiredBuffers_.end();)
         {
-            sceneData_.Create(
-                device_,
-                physicalDeviceMemoryProperties_,
-                sizeof(ShaderSceneParam),
-                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-                Vulkan::Buffer::kDefaultMemoryPropertyFlags);
+            if (itr->first <= safeFrameNumber)
+            {
+                itr->second.Destroy();
+                itr = retiredBuffers_.erase(itr);
+            }
+            else
+            {
+                ++itr;
+            }
         }
-    
-        auto scene = reinterpret_cast<ShaderSceneParam*>(sceneData_.Map());
-        scene->ambient.r = color[0];
-        scene->ambient.g = color[1];
-        scene->ambient.b = color[2];
-        scene->ambient.a = color[3];
-
-        sceneData_.Unmap();
     }
 
-    void RayTracer::TraceRays(int cameraInstanceId)
+    void RayTracer::Defragment(float budgetMilliseconds)
     {
-        if (renderTargets_.find(cameraInstanceId) == renderTargets_.end())
+        if (budgetMilliseconds <= 0.0f)
         {
-            // The camera isn't in the system yet, don't attempt to trace
             return;
         }
 
-        if (renderTargets_[cameraInstanceId]->cameraData.GetBuffer() == VK_NULL_HANDLE)
+        const uint32_t geometryPage = geometryBuffer_.GetEvacuationPage();
+        const uint32_t blasPage = blasBuffer_.GetEvacuationPage();
+        if (geometryPage == Vulkan::GeometryAllocation::kInvalidPage && blasPage == Vulkan::GeometryAllocation::kInvalidPage)
         {
-            // This camera hasn't been updated get for render
             return;
         }
 
-        if (tlas_.accelerationStructure == VK_NULL_HANDLE)
+        struct Move
         {
-            PFG_EDITORLOG("We don't have a tlas, so we cannot trace rays!");
-            return;
-        }
+            int sharedMeshIndex;
+            bool movedGeometry;
+            Vulkan::GeometryAllocation geometry;
+            bool movedBlas;
+            RayTracerAccelerationStructure blas;
+        };
 
-        if (pipelineLayout_ == VK_NULL_HANDLE)
+        const auto start = std::chrono::steady_clock::now();
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        std::vector<Move> moves;
+
+        for (auto itr = sharedMeshesPool_.in_use_begin(); itr != sharedMeshesPool_.in_use_end(); ++itr)
         {
-            CreatePipelineLayout();
-            if (pipelineLayout_ == VK_NULL_HANDLE)
+            // Copies are recorded into one submit that isn't waited on, so the budget only covers recording them
+            const std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            if (elapsed.count() >= budgetMilliseconds)
             {
-                PFG_EDITORLOG("Something went wrong with creating the pipeline layout");
-                // Something went wrong, don't continue
-                return;
+                break;
             }
-        }
 
-        if (pipeline_ == VK_NULL_HANDLE)
-        {
-            CreatePipeline();
-            if (pipeline_ == VK_NULL_HANDLE)
+            const int sharedMeshIndex = (*itr);
+            auto& mesh = sharedMeshesPool_[sharedMeshIndex];
+
+            const bool moveGeometry = mesh->geometry.page == geometryPage;
+            // Blases waiting to be compacted are moved by the compaction itself
+            const bool moveBlas = mesh->blas.accelerationStructure != VK_NULL_HANDLE && mesh->blas.storage.page == blasPage && mesh->compactionQuery == RayTracerMeshSharedData::kNoCompactionQuery && !mesh->hostBlasBuild;
+            if (!moveGeometry && !moveBlas)
             {
-                PFG_EDITORLOG("Something went wrong with creating the pipeline");
-                return;
+                continue;
             }
-        }
-        
-        if (pipeline_ != VK_NULL_HANDLE && pipelineLayout_!= VK_NULL_HANDLE)
-        {
-            BuildDescriptorBufferInfos(cameraInstanceId);
-            UpdateDescriptorSets(cameraInstanceId);
 
-            // cannot manage resources inside renderpass
-            graphicsInterface_->EnsureOutsideRenderPass();
+            if (commandBuffer == VK_NULL_HANDLE)
+            {
+                CreateWorkerCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, graphicsCommandPool_, commandBuffer);
+            }
 
-            UnityVulkanRecordingState recordingState;
-            if (!graphicsInterface_->CommandRecordingState(&recordingState, kUnityVulkanGraphicsQueueAccess_DontCare))
+            Move move = {};
+            move.sharedMeshIndex = sharedMeshIndex;
+            move.movedGeometry = moveGeometry && RelocateGeometry(sharedMeshIndex, commandBuffer, move.geometry);
+            move.movedBlas = moveBlas && RelocateBlas(sharedMeshIndex, commandBuffer, move.blas);
+
+            if (!move.movedGeometry && !move.movedBlas)
             {
-                return;
+                // Nothing fits in the earlier pages, try again next frame
+                break;
             }
 
-            BuildAndSubmitRayTracingCommandBuffer(cameraInstanceId, recordingState.commandBuffer);
-            CopyRenderToRenderTarget(cameraInstanceId, recordingState.commandBuffer);
+            moves.push_back(move);
         }
-    }
 
-#pragma endregion RayTracerAPI
+        if (commandBuffer == VK_NULL_HANDLE)
+        {
+            return;
+        }
 
-    void RayTracer::CreateCommandPool(uint32_t queueFamilyIndex, VkCommandPool& outCommandPool)
-    {
-        VkCommandPoolCreateInfo commandPoolCreateInfo = {};
-        commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-        commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndex;
-        commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        // Make the moved data visible to tlas builds and closest hit shaders
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+            0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
 
-        VK_CHECK("vkCreateCommandPool", vkCreateCommandPool(device_, &commandPoolCreateInfo, nullptr, &outCommandPool));
-    }
+        SubmitWorkerCommandBuffer(commandBuffer, graphicsCommandPool_, graphicsQueue_);
 
-    void RayTracer::CreateWorkerCommandBuffer(VkCommandBufferLevel level, VkCommandPool commandPool, VkCommandBuffer& outCommandBuffer)
-    {
-        //TODO : Can we just use a recording state from unity?
-        VkCommandBufferAllocateInfo commandBufferAllocateInfo = {};
-        commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        commandBufferAllocateInfo.commandPool = commandPool;
-        commandBufferAllocateInfo.level = level;
-        commandBufferAllocateInfo.commandBufferCount = 1;
+        // Everything submitted from here on runs after the copies, so point everything at the new locations.  Frames
+        // in flight keep using the old ones
+        for (auto& move : moves)
+        {
+            auto& mesh = sharedMeshesPool_[move.sharedMeshIndex];
 
-        VK_CHECK("vkAllocateCommandBuffers", vkAllocateCommandBuffers(device_, &commandBufferAllocateInfo, &outCommandBuffer));
-    
-        // Start recording for the new command buffer
-        VkCommandBufferBeginInfo commandBufferBeginInfo = { };
-        commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        VK_CHECK("vkBeginCommandBuffer", vkBeginCommandBuffer(outCommandBuffer, &commandBufferBeginInfo));
-    }
+            if (move.movedGeometry)
+            {
+                retiredGeometry_.push_back(std::make_pair(currentFrameNumber_ + 2, mesh->geometry));
+                mesh->geometry = move.geometry;
 
-    void RayTracer::SubmitWorkerCommandBuffer(VkCommandBuffer commandBuffer, VkCommandPool commandPool, const VkQueue& queue)
-    {
-        VK_CHECK("vkEndCommandBuffer", vkEndCommandBuffer(commandBuffer));
+                // Frames in flight still read the old entries, so write the new locations to a fresh range
+                if (mesh->meshDataOffset != RayTracerMeshSharedData::kNoMeshData)
+                {
+                    retiredMeshData_.push_back(std::make_pair(currentFrameNumber_ + 2, std::make_pair(mesh->meshDataOffset, static_cast<uint32_t>(mesh->submeshes.size()))));
+                    mesh->meshDataOffset = RayTracerMeshSharedData::kNoMeshData;
+                }
 
-        VkSubmitInfo submitInfo = {};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
-    
-        /*if (signalSemaphore)
-        {
-            submit_info.pSignalSemaphores = &signalSemaphore;
-            submit_info.signalSemaphoreCount = 1;
-        }*/
-    
-        // Create fence to ensure that the command buffer has finished executing
-        VkFenceCreateInfo fenceCreateInfo = { };
-        fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fenceCreateInfo.flags = 0;
-    
-        VkFence fence;
-        VK_CHECK("vkCreateFence", vkCreateFence(device_, &fenceCreateInfo, nullptr, &fence));
-    
-        // Submit to the queue
-        VkResult result = vkQueueSubmit(queue, 1, &submitInfo, fence);
-        if (result == VK_ERROR_DEVICE_LOST)
-        {
+                if (!UpdateMeshData(move.sharedMeshIndex))
+                {
+                    PFG_EDITORLOGERROR("Failed to update mesh data for shared mesh instance id " + std::to_string(mesh->sharedMeshInstanceId));
+                }
 
-        }
+                // Instances carry the mesh data offset in their custom index
+                rebuildTlas_ = true;
+            }
 
-        VK_CHECK("vkQueueSubmit", result);
-    
-        // Wait for the fence to signal that command buffer has finished executing
-        const uint64_t DEFAULT_FENCE_TIMEOUT = 100000000000;
-        VK_CHECK("vkWaitForFences", vkWaitForFences(device_, 1, &fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT));
-    
-        vkDestroyFence(device_, fence, nullptr);
+            if (move.movedBlas)
+            {
+                retiredAccelerationStructures_.push_back(std::make_pair(currentFrameNumber_ + 2, mesh->blas.accelerationStructure));
+                retiredBlasStorage_.push_back(std::make_pair(currentFrameNumber_ + 2, mesh->blas.storage));
 
-        if (commandPool != VK_NULL_HANDLE)
+                VkAccelerationStructureDeviceAddressInfoKHR accelerationStructureDeviceAddressInfo = {};
+                accelerationStructureDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+                accelerationStructureDeviceAddressInfo.accelerationStructure = move.blas.accelerationStructure;
+                move.blas.deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(device_, &accelerationStructureDeviceAddressInfo);
+
+                mesh->blas = move.blas;
+
+                // Instances reference blases by address
+                rebuildTlas_ = true;
+            }
+        }
+
+        if (!moves.empty())
         {
-            vkFreeCommandBuffers(device_, commandPool, 1, &commandBuffer);
+            PFG_EDITORLOG("Defragment moved " + std::to_string(moves.size()) + " shared meshes");
         }
     }
 
-    void RayTracer::BuildBlas(int sharedMeshPoolIndex)
+    bool RayTracer::RelocateGeometry(int sharedMeshPoolIndex, VkCommandBuffer commandBuffer, Vulkan::GeometryAllocation& outGeometry)
     {
-        // Create buffers for the bottom level geometry
-    
-        // Setup a single transformation matrix that can be used to transform the whole geometry for a single bottom level acceleration structure
-        VkTransformMatrixKHR transformMatrix = {
-            1.0f, 0.0f, 0.0f, 0.0f,
-            0.0f, 1.0f, 0.0f, 0.0f,
-            0.0f, 0.0f, 1.0f, 0.0f };
-        
-        Vulkan::Buffer transformBuffer;
-        transformBuffer.Create(
-            device_, 
-            physicalDeviceMemoryProperties_, 
-            sizeof(VkTransformMatrixKHR),
-            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-            Vulkan::Buffer::kDefaultMemoryPropertyFlags);
-        transformBuffer.UploadData(&transformMatrix, sizeof(VkTransformMatrixKHR));
-
-        //auto identity = reinterpret_cast<VkTransformMatrixKHR*>(transformBuffer.Map());
-        //PFG_EDITORLOG("Identity matrix: ");
-        //PFG_EDITORLOG(std::to_string(identity->matrix[0][0]) + ", " + std::to_string(identity->matrix[0][1]) + ", " + std::to_string(identity->matrix[0][2]) + ", " + std::to_string(identity->matrix[0][3]));
-        //PFG_EDITORLOG(std::to_string(identity->matrix[1][0]) + ", " + std::to_string(identity->matrix[1][1]) + ", " + std::to_string(identity->matrix[1][2]) + ", " + std::to_string(identity->matrix[1][3]));
-        //PFG_EDITORLOG(std::to_string(identity->matrix[2][0]) + ", " + std::to_string(identity->matrix[2][1]) + ", " + std::to_string(identity->matrix[2][2]) + ", " + std::to_string(identity->matrix[2][3]));
-        //transformBuffer.Unmap();
-
-        // The bottom level acceleration structure contains one set of triangles as the input geometry
-        VkAccelerationStructureGeometryKHR accelerationStructureGeometry = {};
-        accelerationStructureGeometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
-        accelerationStructureGeometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
-        accelerationStructureGeometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+        const auto& mesh = sharedMeshesPool_[sharedMeshPoolIndex];
 
-        accelerationStructureGeometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
-        accelerationStructureGeometry.geometry.triangles.pNext = nullptr;
-        accelerationStructureGeometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-        accelerationStructureGeometry.geometry.triangles.vertexData = sharedMeshesPool_[sharedMeshPoolIndex]->vertexBuffer.GetBufferDeviceAddressConst();
-        accelerationStructureGeometry.geometry.triangles.maxVertex = sharedMeshesPool_[sharedMeshPoolIndex]->vertexCount;
-        accelerationStructureGeometry.geometry.triangles.vertexStride = sizeof(vec3);
-        accelerationStructureGeometry.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
-        accelerationStructureGeometry.geometry.triangles.indexData = sharedMeshesPool_[sharedMeshPoolIndex]->indexBuffer.GetBufferDeviceAddressConst();
-        accelerationStructureGeometry.geometry.triangles.transformData = transformBuffer.GetBufferDeviceAddressConst();
-        
-        // Get the size requirements for buffers involved in the acceleration structure build process
-        VkAccelerationStructureBuildGeometryInfoKHR accelerationStructureBuildGeometryInfo = {};
-        accelerationStructureBuildGeometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-        accelerationStructureBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-        accelerationStructureBuildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-        accelerationStructureBuildGeometryInfo.geometryCount = 1;
-        accelerationStructureBuildGeometryInfo.pGeometries = &accelerationStructureGeometry;
+        if (!geometryBuffer_.AllocateInPages(mesh->geometry.size, kGeometryAlignment, mesh->geometry.page, outGeometry))
+        {
+            return false;
+        }
 
-        // Number of triangles 
-        const uint32_t primitiveCount = sharedMeshesPool_[sharedMeshPoolIndex]->indexCount / 3;
-        /*PFG_EDITORLOG("BuildBlas() vertexCount: " + std::to_string(sharedMeshesPool_[sharedMeshPoolIndex]->vertexCount));
-        PFG_EDITORLOG("BuildBlas() indexCount: " + std::to_string(sharedMeshesPool_[sharedMeshPoolIndex]->indexCount));*/
+        VkBufferCopy geometryCopy = { mesh->geometry.offset, outGeometry.offset, mesh->geometry.size };
+        vkCmdCopyBuffer(
+            commandBuffer,
+            geometryBuffer_.GetPage(mesh->geometry.page).GetBuffer(),
+            geometryBuffer_.GetPage(outGeometry.page).GetBuffer(),
+            1, &geometryCopy);
 
-        VkAccelerationStructureBuildSizesInfoKHR accelerationStructureBuildSizesInfo = {};
-        accelerationStructureBuildSizesInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
-        vkGetAccelerationStructureBuildSizesKHR(
-            device_,
-            VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-            &accelerationStructureBuildGeometryInfo,
-            &primitiveCount,
-            &accelerationStructureBuildSizesInfo);
+        return true;
+    }
+
+    bool RayTracer::RelocateBlas(int sharedMeshPoolIndex, VkCommandBuffer commandBuffer, RayTracerAccelerationStructure& outBlas)
+    {
+        const auto& mesh = sharedMeshesPool_[sharedMeshPoolIndex];
+
+        if (!blasBuffer_.AllocateInPages(mesh->blas.storage.size, kAccelerationStructureAlignment, mesh->blas.storage.page, outBlas.storage))
+        {
+            return false;
+        }
 
-        // Create a buffer to hold the acceleration structure
-        sharedMeshesPool_[sharedMeshPoolIndex]->blas.buffer.Create(
-            device_,
-            physicalDeviceMemoryProperties_,
-            accelerationStructureBuildSizesInfo.accelerationStructureSize,
-            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
-            Vulkan::Buffer::kDefaultMemoryPropertyFlags);
-    
-        // Create the acceleration structure
         VkAccelerationStructureCreateInfoKHR accelerationStructureCreateInfo = {};
         accelerationStructureCreateInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
-        accelerationStructureCreateInfo.buffer = sharedMeshesPool_[sharedMeshPoolIndex]->blas.buffer.GetBuffer();
-        accelerationStructureCreateInfo.size = accelerationStructureBuildSizesInfo.accelerationStructureSize;
+        accelerationStructureCreateInfo.buffer = blasBuffer_.GetPage(outBlas.storage.page).GetBuffer();
+        accelerationStructureCreateInfo.offset = outBlas.storage.offset;
+        accelerationStructureCreateInfo.size = outBlas.storage.size;
         accelerationStructureCreateInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-        VK_CHECK("vkCreateAccelerationStructureKHR", vkCreateAccelerationStructureKHR(device_, &accelerationStructureCreateInfo, nullptr, &sharedMeshesPool_[sharedMeshPoolIndex]->blas.accelerationStructure));
-
-        // The actual build process starts here
-        // Create a scratch buffer as a temporary storage for the acceleration structure build
-        Vulkan::Buffer scratchBuffer;
-        scratchBuffer.Create(
-            device_, 
-            physicalDeviceMemoryProperties_, 
-            accelerationStructureBuildSizesInfo.buildScratchSize, 
-            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, 
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-        VkAccelerationStructureBuildGeometryInfoKHR accelerationBuildGeometryInfo = { };
-        accelerationBuildGeometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-        accelerationBuildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-        accelerationBuildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-        accelerationBuildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-        accelerationBuildGeometryInfo.dstAccelerationStructure = sharedMeshesPool_[sharedMeshPoolIndex]->blas.accelerationStructure;
-        accelerationBuildGeometryInfo.geometryCount = 1;
-        accelerationBuildGeometryInfo.pGeometries = &accelerationStructureGeometry;
-        accelerationBuildGeometryInfo.scratchData = scratchBuffer.GetBufferDeviceAddress();
-
-        VkAccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo = { };
-        accelerationStructureBuildRangeInfo.primitiveCount = primitiveCount;
-        accelerationStructureBuildRangeInfo.primitiveOffset = 0;
-        accelerationStructureBuildRangeInfo.firstVertex = 0;
-        accelerationStructureBuildRangeInfo.transformOffset = 0;
-        std::vector<VkAccelerationStructureBuildRangeInfoKHR*> accelerationStructureBuildRangeInfos = { &accelerationStructureBuildRangeInfo };
-
-        // Build the acceleration structure on the device via a one-time command buffer submission.  We will NOT use the Unity command buffer in this case
-        // Some implementations may support acceleration structure building on the host (VkPhysicalDeviceAccelerationStructureFeaturesKHR->accelerationStructureHostCommands), but we prefer device builds
-
-        VkCommandBuffer buildCommandBuffer;
-        CreateWorkerCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, graphicsCommandPool_, buildCommandBuffer);
-        vkCmdBuildAccelerationStructuresKHR(
-            buildCommandBuffer,
-            1,
-            &accelerationBuildGeometryInfo,
-            accelerationStructureBuildRangeInfos.data());
-        SubmitWorkerCommandBuffer(buildCommandBuffer, graphicsCommandPool_, graphicsQueue_);
 
-        transformBuffer.Destroy();
-        scratchBuffer.Destroy();
+        VkResult result = vkCreateAccelerationStructureKHR(device_, &accelerationStructureCreateInfo, HostAllocator::Instance().GetCallbacks(), &outBlas.accelerationStructure);
+        VK_CHECK("vkCreateAccelerationStructureKHR", result);
+        if (result != VK_SUCCESS)
+        {
+            blasBuffer_.Free(outBlas.storage);
+            return false;
+        }
 
-        // Get the bottom acceleration structure's handle, which will be used during the top level acceleration build
-        VkAccelerationStructureDeviceAddressInfoKHR accelerationStructureDeviceAddressInfo{};
-        accelerationStructureDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
-        accelerationStructureDeviceAddressInfo.accelerationStructure = sharedMeshesPool_[sharedMeshPoolIndex]->blas.accelerationStructure;
-        sharedMeshesPool_[sharedMeshPoolIndex]->blas.deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(device_, &accelerationStructureDeviceAddressInfo);
+        // A clone keeps the blas exactly as built, no need to touch the geometry
+        VkCopyAccelerationStructureInfoKHR copyAccelerationStructureInfo = {};
+        copyAccelerationStructureInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR;
+        copyAccelerationStructureInfo.src = mesh->blas.accelerationStructure;
+        copyAccelerationStructureInfo.dst = outBlas.accelerationStructure;
+        copyAccelerationStructureInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_CLONE_KHR;
+        vkCmdCopyAccelerationStructureKHR(commandBuffer, &copyAccelerationStructureInfo);
 
-        PFG_EDITORLOG("Built blas for mesh (sharedMeshInstanceId: " + std::to_string(sharedMeshesPool_[sharedMeshPoolIndex]->sharedMeshInstanceId) + ")");
+        return true;
     }
 
     void RayTracer::CreateDescriptorSetsLayouts()
@@ -1362,29 +4613,37 @@ namespace PixelsForGlory::Vulkan
         //  binding 0  ->  Acceleration structure
         //  binding 1  ->  Scene data
         //  binding 2  ->  Camera data
+        //  binding 3  ->  Mesh data table
         {
             VkDescriptorSetLayoutBinding accelerationStructureLayoutBinding;
             accelerationStructureLayoutBinding.binding = DESCRIPTOR_BINDING_ACCELERATION_STRUCTURE;
             accelerationStructureLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
-            accelerationStructureLayoutBinding.descriptorCount = 1;
+            accelerationStructureLayoutBinding.descriptorCount = TLAS_LAYER_COUNT;
             accelerationStructureLayoutBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
 
             VkDescriptorSetLayoutBinding sceneDataLayoutBinding;
             sceneDataLayoutBinding.binding = DESCRIPTOR_BINDING_SCENE_DATA;
-            sceneDataLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            sceneDataLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
             sceneDataLayoutBinding.descriptorCount = 1;
             sceneDataLayoutBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
 
             VkDescriptorSetLayoutBinding cameraDataLayoutBinding;
             cameraDataLayoutBinding.binding = DESCRIPTOR_BINDING_CAMERA_DATA;
-            cameraDataLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            cameraDataLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
             cameraDataLayoutBinding.descriptorCount = 1;
             cameraDataLayoutBinding.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_KHR;
 
+            VkDescriptorSetLayoutBinding meshDataLayoutBinding;
+            meshDataLayoutBinding.binding = DESCRIPTOR_BINDING_MESH_DATA;
+            meshDataLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            meshDataLayoutBinding.descriptorCount = 1;
+            meshDataLayoutBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
+
             std::vector<VkDescriptorSetLayoutBinding> bindings({
                     accelerationStructureLayoutBinding,
                     sceneDataLayoutBinding,
-                    cameraDataLayoutBinding
+                    cameraDataLayoutBinding,
+                    meshDataLayoutBinding
                 });
 
             VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {};
@@ -1395,7 +4654,7 @@ namespace PixelsForGlory::Vulkan
             VK_CHECK("vkCreateDescriptorSetLayout", 
                 vkCreateDescriptorSetLayout(device_, 
                                             &descriptorSetLayoutCreateInfo, 
-                                            nullptr, 
+                                            HostAllocator::Instance().GetCallbacks(), 
                                             // Overkill, but represents the sets its creating                        
                                             &descriptorSetLayouts_[DESCRIPTOR_SET_ACCELERATION_STRUCTURE & DESCRIPTOR_SET_SCENE_DATA & DESCRIPTOR_SET_CAMERA_DATA]));
         }
@@ -1414,11 +4673,11 @@ namespace PixelsForGlory::Vulkan
             descriptorSetLayoutCreateInfo.bindingCount = 1;
             descriptorSetLayoutCreateInfo.pBindings = &imageLayoutBinding;
             
-            VK_CHECK("vkCreateDescriptorSetLayout", vkCreateDescriptorSetLayout(device_, &descriptorSetLayoutCreateInfo, nullptr, &descriptorSetLayouts_[DESCRIPTOR_SET_RENDER_TARGET]));
+            VK_CHECK("vkCreateDescriptorSetLayout", vkCreateDescriptorSetLayout(device_, &descriptorSetLayoutCreateInfo, HostAllocator::Instance().GetCallbacks(), &descriptorSetLayouts_[DESCRIPTOR_SET_RENDER_TARGET]));
         }
 
         // set 2
-        // binding 0 -> attributes
+        // binding 0 -> attributes, one per geometry page
         {
             const VkDescriptorBindingFlags setFlag = VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT;
 
@@ -1431,7 +4690,7 @@ namespace PixelsForGlory::Vulkan
             VkDescriptorSetLayoutBinding verticesLayoutBinding;
             verticesLayoutBinding.binding = DESCRIPTOR_BINDING_VERTEX_ATTRIBUTES;
             verticesLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-            verticesLayoutBinding.descriptorCount = static_cast<uint32_t>(sharedMeshAttributesPool_.pool_size());
+            verticesLayoutBinding.descriptorCount = Vulkan::GeometryBuffer::kMaxPages;
             verticesLayoutBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
 
             VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {};
@@ -1440,11 +4699,11 @@ namespace PixelsForGlory::Vulkan
             descriptorSetLayoutCreateInfo.pBindings = &verticesLayoutBinding;
             descriptorSetLayoutCreateInfo.pNext = &setBindingFlags;
 
-            VK_CHECK("vkCreateDescriptorSetLayout", vkCreateDescriptorSetLayout(device_, &descriptorSetLayoutCreateInfo, nullptr, &descriptorSetLayouts_[DESCRIPTOR_SET_VERTEX_ATTRIBUTES]));
+            VK_CHECK("vkCreateDescriptorSetLayout", vkCreateDescriptorSetLayout(device_, &descriptorSetLayoutCreateInfo, HostAllocator::Instance().GetCallbacks(), &descriptorSetLayouts_[DESCRIPTOR_SET_VERTEX_ATTRIBUTES]));
         }
 
         // set 3
-        // binding 0 -> faces
+        // binding 0 -> faces, one per geometry page
         {
             const VkDescriptorBindingFlags setFlag = VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT;
 
@@ -1457,7 +4716,7 @@ namespace PixelsForGlory::Vulkan
             VkDescriptorSetLayoutBinding indicesLayoutBinding;
             indicesLayoutBinding.binding = DESCRIPTOR_BINDING_FACE_DATA;
             indicesLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-            indicesLayoutBinding.descriptorCount = static_cast<uint32_t>(sharedMeshFacesPool_.pool_size());;
+            indicesLayoutBinding.descriptorCount = Vulkan::GeometryBuffer::kMaxPages;
             indicesLayoutBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
 
             VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {};
@@ -1466,7 +4725,33 @@ namespace PixelsForGlory::Vulkan
             descriptorSetLayoutCreateInfo.pBindings = &indicesLayoutBinding;
             descriptorSetLayoutCreateInfo.pNext = &setBindingFlags;
 
-            VK_CHECK("vkCreateDescriptorSetLayout", vkCreateDescriptorSetLayout(device_, &descriptorSetLayoutCreateInfo, nullptr, &descriptorSetLayouts_[DESCRIPTOR_SET_FACE_DATA]));
+            VK_CHECK("vkCreateDescriptorSetLayout", vkCreateDescriptorSetLayout(device_, &descriptorSetLayoutCreateInfo, HostAllocator::Instance().GetCallbacks(), &descriptorSetLayouts_[DESCRIPTOR_SET_FACE_DATA]));
+        }
+
+        // set 4
+        // binding 0 -> source instances of static batch triangles, one per geometry page
+        {
+            const VkDescriptorBindingFlags setFlag = VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT;
+
+            VkDescriptorSetLayoutBindingFlagsCreateInfo setBindingFlags;
+            setBindingFlags.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+            setBindingFlags.pNext = nullptr;
+            setBindingFlags.pBindingFlags = &setFlag;
+            setBindingFlags.bindingCount = 1;
+
+            VkDescriptorSetLayoutBinding sourceInstancesLayoutBinding;
+            sourceInstancesLayoutBinding.binding = DESCRIPTOR_BINDING_SOURCE_INSTANCES;
+            sourceInstancesLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            sourceInstancesLayoutBinding.descriptorCount = Vulkan::GeometryBuffer::kMaxPages;
+            sourceInstancesLayoutBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR;
+
+            VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {};
+            descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+            descriptorSetLayoutCreateInfo.bindingCount = 1;
+            descriptorSetLayoutCreateInfo.pBindings = &sourceInstancesLayoutBinding;
+            descriptorSetLayoutCreateInfo.pNext = &setBindingFlags;
+
+            VK_CHECK("vkCreateDescriptorSetLayout", vkCreateDescriptorSetLayout(device_, &descriptorSetLayoutCreateInfo, HostAllocator::Instance().GetCallbacks(), &descriptorSetLayouts_[DESCRIPTOR_SET_SOURCE_INSTANCES]));
         }
     }
 
@@ -1477,7 +4762,7 @@ namespace PixelsForGlory::Vulkan
         pipelineLayoutCreateInfo.setLayoutCount = DESCRIPTOR_SET_SIZE;
         pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayouts_.data();
 
-        VK_CHECK("vkCreatePipelineLayout", vkCreatePipelineLayout(device_, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout_));
+        VK_CHECK("vkCreatePipelineLayout", vkCreatePipelineLayout(device_, &pipelineLayoutCreateInfo, HostAllocator::Instance().GetCallbacks(), &pipelineLayout_));
     }
 
     void RayTracer::CreatePipeline()
@@ -1510,6 +4795,9 @@ namespace PixelsForGlory::Vulkan
         shaderBindingTable_.AddStageToMissGroup(rayMissShader.GetShaderStage(VK_SHADER_STAGE_MISS_BIT_KHR), PRIMARY_MISS_SHADERS_INDEX);
         shaderBindingTable_.AddStageToMissGroup(shadowMiss.GetShaderStage(VK_SHADER_STAGE_MISS_BIT_KHR), SHADOW_MISS_SHADERS_INDEX);
 
+        // Hit records are indexed by blas geometry, every geometry uses the same hit groups
+        shaderBindingTable_.SetHitRecordSets(MAX_BLAS_GEOMETRIES);
+
         // Create the pipeline for ray tracing based on shader binding table
         VkRayTracingPipelineCreateInfoKHR rayPipelineInfo = {};
         rayPipelineInfo.sType = VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_KHR;
@@ -1520,7 +4808,7 @@ namespace PixelsForGlory::Vulkan
         rayPipelineInfo.maxPipelineRayRecursionDepth = 1;
         rayPipelineInfo.layout = pipelineLayout_;
 
-        VK_CHECK("vkCreateRayTracingPipelinesKHR", vkCreateRayTracingPipelinesKHR(device_, VK_NULL_HANDLE, VK_NULL_HANDLE, 1, &rayPipelineInfo, nullptr, &pipeline_));
+        VK_CHECK("vkCreateRayTracingPipelinesKHR", vkCreateRayTracingPipelinesKHR(device_, VK_NULL_HANDLE, VK_NULL_HANDLE, 1, &rayPipelineInfo, HostAllocator::Instance().GetCallbacks(), &pipeline_));
 
         shaderBindingTable_.CreateSBT(device_, physicalDeviceMemoryProperties_, pipeline_);
     }
@@ -1542,12 +4830,15 @@ namespace PixelsForGlory::Vulkan
             VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
             pipeline_);
 
+        // Ordered by binding in set 0: scene data, camera data
+        const uint32_t dynamicOffsets[] = { sceneDataOffset_, renderTarget->cameraDataOffset };
+
         vkCmdBindDescriptorSets(
             recordingState.commandBuffer,
             VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
             pipelineLayout_, 0,
             static_cast<uint32_t>(renderTarget->descriptorSets.size()), renderTarget->descriptorSets.data(),
-            0, 0);
+            2, dynamicOffsets);
 
         VkStridedDeviceAddressRegionKHR raygenShaderEntry = {};
         raygenShaderEntry.deviceAddress = shaderBindingTable_.GetBuffer().GetBufferDeviceAddress().deviceAddress + shaderBindingTable_.GetRaygenOffset();
@@ -1568,19 +4859,47 @@ namespace PixelsForGlory::Vulkan
 
         // Dispatch the ray tracing commands
         vkCmdBindPipeline(recordingState.commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipeline_);
-        vkCmdBindDescriptorSets(recordingState.commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipelineLayout_, 0, static_cast<uint32_t>(renderTarget->descriptorSets.size()), renderTarget->descriptorSets.data(), 0, 0);
+        vkCmdBindDescriptorSets(recordingState.commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipelineLayout_, 0, static_cast<uint32_t>(renderTarget->descriptorSets.size()), renderTarget->descriptorSets.data(), 2, dynamicOffsets);
+
+        // Worker submits aren't waited on by the CPU.  They were submitted to this queue before Unity's frame, so this
+        // barrier is enough to have the trace wait on the GPU for geometry, blas and tlas writes
+        VkMemoryBarrier memoryBarrier = {};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+        memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(
+            recordingState.commandBuffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+            0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
 
-        // Make into a storage image
+        // Make into a storage image.  Previous contents are discarded and the barrier waits on all earlier commands,
+        // which is what lets cameras of the same size share one image from the render target pool
         VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
         Vulkan::Image::UpdateImageBarrier(
             recordingState.commandBuffer,
-            renderTargets_[cameraInstanceId]->stagingImage.GetImage(),
+            renderTargets_[cameraInstanceId]->stagingImage->GetImage(),
             range,
             0, VK_ACCESS_SHADER_WRITE_BIT,
             VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
 
         //PFG_EDITORLOG("Tracing for " + std::to_string(cameraInstanceId));
 
+        // Time the first trace of the frame, unless the slot's last timing hasn't been read back yet
+        const uint32_t timingSlot = static_cast<uint32_t>(currentFrameNumber_ % kTraceTimingSlots);
+        const bool timeTrace = timestampQueryPool_ != VK_NULL_HANDLE && !traceTimings_[timingSlot].pending;
+        if (timeTrace)
+        {
+            auto& timing = traceTimings_[timingSlot];
+            timing.frameNumber = currentFrameNumber_;
+            timing.tlasBuildCount = tlasBuildCount_;
+            timing.megapixels = static_cast<float>(renderTarget->extent.width) * renderTarget->extent.height * renderTarget->extent.depth / 1000000.0f;
+            timing.pending = true;
+
+            vkCmdResetQueryPool(recordingState.commandBuffer, timestampQueryPool_, 2 + 2 * timingSlot, 2);
+            vkCmdWriteTimestamp(recordingState.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool_, 2 + 2 * timingSlot);
+        }
+
         vkCmdTraceRaysKHR(
             recordingState.commandBuffer,
             &raygenShaderEntry,
@@ -1591,6 +4910,11 @@ namespace PixelsForGlory::Vulkan
             renderTargets_[cameraInstanceId]->extent.height,
             renderTargets_[cameraInstanceId]->extent.depth);
 
+        if (timeTrace)
+        {
+            vkCmdWriteTimestamp(recordingState.commandBuffer, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR, timestampQueryPool_, 3 + 2 * timingSlot);
+        }
+
         //SubmitWorkerCommandBuffer(commandBuffer, graphicsCommandPool_, graphicsQueue_);
     }
 
@@ -1642,7 +4966,7 @@ namespace PixelsForGlory::Vulkan
         // Assign target image to be transfer optimal
         Vulkan::Image::UpdateImageBarrier(
             recordingState.commandBuffer,
-            renderTargets_[cameraInstanceId]->stagingImage.GetImage(),
+            renderTargets_[cameraInstanceId]->stagingImage->GetImage(),
             range,
             VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
             VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
@@ -1655,12 +4979,12 @@ namespace PixelsForGlory::Vulkan
             VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
             VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
-        vkCmdCopyImage(recordingState.commandBuffer, renderTargets_[cameraInstanceId]->stagingImage.GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        vkCmdCopyImage(recordingState.commandBuffer, renderTargets_[cameraInstanceId]->stagingImage->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
         // Revert target image 
         Vulkan::Image::UpdateImageBarrier(
             recordingState.commandBuffer,
-            renderTargets_[cameraInstanceId]->stagingImage.GetImage(),
+            renderTargets_[cameraInstanceId]->stagingImage->GetImage(),
             range,
             VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT,
             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
@@ -1680,43 +5004,47 @@ namespace PixelsForGlory::Vulkan
 
         auto& renderTarget = renderTargets_[cameraInstanceId];
 
-        renderTarget->cameraDataBufferInfo.buffer = renderTarget->cameraData.GetBuffer();
+        // Offsets handed out before the ring grew point into its retired buffer, write the data again into the current
+        // one.  Writing may grow the ring once more, in which case both are written again
+        while (renderTarget->cameraDataBuffer != uploadRing_.GetBuffer().GetBuffer() || sceneDataBuffer_ != uploadRing_.GetBuffer().GetBuffer())
+        {
+            if (!WriteCameraData(*renderTarget) || !WriteSceneData())
+            {
+                PFG_EDITORLOGERROR("Failed to write camera and scene data again after the upload ring grew");
+                break;
+            }
+        }
+
+        // Camera and scene data are bound through dynamic offsets into the upload ring.  The descriptors only need
+        // to be rewritten when the ring had to grow into a new buffer
+        if (renderTarget->cameraDataBufferInfo.buffer != uploadRing_.GetBuffer().GetBuffer())
+        {
+            renderTarget->updateDescriptorSetsData = true;
+        }
+
+        renderTarget->cameraDataBufferInfo.buffer = uploadRing_.GetBuffer().GetBuffer();
         renderTarget->cameraDataBufferInfo.offset = 0;
-        renderTarget->cameraDataBufferInfo.range = renderTarget->cameraData.GetSize();
+        renderTarget->cameraDataBufferInfo.range = sizeof(ShaderCameraParam);
 
         //PFG_EDITORLOG("Updated BuildDescriptorBufferInfos for " + std::to_string(cameraInstanceId));
 
         // TODO: move all below here because its unnecessary to do this each build?
-        sceneBufferInfo_.buffer = sceneData_.GetBuffer();
+        sceneBufferInfo_.buffer = uploadRing_.GetBuffer().GetBuffer();
         sceneBufferInfo_.offset = 0;
-        sceneBufferInfo_.range = sceneData_.GetSize();
+        sceneBufferInfo_.range = sizeof(ShaderSceneParam);
        
-        sharedMeshAttributesBufferInfos_.clear();
-        sharedMeshAttributesBufferInfos_.resize(sharedMeshAttributesPool_.pool_size());
-        for (int i = 0; i < sharedMeshAttributesPool_.pool_size(); ++i)
-        {
-            VkDescriptorBufferInfo& bufferInfo = sharedMeshAttributesBufferInfos_[i];
-            const Vulkan::Buffer& buffer = sharedMeshAttributesPool_[i];
-
-            bufferInfo.buffer = buffer.GetBuffer();
-            bufferInfo.offset = 0;
-            bufferInfo.range = buffer.GetSize();
-
-            sharedMeshAttributesBufferInfos_.push_back(bufferInfo);
-        }
-
-        sharedMeshFacesBufferInfos_.clear();
-        sharedMeshFacesBufferInfos_.resize(sharedMeshFacesPool_.pool_size());
-        for (int i = 0; i < sharedMeshFacesPool_.pool_size(); ++i)
+        // Attributes, faces and source instances are all read from the same pages, only the element type differs
+        geometryPageBufferInfos_.clear();
+        for (uint32_t page = 0; page < geometryBuffer_.GetPageCount(); ++page)
         {
-            VkDescriptorBufferInfo& bufferInfo = sharedMeshFacesBufferInfos_[i];
-            const Vulkan::Buffer& buffer = sharedMeshFacesPool_[i];
+            const Vulkan::Buffer& buffer = geometryBuffer_.GetPage(page);
 
+            VkDescriptorBufferInfo bufferInfo;
             bufferInfo.buffer = buffer.GetBuffer();
             bufferInfo.offset = 0;
             bufferInfo.range = buffer.GetSize();
 
-            sharedMeshFacesBufferInfos_.push_back(bufferInfo);
+            geometryPageBufferInfos_.push_back(bufferInfo);
         }
     }
     
@@ -1724,10 +5052,10 @@ namespace PixelsForGlory::Vulkan
     {   
         // Descriptors are not generated directly, but from a pool.  Create that pool here
         std::vector<VkDescriptorPoolSize> poolSizes({
-            { VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1 },       // Top level acceleration structure
+            { VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, TLAS_LAYER_COUNT }, // Static and dynamic top level acceleration structures
             { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2 },                    // Game Render Target + Scene Render Target
-            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2},                    // Scene data + Camera data
-            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1000 * 2 }             // vertex attribs for each mesh + faces buffer for each mesh  Supports 1000 meshes at once?
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 2},            // Scene data + Camera data
+            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1000 * 3 }             // vertex attribs + faces + source instances for each geometry page, mesh data table.  Shared by every camera
             });
     
         VkDescriptorPoolCreateInfo descriptorPoolCreateInfo;
@@ -1738,7 +5066,7 @@ namespace PixelsForGlory::Vulkan
         descriptorPoolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
         descriptorPoolCreateInfo.pPoolSizes = poolSizes.data();
     
-        VK_CHECK("vkCreateDescriptorPool", vkCreateDescriptorPool(device_, &descriptorPoolCreateInfo, nullptr, &descriptorPool_));
+        VK_CHECK("vkCreateDescriptorPool", vkCreateDescriptorPool(device_, &descriptorPoolCreateInfo, HostAllocator::Instance().GetCallbacks(), &descriptorPool_));
 
         PFG_EDITORLOG("Successfully created descriptor pool");
     }
@@ -1766,8 +5094,9 @@ namespace PixelsForGlory::Vulkan
         std::vector<uint32_t> variableDescriptorCounts({
             1,                                                              // Set 0
             1,                                                              // Set 1
-            static_cast<uint32_t>(sharedMeshAttributesPool_.pool_size()),   // Set 2
-            static_cast<uint32_t>(sharedMeshFacesPool_.pool_size())         // Set 3
+            static_cast<uint32_t>(geometryPageBufferInfos_.size()),         // Set 2
+            static_cast<uint32_t>(geometryPageBufferInfos_.size()),         // Set 3
+            static_cast<uint32_t>(geometryPageBufferInfos_.size())          // Set 4
             });
     
         VkDescriptorSetVariableDescriptorCountAllocateInfo variableDescriptorCountInfo;
@@ -1786,15 +5115,22 @@ namespace PixelsForGlory::Vulkan
         VK_CHECK("vkAllocateDescriptorSets", vkAllocateDescriptorSets(device_, &descriptorSetAllocateInfo, renderTarget->descriptorSets.data()));
     
         std::vector<VkWriteDescriptorSet> descriptorWrites;
+
+        // Declared outside of scope so it isn't destroyed before write
+        VkAccelerationStructureKHR layerAccelerationStructures[TLAS_LAYER_COUNT];
+        layerAccelerationStructures[TLAS_LAYER_STATIC] = staticTlas_.tlas.accelerationStructure;
+        layerAccelerationStructures[TLAS_LAYER_DYNAMIC] = dynamicTlas_.tlas.accelerationStructure;
+
+        VkWriteDescriptorSetAccelerationStructureKHR descriptorAccelerationStructureInfo;
+        descriptorAccelerationStructureInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
+        descriptorAccelerationStructureInfo.pNext = nullptr;
+        descriptorAccelerationStructureInfo.accelerationStructureCount = TLAS_LAYER_COUNT;
+        descriptorAccelerationStructureInfo.pAccelerationStructures = layerAccelerationStructures;
+
         // Set 0
         {
-            // Acceleration Structure
+            // Acceleration Structure, one per tlas layer
             {
-                VkWriteDescriptorSetAccelerationStructureKHR descriptorAccelerationStructureInfo;
-                descriptorAccelerationStructureInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
-                descriptorAccelerationStructureInfo.pNext = nullptr;
-                descriptorAccelerationStructureInfo.accelerationStructureCount = 1;
-                descriptorAccelerationStructureInfo.pAccelerationStructures = &tlas_.accelerationStructure;
 
                 VkWriteDescriptorSet accelerationStructureWrite;
                 accelerationStructureWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -1802,7 +5138,7 @@ namespace PixelsForGlory::Vulkan
                 accelerationStructureWrite.dstSet = renderTarget->descriptorSets[DESCRIPTOR_SET_ACCELERATION_STRUCTURE];
                 accelerationStructureWrite.dstBinding = DESCRIPTOR_BINDING_ACCELERATION_STRUCTURE;
                 accelerationStructureWrite.dstArrayElement = 0;
-                accelerationStructureWrite.descriptorCount = 1;
+                accelerationStructureWrite.descriptorCount = TLAS_LAYER_COUNT;
                 accelerationStructureWrite.descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
                 accelerationStructureWrite.pImageInfo = nullptr;
                 accelerationStructureWrite.pBufferInfo = nullptr;
@@ -1820,7 +5156,7 @@ namespace PixelsForGlory::Vulkan
                 sceneBufferWrite.dstBinding = DESCRIPTOR_BINDING_SCENE_DATA;
                 sceneBufferWrite.dstArrayElement = 0;
                 sceneBufferWrite.descriptorCount = 1;
-                sceneBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+                sceneBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
                 sceneBufferWrite.pImageInfo = nullptr;
                 sceneBufferWrite.pBufferInfo = &sceneBufferInfo_;
                 sceneBufferWrite.pTexelBufferView = nullptr;
@@ -1837,13 +5173,31 @@ namespace PixelsForGlory::Vulkan
                 camdataBufferWrite.dstBinding = DESCRIPTOR_BINDING_CAMERA_DATA;
                 camdataBufferWrite.dstArrayElement = 0;
                 camdataBufferWrite.descriptorCount = 1;
-                camdataBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+                camdataBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
                 camdataBufferWrite.pImageInfo = nullptr;
                 camdataBufferWrite.pBufferInfo = &renderTargets_[cameraInstanceId]->cameraDataBufferInfo;
                 camdataBufferWrite.pTexelBufferView = nullptr;
 
                 descriptorWrites.push_back(camdataBufferWrite);
             }
+
+            // Mesh data
+            if (meshDataBufferInfo_.buffer != VK_NULL_HANDLE)
+            {
+                VkWriteDescriptorSet meshDataBufferWrite;
+                meshDataBufferWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                meshDataBufferWrite.pNext = nullptr;
+                meshDataBufferWrite.dstSet = renderTarget->descriptorSets[DESCRIPTOR_SET_MESH_DATA];
+                meshDataBufferWrite.dstBinding = DESCRIPTOR_BINDING_MESH_DATA;
+                meshDataBufferWrite.dstArrayElement = 0;
+                meshDataBufferWrite.descriptorCount = 1;
+                meshDataBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                meshDataBufferWrite.pImageInfo = nullptr;
+                meshDataBufferWrite.pBufferInfo = &meshDataBufferInfo_;
+                meshDataBufferWrite.pTexelBufferView = nullptr;
+
+                descriptorWrites.push_back(meshDataBufferWrite);
+            }
         }
 
         // Set 1
@@ -1854,7 +5208,7 @@ namespace PixelsForGlory::Vulkan
                 // From renderTargets_ map, Game = 1
                 VkDescriptorImageInfo descriptorRenderTargetGameImageInfo;
                 descriptorRenderTargetGameImageInfo.sampler = VK_NULL_HANDLE;
-                descriptorRenderTargetGameImageInfo.imageView = renderTargets_[cameraInstanceId]->stagingImage.GetImageView();
+                descriptorRenderTargetGameImageInfo.imageView = renderTargets_[cameraInstanceId]->stagingImage->GetImageView();
                 descriptorRenderTargetGameImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 
                 VkWriteDescriptorSet renderTargetGameImageWrite;
@@ -1874,6 +5228,7 @@ namespace PixelsForGlory::Vulkan
         }
        
         // Set 2
+        if (!geometryPageBufferInfos_.empty())
         {
             // Vertex attributes
             {
@@ -1883,10 +5238,10 @@ namespace PixelsForGlory::Vulkan
                 attribsBufferWrite.dstSet = renderTarget->descriptorSets[DESCRIPTOR_SET_VERTEX_ATTRIBUTES];
                 attribsBufferWrite.dstBinding = DESCRIPTOR_BINDING_VERTEX_ATTRIBUTES;
                 attribsBufferWrite.dstArrayElement = 0;
-                attribsBufferWrite.descriptorCount = static_cast<uint32_t>(sharedMeshAttributesPool_.pool_size());
+                attribsBufferWrite.descriptorCount = static_cast<uint32_t>(geometryPageBufferInfos_.size());
                 attribsBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
                 attribsBufferWrite.pImageInfo = nullptr;
-                attribsBufferWrite.pBufferInfo = sharedMeshAttributesBufferInfos_.data();
+                attribsBufferWrite.pBufferInfo = geometryPageBufferInfos_.data();
                 attribsBufferWrite.pTexelBufferView = nullptr;
 
                 descriptorWrites.push_back(attribsBufferWrite);
@@ -1900,15 +5255,36 @@ namespace PixelsForGlory::Vulkan
                 facesBufferWrite.dstSet = renderTarget->descriptorSets[DESCRIPTOR_SET_FACE_DATA];
                 facesBufferWrite.dstBinding = DESCRIPTOR_BINDING_FACE_DATA;
                 facesBufferWrite.dstArrayElement = 0;
-                facesBufferWrite.descriptorCount = static_cast<uint32_t>(sharedMeshFacesPool_.pool_size());;
+                facesBufferWrite.descriptorCount = static_cast<uint32_t>(geometryPageBufferInfos_.size());
                 facesBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
                 facesBufferWrite.pImageInfo = nullptr;
-                facesBufferWrite.pBufferInfo = sharedMeshFacesBufferInfos_.data();
+                facesBufferWrite.pBufferInfo = geometryPageBufferInfos_.data();
                 facesBufferWrite.pTexelBufferView = nullptr;
 
                 descriptorWrites.push_back(facesBufferWrite);
             }
         }
+
+        // Set 4
+        if (!geometryPageBufferInfos_.empty())
+        {
+            // Source instances
+            {
+                VkWriteDescriptorSet sourceInstancesBufferWrite;
+                sourceInstancesBufferWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                sourceInstancesBufferWrite.pNext = nullptr;
+                sourceInstancesBufferWrite.dstSet = renderTarget->descriptorSets[DESCRIPTOR_SET_SOURCE_INSTANCES];
+                sourceInstancesBufferWrite.dstBinding = DESCRIPTOR_BINDING_SOURCE_INSTANCES;
+                sourceInstancesBufferWrite.dstArrayElement = 0;
+                sourceInstancesBufferWrite.descriptorCount = static_cast<uint32_t>(geometryPageBufferInfos_.size());
+                sourceInstancesBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                sourceInstancesBufferWrite.pImageInfo = nullptr;
+                sourceInstancesBufferWrite.pBufferInfo = geometryPageBufferInfos_.data();
+                sourceInstancesBufferWrite.pTexelBufferView = nullptr;
+
+                descriptorWrites.push_back(sourceInstancesBufferWrite);
+            }
+        }
     
         vkUpdateDescriptorSets(device_, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, VK_NULL_HANDLE);
    
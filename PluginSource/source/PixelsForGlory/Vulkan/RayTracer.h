@@ -8,9 +8,20 @@
 #include "../../Unity/IUnityGraphicsVulkan.h"
 #include "../RayTracerAPI.h"
 
+#include "../RangeAllocator.h"
 #include "../ResourcePool.h"
+#include "AccelerationStructureCache.h"
+#include "AccelerationStructureQuality.h"
 #include "Buffer.h"
+#include "DeferredOperationPool.h"
+#include "GeometryBuffer.h"
+#include "HostAllocator.h"
 #include "Image.h"
+#include "InstanceGenerator.h"
+#include "NormalWriter.h"
+#include "RenderTargetPool.h"
+#include "RingBuffer.h"
+#include "ScratchBuffer.h"
 #include "Shader.h"
 #include "ShaderBindingTable.h"
 
@@ -42,19 +53,40 @@ namespace PixelsForGlory::Vulkan
             : destination(nullptr)
             , format(VK_FORMAT_UNDEFINED)
             , extent(VkExtent3D())
+            , stagingImage(nullptr)
+            , cameraDataOffset(0)
+            , hasCameraData(false)
             , cameraDataBufferInfo(VkDescriptorBufferInfo())
+            , camPos(vec3(0.0f))
+            , camDir(vec3(0.0f))
+            , camUp(vec3(0.0f))
+            , camSide(vec3(0.0f))
+            , camNearFarFov(vec3(0.0f))
+            , cameraDataBuffer(VK_NULL_HANDLE)
             , updateDescriptorSetsData(true)
         {}
 
         void* destination;
         VkFormat format;
         VkExtent3D extent;
-        Vulkan::Image stagingImage;
+
+        // Owned by the render target pool, may be shared with other cameras of the same size and format
+        Vulkan::Image* stagingImage;
         
-        // Buffer that represents ShaderCameraParam
-        Vulkan::Buffer cameraData;
+        // Dynamic offset of this frame's ShaderCameraParam in the upload ring
+        uint32_t cameraDataOffset;
+        bool hasCameraData;
         VkDescriptorBufferInfo cameraDataBufferInfo;
 
+        // Camera the offset was written from and the ring buffer it was written to.  Growing the ring retires that
+        // buffer, so the camera is written again into the new one before the descriptors point at it
+        vec3 camPos;
+        vec3 camDir;
+        vec3 camUp;
+        vec3 camSide;
+        vec3 camNearFarFov;
+        VkBuffer cameraDataBuffer;
+
         std::vector<VkDescriptorSet> descriptorSets;
         bool updateDescriptorSetsData;
     };
@@ -69,44 +101,296 @@ namespace PixelsForGlory::Vulkan
 
         VkAccelerationStructureKHR    accelerationStructure;
         uint64_t                      deviceAddress;
+
+        // Tlas owns its buffer, blases live in a range of the blas pages
         Vulkan::Buffer                buffer;
+        Vulkan::GeometryAllocation    storage;
+    };
+
+    struct RayTracerSubmesh
+    {
+        RayTracerSubmesh()
+            : indexStart(0)
+            , indexCount(0)
+        {}
+
+        // Range of the mesh's indices
+        uint32_t indexStart;
+        uint32_t indexCount;
     };
 
     struct RayTracerMeshSharedData
     {
         RayTracerMeshSharedData()
             : sharedMeshInstanceId(-1)
-            , faceDataIndex(-1)
-            , vertexAttributeIndex(-1)
             , vertexCount(0)
             , indexCount(0)
+            , attributesOffset(0)
+            , facesOffset(0)
+            , verticesOffset(0)
+            , indicesOffset(0)
+            , sourceInstancesOffset(0)
+            , meshDataOffset(kNoMeshData)
+            , compactionQuery(kNoCompactionQuery)
+            , blasTimelineValue(0)
+            , buildPolicy(RayTracerBuildPolicy::Static)
+            , hostBlasBuild(false)
+            , deformable(false)
+            , blasDirty(false)
+            , cacheKey(kNoCacheKey)
+            , instanceCount(0)
+            , isStaticBatch(false)
         {}
 
-        int sharedMeshInstanceId;
+        static const uint32_t kNoMeshData = UINT32_MAX;
+        static const uint32_t kNoCompactionQuery = UINT32_MAX;
+        static const uint64_t kNoCacheKey = 0;
 
-        int faceDataIndex;
-        int vertexAttributeIndex;
+        int sharedMeshInstanceId;
 
         int vertexCount;
         int indexCount;
 
-        Vulkan::Buffer vertexBuffer;          // Stores: vertex : vec3 
-        Vulkan::Buffer indexBuffer;           // Stores: index : int
+        // All of the mesh's data in one range of a geometry page, offsets are bytes from the start of the range
+        Vulkan::GeometryAllocation geometry;
+        VkDeviceSize attributesOffset;      // Stores: ShaderVertexAttribute
+        VkDeviceSize facesOffset;           // Stores: ShaderFace
+        VkDeviceSize verticesOffset;        // Stores: vertex : vec3
+        VkDeviceSize indicesOffset;         // Stores: index : int
+        VkDeviceSize sourceInstancesOffset; // Stores: game object instance id : uint per triangle, static batches only
+
+        // One blas geometry per submesh
+        std::vector<RayTracerSubmesh> submeshes;
+
+        // First of the mesh's ShaderMeshData entries, one per submesh.  Instances pass it as their custom index
+        uint32_t meshDataOffset;
 
         RayTracerAccelerationStructure blas;
+
+        // Query the compacted size of the blas is written to, until the blas has been compacted
+        uint32_t compactionQuery;
+
+        // Timeline value of the submit that built the blas
+        uint64_t blasTimelineValue;
+
+        // Build flags of the blas, see GetBuildPolicyFlags
+        RayTracerBuildPolicy buildPolicy;
+
+        // Blas is being built on the host.  Until it is uploaded it lives in the host blas pages and isn't traceable
+        bool hostBlasBuild;
+
+        // Copy of the geometry for host builds, released once the blas is built
+        std::vector<vec3> hostVertices;
+        std::vector<uint32_t> hostIndices;
+
+        // Vertices have been updated at least once.  The blas is built with ALLOW_UPDATE and refit instead of rebuilt
+        bool deformable;
+
+        // Vertices changed since the blas was last built or refit
+        bool blasDirty;
+
+        // Bounds of the current vertices, and of the vertices the blas was last fully built from
+        Vulkan::Bounds bounds;
+        Vulkan::Bounds blasBounds;
+
+        // Refits and bounds growth since the last full build
+        Vulkan::AccelerationStructureQuality blasQuality;
+
+        // Hash of the geometry and build flags the blas is stored under in the acceleration structure cache
+        uint64_t cacheKey;
+
+        // Instances referencing the mesh.  The mesh is released once the last one is removed
+        uint32_t instanceCount;
+
+        // Merged mesh of a static batch, owned by the batch rather than Unity
+        bool isStaticBatch;
+
+        // Copy of the geometry static batches are merged from, kept while static batching is on
+        std::vector<vec3> batchVertices;
+        std::vector<ShaderVertexAttribute> batchAttributes;
+        std::vector<uint32_t> batchIndices;
     };
    
+    struct RayTracerWorkerSubmission
+    {
+        RayTracerWorkerSubmission()
+            : timelineValue(0)
+            , commandPool(VK_NULL_HANDLE)
+            , commandBuffer(VK_NULL_HANDLE)
+        {}
+
+        uint64_t timelineValue;
+        VkCommandPool commandPool;
+        VkCommandBuffer commandBuffer;
+    };
+
+    struct RayTracerBlasBuild
+    {
+        RayTracerBlasBuild()
+            : sharedMeshIndex(-1)
+            , buildGeometryInfo(VkAccelerationStructureBuildGeometryInfoKHR())
+            , scratchSize(0)
+        {}
+
+        int sharedMeshIndex;
+
+        // One geometry and range per submesh.  buildGeometryInfo points at geometries, so builds must not be copied once prepared
+        std::vector<VkAccelerationStructureGeometryKHR> geometries;
+        VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo;
+        std::vector<VkAccelerationStructureBuildRangeInfoKHR> buildRangeInfos;
+        VkDeviceSize scratchSize;
+    };
+
+    struct RayTracerHostBlasBatch
+    {
+        RayTracerHostBlasBatch()
+            : operation(VK_NULL_HANDLE)
+            , uploadTimelineValue(0)
+        {}
+
+        // Build running on the deferred operation pool, VK_NULL_HANDLE once it has completed
+        VkDeferredOperationKHR operation;
+
+        // Everything the build reads has to stay alive until it completes
+        std::vector<RayTracerBlasBuild> builds;
+        std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildGeometryInfos;
+        std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> buildRangeInfos;
+        std::vector<uint8_t> scratch;
+
+        // Host built blases, released once the submit copying them to device local memory is done
+        std::vector<RayTracerAccelerationStructure> hostBlases;
+        uint64_t uploadTimelineValue;
+    };
+
+    struct RayTracerBlasSerialization
+    {
+        RayTracerBlasSerialization()
+            : sharedMeshIndex(-1)
+            , cacheKey(RayTracerMeshSharedData::kNoCacheKey)
+            , query(kNoQuery)
+            , timelineValue(0)
+        {}
+
+        static const uint32_t kNoQuery = UINT32_MAX;
+
+        int sharedMeshIndex;
+
+        // Key of the mesh when it was queued, the serialization is dropped if the mesh changes
+        uint64_t cacheKey;
+
+        // Serialized size query, while it is in flight
+        uint32_t query;
+
+        // Submit that wrote the query or the serialized data
+        uint64_t timelineValue;
+
+        // Host visible copy of the serialized blas, once its size is known
+        Vulkan::Buffer buffer;
+    };
+
+    struct RayTracerTraceTiming
+    {
+        RayTracerTraceTiming()
+            : frameNumber(0)
+            , tlasBuildCount(0)
+            , megapixels(0.0f)
+            , pending(false)
+        {}
+
+        uint64_t frameNumber;
+
+        // Traces of an older tlas don't say anything about the current one
+        uint64_t tlasBuildCount;
+        float megapixels;
+
+        // Timestamps were written and not read back yet
+        bool pending;
+    };
+
     struct RayTracerMeshInstanceData
     {
         RayTracerMeshInstanceData()
             : sharedMeshIndex(-1)
             , localToWorld(mat4())
             , gameObjectInstanceId(0)
+            , recordBlasAddress(0)
+            , recordCustomIndex(0)
+            , hasDescription(false)
+            , isStatic(false)
+            , inStaticBatch(false)
+            , mergedIntoStaticBatch(false)
+            , staticBatchKey(0)
+            , isStaticBatch(false)
         {}
 
         int gameObjectInstanceId;
         int sharedMeshIndex;
         mat4 localToWorld;
+
+        // World bounds at the last full tlas build
+        Vulkan::Bounds tlasBounds;
+
+        // Blas and mesh data the description of the instance's slot was last written with
+        VkDeviceAddress recordBlasAddress;
+        uint32_t recordCustomIndex;
+
+        // The slot's description was written for this instance, a new instance may sit in a slot of a removed one
+        bool hasDescription;
+
+        // Flagged as static scenery, batched while static batching is on
+        bool isStatic;
+
+        // Member of the static batch of its cell, and part of that batch's merged mesh.  The slot's record is inactive
+        // while the instance is merged
+        bool inStaticBatch;
+        bool mergedIntoStaticBatch;
+        uint64_t staticBatchKey;
+
+        // Instance of a static batch's merged mesh, owned by the batch rather than Unity
+        bool isStaticBatch;
+    };
+
+    struct RayTracerStaticBatch
+    {
+        RayTracerStaticBatch()
+            : sharedMeshIndex(-1)
+            , meshInstanceIndex(-1)
+            , dirty(true)
+        {}
+
+        // Static instances whose bounds are centered in the batch's cell
+        std::vector<int> memberInstances;
+
+        // Merged mesh and the instance tracing it, -1 while the members are traced on their own
+        int sharedMeshIndex;
+        int meshInstanceIndex;
+
+        // Members changed since the merged mesh was built
+        bool dirty;
+    };
+
+    struct RayTracerTlasLayer
+    {
+        RayTracerTlasLayer()
+            : tlas(RayTracerAccelerationStructure())
+            , instancePointers(Vulkan::Buffer())
+            , instancePointersCapacity(0)
+            , recordsAddress(0)
+            , buildFlags(0)
+        {}
+
+        RayTracerAccelerationStructure tlas;
+
+        // Instance pool slots the tlas was last built with, sorted
+        std::vector<uint32_t> slots;
+
+        // Address of each slot's record in instancesBuffer_, the tlas is built from these instead of every record
+        Vulkan::Buffer instancePointers;
+        uint32_t instancePointersCapacity;
+
+        // instancesBuffer_ and flags the tlas was last built with, either changing is a rebuild
+        VkDeviceAddress recordsAddress;
+        VkBuildAccelerationStructureFlagsKHR buildFlags;
     };
     
     class RayTracer : public RayTracerAPI
@@ -146,19 +430,31 @@ namespace PixelsForGlory::Vulkan
 
 #pragma region RayTracerAPI
         virtual void SetShaderFolder(std::string shaderFolder);
+        virtual void SetAccelerationStructureCacheFolder(std::string cacheFolder);
         virtual int SetRenderTarget(int cameraInstanceId, int unityTextureFormat, int width, int height, void* textureHandle);
         virtual bool ProcessDeviceEvent(UnityGfxDeviceEventType type, IUnityInterfaces* interfaces);
         virtual int GetSharedMeshIndex(int sharedMeshInstanceId);
-        virtual int AddSharedMesh(int instanceId, float* verticesArray, float* normalsArray, float* uvsArray, int vertexCount, int* indicesArray, int indexCount);
+        virtual int AddSharedMesh(int instanceId, float* verticesArray, float* normalsArray, float* uvsArray, int vertexCount, int* indicesArray, int indexCount, int buildPolicy);
+        virtual int AddSharedMeshWithSubmeshes(int instanceId, float* verticesArray, float* normalsArray, float* uvsArray, int vertexCount, int* indicesArray, int indexCount, int* submeshIndexStarts, int* submeshIndexCounts, int submeshCount, int buildPolicy);
+        virtual void RemoveSharedMesh(int sharedMeshIndex);
+        virtual void UpdateSharedMeshVertices(int sharedMeshIndex, float* verticesArray, float* normalsArray);
         virtual int GetTlasInstanceIndex(int gameObjectInstanceId);
         virtual int AddTlasInstance(int gameObjectInstanceId, int sharedMeshIndex, float* l2wMatrix);
         virtual void RemoveTlasInstance(int meshInstanceIndex);
+        virtual void UpdateTlasInstanceTransform(int meshInstanceIndex, float* l2wMatrix);
+        virtual void SetTlasInstanceStatic(int meshInstanceIndex, int isStatic);
+        virtual void SetTlasBuildPolicy(int buildPolicy);
         virtual void BuildTlas();
         virtual void Prepare();
         virtual void ResetPipeline();
         virtual void UpdateCamera(int cameraInstanceId, float* camPos, float* camDir, float* camUp, float* camSide, float* camNearFarFov);
         virtual void UpdateSceneData(float* color);
         virtual void TraceRays(int cameraInstanceId);
+        virtual void GetMemoryStatistics(RayTracerMemoryStatistics* outStatistics);
+        virtual void SetDefragmentationBudget(float milliseconds);
+        virtual void SetHostMemoryAccounting(int enabled);
+        virtual void SetHostBlasBuildThreads(int threadCount);
+        virtual void SetStaticBatching(int enabled, float cellSize);
 #pragma endregion RayTracerAPI
 
 
@@ -182,35 +478,183 @@ namespace PixelsForGlory::Vulkan
         VkCommandPool graphicsCommandPool_;
         VkCommandPool transferCommandPool_;
 
+        // Signalled by every worker submit with the next value, so the value tells which submits the GPU has finished
+        VkSemaphore timelineSemaphore_;
+        uint64_t submittedTimelineValue_;
+        uint64_t completedTimelineValue_;
+
+        // Worker command buffers, freed once their submit completes
+        std::vector<RayTracerWorkerSubmission> workerSubmissions_;
+
+        // Buffers only worker submits read (staging, replaced scratch), destroyed once those submits complete
+        std::vector<std::pair<uint64_t, Vulkan::Buffer>> submissionRetiredBuffers_;
+
+        VkPhysicalDeviceProperties physicalDeviceProperties_;
         VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties_;
         VkPhysicalDeviceRayTracingPipelinePropertiesKHR rayTracingProperties_;
+        VkPhysicalDeviceAccelerationStructurePropertiesKHR accelerationStructureProperties_;
+
+        // Where mesh geometry lives: device local on discrete GPUs, host visible on UMA devices
+        VkMemoryPropertyFlags geometryMemoryProperties_;
+
+        // VK_EXT_memory_budget was enabled on the device
+        bool memoryBudgetSupported_;
         
         bool alreadyPrepared_;
 
         std::map<int, std::unique_ptr<RayTracerRenderTarget>> renderTargets_;
 
+        // Images the cameras trace into, recycled across resizes and shared between cameras
+        Vulkan::RenderTargetPool renderTargetPool_;
+
+        // Frame numbers from Unity's last recording state, used to release upload ring slices
+        uint64_t currentFrameNumber_;
+        uint64_t safeFrameNumber_;
+
+        // Per frame constants and tlas instances
+        Vulkan::RingBuffer uploadRing_;
+
 #pragma region SharedMeshMembers
 
        resourcePool<std::unique_ptr<RayTracerMeshSharedData>> sharedMeshesPool_;
 
-       // ShaderConstants -> Buffer that represents ShaderVertexAttribute 
-       resourcePool<Vulkan::Buffer> sharedMeshAttributesPool_;
-       std::vector<VkDescriptorBufferInfo> sharedMeshAttributesBufferInfos_;
+       // Mesh ranges are aligned to both shader element strides so offsets can be stored as element indices
+       static const VkDeviceSize kGeometryAlignment;
+
+       // Vertices, indices, ShaderVertexAttribute and ShaderFace of every shared mesh
+       Vulkan::GeometryBuffer geometryBuffer_;
+       std::vector<VkDescriptorBufferInfo> geometryPageBufferInfos_;
+
+       // Acceleration structures must start on a 256 byte boundary of their buffer, and serialized ones on a 256 byte
+       // device address
+       static const VkDeviceSize kAccelerationStructureAlignment = 256;
+
+       // Storage of every blas
+       Vulkan::GeometryBuffer blasBuffer_;
+
+       // Shared mesh indices added since the last BuildTlas, their blases are built together
+       std::vector<int> pendingBlasBuilds_;
+
+       // Most scratch memory a single vkCmdBuildAccelerationStructuresKHR call of a batch may use
+       static const VkDeviceSize kBlasBuildScratchBudget = 64ull * 1024ull * 1024ull;
+
+       // VkPhysicalDeviceAccelerationStructureFeaturesKHR::accelerationStructureHostCommands
+       bool hostBuildsSupported_;
+
+       // CPU threads building blases of new meshes on the host, 0 builds them on the device
+       uint32_t hostBuildThreadCount_;
+       Vulkan::DeferredOperationPool deferredOperationPool_;
+
+       // Host visible storage host builds write to before the blases are copied into blasBuffer_
+       Vulkan::GeometryBuffer hostBlasBuffer_;
+       std::vector<std::unique_ptr<RayTracerHostBlasBatch>> hostBlasBatches_;
+
+       // Compacted sizes of freshly built blases
+       static const uint32_t kCompactionQueryCount = 256;
+       VkQueryPool compactionQueryPool_;
+       std::vector<uint32_t> freeCompactionQueries_;
 
-       // SharedConstants -> Buffer that represents ShaderFace
-       resourcePool<Vulkan::Buffer> sharedMeshFacesPool_;
-       std::vector<VkDescriptorBufferInfo> sharedMeshFacesBufferInfos_;
+       // Shared mesh indices whose blas waits to be compacted
+       std::vector<int> pendingCompactions_;
+
+       // Blases of static meshes are kept on disk between runs.  Built blases missing from the cache are serialized
+       // in the background, which needs their serialized size first
+       Vulkan::AccelerationStructureCache accelerationStructureCache_;
+       static const uint32_t kSerializationQueryCount = 64;
+       VkQueryPool serializationQueryPool_;
+       std::vector<uint32_t> freeSerializationQueries_;
+       std::vector<RayTracerBlasSerialization> pendingSerializations_;
+
+       // Meshes whose vertices were updated, their blases are refit before the next tlas build
+       std::vector<int> dirtyBlases_;
+
+       // Refits degrade a blas.  Rebuild it after this many, or once its vertices drifted this far from where it was
+       // built.  Rebuilds are spread over frames, most degraded blas first
+       static const uint32_t kBlasRefitsPerRebuild = 32;
+       static constexpr float kBlasMaxBoundsGrowth = 1.5f;
+       static const uint32_t kBlasRebuildsPerFrame = 4;
+
+       // Time per frame spent moving geometry and blases out of the last page of their buffer
+       float defragmentationBudgetMilliseconds_;
+
+       // ShaderMeshData per submesh, each mesh owns a range of consecutive entries
+       Vulkan::Buffer meshDataBuffer_;
+       uint32_t meshDataCapacity_;
+       RangeAllocator meshDataRanges_;
+       VkDescriptorBufferInfo meshDataBufferInfo_;
+
+       // Shared meshes no instance references anymore, released on the next BuildTlas
+       std::vector<int> releasedSharedMeshes_;
+
+       // Resources replaced while a frame may still read them, released once that frame is done
+       std::vector<std::pair<uint64_t, Vulkan::Buffer>> retiredBuffers_;
+       std::vector<std::pair<uint64_t, Vulkan::GeometryAllocation>> retiredGeometry_;
+       std::vector<std::pair<uint64_t, Vulkan::GeometryAllocation>> retiredBlasStorage_;
+       std::vector<std::pair<uint64_t, VkAccelerationStructureKHR>> retiredAccelerationStructures_;
+       std::vector<std::pair<uint64_t, std::pair<uint32_t, uint32_t>>> retiredMeshData_;     // Offset and count of mesh data entries
 
 #pragma endregion SharedMeshMembers
 
 #pragma region MeshInstanceMembers
 
        resourcePool<std::unique_ptr<RayTracerMeshInstanceData>> meshInstancePool_;
-       
-       // Buffer that represents VkAccelerationStructureInstanceKHR
-       Vulkan::Buffer instancesAccelerationStructuresBuffer_;
 
-       RayTracerAccelerationStructure tlas_;
+       // VkAccelerationStructureInstanceKHR records must be 16 byte aligned
+       static const VkDeviceSize kAccelerationStructureInstanceAlignment = 16;
+
+       // One record per instance pool slot, so a slot's record never moves.  Empty slots hold inactive records.  Only
+       // records of dirty slots are written before a tlas build, and the buffer only changes when the pool outgrows it
+       Vulkan::Buffer instancesBuffer_;
+       uint32_t instancesCapacity_;
+       std::vector<uint32_t> dirtyInstanceSlots_;
+
+       // ShaderInstanceDescription per slot, same capacity as instancesBuffer_.  Records are generated on the GPU from
+       // these and a stream of the dirty slots' transforms
+       Vulkan::Buffer instanceDescriptionsBuffer_;
+       Vulkan::InstanceGenerator instanceGenerator_;
+
+       // Writes normals of device local deformed meshes into their interleaved vertex attributes
+       Vulkan::NormalWriter normalWriter_;
+
+       // Static instances are merged per cell of a world grid into one mesh and instance.  Batches whose members changed
+       // are merged again before the next tlas build, cells with too few members are traced as they are
+       bool staticBatchingEnabled_;
+       float staticBatchCellSize_;
+       std::map<uint64_t, RayTracerStaticBatch> staticBatches_;
+       static const uint32_t kStaticBatchMinInstances = 2;
+
+       // Dynamic by default so moving instances refit the tlas instead of rebuilding it.  Only applies to the dynamic
+       // layer, the static one is never refit
+       RayTracerBuildPolicy tlasBuildPolicy_;
+
+       // Instances flagged static and static batches are in a tlas of their own, rebuilt only when they change.
+       // Everything else is in the dynamic tlas, rebuilt or refit every frame something moves.  Raygen traces both
+       RayTracerTlasLayer staticTlas_;
+       RayTracerTlasLayer dynamicTlas_;
+
+       // Refits of the dynamic tlas are traded for a rebuild once the trace time they lose adds up to more than a rebuild costs
+       // over a refit.  Safety limits for when nothing could be measured
+       Vulkan::AccelerationStructureQuality tlasQuality_;
+       uint64_t tlasBuildCount_;
+       static const uint32_t kTlasUpdatesPerRebuild = 256;
+       static constexpr float kTlasMaxBoundsGrowth = 2.0f;
+
+       // GPU timestamps of tlas builds and of the first trace of each frame.  Queries 0 and 1 time the tlas build, the
+       // rest are pairs per trace timing slot.  VK_NULL_HANDLE if the graphics queue can't write timestamps
+       static const uint32_t kTraceTimingSlots = 4;
+       VkQueryPool timestampQueryPool_;
+       RayTracerTraceTiming traceTimings_[kTraceTimingSlots];
+
+       // Submit the tlas build timestamps were written by, 0 while none are in flight
+       uint64_t tlasTimingTimelineValue_;
+       bool tlasTimingUpdate_;
+
+       // Moving averages of measured tlas builds and refits, 0 until measured
+       float tlasBuildMilliseconds_;
+       float tlasRefitMilliseconds_;
+
+       // Shared scratch memory for blas and tlas builds
+       Vulkan::ScratchBuffer scratchBuffer_;
        bool rebuildTlas_;
        bool updateTlas_;
 
@@ -222,10 +666,15 @@ namespace PixelsForGlory::Vulkan
        
        Vulkan::ShaderBindingTable shaderBindingTable_;
 
-       // Buffer that represents ShaderSceneParam
-       Vulkan::Buffer sceneData_;
+       // Dynamic offset of this frame's ShaderSceneParam in the upload ring
+       uint32_t sceneDataOffset_;
+       bool hasSceneData_;
        VkDescriptorBufferInfo sceneBufferInfo_;
 
+       // Scene data the offset was written from and the ring buffer it was written to, see cameraDataBuffer
+       vec4 sceneAmbient_;
+       VkBuffer sceneDataBuffer_;
+
        std::vector<VkDescriptorSetLayout> descriptorSetLayouts_;
        VkDescriptorPool                   descriptorPool_;
 
@@ -252,17 +701,226 @@ namespace PixelsForGlory::Vulkan
         void CreateWorkerCommandBuffer(VkCommandBufferLevel level, VkCommandPool commandPool, VkCommandBuffer& outCommandBuffer);
 
         /// <summary>
-        /// Submits a command buffer created by CreateWorkerCommandBuffer
+        /// Submits a command buffer created by CreateWorkerCommandBuffer without waiting for it.  Later work on the
+        /// graphics queue, including Unity's frame, runs after it, so a barrier is all a reader needs.
         /// </summary>
         /// <param name="commandBuffer"></param>
         /// <param name="queue"></param>
-        void SubmitWorkerCommandBuffer(VkCommandBuffer commandBuffer, VkCommandPool commandPool, const VkQueue& queue);
+        /// <returns>Timeline value signalled once the command buffer has finished executing</returns>
+        uint64_t SubmitWorkerCommandBuffer(VkCommandBuffer commandBuffer, VkCommandPool commandPool, const VkQueue& queue);
+
+        /// <summary>
+        /// Read how far the GPU has gotten through worker submits and release what finished submits were using
+        /// </summary>
+        void UpdateCompletedSubmissions();
+
+        /// <summary>
+        /// Block until a worker submit has finished executing.  Only for shutdown and other places that can't defer
+        /// </summary>
+        /// <param name="timelineValue"></param>
+        void WaitForSubmission(uint64_t timelineValue);
+
+        /// <summary>
+        /// Add a shared mesh, see AddSharedMeshWithSubmeshes
+        /// </summary>
+        /// <param name="sourceInstanceIds">Game object instance id per triangle if the mesh is a static batch's merged
+        /// mesh, nullptr otherwise</param>
+        /// <returns>Shared mesh index, -1 on failure</returns>
+        int AddSharedMeshGeometry(int instanceId, float* verticesArray, float* normalsArray, float* uvsArray, int vertexCount, int* indicesArray, int indexCount, int* submeshIndexStarts, int* submeshIndexCounts, int submeshCount, int buildPolicy, const std::vector<uint32_t>* sourceInstanceIds);
+
+        /// <summary>
+        /// Add a static instance to the batch of the cell its bounds are centered in.  Instances of meshes without a
+        /// batch copy of their geometry, or that deform, are left alone
+        /// </summary>
+        /// <param name="meshInstanceIndex"></param>
+        void AddToStaticBatch(int meshInstanceIndex);
+
+        /// <summary>
+        /// Take an instance out of its static batch, it is traced on its own again
+        /// </summary>
+        /// <param name="meshInstanceIndex"></param>
+        void RemoveFromStaticBatch(int meshInstanceIndex);
+
+        /// <summary>
+        /// Merge the members of every dirty static batch into a new mesh, pre-transformed to world space, and replace
+        /// the batch's old mesh and instance with it.  Submeshes stay separate geometries of the merged blas.
+        /// </summary>
+        void BuildStaticBatches();
+
+        /// <summary>
+        /// Remove the instance of a static batch's merged mesh, which releases the mesh along with it
+        /// </summary>
+        /// <param name="batch"></param>
+        void ReleaseStaticBatchInstance(RayTracerStaticBatch& batch);
+
+        /// <summary>
+        /// Build the bottom level acceleration structures of every shared mesh added since the last call.  Builds are
+        /// grouped into as few vkCmdBuildAccelerationStructuresKHR calls as the scratch budget allows and go out in one
+        /// submit.
+        /// </summary>
+        void BuildPendingBlases();
+
+        /// <summary>
+        /// Fill out the geometries, ranges and build info of a shared mesh's blas and get its build sizes
+        /// </summary>
+        /// <param name="sharedMeshPoolIndex"></param>
+        /// <param name="hostBuild">Build from the mesh's host geometry</param>
+        /// <param name="outBuild"></param>
+        /// <param name="outSizes"></param>
+        void DescribeBlasBuild(int sharedMeshPoolIndex, bool hostBuild, RayTracerBlasBuild& outBuild, VkAccelerationStructureBuildSizesInfoKHR& outSizes);
+
+        /// <summary>
+        /// Describe a shared mesh's blas build, and allocate and create its acceleration structure
+        /// </summary>
+        /// <param name="sharedMeshPoolIndex"></param>
+        /// <param name="hostBuild">Build from the mesh's host geometry into the host blas pages</param>
+        /// <param name="outBuild"></param>
+        /// <returns>false if the acceleration structure couldn't be created</returns>
+        bool PrepareBlasBuild(int sharedMeshPoolIndex, bool hostBuild, RayTracerBlasBuild& outBuild);
+
+        /// <summary>
+        /// Refit the blases of meshes whose vertices changed, in one submit.  Meshes updated for the first time are
+        /// rebuilt so they can be refit.  Blases degraded by too many refits or too much bounds growth are rebuilt in
+        /// place instead, at most kBlasRebuildsPerFrame per call.
+        /// </summary>
+        void RefitBlases();
+
+        /// <summary>
+        /// Start building the blases of shared meshes on the deferred operation pool
+        /// </summary>
+        /// <param name="sharedMeshIndices"></param>
+        void BuildHostBlases(const std::vector<int>& sharedMeshIndices);
+
+        /// <summary>
+        /// Copy blases of completed host builds into compacted ranges of the blas pages, and release host blases once
+        /// those copies are done
+        /// </summary>
+        void UploadHostBlases();
+
+        /// <summary>
+        /// Copy blases whose compacted size is known into right sized ranges of the blas pages and retire the
+        /// originals.  Blases that aren't ready yet are left for the next frame.
+        /// </summary>
+        void CompactBlases();
+
+        /// <summary>
+        /// Deserialize the blases of pending builds that are in the acceleration structure cache, in one submit.  Misses
+        /// are left to be built and queued to be serialized.
+        /// </summary>
+        void LoadCachedBlases();
+
+        /// <summary>
+        /// Advance queued serializations: query the serialized size of blases that are done being built and compacted,
+        /// copy them to host memory once the size is known, and write them to the cache once the copy is done.  Never
+        /// waits on the GPU.
+        /// </summary>
+        void SerializeBlases();
+
+        /// <summary>
+        /// Record the generation of the dirty instance slots' records in instancesBuffer_, growing it first if the
+        /// instance pool outgrew it.  Only transforms and changed descriptions are uploaded, the records are written by
+        /// the instance generation shader.  Instances whose blas moved since their description was written are dirty
+        /// as well.
+        /// </summary>
+        /// <param name="commandBuffer"></param>
+        /// <param name="outWrittenSlots">Sorted slots whose record was written</param>
+        /// <param name="outDescribedSlots">Sorted slots whose description changed, not just their transform</param>
+        /// <param name="outReleasedBuffers">Staging and replaced buffers the recorded commands read, release them once
+        /// the submit is done</param>
+        /// <returns>false if nothing could be recorded</returns>
+        bool WriteDirtyInstances(VkCommandBuffer commandBuffer, std::vector<uint32_t>& outWrittenSlots, std::vector<uint32_t>& outDescribedSlots, std::vector<Vulkan::Buffer>& outReleasedBuffers);
+
+        /// <summary>
+        /// Allocate upload memory from the ring, or from a staging buffer when it doesn't fit in a frame of it, e.g.
+        /// the first build of a big scene.  Staging memory is coherent, so only ring slices need flushing
+        /// </summary>
+        /// <param name="size"></param>
+        /// <param name="outAllocation"></param>
+        /// <param name="outStaged">Whether the allocation is a staging buffer</param>
+        /// <param name="outReleasedBuffers">Gets the staging buffer, release it once the submit is done</param>
+        /// <returns></returns>
+        bool AllocateUpload(VkDeviceSize size, Vulkan::RingAllocation& outAllocation, bool& outStaged, std::vector<Vulkan::Buffer>& outReleasedBuffers);
+
+        /// <summary>
+        /// Sizes of a tlas build over some number of instance pointers
+        /// </summary>
+        /// <param name="buildFlags"></param>
+        /// <param name="instanceCount"></param>
+        /// <returns></returns>
+        VkAccelerationStructureBuildSizesInfoKHR GetTlasBuildSizes(VkBuildAccelerationStructureFlagsKHR buildFlags, uint32_t instanceCount) const;
+
+        /// <summary>
+        /// Record the build or refit of a tlas layer over the records of some instance slots.  Rebuilds write the
+        /// layer's instance pointers first and replace its tlas if it is too small.  Scratch is allocated from
+        /// scratchBuffer_, which has to be reserved for it.
+        /// </summary>
+        /// <param name="commandBuffer"></param>
+        /// <param name="layer"></param>
+        /// <param name="slots">Sorted instance pool slots, ignored by refits</param>
+        /// <param name="buildFlags"></param>
+        /// <param name="update">Refit rather than rebuild</param>
+        /// <param name="buildSizes">From GetTlasBuildSizes</param>
+        /// <param name="outReleasedBuffers">Staging and replaced buffers the recorded commands read, release them once
+        /// the submit is done</param>
+        /// <returns>false if nothing could be recorded</returns>
+        bool RecordTlasLayerBuild(VkCommandBuffer commandBuffer, RayTracerTlasLayer& layer, const std::vector<uint32_t>& slots, VkBuildAccelerationStructureFlagsKHR buildFlags, bool update, const VkAccelerationStructureBuildSizesInfoKHR& buildSizes, std::vector<Vulkan::Buffer>& outReleasedBuffers);
+
+        /// <summary>
+        /// Destroy a tlas layer's tlas and instance pointers
+        /// </summary>
+        /// <param name="layer"></param>
+        void DestroyTlasLayer(RayTracerTlasLayer& layer);
+
+        /// <summary>
+        /// Read back timestamps the GPU is done with.  Tlas build and refit times update their averages, and trace
+        /// times of the current tlas feed its quality tracking.
+        /// </summary>
+        void ReadTimestamps();
+
+        /// <summary>
+        /// Release the geometry, blas and mesh data of shared meshes in releasedSharedMeshes_ that are still unused.
+        /// Everything a frame in flight may read is retired rather than freed.  Meshes whose blas is still being built
+        /// or compacted are left for the next frame.
+        /// </summary>
+        void ReleaseSharedMeshes();
+
+        /// <summary>
+        /// Write a shared mesh's entry of the mesh data table, growing the table if needed
+        /// </summary>
+        /// <param name="sharedMeshPoolIndex"></param>
+        /// <returns></returns>
+        bool UpdateMeshData(int sharedMeshPoolIndex);
+
+        /// <summary>
+        /// Release retired resources the GPU is done with, and any page left empty by them
+        /// </summary>
+        /// <param name="safeFrameNumber">Last frame the GPU has completed</param>
+        void ReleaseRetiredResources(uint64_t safeFrameNumber);
+
+        /// <summary>
+        /// Move shared mesh geometry and blases out of the last page of their buffers into holes of earlier pages, so
+        /// the last page can be released once it is empty.  Runs until the budget is used up.
+        /// </summary>
+        /// <param name="budgetMilliseconds"></param>
+        void Defragment(float budgetMilliseconds);
 
         /// <summary>
-        /// Build a bottom level acceleration structure for an added shared mesh
+        /// Allocate a range in an earlier geometry page and record a copy of the mesh's geometry into it
         /// </summary>
         /// <param name="sharedMeshPoolIndex"></param>
-        void BuildBlas(int sharedMeshPoolIndex);
+        /// <param name="commandBuffer"></param>
+        /// <param name="outGeometry"></param>
+        /// <returns>false if no earlier page has room</returns>
+        bool RelocateGeometry(int sharedMeshPoolIndex, VkCommandBuffer commandBuffer, Vulkan::GeometryAllocation& outGeometry);
+
+        /// <summary>
+        /// Create a blas in an earlier blas page and record a clone of the mesh's blas into it
+        /// </summary>
+        /// <param name="sharedMeshPoolIndex"></param>
+        /// <param name="commandBuffer"></param>
+        /// <param name="outBlas">Device address is filled in once the clone has been submitted</param>
+        /// <returns>false if no earlier page has room</returns>
+        bool RelocateBlas(int sharedMeshPoolIndex, VkCommandBuffer commandBuffer, RayTracerAccelerationStructure& outBlas);
 
         /// <summary>
         /// Create descriptor set layouts for shaders
@@ -291,6 +949,19 @@ namespace PixelsForGlory::Vulkan
         /// </summary>
         void BuildDescriptorBufferInfos(int cameraInstanceId);
 
+        /// <summary>
+        /// Write a render target's camera to a new slice of the upload ring
+        /// </summary>
+        /// <param name="renderTarget"></param>
+        /// <returns>false if the ring is out of memory</returns>
+        bool WriteCameraData(RayTracerRenderTarget& renderTarget);
+
+        /// <summary>
+        /// Write the scene data to a new slice of the upload ring
+        /// </summary>
+        /// <returns>false if the ring is out of memory</returns>
+        bool WriteSceneData();
+
         /// <summary>
         /// Create the descriptor pool for generating descriptor sets
         /// </summary>
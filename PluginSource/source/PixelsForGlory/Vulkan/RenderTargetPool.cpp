@@ -0,0 +1,119 @@
+#include "RenderTargetPool.h"
+
+#include <algorithm>
+#include <assert.h>
+
+#include "../Debug.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    RenderTargetPool::RenderTargetPool()
+        : device_(VK_NULL_HANDLE)
+        , physicalDeviceMemoryProperties_(VkPhysicalDeviceMemoryProperties())
+    {}
+
+    void RenderTargetPool::Initialize(VkDevice device, VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties) {
+        device_ = device;
+        physicalDeviceMemoryProperties_ = physicalDeviceMemoryProperties;
+    }
+
+    void RenderTargetPool::Destroy() {
+        for (auto& entry : entries_) {
+            entry->image->Destroy();
+        }
+        entries_.clear();
+    }
+
+    Image* RenderTargetPool::Acquire(const RenderTargetKey& key) {
+        for (auto& entry : entries_) {
+            if (entry->key == key) {
+                ++entry->references;
+                return entry->image.get();
+            }
+        }
+
+        auto entry = std::make_unique<Entry>();
+        entry->key = key;
+        entry->image = std::make_unique<Image>(device_, physicalDeviceMemoryProperties_);
+
+        if (entry->image->Create(
+            VK_IMAGE_TYPE_2D,
+            key.format,
+            key.extent,
+            VK_IMAGE_TILING_OPTIMAL,
+            key.usage,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            MemoryCategory::RenderTarget) != VK_SUCCESS)
+        {
+            PFG_EDITORLOGERROR("Failed to create render image!");
+            entry->image->Destroy();
+            return nullptr;
+        }
+
+        VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        if (entry->image->CreateImageView(VK_IMAGE_VIEW_TYPE_2D, key.format, range) != VK_SUCCESS) {
+            PFG_EDITORLOGERROR("Failed to create render image view!");
+            entry->image->Destroy();
+            return nullptr;
+        }
+
+        entry->references = 1;
+
+        Image* image = entry->image.get();
+        entries_.push_back(std::move(entry));
+
+        return image;
+    }
+
+    void RenderTargetPool::Release(Image* image, uint64_t lastFrameNumber) {
+        if (image == nullptr) {
+            return;
+        }
+
+        auto itr = std::find_if(entries_.begin(), entries_.end(), [image](const std::unique_ptr<Entry>& e) { return e->image.get() == image; });
+        if (itr == entries_.end()) {
+            assert(false);
+            return;
+        }
+
+        auto& entry = *itr;
+        assert(entry->references > 0);
+
+        --entry->references;
+        entry->lastFrameNumber = std::max(entry->lastFrameNumber, lastFrameNumber);
+    }
+
+    void RenderTargetPool::Trim(uint64_t currentFrameNumber, uint64_t safeFrameNumber) {
+        // Oldest idle images first, so going over kMaxIdleImages drops the ones least likely to be reused
+        std::vector<Entry*> idle;
+        for (auto& entry : entries_) {
+            if (entry->references == 0) {
+                idle.push_back(entry.get());
+            }
+        }
+
+        std::sort(idle.begin(), idle.end(), [](const Entry* a, const Entry* b) { return a->lastFrameNumber < b->lastFrameNumber; });
+
+        size_t idleCount = idle.size();
+        for (auto entry : idle) {
+            // Still possibly in use by a frame in flight
+            if (entry->lastFrameNumber > safeFrameNumber) {
+                continue;
+            }
+
+            const bool expired = currentFrameNumber > entry->lastFrameNumber + kIdleFrameLimit;
+            if (!expired && idleCount <= kMaxIdleImages) {
+                continue;
+            }
+
+            entry->image->Destroy();
+            --idleCount;
+
+            entries_.erase(std::find_if(entries_.begin(), entries_.end(), [entry](const std::unique_ptr<Entry>& e) { return e.get() == entry; }));
+        }
+    }
+
+    size_t RenderTargetPool::GetImageCount() const {
+        return entries_.size();
+    }
+}
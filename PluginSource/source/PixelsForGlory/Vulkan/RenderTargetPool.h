@@ -0,0 +1,108 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "../../vulkan.h"
+#include "Image.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    /// <summary>
+    /// Identifies render target images that can stand in for each other
+    /// </summary>
+    struct RenderTargetKey
+    {
+        RenderTargetKey()
+            : format(VK_FORMAT_UNDEFINED)
+            , extent(VkExtent3D())
+            , usage(0)
+        {}
+
+        bool operator==(const RenderTargetKey& other) const
+        {
+            return format == other.format &&
+                extent.width == other.extent.width &&
+                extent.height == other.extent.height &&
+                extent.depth == other.extent.depth &&
+                usage == other.usage;
+        }
+
+        VkFormat            format;
+        VkExtent3D          extent;
+        VkImageUsageFlags   usage;
+    };
+
+    /// <summary>
+    /// Recycles the transient images cameras trace into.  Every camera's dispatch starts from an undefined layout and
+    /// ends with a copy to Unity's texture, and all cameras are recorded one after another into Unity's command
+    /// buffer, so cameras with the same key alias a single image.  Images nobody references are kept for a while so
+    /// resizing back and forth doesn't reallocate, and are only destroyed once the GPU is done with them.
+    /// </summary>
+    class RenderTargetPool
+    {
+    public:
+        // Idle images are destroyed after this many frames without a user
+        static const uint64_t kIdleFrameLimit = 120;
+
+        // Most idle images kept around, oldest go first.  Keeps a window resize drag from piling up sizes
+        static const size_t kMaxIdleImages = 4;
+
+        RenderTargetPool();
+
+        /// <summary>
+        /// Setup pool, images are created on demand
+        /// </summary>
+        /// <param name="device"></param>
+        /// <param name="physicalDeviceMemoryProperties"></param>
+        void Initialize(VkDevice device, VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties);
+
+        /// <summary>
+        /// Destroy every image, referenced or not.  GPU must be idle
+        /// </summary>
+        void Destroy();
+
+        /// <summary>
+        /// Get an image matching the key, shared with any other user of the same key
+        /// </summary>
+        /// <param name="key"></param>
+        /// <returns>nullptr if a new image couldn't be created</returns>
+        Image* Acquire(const RenderTargetKey& key);
+
+        /// <summary>
+        /// Drop a reference taken by Acquire
+        /// </summary>
+        /// <param name="image"></param>
+        /// <param name="lastFrameNumber">Last frame the image may have been used in</param>
+        void Release(Image* image, uint64_t lastFrameNumber);
+
+        /// <summary>
+        /// Destroy idle images that have been unused for too long, or that exceed the idle limit
+        /// </summary>
+        /// <param name="currentFrameNumber"></param>
+        /// <param name="safeFrameNumber">Last frame the GPU has completed</param>
+        void Trim(uint64_t currentFrameNumber, uint64_t safeFrameNumber);
+
+        // getters
+        size_t GetImageCount() const;
+
+    private:
+        struct Entry
+        {
+            Entry()
+                : references(0)
+                , lastFrameNumber(0)
+            {}
+
+            RenderTargetKey         key;
+            std::unique_ptr<Image>  image;
+            uint32_t                references;
+            uint64_t                lastFrameNumber;
+        };
+
+        VkDevice                            device_;
+        VkPhysicalDeviceMemoryProperties    physicalDeviceMemoryProperties_;
+
+        std::vector<std::unique_ptr<Entry>> entries_;
+    };
+}
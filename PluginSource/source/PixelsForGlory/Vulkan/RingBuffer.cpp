@@ -0,0 +1,149 @@
+#include "RingBuffer.h"
+
+#include <algorithm>
+
+#include "../Debug.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    RingBuffer::RingBuffer()
+        : device_(VK_NULL_HANDLE)
+        , physicalDeviceMemoryProperties_(VkPhysicalDeviceMemoryProperties())
+        , usage_(0)
+        , deviceAddress_(0)
+        , data_(nullptr)
+        , size_(0)
+        , head_(0)
+        , used_(0)
+        , frameNumber_(0)
+        , frameUsed_(0)
+    {}
+
+    VkResult RingBuffer::Create(VkDevice device, VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties, VkDeviceSize size, VkBufferUsageFlags usage) {
+        device_ = device;
+        physicalDeviceMemoryProperties_ = physicalDeviceMemoryProperties;
+
+        // Slices are handed to the TLAS build and shaders by address
+        usage_ = usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+        VkResult result = buffer_.Create(device_, physicalDeviceMemoryProperties_, size, usage_, Buffer::kDefaultMemoryPropertyFlags, MemoryCategory::Upload);
+        if (result != VK_SUCCESS) {
+            return result;
+        }
+
+        size_ = size;
+        head_ = 0;
+        used_ = 0;
+        frameUsed_ = 0;
+        frames_.clear();
+
+        data_ = static_cast<uint8_t*>(buffer_.Map());
+        deviceAddress_ = buffer_.GetBufferDeviceAddress().deviceAddress;
+
+        return VK_SUCCESS;
+    }
+
+    void RingBuffer::Destroy() {
+        buffer_.Destroy();
+
+        for (auto& retired : retiredBuffers_) {
+            retired.second.Destroy();
+        }
+        retiredBuffers_.clear();
+
+        frames_.clear();
+        data_ = nullptr;
+        deviceAddress_ = 0;
+        size_ = 0;
+        head_ = 0;
+        used_ = 0;
+        frameUsed_ = 0;
+    }
+
+    void RingBuffer::BeginFrame(uint64_t frameNumber, uint64_t safeFrameNumber) {
+        // Close out the previous frame
+        if (frameUsed_ > 0) {
+            if (!frames_.empty() && frames_.back().first == frameNumber_) {
+                frames_.back().second += frameUsed_;
+            }
+            else {
+                frames_.push_back(std::make_pair(frameNumber_, frameUsed_));
+            }
+            frameUsed_ = 0;
+        }
+        frameNumber_ = frameNumber;
+
+        // Frames are retired in the order they were allocated, so the tail simply moves forward
+        while (!frames_.empty() && frames_.front().first <= safeFrameNumber) {
+            used_ -= frames_.front().second;
+            frames_.pop_front();
+        }
+
+        for (auto itr = retiredBuffers_.begin(); itr != retiredBuffers_.end();) {
+            if (itr->first <= safeFrameNumber) {
+                itr->second.Destroy();
+                itr = retiredBuffers_.erase(itr);
+            }
+            else {
+                ++itr;
+            }
+        }
+    }
+
+    bool RingBuffer::Allocate(VkDeviceSize size, VkDeviceSize alignment, RingAllocation& outAllocation) {
+        if (alignment == 0) {
+            alignment = 1;
+        }
+
+        VkDeviceSize offset = (head_ + alignment - 1) / alignment * alignment;
+        VkDeviceSize consumed = offset - head_ + size;
+
+        // Don't split a slice across the end, skip to the start and count the skipped bytes as used
+        if (offset + size > size_) {
+            offset = 0;
+            consumed = size_ - head_ + size;
+        }
+
+        if (used_ + consumed > size_) {
+            if (Grow(std::max(size_ * 2, size * 2)) != VK_SUCCESS) {
+                return false;
+            }
+
+            offset = 0;
+            consumed = size;
+        }
+
+        head_ = offset + size;
+        used_ += consumed;
+        frameUsed_ += consumed;
+
+        outAllocation.buffer = buffer_.GetBuffer();
+        outAllocation.offset = offset;
+        outAllocation.deviceAddress = deviceAddress_ + offset;
+        outAllocation.data = data_ + offset;
+
+        return true;
+    }
+
+    void RingBuffer::Flush(const RingAllocation& allocation, VkDeviceSize size) const {
+        buffer_.Flush(size, allocation.offset);
+    }
+
+    const Buffer& RingBuffer::GetBuffer() const {
+        return buffer_;
+    }
+
+    VkDeviceSize RingBuffer::GetSize() const {
+        return size_;
+    }
+
+    VkResult RingBuffer::Grow(VkDeviceSize minimumSize) {
+        PFG_EDITORLOG("Growing upload ring to " + std::to_string(minimumSize) + " bytes");
+
+        // Everything already handed out stays in the old buffer until the current frame is done with it
+        retiredBuffers_.push_back(std::make_pair(frameNumber_, buffer_));
+        buffer_ = Buffer();
+
+        return Create(device_, physicalDeviceMemoryProperties_, minimumSize, usage_);
+    }
+}
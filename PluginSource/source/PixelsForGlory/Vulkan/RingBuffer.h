@@ -0,0 +1,108 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include "../../vulkan.h"
+#include "Buffer.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    /// <summary>
+    /// Slice of the ring handed out for the current frame
+    /// </summary>
+    struct RingAllocation
+    {
+        RingAllocation()
+            : buffer(VK_NULL_HANDLE)
+            , offset(0)
+            , deviceAddress(0)
+            , data(nullptr)
+        {}
+
+        VkBuffer        buffer;
+        VkDeviceSize    offset;
+        VkDeviceAddress deviceAddress;  // Address of the slice, not the buffer
+        void*           data;
+    };
+
+    /// <summary>
+    /// Linear allocator over one persistently mapped buffer.  Every allocation lives until the frame it was made in
+    /// is no longer in flight, so data written for one frame never overwrites data the GPU is still reading.
+    /// </summary>
+    class RingBuffer
+    {
+    public:
+        static const uint32_t       kDefaultFramesInFlight = 3;
+        static const VkDeviceSize   kDefaultFrameSize = 1024ull * 1024ull;
+
+        RingBuffer();
+
+        /// <summary>
+        /// Create ring
+        /// </summary>
+        /// <param name="device"></param>
+        /// <param name="physicalDeviceMemoryProperties"></param>
+        /// <param name="size"></param>
+        /// <param name="usage"></param>
+        /// <returns></returns>
+        VkResult Create(VkDevice device, VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties, VkDeviceSize size, VkBufferUsageFlags usage);
+
+        /// <summary>
+        /// Destroy ring and any buffer retired by growing
+        /// </summary>
+        void Destroy();
+
+        /// <summary>
+        /// Start a new frame and release everything allocated for frames the GPU is done with
+        /// </summary>
+        /// <param name="frameNumber">Frame the following allocations will be consumed in</param>
+        /// <param name="safeFrameNumber">Last frame the GPU has completed</param>
+        void BeginFrame(uint64_t frameNumber, uint64_t safeFrameNumber);
+
+        /// <summary>
+        /// Allocate a slice for the current frame.  The ring grows if the frames in flight don't leave enough space.
+        /// </summary>
+        /// <param name="size"></param>
+        /// <param name="alignment"></param>
+        /// <param name="outAllocation"></param>
+        /// <returns></returns>
+        bool Allocate(VkDeviceSize size, VkDeviceSize alignment, RingAllocation& outAllocation);
+
+        /// <summary>
+        /// Make host writes to a slice visible to the GPU.  Only does work for non-coherent memory
+        /// </summary>
+        /// <param name="allocation"></param>
+        /// <param name="size"></param>
+        void Flush(const RingAllocation& allocation, VkDeviceSize size) const;
+
+        // getters
+        const Buffer& GetBuffer() const;
+        VkDeviceSize GetSize() const;
+
+    private:
+        VkResult Grow(VkDeviceSize minimumSize);
+
+        VkDevice                            device_;
+        VkPhysicalDeviceMemoryProperties    physicalDeviceMemoryProperties_;
+        VkBufferUsageFlags                  usage_;
+
+        Buffer          buffer_;
+        VkDeviceAddress deviceAddress_;
+        uint8_t*        data_;
+
+        VkDeviceSize    size_;
+        VkDeviceSize    head_;
+        VkDeviceSize    used_;
+
+        // Bytes consumed by the frame currently being recorded
+        uint64_t        frameNumber_;
+        VkDeviceSize    frameUsed_;
+
+        // Frame number -> bytes consumed, oldest first
+        std::deque<std::pair<uint64_t, VkDeviceSize>> frames_;
+
+        // Buffers replaced by growing, released once their last frame is done
+        std::vector<std::pair<uint64_t, Buffer>> retiredBuffers_;
+    };
+}
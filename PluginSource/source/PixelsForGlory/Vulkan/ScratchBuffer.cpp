@@ -0,0 +1,91 @@
+#include "ScratchBuffer.h"
+
+#include <algorithm>
+#include <assert.h>
+
+#include "../Debug.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    ScratchBuffer::ScratchBuffer()
+        : device_(VK_NULL_HANDLE)
+        , physicalDeviceMemoryProperties_(VkPhysicalDeviceMemoryProperties())
+        , alignment_(1)
+        , baseAddress_(0)
+        , size_(0)
+        , head_(0)
+    {}
+
+    void ScratchBuffer::Initialize(VkDevice device, VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties, VkDeviceSize alignment) {
+        device_ = device;
+        physicalDeviceMemoryProperties_ = physicalDeviceMemoryProperties;
+        alignment_ = std::max<VkDeviceSize>(alignment, 1);
+    }
+
+    void ScratchBuffer::Destroy() {
+        buffer_.Destroy();
+        baseAddress_ = 0;
+        size_ = 0;
+        head_ = 0;
+    }
+
+    void ScratchBuffer::Reset() {
+        head_ = 0;
+    }
+
+    VkResult ScratchBuffer::Reserve(VkDeviceSize size, Buffer& outReleasedBuffer) {
+        if (size <= size_) {
+            return VK_SUCCESS;
+        }
+
+        assert(head_ == 0);
+
+        // Grow geometrically so a stream of slightly larger builds doesn't reallocate every time
+        const VkDeviceSize newSize = std::max(size, size_ * 2);
+
+        PFG_EDITORLOG("Growing acceleration structure scratch buffer to " + std::to_string(newSize) + " bytes");
+
+        outReleasedBuffer = buffer_;
+        buffer_ = Buffer();
+
+        // Extra alignment_ bytes so the base can be rounded up to the required alignment
+        VkResult result = buffer_.Create(
+            device_,
+            physicalDeviceMemoryProperties_,
+            newSize + alignment_,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            MemoryCategory::Scratch);
+        if (result != VK_SUCCESS) {
+            baseAddress_ = 0;
+            size_ = 0;
+            return result;
+        }
+
+        const VkDeviceAddress address = buffer_.GetBufferDeviceAddress().deviceAddress;
+        baseAddress_ = (address + alignment_ - 1) / alignment_ * alignment_;
+        size_ = newSize;
+
+        return VK_SUCCESS;
+    }
+
+    VkDeviceOrHostAddressKHR ScratchBuffer::Allocate(VkDeviceSize size) {
+        const VkDeviceSize alignedSize = GetAlignedSize(size);
+        assert(head_ + alignedSize <= size_);
+
+        VkDeviceOrHostAddressKHR result;
+        result.deviceAddress = baseAddress_ + head_;
+
+        head_ += alignedSize;
+
+        return result;
+    }
+
+    VkDeviceSize ScratchBuffer::GetAlignedSize(VkDeviceSize size) const {
+        return (size + alignment_ - 1) / alignment_ * alignment_;
+    }
+
+    VkDeviceSize ScratchBuffer::GetSize() const {
+        return size_;
+    }
+}
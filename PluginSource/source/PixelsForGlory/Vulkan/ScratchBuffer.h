@@ -0,0 +1,71 @@
+#pragma once
+
+#include "../../vulkan.h"
+#include "Buffer.h"
+
+namespace PixelsForGlory::Vulkan
+{
+    /// <summary>
+    /// Grow-only scratch memory shared by every acceleration structure build.  A batch of builds reserves the total it
+    /// needs up front and then takes disjoint slices, so builds recorded together never alias each other's scratch.
+    /// </summary>
+    class ScratchBuffer
+    {
+    public:
+        ScratchBuffer();
+
+        /// <summary>
+        /// Setup arena, no memory is allocated until the first Reserve
+        /// </summary>
+        /// <param name="device"></param>
+        /// <param name="physicalDeviceMemoryProperties"></param>
+        /// <param name="alignment">minAccelerationStructureScratchOffsetAlignment</param>
+        void Initialize(VkDevice device, VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties, VkDeviceSize alignment);
+
+        /// <summary>
+        /// Destroy arena
+        /// </summary>
+        void Destroy();
+
+        /// <summary>
+        /// Start a new batch.  Slices handed out before are reused, only call once the builds using them are done
+        /// </summary>
+        void Reset();
+
+        /// <summary>
+        /// Make sure the arena can hold size bytes of slices, growing it if needed.  Only call between batches
+        /// </summary>
+        /// <param name="size">Sum of GetAlignedSize for every slice in the batch</param>
+        /// <param name="outReleasedBuffer">Buffer replaced when the arena grows.  Builds still in flight may use it, so
+        /// it is handed back rather than destroyed</param>
+        /// <returns></returns>
+        VkResult Reserve(VkDeviceSize size, Buffer& outReleasedBuffer);
+
+        /// <summary>
+        /// Take the next slice of the batch
+        /// </summary>
+        /// <param name="size"></param>
+        /// <returns>Device address of the slice</returns>
+        VkDeviceOrHostAddressKHR Allocate(VkDeviceSize size);
+
+        /// <summary>
+        /// Size a slice will take in the arena once aligned
+        /// </summary>
+        /// <param name="size"></param>
+        /// <returns></returns>
+        VkDeviceSize GetAlignedSize(VkDeviceSize size) const;
+
+        // getters
+        VkDeviceSize GetSize() const;
+
+    private:
+        VkDevice                            device_;
+        VkPhysicalDeviceMemoryProperties    physicalDeviceMemoryProperties_;
+        VkDeviceSize                        alignment_;
+
+        Buffer          buffer_;
+        VkDeviceAddress baseAddress_;   // Buffer address rounded up to alignment_
+        VkDeviceSize    size_;          // Usable bytes from baseAddress_
+        VkDeviceSize    head_;
+    };
+}
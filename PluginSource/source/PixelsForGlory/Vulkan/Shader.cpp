@@ -3,6 +3,8 @@
 #include <fstream>
 #include <vector>
 
+#include "HostAllocator.h"
+
 namespace PixelsForGlory::Vulkan
 {
     Shader::Shader(VkDevice device)
@@ -35,7 +37,7 @@ namespace PixelsForGlory::Vulkan
             shaderModuleCreateInfo.pCode = reinterpret_cast<uint32_t*>(bytecode.data());
             shaderModuleCreateInfo.flags = 0;
 
-            const VkResult error = vkCreateShaderModule(device_, &shaderModuleCreateInfo, nullptr, &shaderModule_);
+            const VkResult error = vkCreateShaderModule(device_, &shaderModuleCreateInfo, HostAllocator::Instance().GetCallbacks(), &shaderModule_);
             result = (VK_SUCCESS == error);
 
             if (!result)
@@ -55,7 +57,7 @@ namespace PixelsForGlory::Vulkan
     void Shader::Destroy()
     {
         if (shaderModule_) {
-            vkDestroyShaderModule(device_, shaderModule_, nullptr);
+            vkDestroyShaderModule(device_, shaderModule_, HostAllocator::Instance().GetCallbacks());
             shaderModule_ = VK_NULL_HANDLE;
         }
     }
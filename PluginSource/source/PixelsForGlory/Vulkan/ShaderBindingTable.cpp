@@ -8,7 +8,8 @@ namespace PixelsForGlory::Vulkan
         : shaderHandleSize_(0u)
         , shaderGroupAlignment_(0u)
         , numHitGroups_(0u)
-        , numMissGroups_(0u) {
+        , numMissGroups_(0u)
+        , hitRecordSets_(1u) {
     }
 
     void ShaderBindingTable::Initialize(const uint32_t numHitGroups, const uint32_t numMissGroups, const uint32_t shaderHandleSize, const uint32_t shaderGroupAlignment) {
@@ -16,6 +17,7 @@ namespace PixelsForGlory::Vulkan
         shaderGroupAlignment_ = shaderGroupAlignment;
         numHitGroups_ = numHitGroups;
         numMissGroups_ = numMissGroups;
+        hitRecordSets_ = 1u;
 
         numHitShaders_.resize(numHitGroups, 0u);
         numMissShaders_.resize(numMissGroups, 0u);
@@ -125,6 +127,11 @@ namespace PixelsForGlory::Vulkan
         numMissShaders_[groupIndex]++;
     }
 
+    void ShaderBindingTable::SetHitRecordSets(const uint32_t hitRecordSets) {
+        assert(hitRecordSets > 0);
+        hitRecordSets_ = hitRecordSets;
+    }
+
     uint32_t ShaderBindingTable::GetGroupsStride() const {
         return shaderGroupAlignment_;
     }
@@ -146,7 +153,7 @@ namespace PixelsForGlory::Vulkan
     }
 
     uint32_t ShaderBindingTable::GetHitGroupsSize() const {
-        return numHitGroups_ * shaderGroupAlignment_;
+        return numHitGroups_ * hitRecordSets_ * shaderGroupAlignment_;
     }
 
     uint32_t ShaderBindingTable::GetMissGroupsOffset() const {
@@ -170,7 +177,7 @@ namespace PixelsForGlory::Vulkan
     }
 
     uint32_t ShaderBindingTable::GetSBTSize() const {
-        return GetNumGroups() * shaderGroupAlignment_;
+        return GetRaygenSize() + GetHitGroupsSize() + GetMissGroupsSize();
     }
 
     bool ShaderBindingTable::CreateSBT(VkDevice device, VkPhysicalDeviceMemoryProperties physicalDeviceMemoryProperties, VkPipeline pipeline) {
@@ -182,7 +189,8 @@ namespace PixelsForGlory::Vulkan
                 physicalDeviceMemoryProperties,
                 sbtSize,
                 VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-                Vulkan::Buffer::kDefaultMemoryPropertyFlags);
+                Vulkan::Buffer::kDefaultMemoryPropertyFlags,
+                Vulkan::MemoryCategory::ShaderBindingTable);
 
         if (VK_SUCCESS != error) {
             return false;
@@ -193,13 +201,23 @@ namespace PixelsForGlory::Vulkan
         error = vkGetRayTracingShaderGroupHandlesKHR(device, pipeline, 0, this->GetNumGroups(), groupHandles.size(), groupHandles.data());
         VK_CHECK("vkGetRayTracingShaderGroupHandlesKHR", error);
 
-        // now we fill our SBT
+        // now we fill our SBT, groups are laid out raygen, hit groups (once per record set), miss groups
         uint8_t* mem = static_cast<uint8_t*>(sbtBuffer_.Map());
-        for (size_t i = 0; i < this->GetNumGroups(); ++i) {
-            memcpy(mem, groupHandles.data() + i * shaderHandleSize_, shaderHandleSize_);
+        auto writeGroup = [&](size_t groupIndex) {
+            memcpy(mem, groupHandles.data() + groupIndex * shaderHandleSize_, shaderHandleSize_);
             mem += shaderGroupAlignment_;
+        };
+
+        writeGroup(0);
+        for (uint32_t set = 0; set < hitRecordSets_; ++set) {
+            for (uint32_t i = 0; i < numHitGroups_; ++i) {
+                writeGroup(1 + i);
+            }
+        }
+        for (uint32_t i = 0; i < numMissGroups_; ++i) {
+            writeGroup(1 + numHitGroups_ + i);
         }
-        sbtBuffer_.Unmap();
+        sbtBuffer_.Flush();
 
         return (VK_SUCCESS == error);
     }
@@ -46,6 +46,13 @@ namespace PixelsForGlory::Vulkan
         /// <param name="groupIndex"></param>
         void AddStageToMissGroup(const VkPipelineShaderStageCreateInfo& stage, const uint32_t groupIndex);
 
+        /// <summary>
+        /// Repeat the hit groups once per blas geometry, so each geometry of a blas has its own records.  Traces use
+        /// the number of hit groups as their record stride.
+        /// </summary>
+        /// <param name="hitRecordSets"></param>
+        void SetHitRecordSets(const uint32_t hitRecordSets);
+
         // Getters for structure related information
         uint32_t GetGroupsStride() const;
         uint32_t GetNumGroups() const;
@@ -77,6 +84,7 @@ namespace PixelsForGlory::Vulkan
         uint32_t                                            shaderGroupAlignment_;
         uint32_t                                            numHitGroups_;
         uint32_t                                            numMissGroups_;
+        uint32_t                                            hitRecordSets_;
         std::vector<uint32_t>                               numHitShaders_;
         std::vector<uint32_t>                               numMissShaders_;
         std::vector<VkPipelineShaderStageCreateInfo>        stages_;
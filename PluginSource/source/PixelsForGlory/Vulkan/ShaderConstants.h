@@ -1,36 +1,56 @@
 #ifndef SHADER_CONSTANTS_H
 #define SHADER_CONSTANTS_H
 
-#define DESCRIPTOR_SET_SIZE                       4
+#define DESCRIPTOR_SET_SIZE                       5
 
 // Descriptor set bindings
 // Set 0
 #define DESCRIPTOR_SET_ACCELERATION_STRUCTURE     0
 #define DESCRIPTOR_BINDING_ACCELERATION_STRUCTURE 0
 
+// Elements of the acceleration structure binding.  Static instances are in a tlas that is rarely rebuilt, everything
+// else in one rebuilt or refit every frame
+#define TLAS_LAYER_STATIC                         0
+#define TLAS_LAYER_DYNAMIC                        1
+#define TLAS_LAYER_COUNT                          2
+
 #define DESCRIPTOR_SET_SCENE_DATA                 0
 #define DESCRIPTOR_BINDING_SCENE_DATA             1
 
 #define DESCRIPTOR_SET_CAMERA_DATA                0
 #define DESCRIPTOR_BINDING_CAMERA_DATA            2
 
+#define DESCRIPTOR_SET_MESH_DATA                  0
+#define DESCRIPTOR_BINDING_MESH_DATA              3
+
 // Set 1
 #define DESCRIPTOR_SET_RENDER_TARGET              1
 #define DESCRIPTOR_BINDING_RENDER_TARGET          0
 
-// Set 2
+// Set 2, one descriptor per geometry page
 #define DESCRIPTOR_SET_VERTEX_ATTRIBUTES          2
 #define DESCRIPTOR_BINDING_VERTEX_ATTRIBUTES      0
 
-// Set 3
+// Set 3, one descriptor per geometry page
 #define DESCRIPTOR_SET_FACE_DATA                  3
 #define DESCRIPTOR_BINDING_FACE_DATA              0
 
+// Set 4, one descriptor per geometry page
+#define DESCRIPTOR_SET_SOURCE_INSTANCES           4
+#define DESCRIPTOR_BINDING_SOURCE_INSTANCES       0
+
 #define PRIMARY_HIT_SHADERS_INDEX   0
 #define PRIMARY_MISS_SHADERS_INDEX  0
 #define SHADOW_HIT_SHADERS_INDEX    1
 #define SHADOW_MISS_SHADERS_INDEX   1
 
+// Every blas geometry has its own set of hit records, one per hit group, so traces use this as their record stride
+#define HIT_SHADERS_PER_GEOMETRY    2
+#define MAX_BLAS_GEOMETRIES         16
+
+// sourceInstanceOffset of meshes that aren't static batches
+#define NO_SOURCE_INSTANCES         0xFFFFFFFF
+
 
 #define LOCATION_PRIMARY_RAY    0
 #define LOCATION_SHADOW_RAY     1
@@ -52,9 +72,20 @@
 
 #endif
 
+// What the closest hit shader found.  normal is in world space and distance is -1 on a miss.  sourceInstance is the
+// game object instance id a static batch triangle came from, NO_SOURCE_INSTANCES for other meshes
 struct ShaderRayPayload {
     align16 vec4 albedo;
+    align16 vec3 normal;
+    align8  vec2 uv;
     align4 float distance;
+#ifdef __cplusplus
+    align4  uint32_t materialIndex;
+    align4  uint32_t sourceInstance;
+#else
+    align4  uint     materialIndex;
+    align4  uint     sourceInstance;
+#endif
 };
 
 struct ShaderShadowRayPayload {
@@ -81,6 +112,55 @@ struct ShaderFace {
 #endif
 };
 
+// Where the data of one geometry (submesh) of a shared mesh lives.  A mesh's geometries are consecutive entries
+// starting at gl_InstanceCustomIndexEXT, so MeshData[gl_InstanceCustomIndexEXT + gl_GeometryIndexEXT].  Offsets are
+// in elements and faceOffset already points at the geometry's first face, e.g.
+// AttribsArray[nonuniformEXT(mesh.geometryPage)].VertexAttribs[mesh.attributeOffset + face.index0]
+// Static batches merge many instances into one mesh.  The game object instance id each of their triangles came from is
+// at SourceInstancesArray[nonuniformEXT(mesh.geometryPage)].SourceInstances[mesh.sourceInstanceOffset + gl_PrimitiveID]
+struct ShaderMeshData {
+#ifdef __cplusplus
+    align4  uint32_t geometryPage;
+    align4  uint32_t attributeOffset;
+    align4  uint32_t faceOffset;
+    align4  uint32_t materialIndex;         // Submesh index, matches the mesh's material slot in Unity
+    align4  uint32_t sourceInstanceOffset;  // NO_SOURCE_INSTANCES unless the mesh is a static batch
+#else
+    align4  uint     geometryPage;
+    align4  uint     attributeOffset;
+    align4  uint     faceOffset;
+    align4  uint     materialIndex;
+    align4  uint     sourceInstanceOffset;
+#endif
+};
+
+// One entry of the transform stream tlas instance records are generated from.  The first three rows of the
+// instance's localToWorld, written to the record of instance buffer slot `slot`
+struct ShaderInstanceTransform {
+    align4  float    rows[12];
+#ifdef __cplusplus
+    align4  uint32_t slot;
+#else
+    align4  uint     slot;
+#endif
+};
+
+// The rest of an instance record, one per instance buffer slot.  Packed like the bitfields of
+// VkAccelerationStructureInstanceKHR, a zero blas address makes the record inactive
+struct ShaderInstanceDescription {
+#ifdef __cplusplus
+    align4  uint32_t blasAddressLow;
+    align4  uint32_t blasAddressHigh;
+    align4  uint32_t customIndexAndMask;    // instanceCustomIndex : 24, mask : 8
+    align4  uint32_t sbtOffsetAndFlags;     // instanceShaderBindingTableRecordOffset : 24, flags : 8
+#else
+    align4  uint     blasAddressLow;
+    align4  uint     blasAddressHigh;
+    align4  uint     customIndexAndMask;
+    align4  uint     sbtOffsetAndFlags;
+#endif
+};
+
 // packed std140
 struct ShaderSceneParam {
     align16 vec4 ambient;
@@ -139,6 +139,13 @@ extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API SetShaderFolder(const
     s_CurrentAPI->SetShaderFolder(std::string(shaderFolder));
 }
 
+extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API SetAccelerationStructureCacheFolder(const char* cacheFolder)
+{
+    PLUGIN_CHECK();
+
+    s_CurrentAPI->SetAccelerationStructureCacheFolder(std::string(cacheFolder));
+}
+
 extern "C" int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API SetRenderTarget(int cameraInstanceId, int unityTextureFormat, int width, int height, void* textureHandle)
 {
     PLUGIN_CHECK_RETURN(0);
@@ -153,12 +160,68 @@ extern "C" int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API GetSharedMeshIndex(int
     return s_CurrentAPI->GetSharedMeshIndex(sharedMeshInstanceId);
 }
 
+extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API GetMemoryStatistics(PixelsForGlory::RayTracerMemoryStatistics* outStatistics)
+{
+    PLUGIN_CHECK();
+
+    s_CurrentAPI->GetMemoryStatistics(outStatistics);
+}
+
+extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API SetDefragmentationBudget(float milliseconds)
+{
+    PLUGIN_CHECK();
+
+    s_CurrentAPI->SetDefragmentationBudget(milliseconds);
+}
+
+extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API SetHostMemoryAccounting(int enabled)
+{
+    PLUGIN_CHECK();
+
+    s_CurrentAPI->SetHostMemoryAccounting(enabled);
+}
+
+extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API SetHostBlasBuildThreads(int threadCount)
+{
+    PLUGIN_CHECK();
+
+    s_CurrentAPI->SetHostBlasBuildThreads(threadCount);
+}
+
+extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API SetStaticBatching(int enabled, float cellSize)
+{
+    PLUGIN_CHECK();
+
+    s_CurrentAPI->SetStaticBatching(enabled, cellSize);
+}
+
 
-extern "C" int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API AddSharedMesh(int instanceId, float* verticesArray, float* normalsArray, float* uvsArray, int vertexCount, int* indicesArray, int indexCount)
+extern "C" int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API AddSharedMesh(int instanceId, float* verticesArray, float* normalsArray, float* uvsArray, int vertexCount, int* indicesArray, int indexCount, int buildPolicy)
 {
     PLUGIN_CHECK_RETURN(-1);
 
-    return s_CurrentAPI->AddSharedMesh(instanceId, verticesArray, normalsArray, uvsArray, vertexCount, indicesArray, indexCount);
+    return s_CurrentAPI->AddSharedMesh(instanceId, verticesArray, normalsArray, uvsArray, vertexCount, indicesArray, indexCount, buildPolicy);
+}
+
+extern "C" int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API AddSharedMeshWithSubmeshes(int instanceId, float* verticesArray, float* normalsArray, float* uvsArray, int vertexCount, int* indicesArray, int indexCount, int* submeshIndexStarts, int* submeshIndexCounts, int submeshCount, int buildPolicy)
+{
+    PLUGIN_CHECK_RETURN(-1);
+
+    return s_CurrentAPI->AddSharedMeshWithSubmeshes(instanceId, verticesArray, normalsArray, uvsArray, vertexCount, indicesArray, indexCount, submeshIndexStarts, submeshIndexCounts, submeshCount, buildPolicy);
+}
+
+extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API RemoveSharedMesh(int sharedMeshIndex)
+{
+    PLUGIN_CHECK();
+
+    s_CurrentAPI->RemoveSharedMesh(sharedMeshIndex);
+}
+
+extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UpdateSharedMeshVertices(int sharedMeshIndex, float* verticesArray, float* normalsArray)
+{
+    PLUGIN_CHECK();
+
+    s_CurrentAPI->UpdateSharedMeshVertices(sharedMeshIndex, verticesArray, normalsArray);
 }
 
 extern "C" int UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API GetTlasInstanceIndex(int gameObjectInstanceId)
@@ -182,6 +245,27 @@ extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API RemoveTlasInstance(in
     s_CurrentAPI->RemoveTlasInstance(meshInstanceIndex);
 }
 
+extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API UpdateTlasInstanceTransform(int meshInstanceIndex, float* l2wMatrix)
+{
+    PLUGIN_CHECK();
+
+    s_CurrentAPI->UpdateTlasInstanceTransform(meshInstanceIndex, l2wMatrix);
+}
+
+extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API SetTlasInstanceStatic(int meshInstanceIndex, int isStatic)
+{
+    PLUGIN_CHECK();
+
+    s_CurrentAPI->SetTlasInstanceStatic(meshInstanceIndex, isStatic);
+}
+
+extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API SetTlasBuildPolicy(int buildPolicy)
+{
+    PLUGIN_CHECK();
+
+    s_CurrentAPI->SetTlasBuildPolicy(buildPolicy);
+}
+
 extern "C" void UNITY_INTERFACE_EXPORT UNITY_INTERFACE_API BuildTlas()
 {
     PLUGIN_CHECK();
@@ -8,6 +8,10 @@
 #include <string>
 #include "vulkan/vulkan.h"
 #ifdef WIN32
+// min and max are used as names
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 #include <Windows.h>
 #include "vulkan/vulkan_win32.h"
 #endif
@@ -101,6 +105,7 @@ static const std::string vkresult_to_string(VkResult result)
 using vec2 = glm::highp_vec2;
 using vec3 = glm::highp_vec3;
 using vec4 = glm::highp_vec4;
+using mat3 = glm::highp_mat3;
 using mat4 = glm::highp_mat4;
 using quat = glm::highp_quat;
 
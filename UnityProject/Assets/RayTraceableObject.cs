@@ -10,6 +10,9 @@ class RayTraceableObject : MonoBehaviour
     [ReadOnly] public int SharedMeshIndex;
     [ReadOnly] public int MeshInstanceIndex;
 
+    // How the plugin builds the shared mesh's blas, only read when the shared mesh is first sent
+    public PixelsForGlory.RayTracerBuildPolicy BuildPolicy = PixelsForGlory.RayTracerBuildPolicy.Static;
+
     private MeshFilter _meshFilterRef = null;
     private MeshFilter _meshFilter
     {
@@ -36,6 +39,25 @@ class RayTraceableObject : MonoBehaviour
         // Remove instance and possibly shared mesh
         RemoveInstanceFromPlugin();
     }
+
+    private void Update()
+    {
+        if (!transform.hasChanged || MeshInstanceIndex < 0)
+        {
+            return;
+        }
+
+        // Static objects don't move while playing, updating them would only take them out of their static batch
+        if (gameObject.isStatic && Application.isPlaying)
+        {
+            transform.hasChanged = false;
+            return;
+        }
+
+        SendTransformToPlugin();
+        transform.hasChanged = false;
+    }
+
     private void SendMeshToPlugin()
     {
         SharedMeshIndex = PixelsForGlory.RayTracingPlugin.GetSharedMeshIndex(_meshFilter.sharedMesh.GetInstanceID());
@@ -51,6 +73,18 @@ class RayTraceableObject : MonoBehaviour
         var uvs = _meshFilter.sharedMesh.uv;
         var indices = _meshFilter.sharedMesh.triangles;
 
+        // triangles holds every submesh's indices one after another, each submesh becomes a geometry of the blas
+        var submeshCount = _meshFilter.sharedMesh.subMeshCount;
+        var submeshIndexStarts = new int[submeshCount];
+        var submeshIndexCounts = new int[submeshCount];
+        var submeshIndexStart = 0;
+        for (var i = 0; i < submeshCount; ++i)
+        {
+            submeshIndexStarts[i] = submeshIndexStart;
+            submeshIndexCounts[i] = (int)_meshFilter.sharedMesh.GetIndexCount(i);
+            submeshIndexStart += submeshIndexCounts[i];
+        }
+
         //Debug.Log($"{_meshFilter.sharedMesh.GetInstanceID()} verts: {vertices.Length}");
         //Debug.Log($"{_meshFilter.sharedMesh.GetInstanceID()} indices: {indices.Length}");
 
@@ -58,20 +92,28 @@ class RayTraceableObject : MonoBehaviour
         var normalsHandle = GCHandle.Alloc(normals, GCHandleType.Pinned);
         var uvsHandle = GCHandle.Alloc(uvs, GCHandleType.Pinned);
         var indicesHandle = GCHandle.Alloc(indices, GCHandleType.Pinned);
+        var submeshIndexStartsHandle = GCHandle.Alloc(submeshIndexStarts, GCHandleType.Pinned);
+        var submeshIndexCountsHandle = GCHandle.Alloc(submeshIndexCounts, GCHandleType.Pinned);
 
-        SharedMeshIndex = PixelsForGlory.RayTracingPlugin.AddSharedMesh(
+        SharedMeshIndex = PixelsForGlory.RayTracingPlugin.AddSharedMeshWithSubmeshes(
                                             _meshFilter.sharedMesh.GetInstanceID(),
                                             verticesHandle.AddrOfPinnedObject(),
                                             normalsHandle.AddrOfPinnedObject(),
                                             uvsHandle.AddrOfPinnedObject(),
                                             vertices.Length,
                                             indicesHandle.AddrOfPinnedObject(),
-                                            indices.Length);
+                                            indices.Length,
+                                            submeshIndexStartsHandle.AddrOfPinnedObject(),
+                                            submeshIndexCountsHandle.AddrOfPinnedObject(),
+                                            submeshCount,
+                                            BuildPolicy);
 
         verticesHandle.Free();
         normalsHandle.Free();
         uvsHandle.Free();
         indicesHandle.Free();
+        submeshIndexStartsHandle.Free();
+        submeshIndexCountsHandle.Free();
     }
 
     private void SendInstanceToPlugin()
@@ -100,11 +142,34 @@ class RayTraceableObject : MonoBehaviour
         MeshInstanceIndex = PixelsForGlory.RayTracingPlugin.AddTlasInstance(GetInstanceID(), SharedMeshIndex, l2wMatrixHandle.AddrOfPinnedObject());
 
         l2wMatrixHandle.Free();
+
+        // Static scenery may be merged with its neighbours when the plugin batches static geometry
+        if (MeshInstanceIndex >= 0 && gameObject.isStatic)
+        {
+            PixelsForGlory.RayTracingPlugin.SetTlasInstanceStatic(MeshInstanceIndex, 1);
+        }
+
+        // hasChanged starts out set, the transform just sent is current
+        transform.hasChanged = false;
+    }
+
+    private void SendTransformToPlugin()
+    {
+        var l2wMatrix = transform.localToWorldMatrix;
+        var l2wMatrixHandle = GCHandle.Alloc(l2wMatrix, GCHandleType.Pinned);
+
+        PixelsForGlory.RayTracingPlugin.UpdateTlasInstanceTransform(MeshInstanceIndex, l2wMatrixHandle.AddrOfPinnedObject());
+
+        l2wMatrixHandle.Free();
     }
 
     private void RemoveInstanceFromPlugin()
     {
         PixelsForGlory.RayTracingPlugin.RemoveTlasInstance(MeshInstanceIndex);
+
+        // The plugin removes the shared mesh along with its last instance
+        MeshInstanceIndex = -1;
+        SharedMeshIndex = -1;
     }
 }
 
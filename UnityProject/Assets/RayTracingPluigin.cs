@@ -5,6 +5,56 @@ using UnityEngine;
 
 namespace PixelsForGlory
 {
+    /// <summary>
+    /// Matches RayTracerBuildPolicy in RayTracerAPI.h
+    /// </summary>
+    public enum RayTracerBuildPolicy
+    {
+        Static = 0,
+        Dynamic,
+        Streamed,
+        LodProxy
+    }
+
+    /// <summary>
+    /// Matches RayTracerMemoryStatistics in RayTracerAPI.h
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    internal struct RayTracerMemoryStatistics
+    {
+        public ulong meshGeometryBytes;
+        public ulong bottomLevelAccelerationStructureBytes;
+        public ulong topLevelAccelerationStructureBytes;
+        public ulong renderTargetBytes;
+        public ulong shaderBindingTableBytes;
+        public ulong scratchBytes;
+        public ulong uploadBytes;
+        public ulong stagingBytes;
+        public ulong otherBytes;
+
+        public ulong blockBytes;
+        public ulong allocatedBytes;
+
+        public ulong deviceLocalBlockBytes;
+        public ulong deviceLocalBudgetBytes;
+        public ulong deviceLocalUsageBytes;
+
+        public ulong hostCommandBytes;
+        public ulong hostObjectBytes;
+        public ulong hostCacheBytes;
+        public ulong hostDeviceBytes;
+        public ulong hostInstanceBytes;
+        public ulong hostPeakBytes;
+
+        public ulong hostInternalBytes;
+        public ulong hostSlabBytes;
+
+        public uint blockCount;
+        public uint allocationCount;
+        public uint hostAllocationCount;
+        public int memoryBudgetSupported;
+    }
+
     internal static class RayTracingPlugin
     {
         [DllImport("RayTracingPlugin")]
@@ -13,6 +63,9 @@ namespace PixelsForGlory
         [DllImport("RayTracingPlugin")]
         public static extern int SetShaderFolder(string shaderFolder);
 
+        [DllImport("RayTracingPlugin")]
+        public static extern void SetAccelerationStructureCacheFolder(string cacheFolder);
+
         [DllImport("RayTracingPlugin")]
         public static extern int SetRenderTarget(int cameraInstanceId, int unityTextureFormat, int width, int height, IntPtr destination);
 
@@ -23,7 +76,31 @@ namespace PixelsForGlory
         public static extern int GetSharedMeshIndex(int sharedMeshInstanceId);
 
         [DllImport("RayTracingPlugin")]
-        public static extern int AddSharedMesh(int sharedMeshInstanceId, IntPtr vertices, IntPtr normals, IntPtr uvs, int vertexCount, IntPtr indices, int indexCount);
+        public static extern void GetMemoryStatistics(out RayTracerMemoryStatistics statistics);
+
+        [DllImport("RayTracingPlugin")]
+        public static extern void SetDefragmentationBudget(float milliseconds);
+
+        [DllImport("RayTracingPlugin")]
+        public static extern void SetHostMemoryAccounting(int enabled);
+
+        [DllImport("RayTracingPlugin")]
+        public static extern void SetHostBlasBuildThreads(int threadCount);
+
+        [DllImport("RayTracingPlugin")]
+        public static extern void SetStaticBatching(int enabled, float cellSize);
+
+        [DllImport("RayTracingPlugin")]
+        public static extern int AddSharedMesh(int sharedMeshInstanceId, IntPtr vertices, IntPtr normals, IntPtr uvs, int vertexCount, IntPtr indices, int indexCount, RayTracerBuildPolicy buildPolicy);
+
+        [DllImport("RayTracingPlugin")]
+        public static extern int AddSharedMeshWithSubmeshes(int sharedMeshInstanceId, IntPtr vertices, IntPtr normals, IntPtr uvs, int vertexCount, IntPtr indices, int indexCount, IntPtr submeshIndexStarts, IntPtr submeshIndexCounts, int submeshCount, RayTracerBuildPolicy buildPolicy);
+
+        [DllImport("RayTracingPlugin")]
+        public static extern void RemoveSharedMesh(int sharedMeshIndex);
+
+        [DllImport("RayTracingPlugin")]
+        public static extern void UpdateSharedMeshVertices(int sharedMeshIndex, IntPtr vertices, IntPtr normals);
 
         [DllImport("RayTracingPlugin")]
         public static extern int GetTlasInstanceIndex(int gameObjectInstanceId);
@@ -34,6 +111,15 @@ namespace PixelsForGlory
         [DllImport("RayTracingPlugin")]
         public static extern void RemoveTlasInstance(int meshInstanceIndex);
 
+        [DllImport("RayTracingPlugin")]
+        public static extern void UpdateTlasInstanceTransform(int meshInstanceIndex, IntPtr l2wMatrix);
+
+        [DllImport("RayTracingPlugin")]
+        public static extern void SetTlasInstanceStatic(int meshInstanceIndex, int isStatic);
+
+        [DllImport("RayTracingPlugin")]
+        public static extern void SetTlasBuildPolicy(RayTracerBuildPolicy buildPolicy);
+
         [DllImport("RayTracingPlugin")]
         public static extern void BuildTlas();
 
@@ -89,7 +175,7 @@ namespace PixelsForGlory
             var nameOnly = nameParts[0];
 
             var stageParts = nameOnly.Split('_');
-            string stage = $"r{stageParts[1]}";
+            string stage = stageParts[1] == "comp" ? "comp" : $"r{stageParts[1]}";
             
             var glslValidator = $"{glslDir}\\{glslCompiler}";
             var glslPath = $"{sourceFolder}\\{nameOnly}.glsl";
@@ -7,6 +7,7 @@ public class RayTracingRenderPipelineAsset : RenderPipelineAsset
     protected override RenderPipeline CreatePipeline()
     {
         PixelsForGlory.RayTracingPlugin.SetShaderFolder(System.IO.Path.Combine(Application.dataPath, "Plugins", "RayTracing", "x86_64"));
+        PixelsForGlory.RayTracingPlugin.SetAccelerationStructureCacheFolder(System.IO.Path.Combine(Application.persistentDataPath, "AccelerationStructureCache"));
         PixelsForGlory.RayTracingPlugin.MonitorShaders(System.IO.Path.Combine(Application.dataPath, "..", "..", "PluginSource", "source", "PixelsForGlory", "Shaders"));
         PixelsForGlory.RayTracingPlugin.Prepare();
         return new RayTracingRenderPipeline();
@@ -12,6 +12,10 @@ set BINARIES_FOLDER="./UnityProject/Assets/Plugins/RayTracing/x86_64/"
 %GLSL_COMPILER% --target-env vulkan1.2 -V -S rchit %SOURCE_FOLDER%ray_chit.glsl -o %BINARIES_FOLDER%ray_chit.bin
 %GLSL_COMPILER% --target-env vulkan1.2 -V -S rchit %SOURCE_FOLDER%shadow_ray_chit.glsl -o %BINARIES_FOLDER%shadow_ray_chit.bin
 
+:: compute shaders
+%GLSL_COMPILER% --target-env vulkan1.2 -V -S comp %SOURCE_FOLDER%instances_comp.glsl -o %BINARIES_FOLDER%instances_comp.bin
+%GLSL_COMPILER% --target-env vulkan1.2 -V -S comp %SOURCE_FOLDER%normals_comp.glsl -o %BINARIES_FOLDER%normals_comp.bin
+
 :: miss shaders
 %GLSL_COMPILER% --target-env vulkan1.2 -V -S rmiss %SOURCE_FOLDER%ray_miss.glsl -o %BINARIES_FOLDER%ray_miss.bin
 %GLSL_COMPILER% --target-env vulkan1.2 -V -S rmiss %SOURCE_FOLDER%shadow_ray_miss.glsl -o %BINARIES_FOLDER%shadow_ray_miss.bin